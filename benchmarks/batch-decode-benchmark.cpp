@@ -0,0 +1,73 @@
+// Measures how BatchDecoder throughput scales with the number of worker threads,
+// from 1 to 64, over a corpus of mixed PNG & JPEG images of varied size. Speedups
+// beyond std::thread::hardware_concurrency() are not expected.
+//
+// Usage: batch-decode-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const unsigned int nImages = quick ? 32 : 256;
+  const unsigned int scale = quick ? 1 : 4;
+  const double minSeconds = quick ? 0.05 : 2.0;
+
+  // Sizes vary by up to 4x so that static partitioning would leave threads idle
+  std::vector<std::string> corpus;
+  double bytes = 0.0, pixels = 0.0;
+
+  for (unsigned int i = 0; i < nImages; ++i) {
+    const unsigned int w = scale * (80 + 40 * (i % 7)), h = scale * (60 + 30 * (i % 5));
+    corpus.push_back(i % 3 ? test::EncodeJPEG(w, h, 3) : test::EncodePNG(w, h, PNG_COLOR_TYPE_RGB));
+    bytes += corpus.back().size();
+    pixels += (double) w * h;
+  }
+
+  std::vector<james::BatchItem> items;
+  for (const std::string& e : corpus) {
+    items.push_back(james::BatchItem::Memory(e.data(), e.size()));
+  }
+
+  std::printf("%u images, %.1f MB encoded, %u hardware threads\n",
+    nImages, bytes / 1e6, std::thread::hardware_concurrency());
+
+  double single = 0.0;
+
+  for (unsigned int threads = 1; threads <= 64; threads *= 2) {
+    james::BatchDecoderOptions options;
+    options.threads = threads;
+    james::BatchDecoder decoder(options);
+
+    std::atomic<unsigned int> failures(0);
+
+    bench::Result r = bench::Run([&]() {
+      decoder.Decode(items, [&](james::BatchResult& result) {
+        if (result.error) {
+          ++failures;
+        }
+      });
+    }, minSeconds);
+
+    if (threads == 1) {
+      single = r.seconds;
+    }
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%u threads", threads);
+    bench::Report(name, r, bytes, pixels);
+    std::printf("%-40s %10.2fx speedup\n", "", single / r.seconds);
+
+    if (failures) {
+      std::printf("%u decode failures\n", failures.load());
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// A deliberately tiny timing harness for the benchmarks: run a function repeatedly
+// for at least a minimum time & report the mean time per run along with throughput.
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+namespace bench {
+
+  struct Result {
+    double seconds;         // mean wall clock time per iteration
+    unsigned int iterations;
+    double cpuSeconds;      // mean processor time per iteration (all threads)
+  };
+
+  // --quick on the command line shrinks images & run times so that the benchmarks
+  // can double as smoke tests.
+  inline bool QuickMode(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--quick") == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The value of a --name=value argument, or fallback if there isn't one.
+  inline std::string Option(int argc, char** argv, const char* name, const std::string& fallback) {
+    const std::size_t n = std::strlen(name);
+
+    for (int i = 1; i < argc; ++i) {
+      if (std::strncmp(argv[i], "--", 2) == 0 && std::strncmp(argv[i] + 2, name, n) == 0 && argv[i][n + 2] == '=') {
+        return argv[i] + n + 3;
+      }
+    }
+    return fallback;
+  }
+
+  // Peak resident set size in bytes, or 0 where we can't measure it.
+  //
+  // On Linux this is VmHWM, which ResetPeakRSS can set back to the current RSS so
+  // that each benchmark gets its own peak. Elsewhere (& if the reset isn't permitted)
+  // it is the peak for the life of the process.
+  inline std::size_t PeakRSS() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmHWM:") == 0) {
+        return (std::size_t) std::stoull(line.substr(6)) * 1024;
+      }
+    }
+#endif
+#ifdef __unix__
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      return (std::size_t) usage.ru_maxrss * 1024;
+    }
+#endif
+    return 0;
+  }
+
+  // Returns true if the peak was reset.
+  inline bool ResetPeakRSS() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return clearRefs.good();
+#else
+    return false;
+#endif
+  }
+
+  template<class F>
+  Result Run(F f, double minSeconds) {
+    typedef std::chrono::steady_clock Clock;
+
+    f(); // warm up
+
+    Result r = { 0.0, 0, 0.0 };
+    const Clock::time_point start = Clock::now();
+    const std::clock_t cpuStart = std::clock();
+    double elapsed = 0.0;
+
+    do {
+      f();
+      ++r.iterations;
+      elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    r.seconds = elapsed / r.iterations;
+    r.cpuSeconds = (double) (std::clock() - cpuStart) / CLOCKS_PER_SEC / r.iterations;
+    return r;
+  }
+
+  // bytes is the size of the encoded input, pixels the size of the decoded output.
+  inline void Report(const char* name, const Result& r, double bytes, double pixels) {
+    std::printf("%-40s %10.3f ms %10.1f MB/s %10.1f Mpix/s %8u iters\n",
+      name, r.seconds * 1e3, bytes / r.seconds / 1e6, pixels / r.seconds / 1e6, r.iterations);
+  }
+
+}
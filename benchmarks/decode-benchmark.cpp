@@ -0,0 +1,237 @@
+// Measures LoadPNG & LoadJPEG throughput (MB/s of encoded input & Mpix/s of decoded
+// output) & peak RSS over a generated corpus: small icons & 12, 24 & 48 megapixel
+// photos as baseline & progressive JPEGs & plain & interlaced PNGs, in gray, RGB &
+// RGBA. The corpus is generated from a fixed formula so every run, on every machine,
+// decodes the same bytes (for a given libpng, libjpeg & zlib).
+//
+// Usage: decode-benchmark [--quick] [--filter=<substring>] [--min-time=<seconds>]
+//                         [--json=<file>]
+//
+// --filter runs only the benchmarks whose names contain the substring, e.g.
+// --filter=LoadJPEG/progressive. --json also writes the results in the layout of
+// Google Benchmark's JSON output so that existing tools for comparing runs can read
+// it; real_time & cpu_time are per iteration, items_per_second is pixels.
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+  // Photo-like content: smooth gradients plus fine detail & a little noise, so that
+  // the images compress roughly as well as photos do. (test::PatternValue compresses
+  // far better, which would flatter PNG in particular.)
+  unsigned char PhotoValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int noise = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    noise ^= noise >> 15;
+    noise *= 0x2C1B3C6Du;
+    noise ^= noise >> 12;
+
+    const unsigned int smooth = x/7 + y/5 + c*85;
+    const unsigned int detail = ((x ^ y) >> 2) & 15;
+    return (unsigned char) (smooth + detail + (noise & 7));
+  }
+
+  struct Entry {
+    std::string name;
+    bool png;
+    unsigned int w, h;
+    int channels;
+    bool progressive;   // progressive JPEG or interlaced PNG
+  };
+
+  struct Measurement {
+    Entry entry;
+    std::size_t bytes;
+    bench::Result result;
+    std::size_t peakRSS;
+    std::size_t decodeRSS;
+  };
+
+  Entry MakeEntry(bool png, bool progressive, int channels, unsigned int w, unsigned int h) {
+    static const char* const channelNames[] = { "", "gray", "", "rgb", "rgba" };
+
+    Entry e;
+    e.name = std::string(png ? "LoadPNG/" : "LoadJPEG/") +
+      (png ? (progressive ? "interlaced/" : "plain/") : (progressive ? "progressive/" : "baseline/")) +
+      channelNames[channels] + "/" + std::to_string(w) + "x" + std::to_string(h);
+    e.png = png;
+    e.w = w;
+    e.h = h;
+    e.channels = channels;
+    e.progressive = progressive;
+    return e;
+  }
+
+  std::vector<Entry> Corpus(bool quick) {
+    // 12, 24 & 48 megapixels (a tenth of the width & height for --quick)
+    const unsigned int sizes[][2] = { { 4000, 3000 }, { 6000, 4000 }, { 8000, 6000 } };
+    const unsigned int scale = quick ? 10 : 1;
+
+    std::vector<Entry> corpus;
+
+    corpus.push_back(MakeEntry(true, false, 4, 32, 32));
+    corpus.push_back(MakeEntry(true, false, 4, 64, 64));
+    corpus.push_back(MakeEntry(false, false, 3, 64, 64));
+
+    for (const auto& size : sizes) {
+      const unsigned int w = size[0] / scale, h = size[1] / scale;
+
+      corpus.push_back(MakeEntry(false, false, 1, w, h));
+      corpus.push_back(MakeEntry(false, false, 3, w, h));
+      corpus.push_back(MakeEntry(false, true, 3, w, h));
+      corpus.push_back(MakeEntry(true, false, 1, w, h));
+      corpus.push_back(MakeEntry(true, false, 3, w, h));
+      corpus.push_back(MakeEntry(true, true, 3, w, h));
+      corpus.push_back(MakeEntry(true, false, 4, w, h));
+    }
+
+    return corpus;
+  }
+
+  std::string Encode(const Entry& e) {
+    if (e.png) {
+      const int colourType = e.channels == 1 ? PNG_COLOR_TYPE_GRAY :
+        e.channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA;
+      return test::EncodePNG(e.w, e.h, colourType, e.progressive, nullptr, PhotoValue);
+    }
+    return test::EncodeJPEG(e.w, e.h, e.channels, e.progressive, 0, nullptr, PhotoValue);
+  }
+
+  Measurement Measure(const Entry& e, double minSeconds) {
+    Measurement m;
+    m.entry = e;
+
+    // Generated one at a time so that the RSS figures only include one encoded image
+    const std::string encoded = Encode(e);
+    m.bytes = encoded.size();
+
+    bench::ResetPeakRSS();
+    const std::size_t before = bench::PeakRSS();
+
+    m.result = bench::Run([&]() {
+      const james::Image img = e.png ?
+        james::LoadPNG(encoded.data(), encoded.size()) :
+        james::LoadJPEG(encoded.data(), encoded.size());
+
+      if (img.Width() != e.w || img.Height() != e.h) {
+        std::fprintf(stderr, "%s: decoded to the wrong size\n", e.name.c_str());
+        std::exit(1);
+      }
+    }, minSeconds);
+
+    m.peakRSS = bench::PeakRSS();
+    m.decodeRSS = m.peakRSS > before ? m.peakRSS - before : 0;
+    return m;
+  }
+
+  std::string Escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out.push_back('\\');
+      }
+      out.push_back(c);
+    }
+    return out;
+  }
+
+  bool WriteJSON(const char* path, const char* executable, bool quick, bool rssPerBenchmark,
+    const std::vector<Measurement>& results)
+  {
+    std::ofstream out(path);
+
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    out << "{\n"
+      << "  \"context\": {\n"
+      << "    \"date\": \"" << date << "\",\n"
+      << "    \"executable\": \"" << Escape(executable) << "\",\n"
+      << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+      << "    \"library_build_type\": \"release\",\n"
+#else
+      << "    \"library_build_type\": \"debug\",\n"
+#endif
+      << "    \"quick\": " << (quick ? "true" : "false") << ",\n"
+      << "    \"peak_rss_per_benchmark\": " << (rssPerBenchmark ? "true" : "false") << "\n"
+      << "  },\n"
+      << "  \"benchmarks\": [";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      const Measurement& m = results[i];
+      const double pixels = (double) m.entry.w * m.entry.h;
+      const double seconds = m.result.seconds;
+
+      out << (i ? ",\n" : "\n")
+        << "    {\n"
+        << "      \"name\": \"" << Escape(m.entry.name) << "\",\n"
+        << "      \"run_name\": \"" << Escape(m.entry.name) << "\",\n"
+        << "      \"run_type\": \"iteration\",\n"
+        << "      \"repetitions\": 1,\n"
+        << "      \"repetition_index\": 0,\n"
+        << "      \"threads\": 1,\n"
+        << "      \"iterations\": " << m.result.iterations << ",\n"
+        << "      \"real_time\": " << seconds * 1e3 << ",\n"
+        << "      \"cpu_time\": " << m.result.cpuSeconds * 1e3 << ",\n"
+        << "      \"time_unit\": \"ms\",\n"
+        << "      \"bytes_per_second\": " << m.bytes / seconds << ",\n"
+        << "      \"items_per_second\": " << pixels / seconds << ",\n"
+        << "      \"encoded_bytes\": " << m.bytes << ",\n"
+        << "      \"width\": " << m.entry.w << ",\n"
+        << "      \"height\": " << m.entry.h << ",\n"
+        << "      \"channels\": " << m.entry.channels << ",\n"
+        << "      \"peak_rss_bytes\": " << m.peakRSS << ",\n"
+        << "      \"decode_rss_bytes\": " << m.decodeRSS << "\n"
+        << "    }";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.good();
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const std::string filter = bench::Option(argc, argv, "filter", "");
+  const std::string json = bench::Option(argc, argv, "json", "");
+  const double minSeconds = std::stod(bench::Option(argc, argv, "min-time", quick ? "0.02" : "1.0"));
+
+  // If the peak can't be reset, each figure is the peak so far
+  const bool rssPerBenchmark = bench::ResetPeakRSS();
+
+  std::vector<Measurement> results;
+
+  for (const Entry& e : Corpus(quick)) {
+    if (e.name.find(filter) == std::string::npos) {
+      continue;
+    }
+
+    results.push_back(Measure(e, minSeconds));
+
+    const Measurement& m = results.back();
+    bench::Report(e.name.c_str(), m.result, (double) m.bytes, (double) e.w * e.h);
+    std::printf("%-40s %10.1f MB encoded %8.1f MB peak RSS %8.1f MB decoding\n",
+      "", m.bytes / 1e6, m.peakRSS / 1e6, m.decodeRSS / 1e6);
+  }
+
+  if (!rssPerBenchmark) {
+    std::printf("Note: peak RSS could not be reset, so is the peak since the program started.\n");
+  }
+
+  if (!json.empty() && !WriteJSON(json.c_str(), argv[0], quick, rssPerBenchmark, results)) {
+    std::fprintf(stderr, "Couldn't write %s\n", json.c_str());
+    return 1;
+  }
+
+  return 0;
+}
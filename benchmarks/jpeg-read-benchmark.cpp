@@ -0,0 +1,110 @@
+// Measures LoadJPEG throughput for large baseline & progressive images with the
+// default JPEGLoadOptions against the way LoadJPEG used to read (a 1 KiB input
+// buffer & one jpeg_read_scanlines call per row, reproduced here through
+// ImageReader), & counts the number of sgetn calls each makes.
+//
+// Usage: jpeg-read-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace {
+
+  // A std::stringbuf that counts the calls made through sgetn
+  class CountingStringBuf : public std::stringbuf {
+  public:
+    explicit CountingStringBuf(const std::string& s)
+      : std::stringbuf(s, std::ios::in), calls(0)
+    {
+    }
+
+    unsigned long calls;
+
+  protected:
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+      ++calls;
+      return std::stringbuf::xsgetn(s, n);
+    }
+  };
+
+  void BenchmarkRowAtATime(const char* name, const std::string& jpeg, double minSeconds) {
+    james::JPEGLoadOptions options;
+    options.inputBufferSize = 1024;
+
+    unsigned long calls = 0;
+    unsigned int w = 0, h = 0;
+
+    bench::Result r = bench::Run([&]() {
+      CountingStringBuf buf(jpeg);
+      std::istream src(&buf);
+
+      std::unique_ptr<james::ImageReader> reader(james::OpenJPEGReader(src, options));
+      james::Image img(reader->Width(), reader->Height(), reader->BitsPerPixel());
+      unsigned char* row = img.Pixels();
+
+      while (reader->ReadRows(row, 1)) {
+        row += james::RowBytes(*reader);
+      }
+
+      w = img.Width();
+      h = img.Height();
+      calls = buf.calls;
+    }, minSeconds);
+
+    bench::Report(name, r, (double)jpeg.size(), (double)w*h);
+    std::printf("%-40s %10lu sgetn calls\n", "", calls);
+  }
+
+  void BenchmarkLoad(const char* name, const std::string& jpeg,
+    std::size_t bufferSize, double minSeconds)
+  {
+    james::JPEGLoadOptions options;
+    options.inputBufferSize = bufferSize;
+
+    unsigned long calls = 0;
+    unsigned int w = 0, h = 0;
+
+    bench::Result r = bench::Run([&]() {
+      CountingStringBuf buf(jpeg);
+      std::istream src(&buf);
+
+      james::Image img(james::LoadJPEG(src, options));
+      w = img.Width();
+      h = img.Height();
+      calls = buf.calls;
+    }, minSeconds);
+
+    bench::Report(name, r, (double)jpeg.size(), (double)w*h);
+    std::printf("%-40s %10lu sgetn calls\n", "", calls);
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const unsigned int w = quick ? 640 : 6000;
+  const unsigned int h = quick ? 480 : 4000;
+  const double minSeconds = quick ? 0.05 : 2.0;
+
+  const std::string baseline = test::EncodeJPEG(w, h, 3, false);
+  const std::string progressive = test::EncodeJPEG(w, h, 3, true);
+
+  std::printf("%ux%u RGB, baseline %zu bytes, progressive %zu bytes\n",
+    w, h, baseline.size(), progressive.size());
+
+  const std::size_t defaultBuffer = james::JPEGLoadOptions().inputBufferSize;
+
+  BenchmarkRowAtATime("baseline/before (1 KiB, 1 row)", baseline, minSeconds);
+  BenchmarkLoad("baseline/1 KiB buffer", baseline, 1024, minSeconds);
+  BenchmarkLoad("baseline/default options", baseline, defaultBuffer, minSeconds);
+
+  BenchmarkRowAtATime("progressive/before (1 KiB, 1 row)", progressive, minSeconds);
+  BenchmarkLoad("progressive/1 KiB buffer", progressive, 1024, minSeconds);
+  BenchmarkLoad("progressive/default options", progressive, defaultBuffer, minSeconds);
+
+  return 0;
+}
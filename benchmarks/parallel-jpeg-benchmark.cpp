@@ -0,0 +1,126 @@
+// Measures the wall clock latency of LoadJPEG on large baseline 4:2:0 & 4:4:4 JPEGs
+// (12, 24 & 48 megapixels) with a restart marker at the start of every MCU row,
+// single threaded & with JPEGLoadOptions::threads set to 2, 4 & the number of
+// hardware threads. Every run reads the tables again & the rows either side of it
+// are decoded twice for fancy upsampling, so expect a little less than a linear
+// speedup. With fewer cores than threads the runs just take turns.
+//
+// Usage: parallel-jpeg-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <string>
+#include <thread>
+
+namespace {
+
+  // Photo-like content, as in decode-benchmark, so that the images compress about
+  // as well as photos do
+  unsigned char PhotoValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int noise = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    noise ^= noise >> 15;
+    noise *= 0x2C1B3C6Du;
+    noise ^= noise >> 12;
+
+    const unsigned int smooth = x/7 + y/5 + c*85;
+    const unsigned int detail = ((x ^ y) >> 2) & 15;
+    return (unsigned char) (smooth + detail + (noise & 7));
+  }
+
+  // A quality 90 baseline JPEG with luma sampled sampling x sampling times as often
+  // as chroma & a restart marker every MCU row
+  std::string EncodeRestartJPEG(unsigned int w, unsigned int h, int sampling) {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr err;
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    cinfo.comp_info[0].h_samp_factor = sampling;
+    cinfo.comp_info[0].v_samp_factor = sampling;
+    cinfo.restart_in_rows = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    std::vector<unsigned char> row(w*3);
+    while (cinfo.next_scanline < h) {
+      for (unsigned int x = 0; x < w; ++x) {
+        for (unsigned int c = 0; c < 3; ++c) {
+          row[x*3 + c] = PhotoValue(x, cinfo.next_scanline, c);
+        }
+      }
+
+      JSAMPROW rowPtr = row.data();
+      jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::string out((const char*) buffer, size);
+    std::free(buffer);
+    return out;
+  }
+
+  double Milliseconds(const std::string& jpeg, unsigned int threads, double minSeconds) {
+    james::JPEGLoadOptions options;
+    options.threads = threads;
+    options.parallelThreshold = 0;   // so that --quick's small images use it too
+
+    return bench::Run([&]() {
+      const james::Image img = james::LoadJPEG(jpeg.data(), jpeg.size(), options);
+      (void) img;
+    }, minSeconds).seconds * 1e3;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const double minSeconds = quick ? 0.01 : 1.0;
+  const unsigned int scale = quick ? 10 : 1;
+  const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+
+  const unsigned int sizes[][2] = { { 4000, 3000 }, { 6000, 4000 }, { 8000, 6000 } };
+  const int samplings[] = { 2, 1 };
+  const unsigned int threads[] = { 2, 4, hardware };
+
+  std::printf("%u hardware threads\n\n", hardware);
+  std::printf("%-18s %10s %10s %10s %10s %10s %8s\n", "", "MB", "1 thread", "2", "4", "hardware", "best");
+
+  for (int sampling : samplings) {
+    for (const auto& size : sizes) {
+      const unsigned int w = size[0] / scale, h = size[1] / scale;
+      const std::string jpeg = EncodeRestartJPEG(w, h, sampling);
+
+      const std::string name = std::string(sampling == 2 ? "4:2:0 " : "4:4:4 ") +
+        std::to_string(w) + "x" + std::to_string(h);
+
+      const double serial = Milliseconds(jpeg, 1, minSeconds);
+      double best = serial;
+
+      std::printf("%-18s %10.1f %7.1f ms", name.c_str(), jpeg.size() / 1e6, serial);
+
+      for (unsigned int n : threads) {
+        const double ms = Milliseconds(jpeg, n, minSeconds);
+        best = std::min(best, ms);
+        std::printf(" %7.1f ms", ms);
+      }
+
+      std::printf(" %7.2fx\n", serial / best);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,81 @@
+// Measures the wall clock latency of LoadPNG on large non-interlaced RGB & RGBA
+// images (12, 24 & 48 megapixels), single threaded & with PNGLoadOptions::threads
+// set to 2, 4 & the number of hardware threads. The speedup is bounded by the
+// inflate stage, which stays on one thread, so expect it to level off at 3-4
+// threads. With fewer cores than threads the stages just take turns.
+//
+// Usage: parallel-png-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <string>
+#include <thread>
+
+namespace {
+
+  // Photo-like content, as in decode-benchmark, so that libpng's encoder chooses a
+  // realistic mix of filters & the images compress about as well as photos do
+  unsigned char PhotoValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int noise = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    noise ^= noise >> 15;
+    noise *= 0x2C1B3C6Du;
+    noise ^= noise >> 12;
+
+    const unsigned int smooth = x/7 + y/5 + c*85;
+    const unsigned int detail = ((x ^ y) >> 2) & 15;
+    return (unsigned char) (smooth + detail + (noise & 7));
+  }
+
+  double Milliseconds(const std::string& png, unsigned int threads, double minSeconds) {
+    james::PNGLoadOptions options;
+    options.threads = threads;
+    options.parallelThreshold = 0;   // so that --quick's small images use it too
+
+    return bench::Run([&]() {
+      const james::Image img = james::LoadPNG(png.data(), png.size(), options);
+      (void) img;
+    }, minSeconds).seconds * 1e3;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const double minSeconds = quick ? 0.01 : 1.0;
+  const unsigned int scale = quick ? 10 : 1;
+  const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+
+  const unsigned int sizes[][2] = { { 4000, 3000 }, { 6000, 4000 }, { 8000, 6000 } };
+  const int colourTypes[] = { PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA };
+  const unsigned int threads[] = { 2, 4, hardware };
+
+  std::printf("%u hardware threads\n\n", hardware);
+  std::printf("%-18s %10s %10s %10s %10s %10s %8s\n", "", "MB", "1 thread", "2", "4", "hardware", "best");
+
+  for (int colourType : colourTypes) {
+    for (const auto& size : sizes) {
+      const unsigned int w = size[0] / scale, h = size[1] / scale;
+      const std::string png = test::EncodePNG(w, h, colourType, false, nullptr, PhotoValue);
+
+      const std::string name = std::string(colourType == PNG_COLOR_TYPE_RGB ? "rgb " : "rgba ") +
+        std::to_string(w) + "x" + std::to_string(h);
+
+      const double serial = Milliseconds(png, 1, minSeconds);
+      double best = serial;
+
+      std::printf("%-18s %10.1f %7.1f ms", name.c_str(), png.size() / 1e6, serial);
+
+      for (unsigned int n : threads) {
+        const double ms = Milliseconds(png, n, minSeconds);
+        best = std::min(best, ms);
+        std::printf(" %7.1f ms", ms);
+      }
+
+      std::printf(" %7.2fx\n", serial / best);
+    }
+  }
+
+  return 0;
+}
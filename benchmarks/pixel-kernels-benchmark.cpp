@@ -0,0 +1,108 @@
+// Measures each pixel kernel for every instruction set available on this machine,
+// against the scalar version, over one large row of pixels (so the numbers are for
+// streaming through memory, not for data already in cache).
+//
+// Usage: pixel-kernels-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+
+#include <vector>
+
+namespace {
+
+  using james::PixelKernels;
+  using james::SimdLevel;
+
+  const char* LevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE2: return "SSE2";
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::NEON: return "NEON";
+    default: return "scalar";
+    }
+  }
+
+  struct Buffers {
+    explicit Buffers(std::size_t n)
+      : n(n), src(4*n, 0x80), dst(4*n)
+    {
+      for (std::size_t i = 0; i < src.size(); ++i) {
+        src[i] = (unsigned char) (i*7);
+      }
+    }
+
+    std::size_t n;
+    std::vector<unsigned char> src;
+    std::vector<unsigned char> dst;
+  };
+
+  void BenchmarkKernels(const char* kernel, Buffers& b, double minSeconds,
+    void (*run)(const PixelKernels&, Buffers&), std::size_t bytesPerPixel)
+  {
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON };
+    double scalarSeconds = 0.0;
+
+    for (SimdLevel level : levels) {
+      const PixelKernels* k = james::GetPixelKernels(level);
+      if (!k) {
+        continue;
+      }
+
+      bench::Result r = bench::Run([&]() { run(*k, b); }, minSeconds);
+
+      if (level == SimdLevel::Scalar) {
+        scalarSeconds = r.seconds;
+      }
+
+      char name[64];
+      std::snprintf(name, sizeof(name), "%s/%s", kernel, LevelName(level));
+      bench::Report(name, r, (double) b.n*bytesPerPixel, (double) b.n);
+      std::printf("%-40s %10.2fx vs scalar\n", "", scalarSeconds / r.seconds);
+    }
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const std::size_t n = quick ? 256*256 : 4096*4096;
+  const double minSeconds = quick ? 0.02 : 1.0;
+
+  Buffers b(n);
+
+  std::printf("%zu pixels, best available: %s\n", n, LevelName(james::BestSimdLevel()));
+
+  // Throughput is reported against the bytes read
+  BenchmarkKernels("rgbToRGBA", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    k.rgbToRGBA(b.src.data(), b.dst.data(), b.n);
+  }, 3);
+
+  BenchmarkKernels("grayToRGB", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    k.grayToRGB(b.src.data(), b.dst.data(), b.n);
+  }, 1);
+
+  BenchmarkKernels("swapRedBlue24", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    k.swapRedBlue24(b.src.data(), b.n);
+  }, 3);
+
+  BenchmarkKernels("swapRedBlue32", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    k.swapRedBlue32(b.src.data(), b.n);
+  }, 4);
+
+  // Premultiplying repeatedly would drive everything to zero, so each run copies a
+  // fresh source first. Likewise for unpremultiply, which saturates.
+  BenchmarkKernels("premultiplyAlpha", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    b.dst = b.src;
+    k.premultiplyAlpha(b.dst.data(), b.n);
+  }, 4);
+
+  BenchmarkKernels("unpremultiplyAlpha", b, minSeconds, [](const PixelKernels& k, Buffers& b) {
+    b.dst = b.src;
+    k.unpremultiplyAlpha(b.dst.data(), b.n);
+  }, 4);
+
+  std::printf("(premultiplyAlpha & unpremultiplyAlpha include a copy of the source)\n");
+
+  return 0;
+}
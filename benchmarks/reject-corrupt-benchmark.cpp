@@ -0,0 +1,83 @@
+// Measures the cost of rejecting bad input with the throwing loaders (LoadPNG/LoadJPEG
+// inside try/catch) & with TryLoadPNG/TryLoadJPEG, for a few typical kinds of
+// damage. Valid images are included for comparison.
+//
+// Usage: reject-corrupt-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <string>
+
+namespace {
+
+  struct Case {
+    const char* name;
+    std::string data;
+    bool png;
+  };
+
+  // Flips a byte of the first chunk of compressed data
+  std::string CorruptIDAT(std::string png) {
+    png[png.find("IDAT") + 10] ^= 0x55;
+    return png;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const double minSeconds = quick ? 0.02 : 1.0;
+  const unsigned int size = quick ? 64 : 256;
+
+  const std::string png = test::EncodePNG(size, size, PNG_COLOR_TYPE_RGB);
+  const std::string jpeg = test::EncodeJPEG(size, size, 3);
+
+  const Case cases[] = {
+    { "PNG valid", png, true },
+    { "PNG not a PNG", jpeg, true },
+    { "PNG truncated header", png.substr(0, 20), true },
+    { "PNG corrupt IDAT", CorruptIDAT(png), true },
+    { "PNG truncated at 50%", png.substr(0, png.size() / 2), true },
+    { "JPEG valid", jpeg, false },
+    { "JPEG not a JPEG", png, false },
+    { "JPEG truncated header", jpeg.substr(0, 100), false },
+    { "JPEG truncated at 50%", jpeg.substr(0, jpeg.size() / 2), false },
+  };
+
+  std::printf("%-28s %14s %14s %8s\n", "", "throwing", "TryLoad", "ratio");
+
+  for (const Case& c : cases) {
+    const std::string& data = c.data;
+    unsigned int failures = 0;
+
+    const bench::Result throwing = bench::Run([&]() {
+      try {
+        if (c.png) {
+          james::LoadPNG(data.data(), data.size());
+        }
+        else {
+          james::LoadJPEG(data.data(), data.size());
+        }
+      }
+      catch (std::exception&) {
+        ++failures;
+      }
+    }, minSeconds);
+
+    const bench::Result nonThrowing = bench::Run([&]() {
+      const james::LoadResult result = c.png ?
+        james::TryLoadPNG(data.data(), data.size()) : james::TryLoadJPEG(data.data(), data.size());
+
+      if (!result) {
+        ++failures;
+      }
+    }, minSeconds);
+
+    std::printf("%-28s %11.2f us %11.2f us %7.2fx\n", c.name,
+      throwing.seconds * 1e6, nonThrowing.seconds * 1e6, throwing.seconds / nonThrowing.seconds);
+  }
+
+  return 0;
+}
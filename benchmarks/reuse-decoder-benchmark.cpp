@@ -0,0 +1,107 @@
+// Measures the per-image cost saved by keeping a JPEGDecoder or PNGDecoder rather
+// than calling LoadJPEG/LoadPNG for each image, on small (roughly 1-16 KB) icons &
+// thumbnails where decoder setup is a large part of the total. The last column also
+// gives the decoder a PixelBufferPool, so that nothing is allocated per image apart
+// from libjpeg's image memory.
+//
+// The differences are small next to timing noise on a busy machine, so the three
+// variants are run in turn for several rounds & the best time of each is reported.
+//
+// Usage: reuse-decoder-benchmark [--quick]
+
+#include <james/image-loader.hpp>
+#include "benchmark.hpp"
+#include "test-images.hpp"
+
+#include <memory>
+#include <string>
+
+namespace {
+
+  // Photo-like content so that the encoded sizes are realistic: smooth gradients
+  // plus a little noise.
+  unsigned char IconValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int noise = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    noise ^= noise >> 15;
+    noise *= 0x2C1B3C6Du;
+    noise ^= noise >> 12;
+
+    return (unsigned char) (x*2 + y*3 + c*85 + (noise & 15));
+  }
+
+  // Runs f for a round of minSeconds & keeps the fastest mean time seen so far
+  template<class F>
+  void Round(F f, double minSeconds, double& best) {
+    const bench::Result r = bench::Run(f, minSeconds);
+    if (best == 0.0 || r.seconds < best) {
+      best = r.seconds;
+    }
+  }
+
+  struct Case {
+    std::string name;
+    std::string data;
+    bool png;
+  };
+
+}
+
+int main(int argc, char** argv) {
+  const bool quick = bench::QuickMode(argc, argv);
+  const double minSeconds = quick ? 0.01 : 0.2;
+  const unsigned int rounds = quick ? 1 : 5;
+  const unsigned int sizes[] = { 16, 32, 48, 64 };
+
+  std::vector<Case> cases;
+
+  for (unsigned int size : sizes) {
+    const std::string dims = std::to_string(size) + "x" + std::to_string(size);
+    cases.push_back({ "JPEG rgb " + dims, test::EncodeJPEG(size, size, 3, false, 0, nullptr, IconValue), false });
+  }
+  for (unsigned int size : sizes) {
+    const std::string dims = std::to_string(size) + "x" + std::to_string(size);
+    cases.push_back({ "PNG rgba " + dims, test::EncodePNG(size, size, PNG_COLOR_TYPE_RGB_ALPHA, false, nullptr, IconValue), true });
+  }
+
+  std::printf("%-18s %8s %12s %12s %12s %10s\n", "", "bytes", "Load", "Decoder", "+ pool", "saved");
+
+  for (const Case& c : cases) {
+    const std::string& data = c.data;
+
+    james::JPEGDecoder jpeg;
+    james::PNGDecoder png;
+
+    james::JPEGLoadOptions jpegPooled;
+    james::PNGLoadOptions pngPooled;
+    jpegPooled.allocator = pngPooled.allocator = std::make_shared<james::PixelBufferPool>(1 << 20);
+    james::JPEGDecoder jpegWithPool(jpegPooled);
+    james::PNGDecoder pngWithPool(pngPooled);
+
+    double load = 0.0, reused = 0.0, pooled = 0.0;
+
+    for (unsigned int round = 0; round < rounds; ++round) {
+      Round([&]() {
+        const james::Image img = c.png ? james::LoadPNG(data.data(), data.size()) :
+          james::LoadJPEG(data.data(), data.size());
+        (void) img;
+      }, minSeconds, load);
+
+      Round([&]() {
+        const james::Image img = c.png ? png.Decode(data.data(), data.size()) :
+          jpeg.Decode(data.data(), data.size());
+        (void) img;
+      }, minSeconds, reused);
+
+      Round([&]() {
+        const james::Image img = c.png ? pngWithPool.Decode(data.data(), data.size()) :
+          jpegWithPool.Decode(data.data(), data.size());
+        (void) img;
+      }, minSeconds, pooled);
+    }
+
+    std::printf("%-18s %8u %9.2f us %9.2f us %9.2f us %7.2f us\n", c.name.c_str(), (unsigned int) data.size(),
+      load * 1e6, reused * 1e6, pooled * 1e6, (load - pooled) * 1e6);
+  }
+
+  return 0;
+}
@@ -18,8 +18,40 @@
 */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <istream>
+#include <memory>
+#include <string>
+#include <vector>
 
+// The coroutine interface to PushDecoder needs C++20
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#include <stdexcept>
+#include <utility>
+#define JAMES_IMAGE_LOADER_COROUTINES 1
+#endif
+
+#include "image-loader/pixel-allocator.hpp"
+#include "image-loader/pixel-format.hpp"
 #include "image-loader/image.hpp"
+#include "image-loader/pixel-kernels.hpp"
+#include "image-loader/image-format.hpp"
+#include "image-loader/probe-image.hpp"
+#include "image-loader/image-metadata.hpp"
+#include "image-loader/decode-stats.hpp"
+#include "image-loader/load-options.hpp"
+#include "image-loader/load-result.hpp"
 #include "image-loader/load-png.hpp"
 #include "image-loader/load-jpeg.hpp"
+#include "image-loader/reusable-decoder.hpp"
+#include "image-loader/image-reader.hpp"
+#include "image-loader/load-image-file.hpp"
+#include "image-loader/batch-decoder.hpp"
+#include "image-loader/image-cache.hpp"
+#include "image-loader/progressive-decoder.hpp"
+#include "image-loader/push-decoder.hpp"
@@ -0,0 +1,150 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * One input to a `BatchDecoder`: either a file path or a buffer of encoded data.
+   *
+   * A buffer is not copied; it must remain valid until its result has been
+   * delivered.
+   */
+  struct BatchItem {
+    BatchItem()
+      : data(nullptr), size(0)
+    {
+    }
+
+    static BatchItem File(std::string path) {
+      BatchItem item;
+      item.path = std::move(path);
+      return item;
+    }
+
+    static BatchItem Memory(const void* data, std::size_t size) {
+      BatchItem item;
+      item.data = data;
+      item.size = size;
+      return item;
+    }
+
+    std::string path;       // used if data is null
+    const void* data;
+    std::size_t size;
+  };
+
+  /**
+   * The outcome of decoding one `BatchItem`. Exactly one of `image` & `error` is
+   * meaningful: if `error` is null the item decoded successfully.
+   */
+  struct BatchResult {
+    BatchResult()
+      : index(0)
+    {
+    }
+
+    std::size_t index;      // position of the item in the submitted batch
+    Image image;
+    std::exception_ptr error;
+  };
+
+  struct BatchDecoderOptions {
+    BatchDecoderOptions()
+      : threads(0), maxInFlightBytes(0)
+    {
+    }
+
+    /**
+     * Number of worker threads. 0 means `std::thread::hardware_concurrency()`.
+     */
+    unsigned int threads;
+
+    /**
+     * Upper bound on the decoded bytes that may be held by the decoder at once:
+     * images being decoded plus results whose callback has not yet returned. Each
+     * item's size is estimated from its header before decoding starts & a worker
+     * waits for room rather than exceed the limit. An item larger than the limit on
+     * its own is decoded once nothing else is in flight. 0 means unlimited.
+     */
+    std::size_t maxInFlightBytes;
+
+    /**
+     * Options applied to every item, whatever its format.
+     */
+    LoadOptions load;
+  };
+
+  /**
+   * Decodes batches of PNG & JPEG images on a pool of worker threads.
+   *
+   * Items are dealt out to per-worker queues when a batch is submitted. A worker
+   * takes work from the back of its own queue & once that is empty steals from the
+   * front of the others', so a few slow images don't leave the rest of the pool
+   * idle.
+   *
+   * Errors are isolated per item: a corrupt or missing image produces a result with
+   * `error` set & doesn't affect the rest of the batch.
+   *
+   * ### Thread safety
+   * `Decode` & `DecodeAsync` may be called concurrently from several threads; the
+   * batches share the worker pool & the in-flight byte budget. The destructor waits
+   * for all outstanding work & must not be called from a callback.
+   */
+  class BatchDecoder {
+  public:
+    typedef std::function<void(BatchResult&)> Callback;
+
+    BatchDecoder();
+    explicit BatchDecoder(const BatchDecoderOptions& options);
+    ~BatchDecoder();
+
+    BatchDecoder(const BatchDecoder&) = delete;
+    BatchDecoder& operator= (const BatchDecoder&) = delete;
+
+    unsigned int Threads() const noexcept;
+
+    /**
+     * Decode every item, calling `callback` once per item as it completes. Results
+     * arrive in completion order, not submission order, & the callback is invoked on
+     * the worker threads so must be thread safe. It may move the image out of the
+     * result. An exception escaping the callback is swallowed.
+     *
+     * Blocks until every callback has returned, so it must not be called from one of
+     * this decoder's own callbacks (the worker would wait on itself): that throws
+     * `std::logic_error`. Neither should a callback wait on a future from
+     * `DecodeAsync`.
+     */
+    void Decode(const std::vector<BatchItem>& items, const Callback& callback);
+
+    /**
+     * Submit a batch & return immediately with one future per item, in submission
+     * order. A failed item's future rethrows its error from `get()`.
+     *
+     * Note that the in-flight budget covers an image only until it has been handed
+     * to its future; decoded images waiting to be collected are not counted.
+     */
+    std::vector<std::future<Image>> DecodeAsync(const std::vector<BatchItem>& items);
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+  };
+
+}
@@ -0,0 +1,90 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include <cstddef>
+
+namespace james {
+
+  /**
+   * Where the time & memory of a single load went: see `LoadOptions::stats`.
+   *
+   * Times are wall clock seconds. ioSeconds & postProcessSeconds are parts of
+   * headerSeconds + decodeSeconds, not additions to them; whatever is left over is
+   * spent inside libpng or libjpeg (decompression, entropy decoding, IDCT,
+   * upsampling & their own colour conversion).
+   */
+  struct DecodeStats {
+    DecodeStats()
+      : headerSeconds(0.0), decodeSeconds(0.0), ioSeconds(0.0), postProcessSeconds(0.0),
+        bytesRead(0), ioCallbacks(0), peakAllocatedBytes(0), outputBytes(0)
+    {
+    }
+
+    /**
+     * From the start of the load until the header has been read & the decoder
+     * configured.
+     */
+    double headerSeconds;
+
+    /**
+     * From the end of the header until the image is complete.
+     */
+    double decodeSeconds;
+
+    /**
+     * Time spent in the callbacks that supply libpng & libjpeg with data: reading from
+     * the stream or, for PNG, copying from memory.
+     */
+    double ioSeconds;
+
+    /**
+     * Time spent on the loader's own work on the decoded rows: pixel format
+     * conversions that the libraries can't do themselves, premultiplying alpha,
+     * copying a region out of wider rows & applying the EXIF orientation.
+     */
+    double postProcessSeconds;
+
+    /**
+     * Bytes taken from the source. For a stream this is what was read from it, which
+     * for JPEG may run up to `JPEGLoadOptions::inputBufferSize` past the end of the
+     * image; for memory, the bytes the decoder consumed.
+     */
+    unsigned long long bytesRead;
+
+    /**
+     * The number of calls made to the data source callbacks. A JPEG decoded from
+     * memory is handed all of its data at once, so normally makes none.
+     */
+    unsigned long ioCallbacks;
+
+    /**
+     * The most memory held at once by the load: the output Image, the loader's own
+     * buffers & libpng's (& zlib's) allocations. libjpeg allocates internally with no
+     * way to observe it, so its working memory isn't included.
+     */
+    std::size_t peakAllocatedBytes;
+
+    /**
+     * The size of the returned Image's pixels, including any row padding.
+     */
+    std::size_t outputBytes;
+  };
+
+}
@@ -0,0 +1,134 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  struct ImageCacheOptions {
+    ImageCacheOptions()
+      : maxBytes((std::size_t) 256 << 20), shards(16)
+    {
+    }
+
+    /**
+     * The most decoded bytes (`ByteSize` of the cached Images) the cache holds on to.
+     * The budget is split evenly between the shards & each evicts its own least
+     * recently used images to stay within its share. An image bigger than a shard's
+     * share is decoded & returned but never cached.
+     */
+    std::size_t maxBytes;
+
+    /**
+     * Number of independently locked parts of the cache. 0 is treated as 1.
+     */
+    unsigned int shards;
+
+    /**
+     * Options used for every decode. load.metadata & load.stats are ignored, since a
+     * cached image may be handed to many callers.
+     */
+    LoadOptions load;
+  };
+
+  /**
+   * A thread safe cache of decoded PNG & JPEG images, for callers that load the
+   * same images over & over.
+   *
+   * ### Keys
+   * - `Get(data, size)` is keyed by a 64 bit hash of the encoded bytes together with
+   *   their length. Two different images with the same hash & length would be
+   *   confused; with a 64 bit hash that is vanishingly unlikely but not impossible.
+   * - `GetFile(path)` is keyed by the path together with the file's modification time
+   *   & size, so a file that is rewritten is decoded again. The path is used as
+   *   given: two different paths to the same file are cached separately.
+   *
+   * ### Handles
+   * Images are handed out as `std::shared_ptr<const Image>` & are never copied. An
+   * evicted image stays alive until its last handle has gone, but no longer counts
+   * against the budget.
+   *
+   * ### Concurrent misses
+   * If several threads ask for the same missing image at once only one decodes it;
+   * the others wait for & share its result. A failed decode is not cached: every
+   * waiting caller gets the exception & the next request tries again.
+   *
+   * ### Exceptions
+   * As for `LoadImage` & `LoadImageFile`. `GetFile` also throws `std::system_error`
+   * if the file's modification time can't be read, & `std::runtime_error` if the
+   * file changes every time it is loaded (it is tried three times). A file that
+   * changes while it is being loaded is never cached under its old key.
+   *
+   * ### Thread safety
+   * All member functions may be called concurrently.
+   */
+  class ImageCache {
+  public:
+    typedef std::shared_ptr<const Image> Handle;
+
+    struct Stats {
+      unsigned long long hits;        // requests answered from the cache
+      unsigned long long misses;      // requests that decoded the image
+      unsigned long long waits;       // requests that waited for another thread's decode
+      unsigned long long evictions;   // images dropped to stay within the budget
+      std::size_t bytes;              // decoded bytes currently cached
+      std::size_t images;             // images currently cached
+
+      double HitRate() const {
+        const unsigned long long total = hits + misses + waits;
+        return total ? (double)(hits + waits) / (double) total : 0.0;
+      }
+    };
+
+    ImageCache();
+    explicit ImageCache(const ImageCacheOptions& options);
+    ~ImageCache();
+
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator= (const ImageCache&) = delete;
+
+    /**
+     * The decoded image for a PNG or JPEG held in memory. The buffer is hashed on
+     * every call & only read; it needn't outlive the call.
+     */
+    Handle Get(const void* data, std::size_t size);
+
+    /**
+     * The decoded image for a PNG or JPEG file.
+     */
+    Handle GetFile(const char* path);
+
+    /**
+     * Drops every cached image. Decodes in progress are unaffected & will still
+     * be cached when they finish.
+     */
+    void Clear();
+
+    Stats GetStats() const;
+
+    /**
+     * The hash `Get` uses for its keys.
+     */
+    static std::uint64_t ContentHash(const void* data, std::size_t size) noexcept;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+  };
+
+}
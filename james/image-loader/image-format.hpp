@@ -0,0 +1,41 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * The image formats understood by Image Loader.
+   */
+  enum class ImageFormat {
+    Unknown,
+    PNG,
+    JPEG
+  };
+
+  /**
+   * Identifies the format of an image from its first few bytes ("magic number").
+   *
+   * Only the signature is checked, so a result other than ImageFormat::Unknown does
+   * not guarantee that the rest of the data is valid. At most the first 8 bytes are
+   * examined; shorter data is only recognised if it contains the whole signature.
+   */
+  ImageFormat DetectImageFormat(const void* data, std::size_t size) noexcept;
+
+}
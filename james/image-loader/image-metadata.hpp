@@ -0,0 +1,75 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * Metadata embedded in an image file, collected while it is decoded: see
+   * `LoadOptions::metadata`.
+   *
+   * The data is copied out of the decoder (whose buffers, & for a memory mapped
+   * file the file itself, are gone by the time the load returns) but no more than
+   * `LoadOptions::maxMetadataSize` bytes of each kind are kept.
+   */
+  struct ImageMetadata {
+    ImageMetadata()
+      : orientation(1)
+    {
+    }
+
+    /**
+     * The ICC colour profile, from a PNG iCCP chunk or the ICC_PROFILE APP2 markers of
+     * a JPEG (reassembled if the profile spans several). Empty if there is no profile
+     * or it is larger than the limit.
+     */
+    std::vector<unsigned char> iccProfile;
+
+    /**
+     * The EXIF data as a TIFF structure, i.e. without the "Exif\0\0" prefix used in a
+     * JPEG APP1 marker. Empty if there is none or it is larger than the limit.
+     */
+    std::vector<unsigned char> exif;
+
+    /**
+     * The EXIF orientation tag, 1 to 8 (1 being "as stored"). 1 if there is no EXIF
+     * data or no valid orientation in it. This is read even when the EXIF data itself
+     * is too large to keep, & is the orientation as stored in the file whether or not
+     * `LoadOptions::applyOrientation` was set.
+     */
+    unsigned int orientation;
+  };
+
+  /**
+   * Reads the orientation tag from the first IFD of an EXIF TIFF structure.
+   * Returns 1 if the data is malformed or has no valid orientation.
+   */
+  unsigned int ParseExifOrientation(const unsigned char* exif, std::size_t size) noexcept;
+
+  /**
+   * Transforms img so that it displays upright given an EXIF orientation of 1 to 8.
+   * Orientations 5 to 8 swap the width & height. Any other value leaves img alone.
+   *
+   * Flips (2, 3 & 4) are done in place; the transposing orientations need a second
+   * Image, allocated with img's allocator & row alignment, while they run. Works for
+   * any bit depth.
+   */
+  void ApplyOrientation(Image& img, unsigned int orientation);
+
+}
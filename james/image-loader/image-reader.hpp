@@ -0,0 +1,105 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * An ImageReader decodes an image a few rows at a time into memory provided by the
+   * caller, so that arbitrarily large images can be processed with a fixed memory
+   * budget.
+   *
+   * ### Usage
+   * Create an ImageReader using `OpenJPEGReader` or `OpenPNGReader`. The header has
+   * already been read by the time these return so Width(), Height() & BitsPerPixel()
+   * are immediately available. Then call ReadRows repeatedly until it returns 0:
+   *
+   * ```C++
+   * std::unique_ptr<ImageReader> reader(OpenJPEGReader(src));
+   * std::vector<unsigned char> strip(16 * RowBytes(*reader));
+   *
+   * while (unsigned int n = reader->ReadRows(strip.data(), 16)) {
+   *   // ... process n rows ...
+   * }
+   * ```
+   *
+   * ### Pixel layout
+   * Rows are written exactly as they would be stored in the equivalent `james::Image`:
+   * tightly packed, top row first, in the same pixel format that `LoadJPEG`/`LoadPNG`
+   * would produce.
+   *
+   * ### Memory use
+   * JPEG images & non-interlaced PNG images are decoded directly into the caller's
+   * buffer. Interlaced PNG images cannot be: no row is complete until the final pass
+   * has been read. For these the first call to ReadRows decodes the whole image into
+   * an internal buffer & rows are copied out of it.
+   *
+   * ### Exceptions
+   * Errors are reported in the same way as `LoadJPEG`/`LoadPNG`. After an exception
+   * the reader is in an undefined state & the only safe thing to do with it is destroy
+   * it.
+   *
+   * ### Stream lifetime
+   * The source stream must outlive the reader. As with `LoadJPEG`/`LoadPNG`, the
+   * exception state of the stream is modified while the reader exists & restored
+   * when it is destroyed.
+   *
+   * ### Thread safety
+   * An ImageReader is not thread safe, but separate readers share no state.
+   */
+  struct ImageReader {
+    virtual ~ImageReader() {}
+
+    virtual unsigned int Width() const noexcept = 0;
+    virtual unsigned int Height() const noexcept = 0;
+    virtual unsigned int BitsPerPixel() const noexcept = 0;
+
+    /**
+     * The number of rows already returned by ReadRows.
+     */
+    virtual unsigned int RowsRead() const noexcept = 0;
+
+    /**
+     * Decodes up to nRows rows into dst, which must have room for
+     * `nRows * RowBytes(*this)` bytes.
+     *
+     * Returns the number of rows actually decoded; this is only less than nRows when
+     * the end of the image is reached & is 0 once all rows have been read.
+     */
+    virtual unsigned int ReadRows(unsigned char* dst, unsigned int nRows) = 0;
+  };
+
+  inline std::size_t RowBytes(const ImageReader& reader) {
+    return reader.Width()*(reader.BitsPerPixel() >> 3);
+  }
+
+  /**
+   * Opens a JPEG stream for reading row by row. Preconditions, exceptions & thread
+   * safety are as for `LoadJPEG`.
+   */
+  std::unique_ptr<ImageReader> OpenJPEGReader(std::istream& src);
+  std::unique_ptr<ImageReader> OpenJPEGReader(std::istream& src, const JPEGLoadOptions& options);
+
+  /**
+   * Opens a PNG stream for reading row by row. Preconditions, exceptions & thread
+   * safety are as for `LoadPNG`.
+   */
+  std::unique_ptr<ImageReader> OpenPNGReader(std::istream& src);
+
+}
@@ -33,13 +33,19 @@ namespace james {
    * Dimensions are limited only by the maximum allowable value of unsigned int &
    * by available memory.
    *
-   * Bit depth may only be 8, 24 or 32. (8 being a monochrome image, 32 featuring an
-   * 8bit alpha channel) This is enforced in the debug version by assertions & by
-   * throwing a std::invalid_argument exception in the release version. (See Exception
-   * safety section for rationale)
+   * Bit depth may only be 8, 24 or 32 (8 being a monochrome image, 32 featuring an
+   * 8bit alpha channel) or, for 16 bits per channel, 16, 48 or 64. Each 16 bit channel
+   * is stored in the native byte order. This is enforced in the debug version by
+   * assertions & by throwing a std::invalid_argument exception in the release version.
+   * (See Exception safety section for rationale)
    *
    * It is assumed but not enforced that the pixel format is RGBA.
    *
+   * ### Pixel memory
+   * Pixels are allocated with `new[]` unless a `james::PixelAllocator` is supplied on
+   * construction, in which case they come from (& are returned to) that allocator.
+   * Copies of an Image use the same allocator as the original.
+   *
    * ### Copying & inheritance behaviour
    * Image is designed as a **value type**:
    * - It implements both copy and move semantics
@@ -47,13 +53,21 @@ namespace james {
    *   destructor, nor virtual methods, nor protected data)
    *
    * ### Packing
-   * Image assumes its pixel data is tightly packed.
-   * - No padding between pixels (i.e. for 24bpp, pixels are *not* dword aligned)
-   * - No padding between rows (i.e. for 24bpp, rows *might not* be dword aligned either)
+   * There is never any padding between pixels (i.e. for 24bpp, pixels are *not* dword
+   * aligned).
+   *
+   * By default there is no padding between rows either, so for 24bpp rows *might not*
+   * be dword aligned. That makes such an Image incompatible with Windows bitmap
+   * functions (i.e. `StretchDIBits`), which require word aligned rows, & keeps SIMD
+   * code off aligned loads. A row alignment may therefore be given on construction:
+   * - Each row then starts `Stride()` bytes after the previous one, where `Stride()` is
+   *   the row size rounded up to a multiple of the alignment.
+   * - When pixels are allocated with `new[]` the first row is also aligned. With a
+   *   `james::PixelAllocator` it is aligned as well as the allocator's buffers are
+   *   (`james::PixelBufferPool` provides 64 bytes).
+   * - The contents of the padding are unspecified.
    *
-   * I mention this mainly because it makes RGB instances of james::Image fundamentally
-   * incompatible with Windows bitmap functions (i.e. `StretchDIBits`) as these require
-   * rows (but not pixels) be *word* aligned.
+   * Copies keep the row alignment of the original.
    *
    * ### Exception safety
    * Two guarentees are provided by james::Image:
@@ -82,6 +96,14 @@ namespace james {
     Image(Image&&) noexcept;
 
     Image(unsigned int w, unsigned int h, unsigned int bpp);
+    Image(unsigned int w, unsigned int h, unsigned int bpp, std::shared_ptr<PixelAllocator> allocator);
+
+    /**
+     * rowAlignment must be a power of two no greater than 4096; 1 means tightly
+     * packed rows. allocator may be nullptr to use `new[]`.
+     */
+    Image(unsigned int w, unsigned int h, unsigned int bpp, unsigned int rowAlignment,
+      std::shared_ptr<PixelAllocator> allocator);
 
     ~Image() noexcept;
 
@@ -93,16 +115,40 @@ namespace james {
     unsigned int Width() const noexcept { return w_; }
     unsigned int Height() const noexcept { return h_; }
     unsigned int BitsPerPixel() const noexcept { return bpp_; }
+    unsigned int RowAlignment() const noexcept { return align_; }
+
+    /**
+     * Distance in bytes from the start of one row to the start of the next.
+     */
+    std::size_t Stride() const noexcept {
+      return ((std::size_t) w_*(bpp_ >> 3) + align_ - 1) & ~((std::size_t) align_ - 1);
+    }
 
     const unsigned char* Pixels() const noexcept { return pixels_; }
     unsigned char* Pixels() noexcept { return pixels_; }
 
+    const unsigned char* Row(unsigned int y) const noexcept { return pixels_ + y*Stride(); }
+    unsigned char* Row(unsigned int y) noexcept { return pixels_ + y*Stride(); }
+
+    /**
+     * The allocator that owns the pixels, or nullptr if they were allocated with new[].
+     */
+    const std::shared_ptr<PixelAllocator>& Allocator() const noexcept { return allocator_; }
+
   private:
-    unsigned int w_, h_, bpp_;
+    unsigned int w_, h_, bpp_, align_;
     unsigned char* pixels_;
+    unsigned char* block_;    // as allocated; pixels_ may be offset into it for alignment
+    std::shared_ptr<PixelAllocator> allocator_;
+
+    void Allocate();
+    void Deallocate() noexcept;
   };
 
+  /**
+   * Size of the pixel array, including any row padding.
+   */
   inline std::size_t ByteSize(const Image& img) {
-    return img.Width()*img.Height()*(img.BitsPerPixel() >> 3);
+    return img.Stride()*img.Height();
   }
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * Load a PNG or JPEG file, choosing the decoder from the file's contents.
+   *
+   * The file is memory mapped & decoded directly from the mapping, which avoids both
+   * the buffering of a `std::ifstream` & the copy from the page cache into it. On
+   * POSIX systems the mapping is advised as sequential (`MADV_SEQUENTIAL`) so that the
+   * kernel reads ahead aggressively & drops pages once they have been decoded.
+   *
+   * ### Exceptions
+   * - If the file cannot be opened or mapped a `std::system_error` is thrown.
+   * - If the file is neither a PNG nor a JPEG a `std::runtime_error` is thrown.
+   * - Decoding errors are reported as for `LoadPNG`/`LoadJPEG`.
+   *
+   * The strong guarantee is provided: the file is always closed & unmapped before
+   * this function returns.
+   *
+   * ### Thread safety
+   * This function maintains no shared state & is therefore thread safe. As with any
+   * memory mapped file, the results are undefined if the file is truncated by
+   * another process while it is being read.
+   */
+  Image LoadImageFile(const char* path);
+
+  /**
+   * As `LoadImageFile(const char*)` with options that are applied whichever format
+   * the file turns out to be.
+   */
+  Image LoadImageFile(const char* path, const LoadOptions& options);
+
+  /**
+   * Decode a PNG or JPEG held in memory, choosing the decoder from its contents.
+   *
+   * Exceptions are as for `LoadImageFile` except that no I/O takes place. The buffer
+   * is only read & must remain valid until the function returns.
+   */
+  Image LoadImage(const void* data, std::size_t size);
+
+  /**
+   * As `LoadImage(const void*, std::size_t)` with options that are applied whichever
+   * format the buffer turns out to be.
+   */
+  Image LoadImage(const void* data, std::size_t size, const LoadOptions& options);
+
+}
@@ -20,6 +20,81 @@
 
 namespace james {
 
+  /**
+   * Options controlling how `LoadJPEG` reads a JPEG stream.
+   *
+   * The defaults are suitable for most uses; a default constructed JPEGLoadOptions
+   * gives exactly the same behaviour as calling `LoadJPEG(src)`.
+   */
+  struct JPEGLoadOptions : LoadOptions {
+    JPEGLoadOptions()
+      : inputBufferSize(64 * 1024), scaleDenominator(1), maxDimension(0),
+        fastDCT(false), fancyUpsampling(true), threads(1), parallelThreshold(4 * 1024 * 1024)
+    {
+    }
+
+    /**
+     * The number of bytes requested from the source stream's buffer each time
+     * libjpeg runs out of input. Larger values mean fewer (virtual) calls to
+     * `std::streambuf::sgetn`. Must be non-zero.
+     */
+    std::size_t inputBufferSize;
+
+    /**
+     * Decode at 1/scaleDenominator of full size: must be 1, 2, 4 or 8. Scaling is done
+     * by libjpeg as part of the inverse DCT so it reduces decoding time & memory rather
+     * than adding a resize step. Scaled dimensions are rounded up, so a 1001 pixel
+     * wide image scaled by 1/4 is 251 pixels wide.
+     */
+    unsigned int scaleDenominator;
+
+    /**
+     * If non-zero, pick the smallest scale (1/2, 1/4 or 1/8) that still leaves the
+     * longer side of the image at least maxDimension pixels, i.e. the cheapest decode
+     * that can be resized down to a maxDimension thumbnail without upscaling. Images
+     * that are already small enough are decoded at full size.
+     *
+     * When both are given, whichever of this & scaleDenominator shrinks the image the
+     * most wins.
+     */
+    unsigned int maxDimension;
+
+    /**
+     * Use libjpeg's fast integer IDCT (JDCT_IFAST) rather than the accurate one
+     * (JDCT_ISLOW). Slightly less accurate; a good trade for thumbnails.
+     */
+    bool fastDCT;
+
+    /**
+     * Use smooth (fancy) chroma upsampling. Turning this off is faster but blockier.
+     */
+    bool fancyUpsampling;
+
+    /**
+     * Decode big JPEGs that have restart markers on up to this many threads, counting
+     * the calling thread. The default of 1 (or 0) decodes on the calling thread alone.
+     *
+     * A quick scan of the compressed data finds the restart markers that start an MCU
+     * row; the image is split there into runs of rows, each decoded by a libjpeg
+     * decompressor of its own straight into its rows of the Image.
+     *
+     * Only baseline (sequential, Huffman coded, single scan) 8 bit gray & YCbCr JPEGs
+     * with a restart interval, loaded from memory with no region requested, are
+     * decoded this way. Everything else, including JPEGs whose restart markers are too
+     * far apart to split, takes the single threaded path. The pixels are identical
+     * either way.
+     */
+    unsigned int threads;
+
+    /**
+     * Images with fewer pixels than this are decoded on the calling thread whatever
+     * `threads` says: below it, starting the threads & reading the tables again for
+     * each run costs more than it saves. The default is 4 million pixels (e.g.
+     * 2560x1600).
+     */
+    std::size_t parallelThreshold;
+  };
+
   /**
    * Load a JPEG stream into memory and store it in a `james::Image`.
    *
@@ -50,4 +125,44 @@ namespace james {
    */
   Image LoadJPEG(std::istream& src);
 
+  /**
+   * As `LoadJPEG(std::istream&)` but with control over how the stream is read. Invalid
+   * options are a logic error (see `james::Image` for how these are reported).
+   */
+  Image LoadJPEG(std::istream& src, const JPEGLoadOptions& options);
+
+  /**
+   * Load a JPEG image directly from a block of memory, without copying it into a
+   * stream first.
+   *
+   * ### Preconditions
+   * - data points to size readable bytes containing a JPEG stream. The memory must
+   *   remain valid for the duration of the call but is not referenced afterwards.
+   *
+   * ### Exceptions
+   * As for the std::istream overload: any error, including a truncated stream, is
+   * reported by throwing an exception catchable as `std::exception&` & the basic
+   * guarantee is provided.
+   *
+   * ### Thread safety
+   * This function maintains no shared state & is therefore thread safe.
+   */
+  Image LoadJPEG(const void* data, std::size_t size);
+  Image LoadJPEG(const void* data, std::size_t size, const JPEGLoadOptions& options);
+
+  /**
+   * As `LoadJPEG`, but reports bad data through the returned `LoadResult` rather
+   * than by throwing. Rejecting a corrupt image this way costs no more than
+   * detecting the problem, which matters when bad input is routine (e.g. user
+   * uploads).
+   *
+   * Only bad data is reported this way. Invalid options are still a logic error, a
+   * region outside the image still throws `std::out_of_range` & exceptions from a
+   * custom `PixelAllocator` are propagated.
+   */
+  LoadResult TryLoadJPEG(std::istream& src);
+  LoadResult TryLoadJPEG(std::istream& src, const JPEGLoadOptions& options);
+  LoadResult TryLoadJPEG(const void* data, std::size_t size);
+  LoadResult TryLoadJPEG(const void* data, std::size_t size, const JPEGLoadOptions& options);
+
 }
\ No newline at end of file
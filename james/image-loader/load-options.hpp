@@ -0,0 +1,148 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * A rectangle of pixels: x & y are the top left corner, 0 based.
+   */
+  struct Region {
+    Region()
+      : x(0), y(0), width(0), height(0)
+    {
+    }
+
+    Region(unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+      : x(x), y(y), width(width), height(height)
+    {
+    }
+
+    bool Empty() const noexcept { return width == 0 || height == 0; }
+
+    /**
+     * The part of this region that lies within a w x h image (which may be empty).
+     */
+    Region ClippedTo(unsigned int w, unsigned int h) const noexcept {
+      if (x >= w || y >= h) {
+        return Region();
+      }
+      return Region(x, y, width < w - x ? width : w - x, height < h - y ? height : h - y);
+    }
+
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+  };
+
+  /**
+   * Options common to all of the loaders. The format specific option types
+   * (`PNGLoadOptions`, `JPEGLoadOptions`) derive from this.
+   *
+   * A default constructed LoadOptions gives the same behaviour as the loader
+   * overloads that don't take options.
+   */
+  struct LoadOptions {
+    LoadOptions()
+      : rowAlignment(1), pixelFormat(PixelFormat::Auto), region(), metadata(nullptr),
+        maxMetadataSize(1 << 20), applyOrientation(false), stats(nullptr)
+    {
+    }
+
+    /**
+     * Where the pixels of the returned Image come from, e.g. a shared
+     * `PixelBufferPool`. nullptr (the default) means `new[]`.
+     */
+    std::shared_ptr<PixelAllocator> allocator;
+
+    /**
+     * Row alignment of the returned Image, in bytes: see `Image::Stride()`. Rows are
+     * decoded straight into the padded layout. Must be a power of two no greater
+     * than 4096; 1 (the default) gives tightly packed rows.
+     */
+    unsigned int rowAlignment;
+
+    /**
+     * Layout of the returned pixels. The conversion is done as part of decoding (by
+     * libpng's & libjpeg's own transforms where they have them) so there is no
+     * extra pass over the image afterwards.
+     */
+    PixelFormat pixelFormat;
+
+    /**
+     * If not empty, only this rectangle of the image is returned. It is in the
+     * coordinates of the image as decoded, i.e. after any JPEG scaling, & is clipped
+     * to the image; if nothing is left a `std::out_of_range` is thrown.
+     *
+     * Rows below the region are never decoded. Rows above it are skipped as cheaply
+     * as the format allows: a PNG's must still be decompressed (each depends on the
+     * one before) but a JPEG's are skipped without colour conversion or upsampling
+     * where libjpeg-turbo's `jpeg_skip_scanlines` is available. Memory use is
+     * proportional to the region, plus a few full width rows (for interlaced PNGs:
+     * the full width of every row in the region).
+     *
+     * Because decoding stops at the bottom of the region, a stream is left at an
+     * unspecified position inside the image rather than just past its end.
+     *
+     * Ignored by `ImageReader`s.
+     */
+    Region region;
+
+    /**
+     * If not nullptr, the image's ICC profile & EXIF data are stored here. They are
+     * collected from the chunks or markers that the decode reads anyway, so the data
+     * is only read once. Without this (& applyOrientation) JPEG APP1 & APP2 markers
+     * are skipped unread & nothing is copied.
+     *
+     * The ImageMetadata is reset at the start of the load. For a PNG, an eXIf chunk
+     * after the image data is only seen if the whole image is decoded (i.e. not for a
+     * region that stops short of the bottom).
+     *
+     * Ignored by `ImageReader`s & the incremental decoders.
+     */
+    ImageMetadata* metadata;
+
+    /**
+     * The largest ICC profile or EXIF block, in bytes, that will be copied into
+     * `metadata`. Anything larger is left out (but its orientation is still read).
+     */
+    std::size_t maxMetadataSize;
+
+    /**
+     * If true, the returned Image is rotated &/or flipped according to its EXIF
+     * orientation so that it is upright: see `ApplyOrientation`. This happens after
+     * decoding &, for a region, after the region has been cut out, so the region is in
+     * the coordinates of the image as stored.
+     *
+     * Ignored by `ImageReader`s & the incremental decoders.
+     */
+    bool applyOrientation;
+
+    /**
+     * If not nullptr, timings, byte counts & memory use for the load are stored here:
+     * see `DecodeStats`. It is reset at the start of the load. Without it the only
+     * cost is a null check at each point that would be measured.
+     *
+     * Ignored by `ImageReader`s & the incremental decoders.
+     */
+    DecodeStats* stats;
+  };
+
+}
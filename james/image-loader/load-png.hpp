@@ -20,6 +20,51 @@
 
 namespace james {
 
+  /**
+   * Options controlling how `LoadPNG` reads a PNG stream. A default constructed
+   * PNGLoadOptions gives exactly the same behaviour as calling `LoadPNG(src)`.
+   */
+  struct PNGLoadOptions : LoadOptions {
+    PNGLoadOptions()
+      : keep16Bit(false), threads(1), parallelThreshold(4 * 1024 * 1024)
+    {
+    }
+
+    /**
+     * If true, 16 bit PNGs are returned with 16 bits per channel (a 16, 48 or 64bpp
+     * Image, with each channel in the native byte order) rather than being scaled down
+     * to 8. `pixelFormat` still selects the channels & their order, so
+     * `PixelFormat::Gray8` gives 16 bit gray. Images of 8 bits per channel or fewer
+     * are unaffected.
+     *
+     * The byte swap (PNG stores 16 bit samples big endian) is done by libpng as each
+     * row is decoded, so there is no extra pass over the image.
+     */
+    bool keep16Bit;
+
+    /**
+     * Decode big images on up to this many threads, counting the calling thread. The
+     * default of 1 (or 0) decodes on the calling thread alone.
+     *
+     * The calling thread inflates the image data, a second thread undoes the PNG row
+     * filters & any others convert bands of rows into the requested pixel format, so
+     * beyond 3 or 4 threads there is little more to gain.
+     *
+     * Only non-interlaced 8 bit gray, RGB & RGBA images without a tRNS chunk, loaded
+     * from memory with no region, metadata or orientation requested, are decoded this
+     * way; `PixelFormat::Gray8` from a colour image is also excluded. Everything else
+     * takes the single threaded path. The pixels are identical either way.
+     */
+    unsigned int threads;
+
+    /**
+     * Images with fewer pixels than this are decoded on the calling thread whatever
+     * `threads` says: below it, starting the threads & handing bands between them
+     * costs more than it saves. The default is 4 million pixels (e.g. 2560x1600).
+     */
+    std::size_t parallelThreshold;
+  };
+
   /**
    * Load a PNG stream into memory and store it in a `james::Image`.
    *
@@ -49,5 +94,38 @@ namespace james {
    * This function maintains no shared state & is therefore thread safe.
    */
   Image LoadPNG(std::istream& src);
+  Image LoadPNG(std::istream& src, const PNGLoadOptions& options);
+
+  /**
+   * Load a PNG image directly from a block of memory, without copying it into a
+   * stream first.
+   *
+   * ### Preconditions
+   * - data points to size readable bytes containing a PNG stream. The memory must
+   *   remain valid for the duration of the call but is not referenced afterwards.
+   *
+   * ### Exceptions
+   * As for the std::istream overload: any error, including a truncated stream, is
+   * reported by throwing an exception catchable as `std::exception&` & the basic
+   * guarantee is provided.
+   *
+   * ### Thread safety
+   * This function maintains no shared state & is therefore thread safe.
+   */
+  Image LoadPNG(const void* data, std::size_t size);
+  Image LoadPNG(const void* data, std::size_t size, const PNGLoadOptions& options);
+
+  /**
+   * As `LoadPNG`, but reports bad data through the returned `LoadResult` rather than
+   * by throwing. Rejecting a corrupt image this way costs no more than detecting the
+   * problem, which matters when bad input is routine (e.g. user uploads).
+   *
+   * Only bad data is reported this way. A region outside the image still throws
+   * `std::out_of_range` & exceptions from a custom `PixelAllocator` are propagated.
+   */
+  LoadResult TryLoadPNG(std::istream& src);
+  LoadResult TryLoadPNG(std::istream& src, const PNGLoadOptions& options);
+  LoadResult TryLoadPNG(const void* data, std::size_t size);
+  LoadResult TryLoadPNG(const void* data, std::size_t size, const PNGLoadOptions& options);
 
 }
\ No newline at end of file
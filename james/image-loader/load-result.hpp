@@ -0,0 +1,57 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * Why a `TryLoadPNG`/`TryLoadJPEG` call failed.
+   */
+  enum class DecodeError {
+    None,
+    Truncated,          // the data ends before the image does
+    BadHeader,          // not a valid header, including data in some other format
+    UnsupportedFormat,  // a valid image that uses features we can't decode (e.g. CMYK JPEG)
+    OutOfMemory,
+    IO,                 // the source stream reported an error
+    Corrupt             // the header is valid but the image data is not
+  };
+
+  /**
+   * A short description of error, e.g. for logging.
+   */
+  const char* DecodeErrorMessage(DecodeError error) noexcept;
+
+  /**
+   * The result of a `TryLoadPNG`/`TryLoadJPEG` call: either an image or the reason
+   * there isn't one. `image` is empty unless `error` is DecodeError::None.
+   */
+  struct LoadResult {
+    LoadResult()
+      : error(DecodeError::None)
+    {
+    }
+
+    explicit operator bool() const noexcept { return error == DecodeError::None; }
+
+    Image image;
+    DecodeError error;
+  };
+
+}
@@ -0,0 +1,109 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * A PixelAllocator provides the pixel memory for `james::Image`.
+   *
+   * By default an Image allocates its pixels with `new[]`. Supplying a PixelAllocator
+   * (to the Image constructor, or through `LoadOptions::allocator` when loading) lets
+   * the pixel memory come from somewhere else, such as a `PixelBufferPool`.
+   *
+   * Images hold a `std::shared_ptr` to their allocator so an allocator lives at least
+   * as long as the last Image using it.
+   *
+   * ### Requirements on implementations
+   * - Allocate returns memory for at least size bytes or throws (usually
+   *   std::bad_alloc). It must never return nullptr.
+   * - Deallocate is passed the same size that was given to Allocate.
+   * - Both may be called concurrently from multiple threads if Images using the
+   *   allocator are created or destroyed on multiple threads.
+   */
+  struct PixelAllocator {
+    virtual ~PixelAllocator() {}
+
+    virtual void* Allocate(std::size_t size) = 0;
+    virtual void Deallocate(void* ptr, std::size_t size) noexcept = 0;
+  };
+
+  /**
+   * A thread safe PixelAllocator that recycles buffers, so that decoding many
+   * similarly sized images doesn't keep going back to the system heap.
+   *
+   * ### Size classes
+   * Requests are rounded up to a size class & freed buffers are kept on a list for
+   * their class. There are four classes between consecutive powers of two, so at
+   * most 25% of a buffer is wasted by rounding.
+   *
+   * ### Alignment
+   * Every buffer is aligned to `PixelBufferPool::Alignment` (64) bytes, i.e. a cache
+   * line & the widest SIMD register in common use.
+   *
+   * ### Memory cap
+   * At most maxRetainedBytes are kept on the free lists; buffers freed beyond that
+   * go straight back to the system. Buffers in use are not counted: the cap limits
+   * the memory the pool holds on to, not the memory its Images use.
+   *
+   * ### Thread safety
+   * All member functions may be called concurrently.
+   */
+  class PixelBufferPool : public PixelAllocator {
+  public:
+    static const std::size_t Alignment = 64;
+
+    struct Stats {
+      unsigned long long hits;        // Allocate calls satisfied from a free list
+      unsigned long long misses;      // Allocate calls that went to the system
+      std::size_t retainedBytes;      // Bytes currently held on the free lists
+      std::size_t retainedBuffers;    // Buffers currently held on the free lists
+
+      double HitRate() const {
+        return hits + misses ? (double) hits / (double)(hits + misses) : 0.0;
+      }
+    };
+
+    explicit PixelBufferPool(std::size_t maxRetainedBytes);
+    ~PixelBufferPool();
+
+    PixelBufferPool(const PixelBufferPool&) = delete;
+    PixelBufferPool& operator= (const PixelBufferPool&) = delete;
+
+    void* Allocate(std::size_t size) override;
+    void Deallocate(void* ptr, std::size_t size) noexcept override;
+
+    /**
+     * Returns every retained buffer to the system.
+     */
+    void Trim() noexcept;
+
+    Stats GetStats() const;
+
+    /**
+     * The size actually allocated for a request of size bytes: never less than size.
+     */
+    static std::size_t SizeClass(std::size_t size) noexcept;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+  };
+
+}
@@ -0,0 +1,71 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * The layout of the pixels a loader produces. All formats have 8 bit channels.
+   *
+   * - `Auto` keeps the image's own layout: RGB or RGBA for PNG (grayscale is expanded
+   *   to RGB) & RGB or 8 bit grayscale for JPEG.
+   * - `RGB`, `BGR`: 24bpp. Any alpha channel is discarded, not composited.
+   * - `RGBA`, `BGRA`: 32bpp. Images without alpha get an opaque (255) alpha channel.
+   * - `RGBX`: 32bpp RGB with the fourth byte set to 255. Any alpha is discarded.
+   * - `Gray8`: 8bpp luminance. Colour images are converted (using the Rec. 709
+   *   weights for PNG & libjpeg's for JPEG) & any alpha is discarded.
+   * - `PremultipliedRGBA`: as RGBA with the colour channels multiplied by alpha.
+   *   (Premultiplication is of the stored values; no gamma decoding is done.)
+   */
+  enum class PixelFormat {
+    Auto,
+    RGB,
+    RGBA,
+    BGR,
+    BGRA,
+    RGBX,
+    Gray8,
+    PremultipliedRGBA
+  };
+
+  /**
+   * Bytes per pixel of a format, or 0 for `PixelFormat::Auto` (which depends on the
+   * image).
+   */
+  inline unsigned int BytesPerPixel(PixelFormat format) noexcept {
+    switch (format) {
+    case PixelFormat::Gray8:
+      return 1;
+
+    case PixelFormat::RGB:
+    case PixelFormat::BGR:
+      return 3;
+
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA:
+    case PixelFormat::RGBX:
+    case PixelFormat::PremultipliedRGBA:
+      return 4;
+
+    default:
+      return 0;
+    }
+  }
+
+}
@@ -0,0 +1,112 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * Instruction sets the pixel kernels have implementations for.
+   */
+  enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+  };
+
+  /**
+   * One implementation of each pixel kernel. All kernels work on n pixels of 8 bit
+   * channels; src & dst must not overlap. Pointers need no particular alignment.
+   *
+   * - `rgbToRGBA`: 3 byte pixels to 4, adding an opaque (255) alpha.
+   * - `grayToRGB`: 1 byte pixels to 3, replicating the value.
+   * - `swapRedBlue24` & `swapRedBlue32`: RGB <-> BGR & RGBA <-> BGRA, in place.
+   * - `premultiplyAlpha`: RGBA (or BGRA) to premultiplied, in place. Each colour
+   *   channel becomes round(c * a / 255).
+   * - `unpremultiplyAlpha`: the inverse, in place: round(c * 255 / a) clamped to 255,
+   *   or 0 where a is 0. (Premultiplication loses precision at low alpha so this is
+   *   not an exact inverse.)
+   *
+   * Every implementation gives bit-identical results to the scalar one.
+   */
+  struct PixelKernels {
+    void (*rgbToRGBA)(const unsigned char* src, unsigned char* dst, std::size_t n);
+    void (*grayToRGB)(const unsigned char* src, unsigned char* dst, std::size_t n);
+    void (*swapRedBlue24)(unsigned char* pixels, std::size_t n);
+    void (*swapRedBlue32)(unsigned char* pixels, std::size_t n);
+    void (*premultiplyAlpha)(unsigned char* pixels, std::size_t n);
+    void (*unpremultiplyAlpha)(unsigned char* pixels, std::size_t n);
+  };
+
+  /**
+   * The kernels for a given instruction set, or nullptr if they weren't compiled in
+   * or the CPU doesn't support them. The scalar kernels are always available.
+   *
+   * Mainly of use for testing & benchmarking: the functions below use the best
+   * available set.
+   */
+  const PixelKernels* GetPixelKernels(SimdLevel level) noexcept;
+
+  /**
+   * The instruction set the functions below use: the best of those available,
+   * determined once on first use.
+   */
+  SimdLevel BestSimdLevel() noexcept;
+
+  // Row kernels, dispatched to the best available implementation. See PixelKernels.
+
+  void RGBToRGBA(const unsigned char* src, unsigned char* dst, std::size_t n) noexcept;
+  void GrayToRGB(const unsigned char* src, unsigned char* dst, std::size_t n) noexcept;
+  void SwapRedBlue24(unsigned char* pixels, std::size_t n) noexcept;
+  void SwapRedBlue32(unsigned char* pixels, std::size_t n) noexcept;
+  void PremultiplyAlpha(unsigned char* pixels, std::size_t n) noexcept;
+  void UnpremultiplyAlpha(unsigned char* pixels, std::size_t n) noexcept;
+
+  // Whole image versions. These respect the image's stride & leave row padding
+  // untouched. Calling them on an image of the wrong depth is a logic error, handled
+  // as described in image.hpp.
+
+  /**
+   * Swaps the first & third channels of a 24 or 32bpp image, e.g. RGBA <-> BGRA.
+   */
+  void SwapRedBlue(Image& img);
+
+  /**
+   * Premultiplies a 32bpp image with alpha in the fourth channel.
+   */
+  void PremultiplyAlpha(Image& img);
+
+  /**
+   * Reverses PremultiplyAlpha on a 32bpp image.
+   */
+  void UnpremultiplyAlpha(Image& img);
+
+  /**
+   * Returns a 32bpp copy of an 8bpp (gray) or 24bpp image with opaque alpha. The copy
+   * has the same row alignment & allocator as img.
+   */
+  Image ExpandToRGBA(const Image& img);
+
+  /**
+   * Returns a 24bpp copy of an 8bpp (gray) image. The copy has the same row alignment
+   * & allocator as img.
+   */
+  Image ExpandToRGB(const Image& img);
+
+}
@@ -0,0 +1,108 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * A summary of an image's header, as returned by `ProbeImage`.
+   *
+   * All values describe the image as it is stored in the file, not as `LoadPNG` or
+   * `LoadJPEG` would return it. (For example, a 16 bit grayscale PNG has 1 channel &
+   * a bit depth of 16 even though LoadPNG would return 24bpp RGB.)
+   */
+  struct ImageInfo {
+    ImageInfo()
+      : format(ImageFormat::Unknown), width(0), height(0), channels(0), bitDepth(0),
+        interlaced(false), hasICCProfile(false), hasEXIF(false)
+    {
+    }
+
+    ImageFormat format;
+    unsigned int width;
+    unsigned int height;
+
+    /**
+     * Colour channels including alpha. Palette PNGs report the channels of their
+     * palette entries: 3, or 4 if they have transparency.
+     */
+    unsigned int channels;
+
+    /**
+     * Bits per channel (or per palette index) as stored.
+     */
+    unsigned int bitDepth;
+
+    /**
+     * True for Adam7 interlaced PNGs & progressive JPEGs.
+     */
+    bool interlaced;
+
+    /**
+     * Whether an ICC profile is present (an iCCP chunk or an ICC_PROFILE APP2 marker).
+     */
+    bool hasICCProfile;
+
+    /**
+     * Whether EXIF data is present (an eXIf chunk or an Exif APP1 marker). PNG only
+     * reports eXIf chunks that precede the image data.
+     */
+    bool hasEXIF;
+  };
+
+  /**
+   * Reads just enough of a PNG or JPEG stream to describe the image, without
+   * decoding any pixel data. This is much cheaper than a full load & is intended for
+   * validating uploads or planning memory use.
+   *
+   * ### Preconditions
+   * - src points to the beginning of an image stream & is seekable
+   *
+   * ### Post-conditions
+   * Whether or not an exception is thrown, src is returned to the position it had
+   * on entry, so a real decode can follow.
+   *
+   * If the data is not recognised as PNG or JPEG, an ImageInfo with
+   * `format == ImageFormat::Unknown` is returned.
+   *
+   * ### Exceptions
+   * - If src is not seekable a `std::runtime_error` is thrown & nothing is read.
+   * - A malformed or truncated header is reported as for `LoadPNG`/`LoadJPEG`.
+   *
+   * ### Thread safety
+   * This function maintains no shared state & is therefore thread safe.
+   */
+  ImageInfo ProbeImage(std::istream& src);
+
+  /**
+   * As `ProbeImage(std::istream&)` but reads from memory.
+   */
+  ImageInfo ProbeImage(const void* data, std::size_t size);
+
+  /**
+   * Format specific probes used by ProbeImage. The data must be of the given format.
+   * Unlike ProbeImage, the std::istream overloads leave src positioned somewhere
+   * after the header.
+   */
+  ImageInfo ProbePNG(std::istream& src);
+  ImageInfo ProbePNG(const void* data, std::size_t size);
+  ImageInfo ProbeJPEG(std::istream& src);
+  ImageInfo ProbeJPEG(const void* data, std::size_t size);
+
+}
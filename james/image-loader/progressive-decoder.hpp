@@ -0,0 +1,138 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  class FormatDetectingDecoder;
+
+  /**
+   * Decodes a PNG or JPEG image from data pushed to it as it arrives (e.g. from a
+   * network connection) & gives access to a full size preview while decoding is
+   * still under way.
+   *
+   * ### Usage
+   * Pass each piece of data to Feed as it is received. Whenever Feed returns true
+   * the preview has changed & can be redrawn:
+   *
+   * ```C++
+   * ProgressiveDecoder decoder;
+   *
+   * while (!decoder.Done() && (n = Receive(buffer, sizeof(buffer))) > 0) {
+   *   if (decoder.Feed(buffer, n)) {
+   *     Redraw(decoder.Preview());
+   *   }
+   * }
+   * ```
+   *
+   * ### Previews
+   * - A progressive JPEG is decoded in libjpeg's buffered-image mode. After a Feed
+   *   that completes one or more scans the whole image is output again from the
+   *   latest of them, so each preview is a sharper version of the last. The first
+   *   scans usually arrive within the first 10-20% of the data.
+   * - An interlaced (Adam7) PNG is decoded with libpng's progressive reader. After
+   *   each pass the pixels still to come are filled in by repeating their
+   *   neighbours: 8x8 blocks after the first pass, single pixels after the last.
+   * - Anything else is decoded from the top down: rows [0, RowsComplete()) are final
+   *   & the rest of the preview is unspecified.
+   *
+   * Every preview is the size of the final image & in the same pixel format, except
+   * that the earlier passes of an interlaced PNG are not yet premultiplied when
+   * PixelFormat::PremultipliedRGBA is requested.
+   *
+   * ### Truncated data
+   * Running out of data is not an error: until the end of the image has been
+   * received Done() is false & Preview() shows as much as has been decoded.
+   *
+   * ### Exceptions
+   * Corrupt data is reported by Feed throwing an exception catchable as
+   * `std::exception&`, as is data that turns out not to be a PNG or JPEG (at the
+   * latest once 8 bytes have been received). After an exception the decoder is in
+   * an undefined state & the only safe thing to do with it is destroy it.
+   *
+   * ### Thread safety
+   * A ProgressiveDecoder is not thread safe, but separate decoders share no state.
+   */
+  class ProgressiveDecoder {
+  public:
+    ProgressiveDecoder();
+
+    /**
+     * options.region, options.metadata, options.applyOrientation & options.stats are
+     * ignored; everything else applies to both the previews & the final image.
+     */
+    explicit ProgressiveDecoder(const LoadOptions& options);
+    ~ProgressiveDecoder();
+
+    ProgressiveDecoder(const ProgressiveDecoder&) = delete;
+    ProgressiveDecoder& operator= (const ProgressiveDecoder&) = delete;
+
+    /**
+     * Decodes as much of the image as the data received so far allows. All size
+     * bytes are consumed; anything that can't be decoded yet is kept until more
+     * arrives. Data after the end of the image is ignored.
+     *
+     * Returns true if Preview() has changed.
+     */
+    bool Feed(const void* data, std::size_t size);
+
+    /**
+     * ImageFormat::Unknown until enough data has arrived to tell.
+     */
+    ImageFormat Format() const noexcept;
+
+    /**
+     * True once the header has been decoded: from then on Preview() has the
+     * dimensions & pixel format of the final image.
+     */
+    bool HeaderReady() const noexcept;
+
+    /**
+     * The number of rows at the top of Preview() that hold their final pixels.
+     */
+    unsigned int RowsComplete() const noexcept;
+
+    /**
+     * The number of progressive JPEG scans or Adam7 passes reflected in Preview().
+     * Always 0 for other images.
+     */
+    unsigned int Refinements() const noexcept;
+
+    /**
+     * True once the whole image has been decoded.
+     */
+    bool Done() const noexcept;
+
+    /**
+     * The image as decoded so far. Empty until HeaderReady().
+     */
+    const Image& Preview() const noexcept;
+
+    /**
+     * Moves the final image out of the decoder. Must only be called once Done() is
+     * true; Preview() is empty afterwards.
+     */
+    Image TakeImage();
+
+  private:
+    std::unique_ptr<FormatDetectingDecoder> decoder_;
+    Image empty_;
+  };
+
+}
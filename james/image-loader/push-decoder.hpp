@@ -0,0 +1,253 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  class FormatDetectingDecoder;
+
+  /**
+   * Decodes a PNG or JPEG image from data pushed to it, without ever blocking for
+   * more. This suits event loops & asynchronous IO: rather than dedicating a thread
+   * to each decode (which a `std::istream` based loader would block), many decoders
+   * can be driven by a few threads, each Feed doing only as much work as the data
+   * allows.
+   *
+   * libjpeg is run with a suspending data source (`fill_input_buffer` returns
+   * FALSE, so libjpeg backs up to a point it can restart from) & libpng with its
+   * progressive reader (`png_process_data`). Data that can't be decoded yet is
+   * buffered by the decoder; the caller's buffer can be reused as soon as Feed
+   * returns.
+   *
+   * ### Usage
+   * ```C++
+   * switch (decoder.Feed(buffer, n)) {
+   * case PushDecoder::Status::NeedMoreData:
+   *   break;
+   * case PushDecoder::Status::HeaderReady:
+   *   // Width(), Height() & BitsPerPixel() are known
+   *   break;
+   * case PushDecoder::Status::RowsReady:
+   *   // rows [0, RowsComplete()) of Decoded() are final
+   *   break;
+   * case PushDecoder::Status::Done:
+   *   Use(decoder.TakeImage());
+   *   break;
+   * }
+   * ```
+   *
+   * Feed reports the furthest stage the call reached, so if one piece of data
+   * completes the header & some rows it returns RowsReady: the header is available
+   * whenever the status is anything other than NeedMoreData.
+   *
+   * Rows become ready from the top down. An interlaced PNG's rows are only
+   * complete once its last pass starts & a progressive JPEG's once all of its data
+   * has arrived. (For previews of those see `ProgressiveDecoder`.)
+   *
+   * ### Exceptions
+   * As for `ProgressiveDecoder`: corrupt or unrecognised data is reported by Feed
+   * throwing an exception catchable as `std::exception&`, after which the decoder can
+   * only be destroyed. Running out of data is not an error.
+   *
+   * ### Thread safety
+   * A PushDecoder is not thread safe but holds no thread specific state, so
+   * successive calls may be made from different threads. Separate decoders share
+   * no state.
+   */
+  class PushDecoder {
+  public:
+    enum class Status {
+      NeedMoreData,   // nothing new: feed more data
+      HeaderReady,    // the header has been decoded
+      RowsReady,      // RowsComplete() has increased
+      Done            // the whole image has been decoded
+    };
+
+    PushDecoder();
+
+    /**
+     * options.region, options.metadata, options.applyOrientation & options.stats are
+     * ignored.
+     */
+    explicit PushDecoder(const LoadOptions& options);
+    ~PushDecoder();
+
+    PushDecoder(const PushDecoder&) = delete;
+    PushDecoder& operator= (const PushDecoder&) = delete;
+
+    /**
+     * Decodes as much as the data received so far allows. All size bytes are
+     * consumed. Once Done, further data is ignored & Done is returned again.
+     */
+    Status Feed(const void* data, std::size_t size);
+
+    /**
+     * ImageFormat::Unknown until enough data has arrived to tell.
+     */
+    ImageFormat Format() const noexcept;
+
+    bool HeaderReady() const noexcept;
+
+    // Valid once HeaderReady() is true; 0 before.
+    unsigned int Width() const noexcept;
+    unsigned int Height() const noexcept;
+    unsigned int BitsPerPixel() const noexcept;
+
+    /**
+     * The number of rows at the top of Decoded() that hold their final pixels.
+     */
+    unsigned int RowsComplete() const noexcept;
+
+    bool Done() const noexcept;
+
+    /**
+     * The image being decoded into. Empty until HeaderReady(); only rows
+     * [0, RowsComplete()) are meaningful.
+     */
+    const Image& Decoded() const noexcept;
+
+    /**
+     * Moves the image out of the decoder. Must only be called once Done() is true.
+     */
+    Image TakeImage();
+
+  private:
+    std::unique_ptr<FormatDetectingDecoder> decoder_;
+    Image empty_;
+  };
+
+#ifdef JAMES_IMAGE_LOADER_COROUTINES
+
+  /**
+   * The coroutine returned by `DecodeImageAsync`. It is lazily started & yields the
+   * decoded Image (or rethrows the decoder's exception) when awaited:
+   *
+   * ```C++
+   * Image img = co_await DecodeImageAsync([&] { return socket.AsyncRead(); });
+   * ```
+   *
+   * Code that isn't itself a coroutine can call Start() & then poll Done(), e.g. from
+   * an event loop that resumes the coroutine when data arrives, & collect the result
+   * with Get().
+   */
+  class ImageTask {
+  public:
+    struct promise_type {
+      Image image;
+      std::exception_ptr error;
+      std::coroutine_handle<> continuation;
+
+      ImageTask get_return_object() noexcept {
+        return ImageTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept { return {}; }
+
+      // Resume whoever is awaiting us, if anyone
+      struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+          return h.promise().continuation ? h.promise().continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+      };
+
+      FinalAwaiter final_suspend() noexcept { return {}; }
+
+      void return_value(Image img) { image = std::move(img); }
+      void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    ImageTask(ImageTask&& other) noexcept
+      : handle_(other.handle_)
+    {
+      other.handle_ = nullptr;
+    }
+
+    ImageTask& operator= (ImageTask&& other) noexcept {
+      std::swap(handle_, other.handle_);
+      return *this;
+    }
+
+    ~ImageTask() {
+      if (handle_) {
+        handle_.destroy();
+      }
+    }
+
+    void Start() { handle_.resume(); }
+    bool Done() const noexcept { return handle_.done(); }
+
+    /**
+     * The decoded image. Must only be called once Done() is true.
+     */
+    Image Get() {
+      if (handle_.promise().error) {
+        std::rethrow_exception(handle_.promise().error);
+      }
+      return std::move(handle_.promise().image);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle_.promise().continuation = awaiting;
+      return handle_;
+    }
+
+    Image await_resume() { return Get(); }
+
+  private:
+    explicit ImageTask(std::coroutine_handle<promise_type> handle)
+      : handle_(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+  };
+
+  /**
+   * Decodes an image with a PushDecoder, reading data with `co_await read()`. The
+   * awaited value can be anything with `data()` & `size()` (e.g. a
+   * `std::vector<char>` or `std::span<const std::byte>`); it need only stay valid
+   * until the next read. An empty read means the end of the data & throws a
+   * std::runtime_error if the image isn't complete.
+   */
+  template<class Read>
+  ImageTask DecodeImageAsync(Read read, LoadOptions options = LoadOptions()) {
+    PushDecoder decoder(options);
+
+    for (;;) {
+      auto data = co_await read();
+
+      if (data.size() == 0) {
+        throw std::runtime_error("Unexpected end of image data.");
+      }
+
+      if (decoder.Feed(data.data(), data.size()) == PushDecoder::Status::Done) {
+        co_return decoder.TakeImage();
+      }
+    }
+  }
+
+#endif
+
+}
@@ -0,0 +1,107 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+namespace james {
+
+  /**
+   * Decodes one JPEG after another, keeping libjpeg's decompressor between them.
+   *
+   * Each `LoadJPEG` call creates & destroys a decompressor (libjpeg's memory manager,
+   * marker reader & input controller, plus the error & source managers) & allocates
+   * a fresh input buffer. For small images that setup is a large part of the cost. A
+   * JPEGDecoder creates them on its first decode & afterwards only resets them with
+   * `jpeg_abort_decompress`, which releases the memory used for the image but keeps
+   * the rest. The input buffer & the buffers used for pixel format conversion &
+   * region decoding are kept too.
+   *
+   * Decode & TryDecode behave exactly as `LoadJPEG` & `TryLoadJPEG` do with the
+   * options given on construction, including their exceptions: a failed decode
+   * leaves the decoder ready for the next one. To avoid allocating pixels for every
+   * image as well, give the options a `PixelBufferPool`.
+   *
+   * ### Thread safety
+   * A JPEGDecoder must only be used by one thread at a time; give each worker thread
+   * its own.
+   */
+  class JPEGDecoder {
+  public:
+    JPEGDecoder();
+
+    /**
+     * Invalid options are a logic error, as for `LoadJPEG`.
+     */
+    explicit JPEGDecoder(const JPEGLoadOptions& options);
+    ~JPEGDecoder();
+
+    JPEGDecoder(const JPEGDecoder&) = delete;
+    JPEGDecoder& operator= (const JPEGDecoder&) = delete;
+
+    const JPEGLoadOptions& Options() const noexcept;
+
+    Image Decode(std::istream& src);
+    Image Decode(const void* data, std::size_t size);
+
+    LoadResult TryDecode(std::istream& src);
+    LoadResult TryDecode(const void* data, std::size_t size);
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+  };
+
+  /**
+   * Decodes one PNG after another, recycling libpng's memory between them.
+   *
+   * libpng can't reset a read struct for a new image, so each decode still creates
+   * (& destroys) its own. What a PNGDecoder saves is the allocations: the read & info
+   * structs, zlib's inflate state & window & libpng's row buffers are kept when freed
+   * (up to 1 MiB) & handed back when the next image asks for the same sizes.
+   *
+   * Decode & TryDecode behave exactly as `LoadPNG` & `TryLoadPNG` do with the
+   * options given on construction, including their exceptions. To avoid allocating
+   * pixels for every image as well, give the options a `PixelBufferPool`.
+   *
+   * ### Thread safety
+   * A PNGDecoder must only be used by one thread at a time; give each worker thread
+   * its own.
+   */
+  class PNGDecoder {
+  public:
+    PNGDecoder();
+    explicit PNGDecoder(const PNGLoadOptions& options);
+    ~PNGDecoder();
+
+    PNGDecoder(const PNGDecoder&) = delete;
+    PNGDecoder& operator= (const PNGDecoder&) = delete;
+
+    const PNGLoadOptions& Options() const noexcept;
+
+    Image Decode(std::istream& src);
+    Image Decode(const void* data, std::size_t size);
+
+    LoadResult TryDecode(std::istream& src);
+    LoadResult TryDecode(const void* data, std::size_t size);
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+  };
+
+}
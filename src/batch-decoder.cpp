@@ -0,0 +1,373 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "mapped-file.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace james {
+
+  namespace {
+
+    struct Batch {
+      Batch(const std::vector<BatchItem>& items, const BatchDecoder::Callback& callback)
+        : items(items), callback(callback), remaining(items.size())
+      {
+      }
+
+      const std::vector<BatchItem> items;
+      const BatchDecoder::Callback callback;
+
+      std::mutex lock;
+      std::condition_variable finished;
+      std::size_t remaining;
+    };
+
+    // The pool whose worker is the current thread, if any
+    thread_local const void* currentPool = nullptr;
+
+    struct Task {
+      std::shared_ptr<Batch> batch;
+      std::size_t index;
+    };
+
+    // One per worker. The owner works from the back (most recently dealt, so most
+    // likely to be in cache); thieves take from the front.
+    //
+    struct WorkQueue {
+      std::mutex lock;
+      std::deque<Task> tasks;
+    };
+
+    // The size of the image LoadPNG/LoadJPEG will return for a given header
+    //
+    std::size_t EstimateBytes(const ImageInfo& info, const LoadOptions& options) {
+      std::size_t bytesPerPixel = BytesPerPixel(options.pixelFormat);
+
+      if (bytesPerPixel == 0) {
+        bytesPerPixel = info.channels;
+
+        if (info.format == ImageFormat::PNG) {
+          // Gray is expanded to RGB & gray+alpha to RGBA
+          bytesPerPixel = (info.channels == 2 || info.channels == 4) ? 4 : 3;
+        }
+      }
+
+      unsigned int w = info.width, h = info.height;
+
+      if (!options.region.Empty()) {
+        const Region region = options.region.ClippedTo(w, h);
+        w = region.width;
+        h = region.height;
+      }
+
+      const std::size_t align = options.rowAlignment ? options.rowAlignment : 1;
+      const std::size_t stride = (w*bytesPerPixel + align - 1) / align * align;
+
+      return stride * h;
+    }
+  }
+
+  struct BatchDecoder::Impl {
+    explicit Impl(const BatchDecoderOptions& options);
+    ~Impl();
+
+    void Submit(const std::shared_ptr<Batch>& batch);
+
+  private:
+    void Stop();
+    bool Pop(std::size_t self, Task& task);
+    void Run(std::size_t self);
+    void Process(const Task& task);
+
+    void Reserve(std::size_t bytes);
+    void Release(std::size_t bytes);
+
+  public:
+    const BatchDecoderOptions options;
+    std::vector<std::thread> workers;
+
+  private:
+    // One queue per worker; the count is fixed before any worker starts (workers
+    // itself is still growing as they do)
+    std::unique_ptr<WorkQueue[]> queues_;
+    std::size_t nQueues_;
+    std::atomic<std::size_t> nextQueue_;
+
+    // The number of tasks pushed (or about to be) & not yet popped. It is only
+    // incremented with sleepLock_ held so that a worker can't miss a wake-up between
+    // checking it & going to sleep, & always before the tasks are pushed so that a
+    // pop can't take it below zero.
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    std::atomic<std::size_t> queued_;
+    bool stopping_;
+
+    std::mutex budgetLock_;
+    std::condition_variable budgetFreed_;
+    std::size_t inFlight_;
+  };
+
+  BatchDecoder::Impl::Impl(const BatchDecoderOptions& options)
+    : options(options), nQueues_(0), nextQueue_(0), queued_(0), stopping_(false), inFlight_(0)
+  {
+    std::size_t n = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (n == 0) {
+      n = 1;
+    }
+
+    queues_.reset(new WorkQueue[n]);
+    nQueues_ = n;
+    workers.reserve(n);
+
+    try {
+      for (std::size_t i = 0; i < n; ++i) {
+        workers.emplace_back(&Impl::Run, this, i);
+      }
+    }
+    catch (...) {
+      Stop();
+      throw;
+    }
+  }
+
+  BatchDecoder::Impl::~Impl() {
+    Stop();
+  }
+
+  void BatchDecoder::Impl::Stop() {
+    {
+      std::lock_guard<std::mutex> l(sleepLock_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread& t : workers) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+  }
+
+  void BatchDecoder::Impl::Submit(const std::shared_ptr<Batch>& batch) {
+    const std::size_t n = nQueues_;
+    const std::size_t first = nextQueue_.fetch_add(1);
+
+    {
+      std::lock_guard<std::mutex> l(sleepLock_);
+      queued_ += batch->items.size();
+    }
+
+    for (std::size_t i = 0; i < batch->items.size(); ++i) {
+      WorkQueue& q = queues_[(first + i) % n];
+      std::lock_guard<std::mutex> l(q.lock);
+      q.tasks.push_back(Task{ batch, i });
+    }
+
+    wake_.notify_all();
+  }
+
+  bool BatchDecoder::Impl::Pop(std::size_t self, Task& task) {
+    const std::size_t n = nQueues_;
+
+    {
+      WorkQueue& own = queues_[self];
+      std::lock_guard<std::mutex> l(own.lock);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --queued_;
+        return true;
+      }
+    }
+
+    for (std::size_t i = 1; i < n; ++i) {
+      WorkQueue& victim = queues_[(self + i) % n];
+      std::lock_guard<std::mutex> l(victim.lock);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void BatchDecoder::Impl::Run(std::size_t self) {
+    currentPool = this;
+
+    for (;;) {
+      Task task;
+
+      if (Pop(self, task)) {
+        Process(task);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> l(sleepLock_);
+      if (queued_ > 0) {
+        // Counted but not pushed yet: Submit is part way through
+        l.unlock();
+        std::this_thread::yield();
+        continue;
+      }
+
+      wake_.wait(l, [this]() { return queued_ > 0 || stopping_; });
+
+      if (stopping_ && queued_ == 0) {
+        return;
+      }
+    }
+  }
+
+  void BatchDecoder::Impl::Process(const Task& task) {
+    Batch& batch = *task.batch;
+    const BatchItem& item = batch.items[task.index];
+
+    BatchResult result;
+    result.index = task.index;
+
+    std::size_t reserved = 0;
+
+    try {
+      std::unique_ptr<MappedFile> file;
+      const void* data = item.data;
+      std::size_t size = item.size;
+
+      if (!data) {
+        file.reset(new MappedFile(item.path.c_str()));
+        data = file->Data();
+        size = file->Size();
+      }
+
+      if (options.maxInFlightBytes) {
+        const std::size_t estimate = EstimateBytes(ProbeImage(data, size), options.load);
+        Reserve(estimate);
+        reserved = estimate;
+      }
+
+      result.image = LoadImage(data, size, options.load);
+    }
+    catch (...) {
+      result.error = std::current_exception();
+    }
+
+    try {
+      batch.callback(result);
+    }
+    catch (...) {
+    }
+
+    // The callback may have kept the pixels, so the budget is only returned once it
+    // has finished with them
+    result.image = Image();
+    Release(reserved);
+
+    std::lock_guard<std::mutex> l(batch.lock);
+    if (--batch.remaining == 0) {
+      batch.finished.notify_all();
+    }
+  }
+
+  void BatchDecoder::Impl::Reserve(std::size_t bytes) {
+    std::unique_lock<std::mutex> l(budgetLock_);
+    budgetFreed_.wait(l, [&]() {
+      return inFlight_ == 0 || inFlight_ + bytes <= options.maxInFlightBytes;
+    });
+    inFlight_ += bytes;
+  }
+
+  void BatchDecoder::Impl::Release(std::size_t bytes) {
+    if (bytes == 0) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> l(budgetLock_);
+      inFlight_ -= bytes;
+    }
+    budgetFreed_.notify_all();
+  }
+
+  BatchDecoder::BatchDecoder()
+    : impl_(new Impl(BatchDecoderOptions()))
+  {
+  }
+
+  BatchDecoder::BatchDecoder(const BatchDecoderOptions& options)
+    : impl_(new Impl(options))
+  {
+  }
+
+  BatchDecoder::~BatchDecoder() {
+  }
+
+  unsigned int BatchDecoder::Threads() const noexcept {
+    return (unsigned int) impl_->workers.size();
+  }
+
+  void BatchDecoder::Decode(const std::vector<BatchItem>& items, const Callback& callback) {
+    if (currentPool == impl_.get()) {
+      throw std::logic_error("BatchDecoder::Decode can't be called from one of its own callbacks.");
+    }
+
+    if (items.empty()) {
+      return;
+    }
+
+    std::shared_ptr<Batch> batch(std::make_shared<Batch>(items, callback));
+    impl_->Submit(batch);
+
+    std::unique_lock<std::mutex> l(batch->lock);
+    batch->finished.wait(l, [&]() { return batch->remaining == 0; });
+  }
+
+  std::vector<std::future<Image>> BatchDecoder::DecodeAsync(const std::vector<BatchItem>& items) {
+    typedef std::vector<std::promise<Image>> Promises;
+
+    std::shared_ptr<Promises> promises(std::make_shared<Promises>(items.size()));
+    std::vector<std::future<Image>> futures;
+    futures.reserve(items.size());
+
+    for (std::promise<Image>& p : *promises) {
+      futures.push_back(p.get_future());
+    }
+
+    if (!items.empty()) {
+      impl_->Submit(std::make_shared<Batch>(items, [promises](BatchResult& r) {
+        if (r.error) {
+          (*promises)[r.index].set_exception(r.error);
+        }
+        else {
+          (*promises)[r.index].set_value(std::move(r.image));
+        }
+      }));
+    }
+
+    return futures;
+  }
+
+}
@@ -0,0 +1,103 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Internal to Image Loader: not part of the public interface.
+//
+// StatsRecorder fills in a DecodeStats as a load goes. Every member does nothing
+// (beyond a null check) when there is no DecodeStats, so loads that don't ask for
+// statistics don't pay for the clock reads.
+//
+// Nothing here has a destructor that matters: the loaders longjmp out of libpng &
+// libjpeg on errors, so scoped timers can't be relied on.
+
+#include <james/image-loader.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+namespace james {
+
+  class StatsRecorder {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit StatsRecorder(DecodeStats* stats = nullptr)
+      : stats_(stats), allocated_(0)
+    {
+    }
+
+    explicit operator bool() const noexcept { return stats_ != nullptr; }
+
+    Clock::time_point Now() const {
+      return stats_ ? Clock::now() : Clock::time_point();
+    }
+
+    // Adds the time since start to the given field & returns the current time, so
+    // that consecutive phases can be chained.
+    Clock::time_point Lap(double DecodeStats::* field, Clock::time_point start) {
+      if (!stats_) {
+        return start;
+      }
+
+      const Clock::time_point now = Clock::now();
+      stats_->*field += std::chrono::duration<double>(now - start).count();
+      return now;
+    }
+
+    // Records a call to a data source callback that started at start & read bytes.
+    void IO(Clock::time_point start, std::size_t bytes) {
+      if (stats_) {
+        Lap(&DecodeStats::ioSeconds, start);
+        stats_->bytesRead += bytes;
+        ++stats_->ioCallbacks;
+      }
+    }
+
+    void BytesRead(std::size_t bytes) {
+      if (stats_) {
+        stats_->bytesRead += bytes;
+      }
+    }
+
+    void Allocated(std::size_t bytes) {
+      if (stats_) {
+        allocated_ += bytes;
+        stats_->peakAllocatedBytes = std::max(stats_->peakAllocatedBytes, allocated_);
+      }
+    }
+
+    void Freed(std::size_t bytes) {
+      if (stats_) {
+        allocated_ -= std::min(bytes, allocated_);
+      }
+    }
+
+    void Output(const Image& img) {
+      if (stats_) {
+        stats_->outputBytes = ByteSize(img);
+      }
+    }
+
+  private:
+    DecodeStats* stats_;
+    std::size_t allocated_;
+  };
+
+}
@@ -0,0 +1,348 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace james {
+
+  namespace {
+
+    struct Entry {
+      std::string key;
+      ImageCache::Handle image;
+      std::size_t bytes;
+    };
+
+    // Each shard is a complete LRU cache with its own share of the budget. lru is
+    // ordered most recently used first; index finds an entry in it by key.
+    //
+    // loading holds the decodes in progress, so that a second request for the same
+    // key waits for the first rather than decoding again.
+    //
+    struct Shard {
+      Shard()
+        : bytes(0), hits(0), misses(0), waits(0), evictions(0)
+      {
+      }
+
+      std::mutex lock;
+      std::list<Entry> lru;
+      std::unordered_map<std::string, std::list<Entry>::iterator> index;
+      std::unordered_map<std::string, std::shared_future<ImageCache::Handle>> loading;
+
+      std::size_t bytes;
+      unsigned long long hits;
+      unsigned long long misses;
+      unsigned long long waits;
+      unsigned long long evictions;
+    };
+
+    void AppendBytes(std::string& key, std::uint64_t value) {
+      for (int i = 0; i < 8; ++i, value >>= 8) {
+        key.push_back((char)(value & 0xFF));
+      }
+    }
+
+    // Modification time in nanoseconds where the platform offers it
+    //
+    std::string FileKey(const char* path) {
+#ifdef _WIN32
+      struct _stat64 info;
+      if (_stat64(path, &info) != 0) {
+        throw std::system_error(errno, std::generic_category(), "Unable to read image file modification time");
+      }
+      const std::uint64_t mtime = (std::uint64_t) info.st_mtime * 1000000000u;
+#else
+      struct stat info;
+      if (stat(path, &info) != 0) {
+        throw std::system_error(errno, std::generic_category(), "Unable to read image file modification time");
+      }
+#  ifdef __APPLE__
+      const std::uint64_t mtime = (std::uint64_t) info.st_mtimespec.tv_sec * 1000000000u + info.st_mtimespec.tv_nsec;
+#  else
+      const std::uint64_t mtime = (std::uint64_t) info.st_mtim.tv_sec * 1000000000u + info.st_mtim.tv_nsec;
+#  endif
+#endif
+
+      // The prefix keeps file keys apart from content keys
+      std::string key("F");
+      AppendBytes(key, mtime);
+      AppendBytes(key, (std::uint64_t) info.st_size);
+      key.append(path);
+      return key;
+    }
+
+    // Thrown by GetFile's decode if the file changed while it was being loaded, so
+    // that what was read isn't cached under the key of what was there before
+    struct FileChanged : std::runtime_error {
+      FileChanged()
+        : std::runtime_error("The image file kept changing while it was being loaded.")
+      {
+      }
+    };
+
+  }
+
+  struct ImageCache::Impl {
+    explicit Impl(const ImageCacheOptions& options)
+      : load(options.load), nShards(options.shards ? options.shards : 1),
+        shardBytes(options.maxBytes / nShards), shards(new Shard[nShards])
+    {
+      load.metadata = nullptr;
+      load.stats = nullptr;
+    }
+
+    LoadOptions load;
+    const unsigned int nShards;
+    const std::size_t shardBytes;
+    std::unique_ptr<Shard[]> shards;
+
+    Shard& ShardFor(const std::string& key) {
+      return shards[std::hash<std::string>()(key) % nShards];
+    }
+
+    template <typename Decode>
+    Handle Get(const std::string& key, Decode decode);
+
+    void Insert(Shard& shard, const std::string& key, const Handle& image, std::list<Entry>& evicted);
+  };
+
+  template <typename Decode>
+  ImageCache::Handle ImageCache::Impl::Get(const std::string& key, Decode decode) {
+    Shard& shard = ShardFor(key);
+    std::promise<Handle> result;
+
+    {
+      std::unique_lock<std::mutex> guard(shard.lock);
+
+      auto i = shard.index.find(key);
+      if (i != shard.index.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+        ++shard.hits;
+        return i->second->image;
+      }
+
+      auto l = shard.loading.find(key);
+      if (l != shard.loading.end()) {
+        std::shared_future<Handle> pending = l->second;
+        ++shard.waits;
+        guard.unlock();
+        return pending.get();
+      }
+
+      shard.loading.emplace(key, result.get_future().share());
+      ++shard.misses;
+    }
+
+    // Decode without the lock so that the rest of the shard stays available
+
+    Handle image;
+
+    try {
+      image = std::make_shared<const Image>(decode());
+    }
+    catch (...) {
+      {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.loading.erase(key);
+      }
+      result.set_exception(std::current_exception());
+      throw;
+    }
+
+    // Evicted images are released after unlocking: freeing their pixels can be slow
+    std::list<Entry> evicted;
+
+    {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.loading.erase(key);
+
+      try {
+        Insert(shard, key, image, evicted);
+      }
+      catch (...) {
+        // Running out of memory for the bookkeeping just means it isn't cached
+      }
+    }
+
+    result.set_value(image);
+    return image;
+  }
+
+  void ImageCache::Impl::Insert(Shard& shard, const std::string& key, const Handle& image,
+    std::list<Entry>& evicted)
+  {
+    const std::size_t bytes = ByteSize(*image);
+
+    if (bytes > shardBytes || shard.index.count(key)) {
+      return;
+    }
+
+    while (shard.bytes + bytes > shardBytes) {
+      auto last = std::prev(shard.lru.end());
+      shard.index.erase(last->key);
+      shard.bytes -= last->bytes;
+      ++shard.evictions;
+      evicted.splice(evicted.end(), shard.lru, last);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.image = image;
+    entry.bytes = bytes;
+
+    shard.lru.push_front(std::move(entry));
+
+    try {
+      shard.index.emplace(key, shard.lru.begin());
+    }
+    catch (...) {
+      shard.lru.pop_front();
+      throw;
+    }
+
+    shard.bytes += bytes;
+  }
+
+  ImageCache::ImageCache()
+    : ImageCache(ImageCacheOptions())
+  {
+  }
+
+  ImageCache::ImageCache(const ImageCacheOptions& options)
+    : impl_(new Impl(options))
+  {
+  }
+
+  ImageCache::~ImageCache() {
+  }
+
+  ImageCache::Handle ImageCache::Get(const void* data, std::size_t size) {
+    std::string key("M");
+    AppendBytes(key, ContentHash(data, size));
+    AppendBytes(key, (std::uint64_t) size);
+
+    return impl_->Get(key, [&]() { return LoadImage(data, size, impl_->load); });
+  }
+
+  ImageCache::Handle ImageCache::GetFile(const char* path) {
+    // The key is checked again after loading: a file rewritten in between could
+    // otherwise be cached under its old key. A few rewrites in a row are retried.
+    for (int attempt = 1; ; ++attempt) {
+      const std::string key = FileKey(path);
+
+      try {
+        return impl_->Get(key, [&]() {
+          Image img = LoadImageFile(path, impl_->load);
+          if (FileKey(path) != key) {
+            throw FileChanged();
+          }
+          return img;
+        });
+      }
+      catch (const FileChanged&) {
+        if (attempt == 3) {
+          throw;
+        }
+      }
+    }
+  }
+
+  void ImageCache::Clear() {
+    for (unsigned int i = 0; i < impl_->nShards; ++i) {
+      Shard& shard = impl_->shards[i];
+      std::list<Entry> dropped;
+
+      {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        dropped.swap(shard.lru);
+        shard.index.clear();
+        shard.bytes = 0;
+      }
+    }
+  }
+
+  ImageCache::Stats ImageCache::GetStats() const {
+    Stats stats = Stats();
+
+    for (unsigned int i = 0; i < impl_->nShards; ++i) {
+      Shard& shard = impl_->shards[i];
+      std::lock_guard<std::mutex> guard(shard.lock);
+
+      stats.hits += shard.hits;
+      stats.misses += shard.misses;
+      stats.waits += shard.waits;
+      stats.evictions += shard.evictions;
+      stats.bytes += shard.bytes;
+      stats.images += shard.lru.size();
+    }
+
+    return stats;
+  }
+
+  // MurmurHash64A (Austin Appleby, public domain): eight bytes per step, so hashing
+  // is cheap next to decoding.
+  //
+  std::uint64_t ImageCache::ContentHash(const void* data, std::size_t size) noexcept {
+    const std::uint64_t m = 0xC6A4A7935BD1E995ull;
+    const int r = 47;
+
+    const unsigned char* p = (const unsigned char*) data;
+    const unsigned char* end = p + (size & ~(std::size_t) 7);
+    std::uint64_t h = 0x9E3779B97F4A7C15ull ^ ((std::uint64_t) size * m);
+
+    for (; p != end; p += 8) {
+      std::uint64_t k;
+      std::memcpy(&k, p, 8);
+
+      k *= m;
+      k ^= k >> r;
+      k *= m;
+
+      h ^= k;
+      h *= m;
+    }
+
+    // The remaining 0-7 bytes
+    if (size & 7) {
+      for (std::size_t i = 0; i < (size & 7); ++i) {
+        h ^= (std::uint64_t) p[i] << (8*i);
+      }
+      h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+  }
+
+}
@@ -0,0 +1,40 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+#include <cstring>
+
+namespace james {
+
+  ImageFormat DetectImageFormat(const void* data, std::size_t size) noexcept {
+    static const unsigned char pngSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const unsigned char jpegSignature[] = { 0xFF, 0xD8, 0xFF };
+
+    if (size >= sizeof(pngSignature) && std::memcmp(data, pngSignature, sizeof(pngSignature)) == 0) {
+      return ImageFormat::PNG;
+    }
+
+    if (size >= sizeof(jpegSignature) && std::memcmp(data, jpegSignature, sizeof(jpegSignature)) == 0) {
+      return ImageFormat::JPEG;
+    }
+
+    return ImageFormat::Unknown;
+  }
+
+}
@@ -0,0 +1,172 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace james {
+
+  namespace {
+
+    const unsigned int OrientationTag = 0x0112;
+    const unsigned int ShortType = 3;
+
+    unsigned int Read16(const unsigned char* p, bool littleEndian) {
+      return littleEndian ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+    }
+
+    std::size_t Read32(const unsigned char* p, bool littleEndian) {
+      return littleEndian ?
+        (std::size_t) p[0] | ((std::size_t) p[1] << 8) | ((std::size_t) p[2] << 16) | ((std::size_t) p[3] << 24) :
+        ((std::size_t) p[0] << 24) | ((std::size_t) p[1] << 16) | ((std::size_t) p[2] << 8) | (std::size_t) p[3];
+    }
+
+    // Mirrors each row left to right. N is the size of a pixel in bytes.
+    //
+    template<std::size_t N>
+    void MirrorRows(Image& img) {
+      for (unsigned int y = 0; y < img.Height(); ++y) {
+        unsigned char* left = img.Row(y);
+        unsigned char* right = left + (std::size_t) (img.Width() - 1)*N;
+
+        for (; left < right; left += N, right -= N) {
+          std::swap_ranges(left, left + N, right);
+        }
+      }
+    }
+
+    void FlipRows(Image& img) {
+      const std::size_t rowBytes = (std::size_t) img.Width()*(img.BitsPerPixel() >> 3);
+
+      for (unsigned int y = 0; y < img.Height() / 2; ++y) {
+        std::swap_ranges(img.Row(y), img.Row(y) + rowBytes, img.Row(img.Height() - 1 - y));
+      }
+    }
+
+    // Writes src, transposed & mirrored as orientation (5 to 8) requires, into dst,
+    // which must be src.Height() x src.Width(). Reads are sequential; the writes walk
+    // down dst's columns.
+    //
+    template<std::size_t N>
+    void Transpose(const Image& src, Image& dst, unsigned int orientation) {
+      const bool mirrorX = orientation == 6 || orientation == 7;
+      const bool mirrorY = orientation == 7 || orientation == 8;
+
+      for (unsigned int sy = 0; sy < src.Height(); ++sy) {
+        const unsigned char* s = src.Row(sy);
+        const unsigned int dx = mirrorX ? src.Height() - 1 - sy : sy;
+
+        for (unsigned int sx = 0; sx < src.Width(); ++sx, s += N) {
+          const unsigned int dy = mirrorY ? src.Width() - 1 - sx : sx;
+          std::memcpy(dst.Row(dy) + (std::size_t) dx*N, s, N);
+        }
+      }
+    }
+
+    template<std::size_t N>
+    void Orient(Image& img, unsigned int orientation) {
+      switch (orientation) {
+      case 2:
+        MirrorRows<N>(img);
+        break;
+
+      case 3:
+        FlipRows(img);
+        MirrorRows<N>(img);
+        break;
+
+      case 4:
+        FlipRows(img);
+        break;
+
+      default: {
+        Image rotated(img.Height(), img.Width(), img.BitsPerPixel(), img.RowAlignment(), img.Allocator());
+        Transpose<N>(img, rotated, orientation);
+        img = std::move(rotated);
+        break;
+      }
+      }
+    }
+
+  }
+
+  unsigned int ParseExifOrientation(const unsigned char* exif, std::size_t size) noexcept {
+    bool littleEndian;
+
+    if (size < 8) {
+      return 1;
+    }
+
+    if (exif[0] == 'I' && exif[1] == 'I') {
+      littleEndian = true;
+    }
+    else if (exif[0] == 'M' && exif[1] == 'M') {
+      littleEndian = false;
+    }
+    else {
+      return 1;
+    }
+
+    if (Read16(exif + 2, littleEndian) != 42) {
+      return 1;
+    }
+
+    const std::size_t ifd = Read32(exif + 4, littleEndian);
+
+    if (ifd > size - 2) {
+      return 1;
+    }
+
+    const unsigned int nEntries = Read16(exif + ifd, littleEndian);
+
+    // Each entry is 12 bytes: tag, type, count & a value (if it fits in 4 bytes)
+    for (std::size_t i = 0, entry = ifd + 2; i < nEntries && entry + 12 <= size; ++i, entry += 12) {
+      const unsigned char* p = exif + entry;
+
+      if (Read16(p, littleEndian) == OrientationTag) {
+        const unsigned int value = Read16(p + 8, littleEndian);
+
+        if (Read16(p + 2, littleEndian) != ShortType || Read32(p + 4, littleEndian) != 1) {
+          return 1;
+        }
+
+        return value >= 1 && value <= 8 ? value : 1;
+      }
+    }
+
+    return 1;
+  }
+
+  void ApplyOrientation(Image& img, unsigned int orientation) {
+    if (orientation < 2 || orientation > 8 || img.Width() == 0 || img.Height() == 0) {
+      return;
+    }
+
+    switch (img.BitsPerPixel()) {
+    case 8: Orient<1>(img, orientation); break;
+    case 16: Orient<2>(img, orientation); break;
+    case 24: Orient<3>(img, orientation); break;
+    case 32: Orient<4>(img, orientation); break;
+    case 48: Orient<6>(img, orientation); break;
+    case 64: Orient<8>(img, orientation); break;
+    }
+  }
+
+}
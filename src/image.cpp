@@ -18,45 +18,95 @@
 */
 #include <james/image-loader.hpp>
 #include <cstring>
+#include <cstdint>
 #include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
 namespace james {
 
+  namespace {
+
+    // Logic errors are handled as described in image.hpp: assertion failures in debug
+    // builds, std::invalid_argument in release.
+    //
+    void ValidateBitsPerPixel(unsigned int bpp) {
+      const bool valid = bpp == 8 || bpp == 24 || bpp == 32 || bpp == 16 || bpp == 48 || bpp == 64;
+
+#ifndef NDEBUG
+      assert(valid);
+#endif
+
+      if (!valid) {
+        throw std::invalid_argument("james::Image only supports 8, 16, 24, 32, 48 & 64bpp images.");
+      }
+    }
+
+    void ValidateRowAlignment(unsigned int align) {
+      const bool valid = align != 0 && align <= 4096 && (align & (align - 1)) == 0;
+
+#ifndef NDEBUG
+      assert(valid);
+#endif
+
+      if (!valid) {
+        throw std::invalid_argument("james::Image row alignment must be a power of two no greater than 4096.");
+      }
+    }
+
+  }
+
   Image::Image()
-    : w_(0), h_(0), bpp_(32), pixels_(nullptr)
+    : w_(0), h_(0), bpp_(32), align_(1), pixels_(nullptr), block_(nullptr)
   {
   }
 
   Image::Image(const Image& src)
-    : w_(src.w_), h_(src.h_), bpp_(src.bpp_), pixels_(new unsigned char[w_*h_*(src.bpp_>>3)])
+    : w_(src.w_), h_(src.h_), bpp_(src.bpp_), align_(src.align_), pixels_(nullptr), block_(nullptr),
+      allocator_(src.allocator_)
   {
-    std::memcpy(pixels_, src.pixels_, w_*h_*(src.bpp_>>3));
+    Allocate();
+    if (src.pixels_) {
+      std::memcpy(pixels_, src.pixels_, ByteSize(*this));
+    }
   }
 
   Image::Image(Image&& src) noexcept
-    : w_(src.w_), h_(src.h_), bpp_(src.bpp_), pixels_(src.pixels_)
+    : w_(src.w_), h_(src.h_), bpp_(src.bpp_), align_(src.align_), pixels_(src.pixels_), block_(src.block_),
+      allocator_(std::move(src.allocator_))
   {
     src.w_ = 0;
     src.h_ = 0;
     src.pixels_ = nullptr;
+    src.block_ = nullptr;
   }
 
   Image::Image(unsigned int w, unsigned int h, unsigned int bpp)
-    : w_(w), h_(h), bpp_(bpp), pixels_(new unsigned char[w*h*(bpp>>3)])
+    : w_(w), h_(h), bpp_(bpp), align_(1), pixels_(nullptr), block_(nullptr)
   {
-#ifndef NDEBUG
-    assert(bpp == 8 || bpp == 24 || bpp == 32);
-#endif
+    ValidateBitsPerPixel(bpp);
+    Allocate();
+  }
 
-    if (bpp != 8 && bpp != 24 && bpp != 32) {
-      throw std::invalid_argument("james::Image only supports 8, 24 & 32bpp images.");
-    }
+  Image::Image(unsigned int w, unsigned int h, unsigned int bpp, std::shared_ptr<PixelAllocator> allocator)
+    : w_(w), h_(h), bpp_(bpp), align_(1), pixels_(nullptr), block_(nullptr), allocator_(std::move(allocator))
+  {
+    ValidateBitsPerPixel(bpp);
+    Allocate();
+  }
+
+  Image::Image(unsigned int w, unsigned int h, unsigned int bpp, unsigned int rowAlignment,
+    std::shared_ptr<PixelAllocator> allocator)
+    : w_(w), h_(h), bpp_(bpp), align_(rowAlignment), pixels_(nullptr), block_(nullptr),
+      allocator_(std::move(allocator))
+  {
+    ValidateBitsPerPixel(bpp);
+    ValidateRowAlignment(rowAlignment);
+    Allocate();
   }
 
   Image::~Image() noexcept {
-    delete pixels_;
+    Deallocate();
   }
 
   Image& Image::operator= (const Image& src) {
@@ -75,7 +125,43 @@ namespace james {
     std::swap(w_, src.w_);
     std::swap(h_, src.h_);
     std::swap(bpp_, src.bpp_);
+    std::swap(align_, src.align_);
     std::swap(pixels_, src.pixels_);
+    std::swap(block_, src.block_);
+    std::swap(allocator_, src.allocator_);
+  }
+
+  // Allocate & Deallocate both rely on w_, h_, bpp_ & align_ being unchanged between
+  // the two calls; they are immutable once set so this always holds.
+  //
+  // new[] only promises alignment suitable for fundamental types so for larger row
+  // alignments we over-allocate & offset pixels_ into the block.
+
+  void Image::Allocate() {
+    if (allocator_) {
+      block_ = static_cast<unsigned char*>(allocator_->Allocate(ByteSize(*this)));
+      pixels_ = block_;
+    }
+    else {
+      const std::size_t slack = align_ > alignof(std::max_align_t) ? align_ - 1 : 0;
+      block_ = new unsigned char[ByteSize(*this) + slack];
+      pixels_ = reinterpret_cast<unsigned char*>(
+        (reinterpret_cast<std::uintptr_t>(block_) + slack) & ~(std::uintptr_t)(slack ? align_ - 1 : 0)
+      );
+    }
+  }
+
+  void Image::Deallocate() noexcept {
+    if (!block_) {
+      return;
+    }
+
+    if (allocator_) {
+      allocator_->Deallocate(block_, ByteSize(*this));
+    }
+    else {
+      delete[] block_;
+    }
   }
 
 }
\ No newline at end of file
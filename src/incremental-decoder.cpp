@@ -0,0 +1,78 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "incremental-decoder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace james {
+
+  namespace {
+
+    // Enough to recognise either signature (see DetectImageFormat)
+    //
+    const std::size_t SignatureSize = 8;
+
+  }
+
+  FormatDetectingDecoder::FormatDetectingDecoder(const LoadOptions& options, bool previews)
+    : options_(options), previews_(previews), format_(ImageFormat::Unknown)
+  {
+    options_.region = Region();
+    options_.metadata = nullptr;
+    options_.applyOrientation = false;
+    options_.stats = nullptr;
+  }
+
+  void FormatDetectingDecoder::Feed(const unsigned char* data, std::size_t size) {
+    if (!decoder_) {
+      const std::size_t n = std::min(size, SignatureSize - signature_.size());
+      signature_.insert(signature_.end(), data, data + n);
+
+      format_ = DetectImageFormat(signature_.data(), signature_.size());
+
+      if (format_ == ImageFormat::PNG) {
+        PNGLoadOptions options;
+        static_cast<LoadOptions&>(options) = options_;
+        decoder_ = CreateIncrementalPNGDecoder(options);
+      }
+      else if (format_ == ImageFormat::JPEG) {
+        JPEGLoadOptions options;
+        static_cast<LoadOptions&>(options) = options_;
+        decoder_ = CreateIncrementalJPEGDecoder(options, previews_);
+      }
+      else if (signature_.size() == SignatureSize) {
+        throw std::runtime_error("Unrecognised image format.");
+      }
+      else {
+        return;
+      }
+
+      decoder_->Feed(signature_.data(), signature_.size());
+      signature_ = std::vector<unsigned char>();
+
+      data += n;
+      size -= n;
+    }
+
+    decoder_->Feed(data, size);
+  }
+
+}
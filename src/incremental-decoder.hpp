@@ -0,0 +1,102 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Internal to Image Loader: not part of the public interface.
+//
+// The engine shared by ProgressiveDecoder & PushDecoder. The format specific
+// implementations live next to the blocking loaders (load-png.cpp & load-jpeg.cpp)
+// so that they share the same header handling & pixel format transforms.
+
+#include <james/image-loader.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace james {
+
+  // An IncrementalDecoder is given the encoded data a piece at a time & decodes as
+  // much of the image as that data allows, buffering whatever it can't use yet.
+  //
+  // The image is decoded in place into `image`, which is allocated as soon as the
+  // header has been read. While decoding is under way:
+  // - rows [0, rowsComplete) hold their final pixels.
+  // - for a progressive JPEG or an interlaced PNG, after `refinements` scans or
+  //   passes the whole of `image` holds a full size approximation of the final
+  //   image (an interlaced PNG's missing pixels are filled by repeating their
+  //   neighbours). Before the first, anything not yet final is unspecified.
+  //
+  // Errors are thrown from Feed, after which the decoder must be discarded.
+  //
+  class IncrementalDecoder {
+  public:
+    IncrementalDecoder()
+      : headerReady(false), done(false), rowsComplete(0), refinements(0)
+    {
+    }
+
+    virtual ~IncrementalDecoder() {}
+
+    IncrementalDecoder(const IncrementalDecoder&) = delete;
+    IncrementalDecoder& operator= (const IncrementalDecoder&) = delete;
+
+    // Consumes all size bytes. Does nothing once done.
+    virtual void Feed(const unsigned char* data, std::size_t size) = 0;
+
+    Image image;
+    bool headerReady;
+    bool done;
+    unsigned int rowsComplete;
+    unsigned int refinements;
+  };
+
+  // With previews false a progressive JPEG is decoded in one go once all of its
+  // data has arrived, rather than once per scan.
+  //
+  std::unique_ptr<IncrementalDecoder> CreateIncrementalJPEGDecoder(const JPEGLoadOptions& options, bool previews);
+  std::unique_ptr<IncrementalDecoder> CreateIncrementalPNGDecoder(const PNGLoadOptions& options);
+
+  // Holds on to the first few bytes until the format can be told from them, then
+  // creates the matching IncrementalDecoder & passes everything on to it. Data that
+  // is neither PNG nor JPEG is rejected with a std::runtime_error.
+  //
+  // options.region, options.metadata, options.applyOrientation & options.stats are
+  // ignored.
+  //
+  class FormatDetectingDecoder {
+  public:
+    FormatDetectingDecoder(const LoadOptions& options, bool previews);
+
+    void Feed(const unsigned char* data, std::size_t size);
+
+    ImageFormat Format() const noexcept { return format_; }
+
+    // null until the format is known
+    IncrementalDecoder* Decoder() const noexcept { return decoder_.get(); }
+
+  private:
+    LoadOptions options_;
+    bool previews_;
+    std::vector<unsigned char> signature_;
+    ImageFormat format_;
+    std::unique_ptr<IncrementalDecoder> decoder_;
+  };
+
+}
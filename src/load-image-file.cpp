@@ -0,0 +1,58 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "mapped-file.hpp"
+
+#include <stdexcept>
+
+namespace james {
+
+  Image LoadImageFile(const char* path) {
+    return LoadImageFile(path, LoadOptions());
+  }
+
+  Image LoadImageFile(const char* path, const LoadOptions& options) {
+    MappedFile file(path);
+    return LoadImage(file.Data(), file.Size(), options);
+  }
+
+  Image LoadImage(const void* data, std::size_t size) {
+    return LoadImage(data, size, LoadOptions());
+  }
+
+  Image LoadImage(const void* data, std::size_t size, const LoadOptions& options) {
+    switch (DetectImageFormat(data, size)) {
+    case ImageFormat::PNG: {
+      PNGLoadOptions pngOptions;
+      static_cast<LoadOptions&>(pngOptions) = options;
+      return LoadPNG(data, size, pngOptions);
+    }
+
+    case ImageFormat::JPEG: {
+      JPEGLoadOptions jpegOptions;
+      static_cast<LoadOptions&>(jpegOptions) = options;
+      return LoadJPEG(data, size, jpegOptions);
+    }
+
+    default:
+      throw std::runtime_error("Unrecognised image format (expected PNG or JPEG).");
+    }
+  }
+
+}
@@ -17,8 +17,19 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include <james/image-loader.hpp>
+#include "incremental-decoder.hpp"
+#include "decode-stats-impl.hpp"
+#include "pixel-convert.hpp"
 
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <assert.h>
@@ -33,19 +44,102 @@ namespace james {
 
   namespace {
 
+    // Logic errors in the options are handled in the same way as james::Image handles
+    // them: assertion failures in debug builds, std::invalid_argument in release.
+    //
+    void ValidateOptions(const JPEGLoadOptions& options) {
+#ifndef NDEBUG
+      assert(options.inputBufferSize > 0);
+#endif
+
+      if (options.inputBufferSize == 0) {
+        throw std::invalid_argument("JPEGLoadOptions::inputBufferSize must be non-zero.");
+      }
+
+      const unsigned int d = options.scaleDenominator;
+
+#ifndef NDEBUG
+      assert(d == 1 || d == 2 || d == 4 || d == 8);
+#endif
+
+      if (d != 1 && d != 2 && d != 4 && d != 8) {
+        throw std::invalid_argument("JPEGLoadOptions::scaleDenominator must be 1, 2, 4 or 8.");
+      }
+    }
+
+    // Chooses the scale denominator to decode with: the largest of options.scaleDenominator
+    // & the largest denominator that still keeps the image at least maxDimension pixels
+    // along its longer side.
+    //
+    unsigned int ScaleDenominator(const JPEGLoadOptions& options, JDIMENSION w, JDIMENSION h) {
+      unsigned int d = options.scaleDenominator;
+
+      if (options.maxDimension > 0) {
+        const JDIMENSION longest = std::max(w, h);
+
+        for (unsigned int candidate = 8; candidate > d; candidate >>= 1) {
+          // libjpeg rounds scaled dimensions up
+          if ((longest + candidate - 1) / candidate >= options.maxDimension) {
+            d = candidate;
+            break;
+          }
+        }
+      }
+
+      return d;
+    }
+
+    // JPEGDecompressionAdapter bundles up everything a decompression needs so that it
+    // is reachable from libjpeg's callbacks (which only get the jpeg_decompress_struct).
+    //
+    // Data comes either from a std::istream (stream is non-null), directly from a
+    // block of memory owned by the caller (data & dataSize) or, for incremental
+    // decoding, is pushed into buffer a piece at a time (suspend is set).
+    //
+    // A JPEGDecoder's adapter is constructed without a source & used for one decode
+    // after another: see Bind & Unbind.
+    //
     struct JPEGDecompressionAdapter {
       jpeg_decompress_struct base;
       jpeg_error_mgr err;
       jpeg_source_mgr src;
 
       jmp_buf errHandler;
-      std::istream& stream;
+      bool created;
+      std::istream* stream;
       std::ios::iostate streamExceptionState;
       std::vector<JOCTET> buffer;
+      const JOCTET* data;
+      std::size_t dataSize;
+      bool suspend;
+      std::size_t skipBytes;
       std::exception_ptr currentError;
 
-      JPEGDecompressionAdapter(std::istream& src)
-        : base(), stream(src), streamExceptionState(stream.exceptions()), buffer(1024)
+      // Why we longjmp'd back & (for errors we raise ourselves, see Fail) the message to
+      // throw. Errors before the header has been read are reported as BadHeader.
+      DecodeError error;
+      const char* message;
+      bool headerRead;
+
+      // Set when libjpeg can't produce the requested PixelFormat itself: rows are then
+      // decoded into scratch & converted from there. (See SetColorSpace.)
+      PixelFormat convertTo;
+      std::vector<unsigned char> scratch;
+
+      // Rows decoded for DecompressRegion. Buffers live here rather than on the stack
+      // so that a longjmp out of libjpeg can't leak them.
+      std::vector<unsigned char> band;
+
+      // The EXIF orientation, if ReadHeader was asked to collect metadata
+      unsigned int orientation;
+
+      // Set by TryDecompress when the options ask for DecodeStats
+      StatsRecorder stats;
+
+      JPEGDecompressionAdapter(std::istream& src, const JPEGLoadOptions& options)
+        : base(), created(false), stream(&src), streamExceptionState(src.exceptions()), buffer(options.inputBufferSize),
+          data(nullptr), dataSize(0), suspend(false), skipBytes(0), error(DecodeError::None), message(nullptr),
+          headerRead(false), convertTo(PixelFormat::Auto), orientation(1)
       {
         // Note 1: we *must not* call jpeg_create_decompress here. See loadJPEG for why
 
@@ -53,7 +147,70 @@ namespace james {
         //       although JPEGDecompressionAdapter does directly own a resource (jpeg_decompress_struct)
         //       this is not initialised until later (see note 1) so no specific cleanup is
         //       needed in the exceptional case.
-        stream.exceptions(std::istream::failbit | std::istream::badbit | std::istream::eofbit);
+        stream->exceptions(std::istream::failbit | std::istream::badbit | std::istream::eofbit);
+      }
+
+      JPEGDecompressionAdapter(const void* src, std::size_t srcSize)
+        : base(), created(false), stream(nullptr), streamExceptionState(), data((const JOCTET*) src), dataSize(srcSize),
+          suspend(false), skipBytes(0), error(DecodeError::None), message(nullptr), headerRead(false),
+          convertTo(PixelFormat::Auto), orientation(1)
+      {
+      }
+
+      JPEGDecompressionAdapter()
+        : base(), created(false), stream(nullptr), streamExceptionState(), data(nullptr), dataSize(0),
+          suspend(true), skipBytes(0), error(DecodeError::None), message(nullptr), headerRead(false),
+          convertTo(PixelFormat::Auto), orientation(1)
+      {
+      }
+
+      // For reuse: there is no source until Bind is called
+      explicit JPEGDecompressionAdapter(const JPEGLoadOptions& options)
+        : base(), created(false), stream(nullptr), streamExceptionState(), buffer(options.inputBufferSize),
+          data(nullptr), dataSize(0), suspend(false), skipBytes(0), error(DecodeError::None), message(nullptr),
+          headerRead(false), convertTo(PixelFormat::Auto), orientation(1)
+      {
+      }
+
+      // Points a reusable adapter at its next source. The decompressor itself (if
+      // it has been created) & the buffers are kept.
+      void Bind(std::istream& src) {
+        Bind(nullptr, 0);
+        streamExceptionState = src.exceptions();
+        src.exceptions(std::istream::failbit | std::istream::badbit | std::istream::eofbit);
+        stream = &src;
+      }
+
+      void Bind(const void* src, std::size_t srcSize) {
+        data = (const JOCTET*) src;
+        dataSize = srcSize;
+        currentError = nullptr;
+        error = DecodeError::None;
+        message = nullptr;
+        headerRead = false;
+        convertTo = PixelFormat::Auto;
+        orientation = 1;
+        stats = StatsRecorder();
+      }
+
+      // Ends a decode, successful or not. jpeg_abort_decompress returns libjpeg to
+      // its idle state, releasing the memory it allocated for the image but keeping
+      // what it allocated when the decompressor was created.
+      void Unbind() noexcept {
+        if (created) {
+          jpeg_abort_decompress(&base);
+        }
+
+        if (stream) {
+          // Restoring the exception mask can only throw if it makes the stream's
+          // current state throw, which the caller has asked for
+          try {
+            stream->exceptions(streamExceptionState);
+          }
+          catch (...) {
+          }
+          stream = nullptr;
+        }
       }
 
       ~JPEGDecompressionAdapter() {
@@ -68,10 +225,36 @@ namespace james {
         //       destructor (so any clean-up will definitely happen) & then propagate
         //       the exception.
         //
-        stream.exceptions(streamExceptionState);
+        if (stream) {
+          stream->exceptions(streamExceptionState);
+        }
       }
     };
 
+    // Maps a libjpeg error code to a DecodeError
+    //
+    DecodeError ClassifyError(int code, bool headerRead) {
+      switch (code) {
+      case JERR_INPUT_EOF:
+        return DecodeError::Truncated;
+
+      case JERR_OUT_OF_MEMORY:
+        return DecodeError::OutOfMemory;
+
+      case JERR_FILE_READ:
+        return DecodeError::IO;
+
+      case JERR_ARITH_NOTIMPL:
+      case JERR_BAD_PRECISION:
+      case JERR_CONVERSION_NOTIMPL:
+      case JERR_NOT_COMPILED:
+        return DecodeError::UnsupportedFormat;
+
+      default:
+        return headerRead ? DecodeError::Corrupt : DecodeError::BadHeader;
+      }
+    }
+
     // Install a custom error hander that returns to our main control code so that
     // correct clean-up and propagation of the error can occur.
     //
@@ -80,8 +263,26 @@ namespace james {
       
       jpeg.err.error_exit = [](j_common_ptr cptr) {
         JPEGDecompressionAdapter* jpeg = reinterpret_cast<JPEGDecompressionAdapter*>(cptr);
+
+        if (jpeg->error == DecodeError::None) {
+          jpeg->error = ClassifyError(jpeg->err.msg_code, jpeg->headerRead);
+        }
+
         longjmp(jpeg->errHandler, 1);
       };
+
+      // Warnings (e.g. about corrupt data that libjpeg can recover from) would
+      // otherwise be printed to stderr
+      jpeg.err.output_message = [](j_common_ptr) {};
+    }
+
+    // Reports an error that we have detected ourselves in the same way as libjpeg's
+    // own errors: by longjmp to errHandler. Same setjmp requirements as libjpeg calls.
+    //
+    [[noreturn]] void Fail(JPEGDecompressionAdapter& jpeg, DecodeError error, const char* message) {
+      jpeg.error = error;
+      jpeg.message = message;
+      longjmp(jpeg.errHandler, 1);
     }
 
     // Configures a custom data source based on a std::istream to feed the JPEG
@@ -115,15 +316,14 @@ namespace james {
 
       jpeg.src.fill_input_buffer = [](j_decompress_ptr dptr) -> boolean {
         JPEGDecompressionAdapter* jpeg = (JPEGDecompressionAdapter*) dptr;
+        const StatsRecorder::Clock::time_point start = jpeg->stats.Now();
 
         try {
-          // FIXME: we're probably not doing the right thing with EOF here
-          //        Docs suggest that an unexpected EOF should trigger
-          //        writing EOF markers to the buffer repeatedly until
-          //        the decoder gives up and stops to allow partial decoding
-          //        of broken streams. We don't.
+          // A stream that ends early is an error rather than being padded out with
+          // fake EOI markers: LoadJPEG returns complete images or nothing. Partial
+          // decoding of data that is still arriving is what ProgressiveDecoder is for.
 
-          jpeg->src.bytes_in_buffer = (std::size_t) jpeg->stream.rdbuf()->sgetn(
+          jpeg->src.bytes_in_buffer = (std::size_t) jpeg->stream->rdbuf()->sgetn(
             (char*)&jpeg->buffer[0], jpeg->buffer.size());
           jpeg->src.next_input_byte = &jpeg->buffer[0];
         }
@@ -131,6 +331,14 @@ namespace james {
           jpeg->currentError = std::current_exception();
           ERREXIT(dptr, JERR_FILE_READ);
         }
+
+        jpeg->stats.IO(start, jpeg->src.bytes_in_buffer);
+
+        // Returning TRUE with an empty buffer would let libjpeg read past the end of it
+        if (jpeg->src.bytes_in_buffer == 0) {
+          ERREXIT(dptr, JERR_INPUT_EOF);
+        }
+
         return TRUE;
       };
 
@@ -155,7 +363,9 @@ namespace james {
             // - Advance the stream (remembering to subtract the bytes left in
             //   the buffer - we've already read them so don't skip twice!)
             // - Mark the buffer as empty to trigger a fill_input_buffer call
-            jpeg->stream.seekg(l - jpeg->src.bytes_in_buffer, std::ios::cur);
+            const StatsRecorder::Clock::time_point start = jpeg->stats.Now();
+            jpeg->stream->seekg(l - jpeg->src.bytes_in_buffer, std::ios::cur);
+            jpeg->stats.IO(start, 0);
             jpeg->src.bytes_in_buffer = 0;
           }
         }
@@ -166,67 +376,1447 @@ namespace james {
       };
 
     }
-  }
 
-  Image LoadJPEG(std::istream& src) {
+    // Configures a data source that reads directly from the caller's memory. libjpeg
+    // is given the whole block up front so there is nothing to fill or refill: the
+    // callbacks only run if the data turns out to be truncated.
+    //
+    void InstallMemoryAdapter(JPEGDecompressionAdapter& jpeg) {
+      jpeg.base.src = &jpeg.src;
+
+      jpeg.src.next_input_byte = jpeg.data;
+      jpeg.src.bytes_in_buffer = jpeg.dataSize;
+
+      jpeg.src.init_source = [](j_decompress_ptr) {};
+      jpeg.src.term_source = [](j_decompress_ptr) {};
+      jpeg.src.resync_to_restart = jpeg_resync_to_restart;
+
+      jpeg.src.fill_input_buffer = [](j_decompress_ptr dptr) -> boolean {
+        ERREXIT(dptr, JERR_INPUT_EOF);
+        return FALSE;
+      };
+
+      jpeg.src.skip_input_data = [](j_decompress_ptr dptr, long l) {
+        if (l <= 0) {
+          return;
+        }
+
+        // Skipping past the end leaves the buffer empty; the next read will then
+        // report the truncation through fill_input_buffer.
+        const std::size_t skip = std::min((std::size_t) l, dptr->src->bytes_in_buffer);
+        dptr->src->next_input_byte += skip;
+        dptr->src->bytes_in_buffer -= skip;
+      };
+    }
+
+    // Configures a data source for incremental decoding. Data is appended to
+    // jpeg.buffer by FeedSuspendingAdapter; when libjpeg runs out, fill_input_buffer
+    // returns FALSE & the libjpeg call in progress returns early (JPEG_SUSPENDED)
+    // having backed up to a point it can restart from once there is more.
+    //
+    void InstallSuspendingAdapter(JPEGDecompressionAdapter& jpeg) {
+      jpeg.base.src = &jpeg.src;
+
+      jpeg.src.next_input_byte = nullptr;
+      jpeg.src.bytes_in_buffer = 0;
+
+      jpeg.src.init_source = [](j_decompress_ptr) {};
+      jpeg.src.term_source = [](j_decompress_ptr) {};
+      jpeg.src.resync_to_restart = jpeg_resync_to_restart;
+
+      jpeg.src.fill_input_buffer = [](j_decompress_ptr) -> boolean {
+        return FALSE;
+      };
 
-    // Sequence of actions is important here:
-    // (1) Call setjmp; must be first because error handler setup
-    //     depends on having a valid jmpbuf
-    // (2) Install error handling code; must be next because *ANY* calls
-    //     into libjpeg can potentially cause errors, including jpeg_create_decompress
-    // (3) Create the decompressor (jpeg_create_decompress)
-    // (4) Install the std::istream adapter code (requires a valid decompressor)
-    // (5) Read the JPEG header etc. (requires a valid data stream & decompressor)
-    // (6) Create the james::Image (can only happen after decompression has started
-    //     so that we know the dimensions)
-    // (7) Finally we be do the decompression & clean up
-    //
-    // Throwing exceptions within the body of LoadJPEG is fine because this will
-    // just trigger the destructor of JPEGDecompressionAdapter which will call
-    // jpeg_destroy_decompress and reset the stream.
-
-    JPEGDecompressionAdapter jpeg(src);
-    Image img;
-
-    if (setjmp(jpeg.errHandler)) {
+      // Skips can run past the data we have; the rest is dropped from the front of
+      // the next piece of data to arrive.
+      jpeg.src.skip_input_data = [](j_decompress_ptr dptr, long l) {
+        JPEGDecompressionAdapter* jpeg = (JPEGDecompressionAdapter*)dptr;
+
+        if (l <= 0) {
+          return;
+        }
+
+        const std::size_t skip = std::min((std::size_t) l, jpeg->src.bytes_in_buffer);
+        jpeg->src.next_input_byte += skip;
+        jpeg->src.bytes_in_buffer -= skip;
+        jpeg->skipBytes += (std::size_t) l - skip;
+      };
+    }
+
+    // Adds size bytes to the data available to a suspending source. Anything libjpeg
+    // has already consumed is discarded first; anything it has yet to consume must
+    // be kept, since after a suspension it will re-read from there.
+    //
+    void FeedSuspendingAdapter(JPEGDecompressionAdapter& jpeg, const unsigned char* data, std::size_t size) {
+      const std::size_t consumed = jpeg.buffer.size() - jpeg.src.bytes_in_buffer;
+      jpeg.buffer.erase(jpeg.buffer.begin(), jpeg.buffer.begin() + consumed);
+
+      const std::size_t skip = std::min(jpeg.skipBytes, size);
+      jpeg.skipBytes -= skip;
+      jpeg.buffer.insert(jpeg.buffer.end(), data + skip, data + size);
+
+      jpeg.src.next_input_byte = jpeg.buffer.data();
+      jpeg.src.bytes_in_buffer = jpeg.buffer.size();
+    }
+
+    // Throws the error that caused libjpeg to longjmp back to us. Only makes sense
+    // when called from the setjmp error branch.
+    //
+    [[noreturn]] void ThrowCurrentError(JPEGDecompressionAdapter& jpeg) {
       if (jpeg.currentError) {
         std::rethrow_exception(jpeg.currentError);
       }
       else {
-        throw std::runtime_error("Error decompressing JPEG stream.");
+        throw std::runtime_error(jpeg.message ? jpeg.message : "Error decompressing JPEG stream.");
+      }
+    }
+
+    // Steps (2) to (4) of LoadJPEG (see below): leaves the decompressor ready for
+    // jpeg_read_header.
+    //
+    // libjpeg errors are reported by longjmp so the caller *must* have called setjmp
+    // on jpeg.errHandler before calling this.
+    //
+    // A reused decompressor (see JPEGDecoder) is only created once; each decode
+    // just installs its data source.
+    //
+    void CreateDecompress(JPEGDecompressionAdapter& jpeg) {
+      if (!jpeg.created) {
+        InstallErrorHandlers(jpeg);
+
+        jpeg_create_decompress(&jpeg.base);
+        jpeg.created = true;
+      }
+
+      if (jpeg.stream) {
+        InstallIOAdapter(jpeg);
+      }
+      else if (jpeg.suspend) {
+        InstallSuspendingAdapter(jpeg);
+      }
+      else {
+        InstallMemoryAdapter(jpeg);
+      }
+    }
+
+    // The most rows we ask jpeg_read_scanlines for at once (see ReadScanlines)
+    const int MaxRowsPerRead = 16;
+
+    // Asks libjpeg for output in the requested format. libjpeg-turbo's extended colour
+    // spaces cover everything except premultiplication, which is a no-op anyway since
+    // JPEGs are opaque. Without them (or for a grayscale image expanded to RGB, which
+    // older libjpegs can't do) libjpeg's default RGB or gray output is converted a
+    // batch of rows at a time by ReadScanlines.
+    //
+    void SetColorSpace(JPEGDecompressionAdapter& jpeg, PixelFormat format) {
+      jpeg.convertTo = PixelFormat::Auto;
+
+      switch (format) {
+      case PixelFormat::Auto:
+        return;
+
+      case PixelFormat::Gray8:
+        jpeg.base.out_color_space = JCS_GRAYSCALE;
+        return;
+
+#ifdef JCS_EXTENSIONS
+      case PixelFormat::RGB:
+        jpeg.base.out_color_space = JCS_EXT_RGB;
+        return;
+
+      case PixelFormat::BGR:
+        jpeg.base.out_color_space = JCS_EXT_BGR;
+        return;
+
+      case PixelFormat::RGBX:
+        jpeg.base.out_color_space = JCS_EXT_RGBX;
+        return;
+
+#ifdef JCS_ALPHA_EXTENSIONS
+      case PixelFormat::RGBA:
+      case PixelFormat::PremultipliedRGBA:
+        jpeg.base.out_color_space = JCS_EXT_RGBA;
+        return;
+
+      case PixelFormat::BGRA:
+        jpeg.base.out_color_space = JCS_EXT_BGRA;
+        return;
+#else
+      // The X in RGBX is 0xFF, i.e. an opaque alpha
+      case PixelFormat::RGBA:
+      case PixelFormat::PremultipliedRGBA:
+        jpeg.base.out_color_space = JCS_EXT_RGBX;
+        return;
+
+      case PixelFormat::BGRA:
+        jpeg.base.out_color_space = JCS_EXT_BGRX;
+        return;
+#endif
+#endif
+
+      default:
+        if (format == PixelFormat::RGB && jpeg.base.jpeg_color_space != JCS_GRAYSCALE) {
+          jpeg.base.out_color_space = JCS_RGB;
+        }
+        else {
+          jpeg.convertTo = format;
+        }
+        return;
       }
     }
 
-    InstallErrorHandlers(jpeg);
+    // Bytes per pixel of the rows ReadScanlines produces
+    //
+    unsigned int OutputBytesPerPixel(const JPEGDecompressionAdapter& jpeg) {
+      return jpeg.convertTo == PixelFormat::Auto ? jpeg.base.output_components : BytesPerPixel(jpeg.convertTo);
+    }
 
-    jpeg_create_decompress(&jpeg.base);
+    // Decompression parameters can only be set between reading the header & starting
+    // decompression. Scaling happens in the IDCT so a reduced size decode is
+    // genuinely cheaper, not a resize after the fact.
+    //
+    void SetDecompressParameters(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options) {
+      jpeg.base.scale_num = 1;
+      jpeg.base.scale_denom = ScaleDenominator(options, jpeg.base.image_width, jpeg.base.image_height);
+      jpeg.base.dct_method = options.fastDCT ? JDCT_IFAST : JDCT_ISLOW;
+      jpeg.base.do_fancy_upsampling = options.fancyUpsampling ? TRUE : FALSE;
+      SetColorSpace(jpeg, options.pixelFormat);
+    }
 
-    InstallIOAdapter(jpeg);
+    // Checks the output that jpeg_start_decompress has settled on is something we can
+    // handle & sets up for ReadScanlines.
+    //
+    void CheckOutput(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options) {
+      if (jpeg.base.num_components != 1 && jpeg.base.num_components != 3) {
+        Fail(jpeg, DecodeError::UnsupportedFormat, "Unsupported JPEG image type.");
+      }
 
-    jpeg_read_header(&jpeg.base, true);
-    jpeg_start_decompress(&jpeg.base);
+      if (options.pixelFormat != PixelFormat::Auto &&
+        OutputBytesPerPixel(jpeg) != BytesPerPixel(options.pixelFormat))
+      {
+        Fail(jpeg, DecodeError::UnsupportedFormat, "Unexpected JPEG output size for the requested pixel format.");
+      }
 
-    if (jpeg.base.num_components != 1 && jpeg.base.num_components != 3) {
-      throw std::runtime_error("Unsupported JPEG image type.");
+      if (jpeg.convertTo != PixelFormat::Auto) {
+        jpeg.scratch.resize((std::size_t) MaxRowsPerRead*jpeg.base.output_width*jpeg.base.output_components);
+        jpeg.stats.Allocated(jpeg.scratch.size());
+      }
     }
 
-    img = Image(jpeg.base.image_width, jpeg.base.image_height, jpeg.base.num_components << 3);
+    // The APPn markers that may hold metadata & the signatures identifying them
+    //
+    const int ExifMarker = JPEG_APP0 + 1;
+    const int ICCMarker = JPEG_APP0 + 2;
+    const char ExifSignature[] = "Exif\0";          // "Exif\0\0"
+    const char ICCSignature[] = "ICC_PROFILE";      // "ICC_PROFILE\0"
 
-    JSAMPROW rowPtr[1];
-    rowPtr[0] = img.Pixels();
+    // An ICC profile too big for one marker is split across several, each starting
+    // with the signature, its sequence number (from 1) & the number of markers.
+    //
+    const std::size_t ICCHeaderSize = sizeof(ICCSignature) + 2;
 
-    while (jpeg.base.output_scanline < jpeg.base.output_height) {
-      jpeg_read_scanlines(&jpeg.base, rowPtr, 1);
-      rowPtr[0] += jpeg.base.image_width*jpeg.base.num_components;
+    bool StartsWith(jpeg_saved_marker_ptr m, const char* signature, std::size_t signatureSize) {
+      return m->data_length >= signatureSize && std::memcmp(m->data, signature, signatureSize) == 0;
     }
 
-    jpeg_finish_decompress(&jpeg.base);
+    // Reassembles the ICC profile from the saved APP2 markers. Returns false (leaving
+    // profile empty) if there is none, it is incomplete or it is larger than maxSize.
+    //
+    bool ReadICCProfile(const jpeg_decompress_struct& base, std::size_t maxSize, std::vector<unsigned char>& profile) {
+      jpeg_saved_marker_ptr parts[256] = {};
+      unsigned int nParts = 0;
+      std::size_t size = 0;
 
-    // Remember: DON'T call jpeg_destroy_decompress; the destructor of
-    // JPEGDecompressionAdapter will do that for us.
+      for (jpeg_saved_marker_ptr m = base.marker_list; m; m = m->next) {
+        if (m->marker != ICCMarker || !StartsWith(m, ICCSignature, sizeof(ICCSignature)) ||
+          m->data_length < ICCHeaderSize)
+        {
+          continue;
+        }
 
-    return img;
-  }
+        const unsigned int seq = m->data[sizeof(ICCSignature)];
+        const unsigned int count = m->data[sizeof(ICCSignature) + 1];
+
+        if (seq == 0 || seq > count || (nParts && count != nParts) || parts[seq - 1]) {
+          return false;
+        }
+
+        nParts = count;
+        parts[seq - 1] = m;
+        size += m->data_length - ICCHeaderSize;
+      }
+
+      if (nParts == 0 || size > maxSize) {
+        return false;
+      }
+
+      profile.reserve(size);
+      for (unsigned int i = 0; i < nParts; ++i) {
+        if (!parts[i]) {
+          profile.clear();
+          return false;
+        }
+        profile.insert(profile.end(), parts[i]->data + ICCHeaderSize, parts[i]->data + parts[i]->data_length);
+      }
+      return true;
+    }
+
+    // Copies the metadata out of the markers saved while reading the header (see
+    // ReadHeader): into options.metadata, if set, & jpeg.orientation.
+    //
+    void ReadMetadata(JPEGDecompressionAdapter& jpeg, const LoadOptions& options) {
+      for (jpeg_saved_marker_ptr m = jpeg.base.marker_list; m; m = m->next) {
+        if (m->marker == ExifMarker && StartsWith(m, ExifSignature, sizeof(ExifSignature))) {
+          const unsigned char* exif = m->data + sizeof(ExifSignature);
+          const std::size_t exifSize = m->data_length - sizeof(ExifSignature);
+
+          jpeg.orientation = ParseExifOrientation(exif, exifSize);
+
+          if (options.metadata) {
+            options.metadata->orientation = jpeg.orientation;
+
+            if (exifSize <= options.maxMetadataSize) {
+              options.metadata->exif.assign(exif, exif + exifSize);
+            }
+          }
+          break;
+        }
+      }
+
+      if (options.metadata) {
+        ReadICCProfile(jpeg.base, options.maxMetadataSize, options.metadata->iccProfile);
+      }
+    }
+
+    // Reads the header & sets the decompression parameters. If collectMetadata is set
+    // & options ask for metadata, the APP1 & APP2 markers are kept while the header is
+    // read & passed to ReadMetadata.
+    //
+    // Returns when the header was finished with, for DecodeStats. Same setjmp
+    // requirements as CreateDecompress.
+    //
+    StatsRecorder::Clock::time_point ReadHeader(JPEGDecompressionAdapter& jpeg,
+      const JPEGLoadOptions& options, bool collectMetadata = false)
+    {
+      const bool metadata = collectMetadata && (options.metadata || options.applyOrientation);
+      const StatsRecorder::Clock::time_point start = jpeg.stats.Now();
+
+      CreateDecompress(jpeg);
+
+      // Set either way: a reused decompressor keeps the setting from its last decode
+      jpeg_save_markers(&jpeg.base, ExifMarker, metadata ? 0xFFFF : 0);
+      jpeg_save_markers(&jpeg.base, ICCMarker, metadata ? 0xFFFF : 0);
+
+      jpeg_read_header(&jpeg.base, true);
+      jpeg.headerRead = true;
+
+      if (metadata) {
+        ReadMetadata(jpeg, options);
+      }
+
+      SetDecompressParameters(jpeg, options);
+      return jpeg.stats.Lap(&DecodeStats::headerSeconds, start);
+    }
+
+    // Steps (2) to (5) of LoadJPEG (see below): reads the header (see ReadHeader) &
+    // leaves the decompressor ready for jpeg_read_scanlines. Same setjmp requirements
+    // as CreateDecompress.
+    //
+    // Returns when the header was finished with: jpeg_start_decompress can do a lot of
+    // the work (all of it, for a progressive JPEG).
+    //
+    StatsRecorder::Clock::time_point StartDecompress(JPEGDecompressionAdapter& jpeg,
+      const JPEGLoadOptions& options, bool collectMetadata = false)
+    {
+      const StatsRecorder::Clock::time_point headerEnd = ReadHeader(jpeg, options, collectMetadata);
+
+      jpeg_start_decompress(&jpeg.base);
+      CheckOutput(jpeg, options);
+
+      return headerEnd;
+    }
+
+    // Decodes up to maxRows scanlines into rows stride bytes apart starting at dst. Rows are
+    // requested in batches of rec_outbuf_height, which lets libjpeg output a whole row
+    // group per call rather than buffering it internally & handing it out a row at a
+    // time. (libjpeg never recommends more than 4: rec_outbuf_height is at most
+    // max_v_samp_factor.)
+    //
+    // Returns the number of rows decoded, which is only less than maxRows at the end of
+    // the image or if a suspending source runs out of data. Same setjmp requirements
+    // as StartDecompress.
+    //
+    JDIMENSION ReadScanlines(JPEGDecompressionAdapter& jpeg, unsigned char* dst, std::size_t stride,
+      JDIMENSION maxRows)
+    {
+      const JDIMENSION batchSize = std::max(1, std::min(jpeg.base.rec_outbuf_height, MaxRowsPerRead));
+      const JDIMENSION firstRow = jpeg.base.output_scanline;
+      const JDIMENSION lastRow = std::min(jpeg.base.output_height, firstRow + maxRows);
+
+      const bool convert = jpeg.convertTo != PixelFormat::Auto;
+      const std::size_t scratchStride = (std::size_t) jpeg.base.output_width*jpeg.base.output_components;
+
+      JSAMPROW rowPtrs[MaxRowsPerRead];
+
+      while (jpeg.base.output_scanline < lastRow) {
+        const JDIMENSION nRows = std::min(batchSize, lastRow - jpeg.base.output_scanline);
+        unsigned char* rowPtr = dst + (jpeg.base.output_scanline - firstRow)*stride;
+
+        for (JDIMENSION i = 0; i < nRows; ++i) {
+          rowPtrs[i] = convert ? &jpeg.scratch[i*scratchStride] : rowPtr + i*stride;
+        }
+
+        const JDIMENSION nRead = jpeg_read_scanlines(&jpeg.base, rowPtrs, nRows);
+
+        if (convert) {
+          const StatsRecorder::Clock::time_point start = jpeg.stats.Now();
+
+          for (JDIMENSION i = 0; i < nRead; ++i) {
+            ConvertRow(rowPtrs[i], jpeg.base.output_components, rowPtr + i*stride,
+              jpeg.convertTo, jpeg.base.output_width);
+          }
+
+          jpeg.stats.Lap(&DecodeStats::postProcessSeconds, start);
+        }
+
+        if (nRead == 0) {
+          break;
+        }
+      }
+
+      return jpeg.base.output_scanline - firstRow;
+    }
+
+    // JPEGReader implements the ImageReader interface directly on top of
+    // jpeg_read_scanlines.
+    //
+    class JPEGReader : public ImageReader {
+    public:
+      JPEGReader(std::istream& src, const JPEGLoadOptions& options)
+        : jpeg_(src, options)
+      {
+        if (setjmp(jpeg_.errHandler)) {
+          ThrowCurrentError(jpeg_);
+        }
+
+        StartDecompress(jpeg_, options);
+      }
+
+      unsigned int Width() const noexcept override { return jpeg_.base.output_width; }
+      unsigned int Height() const noexcept override { return jpeg_.base.output_height; }
+      unsigned int BitsPerPixel() const noexcept override { return OutputBytesPerPixel(jpeg_) << 3; }
+      unsigned int RowsRead() const noexcept override { return jpeg_.base.output_scanline; }
+
+      unsigned int ReadRows(unsigned char* dst, unsigned int nRows) override {
+        const unsigned int firstRow = jpeg_.base.output_scanline;
+
+        if (firstRow == jpeg_.base.output_height) {
+          return 0;
+        }
+
+        if (setjmp(jpeg_.errHandler)) {
+          ThrowCurrentError(jpeg_);
+        }
+
+        ReadScanlines(jpeg_, dst, RowBytes(*this), nRows);
+
+        if (jpeg_.base.output_scanline == jpeg_.base.output_height) {
+          jpeg_finish_decompress(&jpeg_.base);
+        }
+
+        return jpeg_.base.output_scanline - firstRow;
+      }
+
+    private:
+      JPEGDecompressionAdapter jpeg_;
+    };
+
+    // IncrementalJPEGDecoder drives libjpeg through a suspending source. Any libjpeg
+    // call can return early for lack of data so decoding is a state machine: each
+    // Feed resumes at whichever step last suspended.
+    //
+    // When previews are wanted a progressive JPEG is decoded in buffered-image mode:
+    // libjpeg accumulates the coefficients of each scan as it arrives & once a Feed
+    // has completed one or more scans the image is output again from the latest of
+    // them. Scans that arrive together only cost one output pass.
+    //
+    class IncrementalJPEGDecoder : public IncrementalDecoder {
+    public:
+      IncrementalJPEGDecoder(const JPEGLoadOptions& options, bool previews)
+        : options_(options), previews_(previews), step_(Step::Header), completeScan_(0), outputScan_(0)
+      {
+        if (setjmp(jpeg_.errHandler)) {
+          ThrowCurrentError(jpeg_);
+        }
+
+        CreateDecompress(jpeg_);
+      }
+
+      void Feed(const unsigned char* data, std::size_t size) override {
+        if (done) {
+          return;
+        }
+
+        FeedSuspendingAdapter(jpeg_, data, size);
+
+        if (setjmp(jpeg_.errHandler)) {
+          ThrowCurrentError(jpeg_);
+        }
+
+        while (!done && Advance()) {
+        }
+      }
+
+    private:
+      enum class Step {
+        Header, Start, Scanlines, Consume, StartOutput, Output, FinishOutput, Finish
+      };
+
+      // Performs the current step, returning false if libjpeg suspended.
+      //
+      bool Advance() {
+        jpeg_decompress_struct& base = jpeg_.base;
+
+        switch (step_) {
+        case Step::Header:
+          if (jpeg_read_header(&base, TRUE) == JPEG_SUSPENDED) {
+            return false;
+          }
+
+          jpeg_.headerRead = true;
+          SetDecompressParameters(jpeg_, options_);
+          base.buffered_image = previews_ && jpeg_has_multiple_scans(&base) ? TRUE : FALSE;
+          step_ = Step::Start;
+          return true;
+
+        case Step::Start:
+          // Without buffered-image mode a progressive JPEG suspends here until all of
+          // its scans have arrived
+          if (!jpeg_start_decompress(&base)) {
+            return false;
+          }
+
+          CheckOutput(jpeg_, options_);
+          image = Image(base.output_width, base.output_height, OutputBytesPerPixel(jpeg_) << 3,
+            options_.rowAlignment, options_.allocator);
+          headerReady = true;
+          step_ = base.buffered_image ? Step::Consume : Step::Scanlines;
+          return true;
+
+        case Step::Scanlines:
+          ReadScanlines(jpeg_, image.Row(base.output_scanline), image.Stride(),
+            base.output_height - base.output_scanline);
+          rowsComplete = base.output_scanline;
+
+          if (base.output_scanline < base.output_height) {
+            return false;
+          }
+
+          step_ = Step::Finish;
+          return true;
 
-}
\ No newline at end of file
+        case Step::Consume:
+          for (;;) {
+            const int status = jpeg_consume_input(&base);
+
+            if (status == JPEG_SUSPENDED) {
+              break;
+            }
+
+            if (status == JPEG_SCAN_COMPLETED || status == JPEG_REACHED_EOI) {
+              completeScan_ = base.input_scan_number;
+            }
+
+            if (status == JPEG_REACHED_EOI) {
+              break;
+            }
+          }
+
+          // The EOI can arrive after the last scan has already been output, leaving
+          // nothing new to show
+          if (jpeg_input_complete(&base) && outputScan_ == (unsigned int) base.input_scan_number) {
+            rowsComplete = base.output_height;
+            step_ = Step::Finish;
+            return true;
+          }
+
+          if (completeScan_ == outputScan_) {
+            return false;
+          }
+
+          step_ = Step::StartOutput;
+          return true;
+
+        case Step::StartOutput:
+          // Output from a scan that has been read completely never waits for input
+          if (!jpeg_start_output(&base, completeScan_)) {
+            return false;
+          }
+
+          outputScan_ = completeScan_;
+          step_ = Step::Output;
+          return true;
+
+        case Step::Output:
+          ReadScanlines(jpeg_, image.Row(base.output_scanline), image.Stride(),
+            base.output_height - base.output_scanline);
+
+          if (base.output_scanline < base.output_height) {
+            return false;
+          }
+
+          ++refinements;
+
+          if (jpeg_input_complete(&base) && outputScan_ == (unsigned int) base.input_scan_number) {
+            rowsComplete = base.output_height;
+          }
+
+          step_ = Step::FinishOutput;
+          return true;
+
+        case Step::FinishOutput:
+          // Reads on to the start of the next scan, so this can suspend too
+          if (!jpeg_finish_output(&base)) {
+            return false;
+          }
+
+          step_ = rowsComplete == base.output_height ? Step::Finish : Step::Consume;
+          return true;
+
+        case Step::Finish:
+          if (!jpeg_finish_decompress(&base)) {
+            return false;
+          }
+
+          done = true;
+          return true;
+        }
+
+        return false;
+      }
+
+      JPEGDecompressionAdapter jpeg_;
+      JPEGLoadOptions options_;
+      bool previews_;
+      Step step_;
+      unsigned int completeScan_;
+      unsigned int outputScan_;
+    };
+
+    // Decodes just region (which must lie within the output image) into img after
+    // StartDecompress. Rows are decoded into a small band buffer & only the region's
+    // columns are kept, unless the region is full width (after cropping) in which case
+    // they are decoded straight into the Image. Same setjmp requirements as
+    // StartDecompress.
+    //
+    void DecompressRegion(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options, const Region& region,
+      Image& img)
+    {
+      const std::size_t bytesPerPixel = OutputBytesPerPixel(jpeg);
+      JDIMENSION xOffset = region.x;
+
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+      // libjpeg-turbo can skip the columns & rows we don't want. It widens the crop to
+      // iMCU boundaries & updates output_width to match.
+      //
+      // Fancy upsampling treats the edges of the crop as the edges of the image, so we
+      // ask for a pixel either side of the region: that pulls in the neighbouring iMCUs
+      // whenever the region starts or ends on a boundary, giving the same pixels as a
+      // full decode.
+      const JDIMENSION left = region.x > 0 ? region.x - 1 : 0;
+      const JDIMENSION right = std::min<JDIMENSION>(region.x + region.width + 1, jpeg.base.output_width);
+      JDIMENSION cropX = left;
+      JDIMENSION cropWidth = right - left;
+      jpeg_crop_scanline(&jpeg.base, &cropX, &cropWidth);
+      xOffset = region.x - cropX;
+
+      jpeg_skip_scanlines(&jpeg.base, region.y);
+#endif
+
+      img = Image(region.width, region.height, (unsigned int) bytesPerPixel << 3, options.rowAlignment, options.allocator);
+      jpeg.stats.Allocated(ByteSize(img));
+
+      if (xOffset == 0 && jpeg.base.output_width == region.width && jpeg.base.output_scanline == region.y) {
+        ReadScanlines(jpeg, img.Pixels(), img.Stride(), region.height);
+        return;
+      }
+
+      const std::size_t bandStride = jpeg.base.output_width*bytesPerPixel;
+      std::vector<unsigned char>& band = jpeg.band;
+      band.resize(MaxRowsPerRead*bandStride);
+      jpeg.stats.Allocated(band.size());
+
+      // Without jpeg_skip_scanlines the rows above have to be decoded & discarded
+      while (jpeg.base.output_scanline < region.y) {
+        ReadScanlines(jpeg, band.data(), bandStride,
+          std::min<JDIMENSION>(MaxRowsPerRead, region.y - jpeg.base.output_scanline));
+      }
+
+      for (unsigned int y = 0; y < region.height; ) {
+        const JDIMENSION n = ReadScanlines(jpeg, band.data(), bandStride,
+          std::min<JDIMENSION>(MaxRowsPerRead, region.height - y));
+
+        const StatsRecorder::Clock::time_point start = jpeg.stats.Now();
+
+        for (JDIMENSION i = 0; i < n; ++i, ++y) {
+          std::memcpy(img.Row(y), &band[i*bandStride + xOffset*bytesPerPixel], region.width*bytesPerPixel);
+        }
+
+        jpeg.stats.Lap(&DecodeStats::postProcessSeconds, start);
+      }
+    }
+
+    // Restart-parallel decoding (JPEGLoadOptions::threads)
+    //
+    // A restart marker resets the entropy decoder, so a baseline JPEG can be cut at
+    // any marker that falls at the start of an MCU row. Each run of MCU rows is then
+    // decoded by a decompressor of its own, from a stream of its own: the original
+    // tables, an SOF giving just the run's height, the entropy-coded data between the
+    // chosen markers (with the markers inside renumbered from RST0) & an EOI. Workers
+    // build these streams as they go, so only one run's data per thread is copied at
+    // a time.
+    //
+    // Fancy upsampling of vertically subsampled chroma looks at the row groups above &
+    // below, which a run's own stream doesn't have at its ends. Such runs also decode
+    // the rows either side & throw them away, so that their own rows come out exactly
+    // as a single decode would give them.
+
+    struct RestartMarker {
+      std::size_t start;    // the first 0xFF (there may be fill bytes)
+      std::size_t end;      // just past the RSTn
+    };
+
+    // What DecompressParallel needs to know about the JPEG's layout
+    //
+    struct RestartIndex {
+      RestartIndex()
+        : heightOffset(0), scanStart(0), scanEnd(0), mcusPerRow(0), mcuRows(0), mcuHeight(0),
+          restartInterval(0), restartRows(0)
+      {
+      }
+
+      // The markers up to & including SOS, less the metadata segments (APP1-APP13,
+      // APP15 & COM), & where the image height is within them
+      std::vector<JOCTET> header;
+      std::size_t heightOffset;
+
+      // The entropy-coded data runs from scanStart up to the marker at scanEnd,
+      // broken by the RSTn markers
+      std::size_t scanStart;
+      std::size_t scanEnd;
+      std::vector<RestartMarker> markers;
+
+      unsigned int mcusPerRow;
+      unsigned int mcuRows;
+      unsigned int mcuHeight;         // in image rows
+      unsigned int restartInterval;   // in MCUs
+      unsigned int restartRows;       // markers only start MCU rows at multiples of this
+    };
+
+    // The checks on the header for DecompressParallel, kept apart from it because
+    // jpeg_has_multiple_scans can longjmp: see JPEGLoadOptions::threads.
+    //
+    bool CanDecompressParallel(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options) {
+      const jpeg_decompress_struct& base = jpeg.base;
+
+      if (options.threads < 2 || !jpeg.data || jpeg.suspend || !options.region.Empty() ||
+        (std::size_t) base.image_width*base.image_height < options.parallelThreshold)
+      {
+        return false;
+      }
+
+      return base.restart_interval > 0 && !base.progressive_mode && !base.arith_code &&
+        base.data_precision == 8 && (base.num_components == 1 || base.num_components == 3) &&
+        base.comps_in_scan == base.num_components && !jpeg_has_multiple_scans(&jpeg.base);
+    }
+
+    // Copies the header up to the end of the SOS segment (at scanStart) into
+    // index.header, dropping the metadata. Returns false if it isn't laid out as
+    // expected.
+    //
+    bool IndexHeader(const JOCTET* data, std::size_t scanStart, RestartIndex& index) {
+      if (scanStart < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+      }
+
+      index.header.assign(data, data + 2);
+      std::size_t pos = 2;
+
+      while (pos < scanStart) {
+        if (data[pos] != 0xFF) {
+          return false;
+        }
+
+        while (pos < scanStart && data[pos] == 0xFF) {
+          ++pos;
+        }
+
+        if (scanStart - pos < 3) {
+          return false;
+        }
+
+        const int marker = data[pos];
+        const std::size_t length = (std::size_t) data[pos + 1] << 8 | data[pos + 2];
+        const std::size_t end = pos + 1 + length;
+
+        if (length < 2 || end > scanStart) {
+          return false;
+        }
+
+        // APP0 (JFIF) & APP14 (Adobe) can decide the colour space so they stay
+        const bool metadata = (marker > JPEG_APP0 && marker < JPEG_APP0 + 14) ||
+          marker == JPEG_APP0 + 15 || marker == JPEG_COM;
+
+        if (!metadata) {
+          if (marker == 0xC0 || marker == 0xC1) {
+            if (length < 7) {
+              return false;
+            }
+
+            // FF, SOFn, length (2), precision, height
+            index.heightOffset = index.header.size() + 5;
+          }
+
+          index.header.push_back(0xFF);
+          index.header.insert(index.header.end(), data + pos, data + end);
+        }
+
+        pos = end;
+      }
+
+      return pos == scanStart && index.heightOffset != 0;
+    }
+
+    // The pre-scan: finds every RSTn marker in the entropy-coded data & the marker
+    // that ends it. Returns false if the data ends first or the markers are out of
+    // sequence, leaving those for the single threaded decode to deal with.
+    //
+    bool IndexScan(const JOCTET* data, std::size_t size, RestartIndex& index) {
+      std::size_t pos = index.scanStart;
+
+      for (;;) {
+        const JOCTET* ff = (const JOCTET*) std::memchr(data + pos, 0xFF, size - pos);
+        if (!ff) {
+          return false;
+        }
+
+        const std::size_t start = ff - data;
+        std::size_t next = start + 1;
+
+        while (next < size && data[next] == 0xFF) {
+          ++next;
+        }
+
+        if (next == size) {
+          return false;
+        }
+
+        const JOCTET marker = data[next];
+        pos = next + 1;
+
+        if (marker == 0) {
+          // A stuffed 0xFF data byte
+          continue;
+        }
+
+        if (marker < JPEG_RST0 || marker > JPEG_RST0 + 7) {
+          index.scanEnd = start;
+          return true;
+        }
+
+        if (marker != JPEG_RST0 + index.markers.size() % 8) {
+          return false;
+        }
+
+        index.markers.push_back({ start, pos });
+      }
+    }
+
+    unsigned int GreatestCommonDivisor(unsigned int a, unsigned int b) {
+      while (b) {
+        const unsigned int r = a % b;
+        a = b;
+        b = r;
+      }
+      return a;
+    }
+
+    // Indexes the JPEG for DecompressParallel, once CanDecompressParallel has agreed.
+    // Returns false if it can't be split into at least two runs.
+    //
+    bool IndexRestarts(const JPEGDecompressionAdapter& jpeg, RestartIndex& index) {
+      const jpeg_decompress_struct& base = jpeg.base;
+
+      // Within an interleaved scan an MCU covers max_h x max_v blocks of the image; a
+      // single component scan has one block per MCU
+      const unsigned int mcuWidth = base.num_components == 1 ? 8 : 8*base.max_h_samp_factor;
+      index.mcuHeight = base.num_components == 1 ? 8 : 8*base.max_v_samp_factor;
+      index.mcusPerRow = (base.image_width + mcuWidth - 1) / mcuWidth;
+      index.mcuRows = (base.image_height + index.mcuHeight - 1) / index.mcuHeight;
+      index.restartInterval = base.restart_interval;
+      index.restartRows = index.restartInterval / GreatestCommonDivisor(index.restartInterval, index.mcusPerRow);
+
+      if (index.restartRows >= index.mcuRows) {
+        return false;
+      }
+
+      // libjpeg has read up to the end of the SOS segment
+      index.scanStart = base.src->next_input_byte - jpeg.data;
+
+      if (!IndexHeader(jpeg.data, index.scanStart, index) || !IndexScan(jpeg.data, jpeg.dataSize, index)) {
+        return false;
+      }
+
+      const std::uint64_t nMCUs = (std::uint64_t) index.mcusPerRow*index.mcuRows;
+      const std::uint64_t nIntervals = (nMCUs + index.restartInterval - 1) / index.restartInterval;
+
+      return index.markers.size() + 1 == nIntervals;
+    }
+
+    // Builds the stream for MCU rows [firstRow, endRow), which must start at a
+    // restart marker, into stream. The run's entropy-coded data goes up to the marker
+    // after endRow (or the end of the scan).
+    //
+    void BuildRunStream(const JOCTET* data, const RestartIndex& index, unsigned int firstRow,
+      unsigned int endRow, unsigned int height, std::vector<JOCTET>& stream)
+    {
+      const std::size_t nIntervals = index.markers.size() + 1;
+      const std::size_t firstInterval = (std::size_t) ((std::uint64_t) firstRow*index.mcusPerRow / index.restartInterval);
+      const std::size_t endInterval = std::min<std::size_t>(nIntervals, (std::size_t)
+        (((std::uint64_t) endRow*index.mcusPerRow + index.restartInterval - 1) / index.restartInterval));
+
+      const std::size_t start = firstInterval == 0 ? index.scanStart : index.markers[firstInterval - 1].end;
+      const std::size_t end = endInterval == nIntervals ? index.scanEnd : index.markers[endInterval - 1].start;
+
+      stream.assign(index.header.begin(), index.header.end());
+      stream[index.heightOffset] = (JOCTET) (height >> 8);
+      stream[index.heightOffset + 1] = (JOCTET) height;
+
+      std::size_t pos = start;
+
+      for (std::size_t i = firstInterval; i + 1 < endInterval; ++i) {
+        const RestartMarker& marker = index.markers[i];
+
+        stream.insert(stream.end(), data + pos, data + marker.start);
+        stream.push_back(0xFF);
+        stream.push_back((JOCTET) (JPEG_RST0 + (i - firstInterval) % 8));
+        pos = marker.end;
+      }
+
+      stream.insert(stream.end(), data + pos, data + end);
+      stream.push_back(0xFF);
+      stream.push_back(0xD9);
+    }
+
+    // Decodes a run's stream (see BuildRunStream) with its own decompressor: the first
+    // skipRows output rows are only there for the upsampler & are thrown away; the
+    // next nRows go into img from firstRow. Decompression parameters are copied from
+    // main, whose header has been read. Errors are returned, with message set.
+    //
+    DecodeError DecodeRun(const std::vector<JOCTET>& stream, const JPEGDecompressionAdapter& main,
+      const JPEGLoadOptions& options, JDIMENSION skipRows, JDIMENSION firstRow, JDIMENSION nRows,
+      Image& img, const char*& message)
+    {
+      JPEGDecompressionAdapter jpeg(stream.data(), stream.size());
+
+      if (setjmp(jpeg.errHandler)) {
+        message = jpeg.message;
+        return jpeg.error;
+      }
+
+      CreateDecompress(jpeg);
+      jpeg_read_header(&jpeg.base, TRUE);
+      jpeg.headerRead = true;
+
+      jpeg.base.scale_num = 1;
+      jpeg.base.scale_denom = main.base.scale_denom;
+      jpeg.base.dct_method = main.base.dct_method;
+      jpeg.base.do_fancy_upsampling = main.base.do_fancy_upsampling;
+      SetColorSpace(jpeg, options.pixelFormat);
+
+      jpeg_start_decompress(&jpeg.base);
+      CheckOutput(jpeg, options);
+
+      if (jpeg.base.output_width != img.Width() || (OutputBytesPerPixel(jpeg) << 3) != img.BitsPerPixel() ||
+        jpeg.base.output_height < skipRows + nRows)
+      {
+        Fail(jpeg, DecodeError::Corrupt, "Unexpected JPEG restart interval layout.");
+      }
+
+      if (skipRows > 0) {
+        const std::size_t bandStride = (std::size_t) img.Width()*OutputBytesPerPixel(jpeg);
+        jpeg.band.resize(MaxRowsPerRead*bandStride);
+
+        while (jpeg.base.output_scanline < skipRows) {
+          ReadScanlines(jpeg, jpeg.band.data(), bandStride,
+            std::min<JDIMENSION>(MaxRowsPerRead, skipRows - jpeg.base.output_scanline));
+        }
+      }
+
+      ReadScanlines(jpeg, img.Row(firstRow), img.Stride(), nRows);
+
+      // Anything after our rows is abandoned along with the decompressor
+      return DecodeError::None;
+    }
+
+    // Decodes the whole image into img on options.threads threads, given that
+    // CanDecompressParallel has agreed. Returns false, having done nothing, if the
+    // image can't usefully be split after all; errors in the data are returned
+    // through error, with jpeg.message set. Makes no libjpeg calls on jpeg, so it
+    // can't longjmp.
+    //
+    // DecodeStats can't see inside the workers: their time counts as decodeSeconds &
+    // their buffers aren't included in peakAllocatedBytes.
+    //
+    bool DecompressParallel(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options, Image& img,
+      DecodeError& error)
+    {
+      RestartIndex index;
+
+      if (!IndexRestarts(jpeg, index)) {
+        return false;
+      }
+
+      const jpeg_decompress_struct& base = jpeg.base;
+
+      // Vertically subsampled chroma is upsampled from the row groups either side
+      bool context = false;
+      if (base.do_fancy_upsampling) {
+        for (int i = 0; i < base.num_components; ++i) {
+          context = context || base.comp_info[i].v_samp_factor < base.max_v_samp_factor;
+        }
+      }
+
+      // Several runs per thread so that threads finishing early have more to do
+      const unsigned int targetRuns = options.threads*4;
+      const unsigned int runRows = ((index.mcuRows + targetRuns - 1) / targetRuns + index.restartRows - 1) /
+        index.restartRows*index.restartRows;
+      const unsigned int nRuns = (index.mcuRows + runRows - 1) / runRows;
+
+      if (nRuns < 2) {
+        return false;
+      }
+
+      // libjpeg rounds scaled dimensions up
+      const unsigned int d = base.scale_denom;
+      const JDIMENSION w = (base.image_width + d - 1) / d;
+      const JDIMENSION h = (base.image_height + d - 1) / d;
+      const unsigned int bytesPerPixel = options.pixelFormat == PixelFormat::Auto ?
+        (unsigned int) base.num_components : BytesPerPixel(options.pixelFormat);
+      const unsigned int mcuOutputRows = index.mcuHeight / d;
+
+      img = Image(w, h, bytesPerPixel << 3, options.rowAlignment, options.allocator);
+      jpeg.stats.Allocated(ByteSize(img));
+
+      std::atomic<unsigned int> nextRun(0);
+      std::atomic<bool> failed(false);
+      std::mutex errorLock;
+      error = DecodeError::None;
+
+      auto work = [&]() {
+        std::vector<JOCTET> stream;
+
+        while (!failed) {
+          const unsigned int run = nextRun++;
+          if (run >= nRuns) {
+            return;
+          }
+
+          // The MCU rows this run owns & those it decodes
+          const unsigned int first = run*runRows;
+          const unsigned int end = std::min(first + runRows, index.mcuRows);
+          const unsigned int decodeFirst = context && first > 0 ? first - index.restartRows : first;
+          const unsigned int decodeEnd = context && end < index.mcuRows ? end + 1 : end;
+          const unsigned int height = decodeEnd == index.mcuRows ?
+            base.image_height - decodeFirst*index.mcuHeight : (decodeEnd - decodeFirst)*index.mcuHeight;
+
+          const JDIMENSION firstRow = first*mcuOutputRows;
+          const JDIMENSION endRow = end == index.mcuRows ? h : end*mcuOutputRows;
+
+          const char* message = nullptr;
+          DecodeError result;
+
+          try {
+            BuildRunStream(jpeg.data, index, decodeFirst, decodeEnd, height, stream);
+            result = DecodeRun(stream, jpeg, options, (first - decodeFirst)*mcuOutputRows, firstRow,
+              endRow - firstRow, img, message);
+          }
+          catch (...) {
+            // Only allocations can throw here
+            result = DecodeError::OutOfMemory;
+          }
+
+          if (result != DecodeError::None) {
+            std::lock_guard<std::mutex> guard(errorLock);
+
+            if (!failed) {
+              failed = true;
+              error = result;
+              jpeg.message = message;
+            }
+            return;
+          }
+        }
+      };
+
+      // The calling thread works too & takes up the slack if threads can't be started
+      std::vector<std::thread> threads;
+
+      try {
+        for (unsigned int i = 1; i < std::min(options.threads, nRuns); ++i) {
+          threads.emplace_back(work);
+        }
+      }
+      catch (...) {
+      }
+
+      work();
+
+      for (std::thread& t : threads) {
+        t.join();
+      }
+
+      // For DecodeStats: the data was used up to the end of the scan
+      jpeg.src.next_input_byte = jpeg.data + index.scanEnd;
+      jpeg.src.bytes_in_buffer = jpeg.dataSize - index.scanEnd;
+
+      return true;
+    }
+
+    // The body of LoadJPEG & TryLoadJPEG, shared by all of their overloads & by
+    // JPEGDecoder. jpeg must be freshly constructed or bound (see Bind).
+    //
+    // Decodes into img, returning DecodeError::None, or returns why decoding failed:
+    // errors in the data are never thrown, so that rejecting a corrupt image doesn't
+    // cost an exception. (Errors in options & a failure to allocate img are still
+    // thrown.)
+    //
+    DecodeError TryDecompress(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options, Image& img) {
+
+      // Sequence of actions is important here:
+      // (1) Call setjmp; must be first because error handler setup
+      //     depends on having a valid jmpbuf
+      // (2) Install error handling code; must be next because *ANY* calls
+      //     into libjpeg can potentially cause errors, including jpeg_create_decompress
+      // (3) Create the decompressor (jpeg_create_decompress)
+      // (4) Install the data source: either the std::istream adapter or the memory
+      //     adapter (requires a valid decompressor)
+      // (5) Read the JPEG header etc. (requires a valid data stream & decompressor)
+      // (6) Create the james::Image (can only happen after decompression has started
+      //     so that we know the dimensions)
+      // (7) Finally we be do the decompression & clean up
+      //
+      // Throwing exceptions within the body of TryDecompress is fine because this will
+      // just trigger the destructor of JPEGDecompressionAdapter which will call
+      // jpeg_destroy_decompress and reset the stream.
+      //
+      // img is the caller's, not a local, so its value is well defined after a longjmp.
+
+      StatsRecorder::Clock::time_point headerEnd;
+
+      if (options.metadata) {
+        *options.metadata = ImageMetadata();
+      }
+
+      if (options.stats) {
+        *options.stats = DecodeStats();
+        jpeg.stats = StatsRecorder(options.stats);
+        jpeg.stats.Allocated(jpeg.buffer.size());
+      }
+
+      if (setjmp(jpeg.errHandler)) {
+        img = Image();
+        return jpeg.error;
+      }
+
+      headerEnd = ReadHeader(jpeg, options, true);
+
+      DecodeError parallelError = DecodeError::None;
+
+      if (CanDecompressParallel(jpeg, options) && DecompressParallel(jpeg, options, img, parallelError)) {
+        // The main decompressor is never started; it is abandoned like a region's
+        if (parallelError != DecodeError::None) {
+          Fail(jpeg, parallelError, jpeg.message);
+        }
+      }
+      else if (!options.region.Empty()) {
+        jpeg_start_decompress(&jpeg.base);
+        CheckOutput(jpeg, options);
+
+        const Region region = options.region.ClippedTo(jpeg.base.output_width, jpeg.base.output_height);
+
+        if (region.Empty()) {
+          throw std::out_of_range("The requested region lies outside the JPEG image.");
+        }
+
+        // Rows below the region are never decoded; jpeg_destroy_decompress (in the
+        // adapter's destructor) or, for a JPEGDecoder, Unbind abandons the decompression.
+        DecompressRegion(jpeg, options, region, img);
+
+        if (jpeg.base.output_scanline == jpeg.base.output_height) {
+          jpeg_finish_decompress(&jpeg.base);
+        }
+      }
+      else {
+        jpeg_start_decompress(&jpeg.base);
+        CheckOutput(jpeg, options);
+
+        img = Image(jpeg.base.output_width, jpeg.base.output_height, OutputBytesPerPixel(jpeg) << 3,
+          options.rowAlignment, options.allocator);
+        jpeg.stats.Allocated(ByteSize(img));
+
+        ReadScanlines(jpeg, img.Pixels(), img.Stride(), jpeg.base.output_height);
+
+        jpeg_finish_decompress(&jpeg.base);
+      }
+
+      // Remember: DON'T call jpeg_destroy_decompress; the destructor of
+      // JPEGDecompressionAdapter will do that for us.
+
+      if (options.applyOrientation) {
+        const StatsRecorder::Clock::time_point start = jpeg.stats.Now();
+        ApplyOrientation(img, jpeg.orientation);
+        jpeg.stats.Lap(&DecodeStats::postProcessSeconds, start);
+      }
+
+      if (jpeg.data) {
+        // The memory source hands everything over up front, so count what was used
+        jpeg.stats.BytesRead(jpeg.dataSize - jpeg.src.bytes_in_buffer);
+      }
+
+      jpeg.stats.Lap(&DecodeStats::decodeSeconds, headerEnd);
+      jpeg.stats.Output(img);
+
+      return DecodeError::None;
+    }
+
+    Image Decompress(JPEGDecompressionAdapter& jpeg, const JPEGLoadOptions& options) {
+      Image img;
+
+      if (TryDecompress(jpeg, options, img) != DecodeError::None) {
+        ThrowCurrentError(jpeg);
+      }
+
+      return img;
+    }
+
+    // Runs decode, which decompresses into the Image it is given & returns the error
+    // as TryDecompress does, turning the exceptions that can still result from bad
+    // data (allocation failures & errors from the stream) into error codes.
+    //
+    template<class F>
+    LoadResult TryLoad(F decode) {
+      LoadResult result;
+
+      try {
+        result.error = decode(result.image);
+      }
+      catch (std::bad_alloc&) {
+        result.error = DecodeError::OutOfMemory;
+      }
+      catch (std::ios::failure&) {
+        result.error = DecodeError::IO;
+      }
+
+      if (!result) {
+        result.image = Image();
+      }
+
+      return result;
+    }
+
+    bool HasMarker(const jpeg_decompress_struct& base, int marker, const char* signature, std::size_t signatureSize) {
+      for (jpeg_saved_marker_ptr m = base.marker_list; m; m = m->next) {
+        if (m->marker == marker && StartsWith(m, signature, signatureSize)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Reads the header only. jpeg must be freshly constructed.
+    //
+    ImageInfo Probe(JPEGDecompressionAdapter& jpeg) {
+      ImageInfo info;
+
+      if (setjmp(jpeg.errHandler)) {
+        ThrowCurrentError(jpeg);
+      }
+
+      CreateDecompress(jpeg);
+
+      // Only keep enough of each APP1/APP2 marker to recognise it; libjpeg skips the
+      // rest (which, for EXIF, is often a sizeable thumbnail)
+      jpeg_save_markers(&jpeg.base, ExifMarker, sizeof(ExifSignature));
+      jpeg_save_markers(&jpeg.base, ICCMarker, sizeof(ICCSignature));
+
+      jpeg_read_header(&jpeg.base, true);
+      jpeg.headerRead = true;
+
+      info.format = ImageFormat::JPEG;
+      info.width = jpeg.base.image_width;
+      info.height = jpeg.base.image_height;
+      info.channels = jpeg.base.num_components;
+      info.bitDepth = jpeg.base.data_precision;
+      info.interlaced = jpeg.base.progressive_mode != FALSE;
+      info.hasICCProfile = HasMarker(jpeg.base, ICCMarker, ICCSignature, sizeof(ICCSignature));
+      info.hasEXIF = HasMarker(jpeg.base, ExifMarker, ExifSignature, sizeof(ExifSignature));
+
+      return info;
+    }
+
+    // A header rarely needs more than a few KiB; larger markers are skipped (by
+    // seeking) rather than read.
+    //
+    const std::size_t ProbeBufferSize = 4096;
+  }
+
+  Image LoadJPEG(std::istream& src) {
+    return LoadJPEG(src, JPEGLoadOptions());
+  }
+
+  Image LoadJPEG(std::istream& src, const JPEGLoadOptions& options) {
+    ValidateOptions(options);
+
+    JPEGDecompressionAdapter jpeg(src, options);
+    return Decompress(jpeg, options);
+  }
+
+  Image LoadJPEG(const void* data, std::size_t size) {
+    return LoadJPEG(data, size, JPEGLoadOptions());
+  }
+
+  Image LoadJPEG(const void* data, std::size_t size, const JPEGLoadOptions& options) {
+    ValidateOptions(options);
+
+    JPEGDecompressionAdapter jpeg(data, size);
+    return Decompress(jpeg, options);
+  }
+
+  LoadResult TryLoadJPEG(std::istream& src) {
+    return TryLoadJPEG(src, JPEGLoadOptions());
+  }
+
+  LoadResult TryLoadJPEG(std::istream& src, const JPEGLoadOptions& options) {
+    ValidateOptions(options);
+
+    return TryLoad([&](Image& img) {
+      JPEGDecompressionAdapter jpeg(src, options);
+      return TryDecompress(jpeg, options, img);
+    });
+  }
+
+  LoadResult TryLoadJPEG(const void* data, std::size_t size) {
+    return TryLoadJPEG(data, size, JPEGLoadOptions());
+  }
+
+  LoadResult TryLoadJPEG(const void* data, std::size_t size, const JPEGLoadOptions& options) {
+    ValidateOptions(options);
+
+    return TryLoad([&](Image& img) {
+      JPEGDecompressionAdapter jpeg(data, size);
+      return TryDecompress(jpeg, options, img);
+    });
+  }
+
+  ImageInfo ProbeJPEG(std::istream& src) {
+    JPEGLoadOptions options;
+    options.inputBufferSize = ProbeBufferSize;
+
+    JPEGDecompressionAdapter jpeg(src, options);
+    return Probe(jpeg);
+  }
+
+  ImageInfo ProbeJPEG(const void* data, std::size_t size) {
+    JPEGDecompressionAdapter jpeg(data, size);
+    return Probe(jpeg);
+  }
+
+  std::unique_ptr<ImageReader> OpenJPEGReader(std::istream& src) {
+    return OpenJPEGReader(src, JPEGLoadOptions());
+  }
+
+  std::unique_ptr<ImageReader> OpenJPEGReader(std::istream& src, const JPEGLoadOptions& options) {
+    ValidateOptions(options);
+
+    return std::unique_ptr<ImageReader>(new JPEGReader(src, options));
+  }
+
+  std::unique_ptr<IncrementalDecoder> CreateIncrementalJPEGDecoder(const JPEGLoadOptions& options, bool previews) {
+    ValidateOptions(options);
+
+    return std::unique_ptr<IncrementalDecoder>(new IncrementalJPEGDecoder(options, previews));
+  }
+
+  struct JPEGDecoder::Impl {
+    explicit Impl(const JPEGLoadOptions& options)
+      : options(options), jpeg(options)
+    {
+    }
+
+    // Binds jpeg to a source for one decode & unbinds it however the decode ends
+    //
+    struct Binding {
+      template<class... Args>
+      Binding(JPEGDecompressionAdapter& jpeg, Args&&... args)
+        : jpeg(jpeg)
+      {
+        jpeg.Bind(std::forward<Args>(args)...);
+      }
+
+      ~Binding() {
+        jpeg.Unbind();
+      }
+
+      JPEGDecompressionAdapter& jpeg;
+    };
+
+    const JPEGLoadOptions options;
+    JPEGDecompressionAdapter jpeg;
+  };
+
+  JPEGDecoder::JPEGDecoder()
+    : JPEGDecoder(JPEGLoadOptions())
+  {
+  }
+
+  JPEGDecoder::JPEGDecoder(const JPEGLoadOptions& options)
+  {
+    ValidateOptions(options);
+
+    impl_.reset(new Impl(options));
+  }
+
+  JPEGDecoder::~JPEGDecoder() {
+  }
+
+  const JPEGLoadOptions& JPEGDecoder::Options() const noexcept {
+    return impl_->options;
+  }
+
+  Image JPEGDecoder::Decode(std::istream& src) {
+    Impl::Binding binding(impl_->jpeg, src);
+    return Decompress(impl_->jpeg, impl_->options);
+  }
+
+  Image JPEGDecoder::Decode(const void* data, std::size_t size) {
+    Impl::Binding binding(impl_->jpeg, data, size);
+    return Decompress(impl_->jpeg, impl_->options);
+  }
+
+  LoadResult JPEGDecoder::TryDecode(std::istream& src) {
+    return TryLoad([&](Image& img) {
+      Impl::Binding binding(impl_->jpeg, src);
+      return TryDecompress(impl_->jpeg, impl_->options, img);
+    });
+  }
+
+  LoadResult JPEGDecoder::TryDecode(const void* data, std::size_t size) {
+    return TryLoad([&](Image& img) {
+      Impl::Binding binding(impl_->jpeg, data, size);
+      return TryDecompress(impl_->jpeg, impl_->options, img);
+    });
+  }
+
+}
@@ -17,13 +17,26 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include <james/image-loader.hpp>
+#include "incremental-decoder.hpp"
+#include "decode-stats-impl.hpp"
+#include "pixel-convert.hpp"
 
 #include <utility>
 #include <stdexcept>
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <cstdint>
+#include <limits>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <png.h>
+#include <zlib.h>
 
 #include <iostream>
 
@@ -31,6 +44,143 @@ namespace james {
 
   namespace {
 
+    void NoteOutOfMemory(png_structp png);
+
+    // libPNG's internal allocations (row buffers, zlib state etc.) are routed through
+    // the global operator new so that they are accounted for in the same way as the
+    // Image pixel buffer. These are called from C so they must not throw: returning
+    // nullptr makes libPNG raise an out-of-memory error through png_error.
+    //
+    // The mem_ptr is a PNGMemory, or nullptr if the load needs neither of its parts.
+    // Each block starts with a header giving its size & whether it was counted by the
+    // StatsRecorder, so that blocks allocated before the recorder was attached aren't
+    // subtracted when freed.
+    //
+    struct AllocationHeader {
+      std::size_t size;
+      bool counted;
+    };
+
+    const std::size_t AllocationHeaderSize = 16;
+    static_assert(sizeof(AllocationHeader) <= AllocationHeaderSize, "AllocationHeader too big");
+    static_assert(alignof(std::max_align_t) <= AllocationHeaderSize, "Allocations would be misaligned");
+
+    // Blocks freed by libPNG that a PNGDecoder keeps for its next decode. libPNG makes
+    // much the same allocations for every image (the read & info structs, zlib's
+    // state & window, row buffers) so after the first decode nearly all of them are
+    // found here. Blocks are only reused for requests of exactly the same size.
+    //
+    class PNGBlockCache {
+    public:
+      // Beyond this freed blocks go straight back to the system
+      static const std::size_t MaxBytes = 1 << 20;
+
+      PNGBlockCache()
+        : bytes_(0)
+      {
+      }
+
+      ~PNGBlockCache() {
+        for (const Block& b : blocks_) {
+          ::operator delete(b.second);
+        }
+      }
+
+      PNGBlockCache(const PNGBlockCache&) = delete;
+      PNGBlockCache& operator= (const PNGBlockCache&) = delete;
+
+      unsigned char* Take(std::size_t size) noexcept {
+        for (Block& b : blocks_) {
+          if (b.first == size) {
+            unsigned char* block = b.second;
+            b = blocks_.back();
+            blocks_.pop_back();
+            bytes_ -= size;
+            return block;
+          }
+        }
+        return nullptr;
+      }
+
+      // Returns false if the block wasn't kept
+      bool Put(unsigned char* block, std::size_t size) noexcept {
+        if (bytes_ + size > MaxBytes) {
+          return false;
+        }
+
+        try {
+          blocks_.push_back(Block(size, block));
+        }
+        catch (...) {
+          return false;
+        }
+
+        bytes_ += size;
+        return true;
+      }
+
+    private:
+      typedef std::pair<std::size_t, unsigned char*> Block;
+
+      std::vector<Block> blocks_;
+      std::size_t bytes_;
+    };
+
+    // Either part may be null
+    struct PNGMemory {
+      StatsRecorder* stats;
+      PNGBlockCache* cache;
+    };
+
+    png_voidp PNGMalloc(png_structp png, png_alloc_size_t size) {
+      PNGMemory* memory = (PNGMemory*) png_get_mem_ptr(png);
+      StatsRecorder* stats = memory ? memory->stats : nullptr;
+      unsigned char* block = nullptr;
+
+      if (memory && memory->cache) {
+        block = memory->cache->Take(size);
+      }
+
+      if (!block && size <= std::numeric_limits<std::size_t>::max() - AllocationHeaderSize) {
+        block = (unsigned char*) ::operator new(size + AllocationHeaderSize, std::nothrow);
+      }
+
+      if (!block) {
+        NoteOutOfMemory(png);
+        return nullptr;
+      }
+
+      AllocationHeader* header = (AllocationHeader*) block;
+      header->size = size;
+      header->counted = stats && *stats;
+
+      if (header->counted) {
+        stats->Allocated(size);
+      }
+
+      return block + AllocationHeaderSize;
+    }
+
+    void PNGFree(png_structp png, png_voidp ptr) {
+      if (!ptr) {
+        return;
+      }
+
+      PNGMemory* memory = (PNGMemory*) png_get_mem_ptr(png);
+      unsigned char* block = (unsigned char*) ptr - AllocationHeaderSize;
+      const AllocationHeader* header = (const AllocationHeader*) block;
+
+      if (header->counted && memory && memory->stats) {
+        memory->stats->Freed(header->size);
+      }
+
+      if (memory && memory->cache && memory->cache->Put(block, header->size)) {
+        return;
+      }
+
+      ::operator delete(block);
+    }
+
     // PNGDataMgr is a RAII type for managing the two key structures used in libPNG:
     // --> png_structp & png_infop
     //
@@ -38,10 +188,13 @@ namespace james {
       png_structp png;
       png_infop info;
 
-      PNGDataMgr()
+      // memory must outlive the PNGDataMgr
+      explicit PNGDataMgr(PNGMemory* memory)
         : png(nullptr), info(nullptr)
       {
-        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        png = png_create_read_struct_2(
+          PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr,
+          memory, &PNGMalloc, &PNGFree);
         if (!png) {
           throw std::runtime_error("libPNG internal error (png_create_read_struct failed)");
         }
@@ -61,26 +214,77 @@ namespace james {
     // PNGLoaderState bundles up all the data needed for a LoadPNG call so that it can
     // be accessible to callback functions that get a single data pointer for context.
     //
+    // Data comes either from a std::istream (src is non-null), directly from a block
+    // of memory owned by the caller (data, dataSize & dataPos) or, for incremental
+    // decoding, is pushed to libPNG with png_process_data (neither is set).
+    //
     struct PNGLoaderState {
+      // Declared first so that it outlives libPNG
+      PNGMemory memory;
       PNGDataMgr libPNG;
       
       Image img;
 
-      std::istream& src;
+      std::istream* src;
       std::ios::iostate streamExceptionState;
 
+      const png_byte* data;
+      std::size_t dataSize;
+      std::size_t dataPos;
+
       std::exception_ptr currentError;
 
-      PNGLoaderState(std::istream& src)
-        : src(src), streamExceptionState(src.exceptions())
+      // Why we longjmp'd back & (for errors we raise ourselves, see Fail) the message to
+      // throw. Errors before the header has been read are reported as BadHeader.
+      DecodeError error;
+      const char* message;
+      bool headerRead;
+
+      // Rows decoded for ReadRegion. Buffers live here rather than on the stack so
+      // that a longjmp out of libPNG can't leak them.
+      std::vector<unsigned char> scratch;
+      std::vector<unsigned char> band;
+
+      // The EXIF orientation, as found by ReadMetadata
+      unsigned int orientation;
+
+      // See AttachStats
+      StatsRecorder stats;
+
+      // cache, if given, must outlive the state: see PNGDecoder
+      explicit PNGLoaderState(std::istream& src, PNGBlockCache* cache = nullptr)
+        : memory{ nullptr, cache }, libPNG(&memory), src(&src), streamExceptionState(src.exceptions()),
+          data(nullptr), dataSize(0), dataPos(0),
+          error(DecodeError::None), message(nullptr), headerRead(false), orientation(1)
       {
+        InstallErrorHandlers();
+
         // Note: this might (???) be able to throw an exception. This is safe because
         //       PNGLoaderState does not directly own any raw resources - they are all
         //       wrapped up in manager objects.
         src.exceptions(std::istream::failbit | std::istream::badbit | std::istream::eofbit);
       }
 
+      PNGLoaderState(const void* data, std::size_t dataSize, PNGBlockCache* cache = nullptr)
+        : memory{ nullptr, cache }, libPNG(&memory), src(nullptr), streamExceptionState(),
+          data((const png_byte*) data), dataSize(dataSize), dataPos(0),
+          error(DecodeError::None), message(nullptr), headerRead(false), orientation(1)
+      {
+        InstallErrorHandlers();
+      }
+
+      PNGLoaderState()
+        : memory{ nullptr, nullptr }, libPNG(&memory), src(nullptr), streamExceptionState(),
+          data(nullptr), dataSize(0), dataPos(0),
+          error(DecodeError::None), message(nullptr), headerRead(false), orientation(1)
+      {
+        InstallErrorHandlers();
+      }
+
       ~PNGLoaderState() {
+        // stats is destroyed before libPNG, which still frees memory
+        memory.stats = nullptr;
+
         // Note: this could potentially throw an exceptions. I'm pretty sure it wont, because
         //       we are only ever making the exception behaviour *less* likely to throw,
         //       but none-the-less, having potentially throwing code in a destructor
@@ -90,97 +294,1507 @@ namespace james {
         //       destructor (so any clean-up will definitely happen) & then propagate
         //       the exception.
         //
-        src.exceptions(streamExceptionState);
+        if (src) {
+          src->exceptions(streamExceptionState);
+        }
+      }
+
+    private:
+      // libPNG's default handlers print to stderr. Ours are silent: errors are
+      // classified & reported to the caller, warnings are ignored.
+      //
+      void InstallErrorHandlers() {
+        png_set_error_fn(libPNG.png, this, [](png_structp png, png_const_charp) {
+          PNGLoaderState* state = (PNGLoaderState*) png_get_error_ptr(png);
+
+          if (state->error == DecodeError::None) {
+            state->error = state->headerRead ? DecodeError::Corrupt : DecodeError::BadHeader;
+          }
+
+          png_longjmp(png, 1);
+        }, [](png_structp, png_const_charp) {});
       }
     };
 
-    // Setup our std::istream adapter callback
+    void NoteOutOfMemory(png_structp png) {
+      // Allocations made while the read struct is being created come before we have
+      // installed our error handlers
+      if (PNGLoaderState* state = (PNGLoaderState*) png_get_error_ptr(png)) {
+        state->error = DecodeError::OutOfMemory;
+      }
+    }
+
+    // Reports an error that we have detected ourselves in the same way as libPNG's own
+    // errors. Same setjmp requirements as libPNG calls.
+    //
+    [[noreturn]] void Fail(PNGLoaderState& state, DecodeError error, const char* message) {
+      state.error = error;
+      state.message = message;
+      png_error(state.libPNG.png, message);
+    }
+
+    // Setup our IO adapter callback: either the std::istream adapter or, when reading
+    // from memory, a callback that just copies from the caller's buffer & advances
+    // a cursor.
     //
     void InstallIOAdapter(PNGLoaderState& state) {
-      png_set_read_fn(state.libPNG.png, &state, [](png_structp png, png_bytep buffer, png_size_t length) {
+      if (state.src) {
+        png_set_read_fn(state.libPNG.png, &state, [](png_structp png, png_bytep buffer, png_size_t length) {
 
-        PNGLoaderState* state = (PNGLoaderState*) png_get_io_ptr(png);
+          PNGLoaderState* state = (PNGLoaderState*) png_get_io_ptr(png);
+          const StatsRecorder::Clock::time_point start = state->stats.Now();
+          std::streamsize n = 0;
 
-        try {
-          if (length != state->src.rdbuf()->sgetn((char*)buffer, length)) {
-            throw std::runtime_error("Unexpected end of file.");
+          try {
+            n = state->src->rdbuf()->sgetn((char*)buffer, length);
+          }
+          catch (...) {
+            state->currentError = std::current_exception();
+            state->error = DecodeError::IO;
+            png_error(state->libPNG.png, "Exception adapter");
           }
-        }
-        catch (...) {
-          state->currentError = std::current_exception();
-          png_error(state->libPNG.png, "Exception adapter");
-        }
 
-      });
-    }
-  }
+          state->stats.IO(start, (std::size_t) n);
 
-  Image LoadPNG(std::istream& src) {
-    // LoadPNG has a specific order of operation...
-    // (1) Allocate PNGLoaderState - we now have the PNG data structures needed
-    // (2) Call setjmp to setup error handling (pretty much any libPNG call can
-    //     fail with a longjmp but NOT create_read/info_struct - unlike libJPEG)
-    // (3) Install the std::istream IO adapter
-    // (4) Read the whole image into memory & decompress
-    // (5) Allocate the iImage (using the newly known image dimensions) and 
-    //     copy the decompressed data into it
+          if ((std::streamsize) length != n) {
+            Fail(*state, DecodeError::Truncated, "Unexpected end of file.");
+          }
 
-    PNGLoaderState state(src);
+        });
+      }
+      else {
+        png_set_read_fn(state.libPNG.png, &state, [](png_structp png, png_bytep buffer, png_size_t length) {
 
-    png_uint_32 w;
-    png_uint_32 h;
-    int channelWidth;
-    int nChannels;
+          PNGLoaderState* state = (PNGLoaderState*) png_get_io_ptr(png);
+          const StatsRecorder::Clock::time_point start = state->stats.Now();
 
-    png_bytepp rowPtrs = nullptr;
-    unsigned char* dstPtr = nullptr;
+          if (length > state->dataSize - state->dataPos) {
+            Fail(*state, DecodeError::Truncated, "Unexpected end of file.");
+          }
+
+          std::memcpy(buffer, state->data + state->dataPos, length);
+          state->dataPos += length;
+          state->stats.IO(start, length);
+
+        });
+      }
+    }
 
-    if (setjmp(png_jmpbuf(state.libPNG.png))) {
+    // Throws the error that caused libPNG to longjmp back to us. Only makes sense
+    // when called from the setjmp error branch.
+    //
+    [[noreturn]] void ThrowCurrentError(PNGLoaderState& state) {
       if (state.currentError) {
         std::rethrow_exception(state.currentError);
       }
       else {
-        throw std::runtime_error("An unspecified error occured.");
+        throw std::runtime_error(state.message ? state.message : "An unspecified error occured.");
       }
     }
 
-    InstallIOAdapter(state);
+    // The dimensions & layout of the decoded image, as they will be after our
+    // transforms have been applied.
+    //
+    struct PNGHeader {
+      png_uint_32 w;
+      png_uint_32 h;
+      int nChannels;
+      int bitDepth;
+      int nPasses;
+      bool premultiply;
+
+      // As stored in the file, before our transforms
+      int sourceColorType;
+      int sourceBitDepth;
 
-    png_read_png(
-      state.libPNG.png, state.libPNG.info,
-      PNG_TRANSFORM_SCALE_16 | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND | PNG_TRANSFORM_GRAY_TO_RGB,
-      nullptr);
+      std::size_t BytesPerPixel() const { return (std::size_t) nChannels*bitDepth/8; }
+      unsigned int BitsPerPixel() const { return (unsigned int) (nChannels*bitDepth); }
+      png_size_t RowBytes() const { return (png_size_t) w*BytesPerPixel(); }
+    };
+
+    bool IsLittleEndian() {
+      const std::uint16_t one = 1;
+      unsigned char first;
+
+      std::memcpy(&first, &one, 1);
+      return first == 1;
+    }
 
-    w = png_get_image_width(state.libPNG.png, state.libPNG.info);
-    h = png_get_image_height(state.libPNG.png, state.libPNG.info);
-    channelWidth = png_get_bit_depth(state.libPNG.png, state.libPNG.info);
-    nChannels = png_get_channels(state.libPNG.png, state.libPNG.info);
+    // Premultiplies a row of 16 bit RGBA. The 8 bit version lives with the other
+    // pixel kernels; 16 bit images are rare enough that a scalar loop will do.
+    //
+    void PremultiplyAlpha16(unsigned char* row, std::size_t nPixels) {
+      std::uint16_t* p = (std::uint16_t*) row;
 
-    // I *think* that the combination of transform flags passed to png_read_png means that we should
-    // only ever get 8 bit channels with 3 or 4 components per pixel, however, I'm not quite sure so
-    // in the spirit of "belt and braces" we check and throw anyway... (since if I'm wrong we would
-    // have a buffer overrun which is a mjor security cock up)
+      for (std::size_t i = 0; i < nPixels; ++i, p += 4) {
+        const std::uint32_t a = p[3];
 
-    if (channelWidth != 8) {
-      throw std::runtime_error("PNG channel width was not 8. Only 8 is supported.");
+        p[0] = (std::uint16_t) ((p[0]*a + 32767) / 65535);
+        p[1] = (std::uint16_t) ((p[1]*a + 32767) / 65535);
+        p[2] = (std::uint16_t) ((p[2]*a + 32767) / 65535);
+      }
     }
 
-    if (nChannels != 3 && nChannels != 4) {
-      throw std::runtime_error("Number of PNG colour channels was neither 3 nor 4.");
+    void Premultiply(const PNGHeader& header, unsigned char* row, std::size_t nPixels) {
+      if (header.bitDepth == 16) {
+        PremultiplyAlpha16(row, nPixels);
+      }
+      else {
+        PremultiplyAlpha(row, nPixels);
+      }
     }
-      
-    state.img = Image(w, h, nChannels << 3);
-    
-    rowPtrs = png_get_rows(state.libPNG.png, state.libPNG.info);
-    dstPtr = state.img.Pixels();
 
-    while (h --) {
-      memcpy(dstPtr, *rowPtrs, w*nChannels);
+    // Configures libPNG to produce rows in the requested format. Must be called after
+    // png_read_info.
+    //
+    // With keep16Bit, 16 bit images stay 16 bit & libPNG swaps each sample into the
+    // native byte order as it goes.
+    //
+    void SetTransforms(PNGLoaderState& state, PixelFormat format, bool keep16Bit) {
+      png_structp png = state.libPNG.png;
+      const bool sixteenBit = keep16Bit && png_get_bit_depth(png, state.libPNG.info) == 16;
+
+      // These are the same transformations that PNG_TRANSFORM_SCALE_16 | PNG_TRANSFORM_PACKING |
+      // PNG_TRANSFORM_EXPAND would request of png_read_png.
+      if (sixteenBit) {
+        if (IsLittleEndian()) {
+          png_set_swap(png);
+        }
+      }
+      else {
+        png_set_scale_16(png);
+      }
+      png_set_packing(png);
+      png_set_expand(png);
+
+      switch (format) {
+      case PixelFormat::Gray8:
+        if (png_get_color_type(png, state.libPNG.info) & PNG_COLOR_MASK_COLOR) {
+          // error_action 1: convert silently; negative weights: use the defaults
+          png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+        }
+        png_set_strip_alpha(png);
+        break;
+
+      case PixelFormat::RGB:
+      case PixelFormat::BGR:
+        png_set_gray_to_rgb(png);
+        png_set_strip_alpha(png);
+        break;
 
-      dstPtr += w*nChannels;
-      rowPtrs++;
+      case PixelFormat::RGBA:
+      case PixelFormat::BGRA:
+      case PixelFormat::PremultipliedRGBA:
+        png_set_gray_to_rgb(png);
+        png_set_add_alpha(png, 0xffff, PNG_FILLER_AFTER);
+        break;
+
+      case PixelFormat::RGBX:
+        png_set_gray_to_rgb(png);
+        png_set_strip_alpha(png);
+        png_set_filler(png, 0xffff, PNG_FILLER_AFTER);
+        break;
+
+      default:
+        png_set_gray_to_rgb(png);
+        break;
+      }
+
+      if (format == PixelFormat::BGR || format == PixelFormat::BGRA) {
+        png_set_bgr(png);
+      }
     }
 
-    return state.img;
-  }
-}
\ No newline at end of file
+    // Configures libPNG to produce 8 bit rows (or 16 bit, for a 16 bit image with
+    // keep16Bit) in the requested format (for PixelFormat::Auto: RGB or RGBA) once the
+    // header has been read.
+    //
+    // libPNG errors are reported by longjmp so the caller *must* have called setjmp
+    // on png_jmpbuf(state.libPNG.png) before calling this.
+    //
+    PNGHeader ConfigureHeader(PNGLoaderState& state, PixelFormat format, bool keep16Bit) {
+      PNGHeader header;
+
+      header.sourceColorType = png_get_color_type(state.libPNG.png, state.libPNG.info);
+      header.sourceBitDepth = png_get_bit_depth(state.libPNG.png, state.libPNG.info);
+
+      SetTransforms(state, format, keep16Bit);
+
+      // libPNG will de-interlace for us so long as we give it the same row buffer for
+      // every pass (it combines the new pixels with those already in the row)
+      header.nPasses = png_set_interlace_handling(state.libPNG.png);
+      header.premultiply = format == PixelFormat::PremultipliedRGBA;
+
+      png_read_update_info(state.libPNG.png, state.libPNG.info);
+
+      header.w = png_get_image_width(state.libPNG.png, state.libPNG.info);
+      header.h = png_get_image_height(state.libPNG.png, state.libPNG.info);
+      header.bitDepth = png_get_bit_depth(state.libPNG.png, state.libPNG.info);
+      header.nChannels = png_get_channels(state.libPNG.png, state.libPNG.info);
+
+      // I *think* that the combination of transforms set above means that we should only ever
+      // get 8 (or, if asked for, 16) bit channels with 3 or 4 components per pixel, however, I'm not quite sure so
+      // in the spirit of "belt and braces" we check and throw anyway... (since if I'm wrong we would
+      // have a buffer overrun which is a mjor security cock up)
+
+      if (header.bitDepth != 8 && !(keep16Bit && header.bitDepth == 16)) {
+        Fail(state, DecodeError::UnsupportedFormat, "Unexpected PNG channel width.");
+      }
+
+      if (format == PixelFormat::Auto) {
+        if (header.nChannels != 3 && header.nChannels != 4) {
+          Fail(state, DecodeError::UnsupportedFormat, "Number of PNG colour channels was neither 3 nor 4.");
+        }
+      }
+      else if (header.nChannels != (int) BytesPerPixel(format)) {
+        Fail(state, DecodeError::UnsupportedFormat, "Unexpected number of PNG colour channels for the requested pixel format.");
+      }
+
+      if (png_get_rowbytes(state.libPNG.png, state.libPNG.info) != header.RowBytes()) {
+        Fail(state, DecodeError::UnsupportedFormat, "Unexpected PNG row size.");
+      }
+
+      return header;
+    }
+
+    // Reads the PNG header & configures the transforms. Same setjmp requirements as
+    // ConfigureHeader.
+    //
+    PNGHeader ReadHeader(PNGLoaderState& state, PixelFormat format, bool keep16Bit) {
+      png_read_info(state.libPNG.png, state.libPNG.info);
+      state.headerRead = true;
+      return ConfigureHeader(state, format, keep16Bit);
+    }
+
+    // Copies the iCCP & eXIf chunks that libPNG has read so far into options.metadata,
+    // if set, & state.orientation. An eXIf chunk is only looked for if none has been
+    // found yet, so this can be called again after png_read_end to pick up one that
+    // follows the image data.
+    //
+    void ReadMetadata(PNGLoaderState& state, const LoadOptions& options) {
+      png_structp png = state.libPNG.png;
+      png_infop info = state.libPNG.info;
+      ImageMetadata* metadata = options.metadata;
+
+      if (metadata && metadata->iccProfile.empty() && png_get_valid(png, info, PNG_INFO_iCCP)) {
+        png_charp name;
+        int compression;
+        png_bytep profile;
+        png_uint_32 size;
+
+        if (png_get_iCCP(png, info, &name, &compression, &profile, &size) && size <= options.maxMetadataSize) {
+          metadata->iccProfile.assign(profile, profile + size);
+        }
+      }
+
+#ifdef PNG_eXIf_SUPPORTED
+      png_uint_32 exifSize;
+      png_bytep exif;
+
+      if (state.orientation == 1 && png_get_eXIf_1(png, info, &exifSize, &exif)) {
+        state.orientation = ParseExifOrientation(exif, exifSize);
+
+        if (metadata && metadata->exif.empty()) {
+          metadata->orientation = state.orientation;
+
+          if (exifSize <= options.maxMetadataSize) {
+            metadata->exif.assign(exif, exif + exifSize);
+          }
+        }
+      }
+#endif
+    }
+
+    // Decompresses every pass of the image into img, which must have the dimensions
+    // given by header. Same setjmp requirements as ReadHeader.
+    //
+    void ReadImage(PNGLoaderState& state, const PNGHeader& header, Image& img) {
+      for (int pass = 0; pass < header.nPasses; ++pass) {
+        const bool lastPass = pass == header.nPasses - 1;
+
+        for (png_uint_32 y = 0; y < header.h; ++y) {
+          png_read_row(state.libPNG.png, img.Row(y), nullptr);
+
+          // libPNG's own premultiplication (png_set_alpha_mode) works in linear light,
+          // which isn't what consumers of premultiplied 8 bit RGBA expect
+          if (lastPass && header.premultiply) {
+            const StatsRecorder::Clock::time_point start = state.stats.Now();
+            Premultiply(header, img.Row(y), header.w);
+            state.stats.Lap(&DecodeStats::postProcessSeconds, start);
+          }
+        }
+      }
+    }
+
+    // Decompresses just region (which must lie within the image) into img, which must
+    // be region.width x region.height. Rows are read up to the bottom of the region &
+    // no further. Same setjmp requirements as ReadHeader.
+    //
+    void ReadRegion(PNGLoaderState& state, const PNGHeader& header, const Region& region, Image& img) {
+      const png_size_t rowBytes = header.RowBytes();
+      const std::size_t bytesPerPixel = header.BytesPerPixel();
+      const png_uint_32 bottom = region.y + region.height;
+      const bool fullWidth = region.x == 0 && region.width == header.w;
+
+      std::vector<unsigned char>& scratch = state.scratch;
+      scratch.resize(rowBytes);
+      state.stats.Allocated(scratch.size());
+
+      if (header.nPasses == 1) {
+        for (png_uint_32 y = 0; y < bottom; ++y) {
+          if (y < region.y) {
+            png_read_row(state.libPNG.png, scratch.data(), nullptr);
+            continue;
+          }
+
+          unsigned char* dst = img.Row(y - region.y);
+
+          if (fullWidth) {
+            png_read_row(state.libPNG.png, dst, nullptr);
+          }
+          else {
+            png_read_row(state.libPNG.png, scratch.data(), nullptr);
+          }
+
+          const StatsRecorder::Clock::time_point start = state.stats.Now();
+
+          if (!fullWidth) {
+            std::memcpy(dst, &scratch[region.x*bytesPerPixel], region.width*bytesPerPixel);
+          }
+
+          if (header.premultiply) {
+            Premultiply(header, dst, region.width);
+          }
+
+          state.stats.Lap(&DecodeStats::postProcessSeconds, start);
+        }
+        return;
+      }
+
+      // Every pass adds pixels to rows throughout the image so the region's rows must
+      // be kept at full width until the last one. Rows outside the region share the
+      // scratch row; only the last pass can stop at the bottom of the region.
+      std::vector<unsigned char>& band = state.band;
+      band.resize(fullWidth ? 0 : region.height*rowBytes);
+      state.stats.Allocated(band.size());
+
+      for (int pass = 0; pass < header.nPasses; ++pass) {
+        const png_uint_32 nRows = pass == header.nPasses - 1 ? bottom : header.h;
+
+        for (png_uint_32 y = 0; y < nRows; ++y) {
+          unsigned char* row = scratch.data();
+
+          if (y >= region.y && y < bottom) {
+            row = fullWidth ? img.Row(y - region.y) : &band[(y - region.y)*rowBytes];
+          }
+
+          png_read_row(state.libPNG.png, row, nullptr);
+        }
+      }
+
+      const StatsRecorder::Clock::time_point start = state.stats.Now();
+
+      for (unsigned int y = 0; y < region.height; ++y) {
+        if (!fullWidth) {
+          std::memcpy(img.Row(y), &band[y*rowBytes + region.x*bytesPerPixel], region.width*bytesPerPixel);
+        }
+
+        if (header.premultiply) {
+          Premultiply(header, img.Row(y), region.width);
+        }
+      }
+
+      state.stats.Lap(&DecodeStats::postProcessSeconds, start);
+    }
+
+    // Parallel decoding (PNGLoadOptions::threads)
+    //
+    // libPNG decodes a row at a time on one thread: inflate, unfilter, transform. For
+    // big images we bypass it once the header has been read & run those steps as a
+    // pipeline instead, reading the IDAT chunks straight from the caller's memory.
+
+    // Bands are sized to stay in cache between the stages
+    const std::size_t ParallelBandBytes = 256 * 1024;
+
+    std::uint32_t ReadBigEndian32(const png_byte* p) {
+      return (std::uint32_t) p[0] << 24 | (std::uint32_t) p[1] << 16 | (std::uint32_t) p[2] << 8 | p[3];
+    }
+
+    // Whether ReadImageParallel can decode the image: see PNGLoadOptions::threads.
+    // Must be called straight after ReadHeader, which leaves state.dataPos just past
+    // the header of the first IDAT chunk.
+    //
+    bool CanReadParallel(const PNGLoaderState& state, const PNGHeader& header, const PNGLoadOptions& options) {
+      if (options.threads < 2 || !state.data || (std::size_t) header.w*header.h < options.parallelThreshold) {
+        return false;
+      }
+
+      if (!options.region.Empty() || options.metadata || options.applyOrientation) {
+        return false;
+      }
+
+      if (header.nPasses != 1 || header.sourceBitDepth != 8 ||
+        png_get_valid(state.libPNG.png, state.libPNG.info, PNG_INFO_tRNS))
+      {
+        return false;
+      }
+
+      switch (header.sourceColorType) {
+      case PNG_COLOR_TYPE_GRAY:
+        break;
+
+      case PNG_COLOR_TYPE_RGB:
+      case PNG_COLOR_TYPE_RGB_ALPHA:
+        if (options.pixelFormat == PixelFormat::Gray8) {
+          return false;
+        }
+        break;
+
+      default:
+        return false;
+      }
+
+      return state.dataPos >= 8 && std::memcmp(state.data + state.dataPos - 4, "IDAT", 4) == 0;
+    }
+
+    unsigned char PaethPredictor(int a, int b, int c) {
+      const int p = a + b - c;
+      const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+
+      return (unsigned char) (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+    }
+
+    // Undoes the filter on a row of Bpp bytes per pixel, in place. row starts with the
+    // filter type; prior is the row above, already unfiltered (zeros for the first
+    // row). Returns false for an unknown filter type.
+    //
+    template<unsigned int Bpp>
+    bool UnfilterRow(unsigned char* row, const unsigned char* prior, std::size_t rowBytes) {
+      const unsigned char filter = *row++;
+
+      switch (filter) {
+      case PNG_FILTER_VALUE_NONE:
+        break;
+
+      case PNG_FILTER_VALUE_SUB:
+        for (std::size_t i = Bpp; i < rowBytes; ++i) {
+          row[i] = (unsigned char) (row[i] + row[i - Bpp]);
+        }
+        break;
+
+      case PNG_FILTER_VALUE_UP:
+        for (std::size_t i = 0; i < rowBytes; ++i) {
+          row[i] = (unsigned char) (row[i] + prior[i]);
+        }
+        break;
+
+      case PNG_FILTER_VALUE_AVG:
+        for (std::size_t i = 0; i < Bpp; ++i) {
+          row[i] = (unsigned char) (row[i] + (prior[i] >> 1));
+        }
+        for (std::size_t i = Bpp; i < rowBytes; ++i) {
+          row[i] = (unsigned char) (row[i] + ((row[i - Bpp] + prior[i]) >> 1));
+        }
+        break;
+
+      case PNG_FILTER_VALUE_PAETH:
+        // With nothing to the left the predictor is just the pixel above
+        for (std::size_t i = 0; i < Bpp; ++i) {
+          row[i] = (unsigned char) (row[i] + prior[i]);
+        }
+        for (std::size_t i = Bpp; i < rowBytes; ++i) {
+          row[i] = (unsigned char) (row[i] + PaethPredictor(row[i - Bpp], prior[i], prior[i - Bpp]));
+        }
+        break;
+
+      default:
+        return false;
+      }
+
+      return true;
+    }
+
+    bool UnfilterRow(unsigned int bpp, unsigned char* row, const unsigned char* prior, std::size_t rowBytes) {
+      switch (bpp) {
+      case 1:
+        return UnfilterRow<1>(row, prior, rowBytes);
+      case 3:
+        return UnfilterRow<3>(row, prior, rowBytes);
+      default:
+        return UnfilterRow<4>(row, prior, rowBytes);
+      }
+    }
+
+    // Converts n pixels of unfiltered 8 bit gray (srcChannels == 1), RGB or RGBA into
+    // format (not PixelFormat::Auto), giving the same result as the transforms set by
+    // SetTransforms & the premultiplication done by ReadImage.
+    //
+    void TransformRow(const unsigned char* src, unsigned int srcChannels, unsigned char* dst,
+      PixelFormat format, std::size_t n)
+    {
+      const unsigned int dstChannels = BytesPerPixel(format);
+
+      if (srcChannels != 4) {
+        if (dstChannels == srcChannels && format != PixelFormat::BGR) {
+          std::memcpy(dst, src, n*srcChannels);
+        }
+        else {
+          // Any alpha added is opaque so there is nothing to premultiply
+          ConvertRow(src, srcChannels, dst, format, n);
+        }
+        return;
+      }
+
+      if (dstChannels == 4 && format != PixelFormat::RGBX) {
+        std::memcpy(dst, src, n*4);
+
+        if (format == PixelFormat::BGRA) {
+          SwapRedBlue32(dst, n);
+        }
+        else if (format == PixelFormat::PremultipliedRGBA) {
+          PremultiplyAlpha(dst, n);
+        }
+        return;
+      }
+
+      // png_set_strip_alpha &, for RGBX, an opaque filler
+      const bool bgr = format == PixelFormat::BGR;
+
+      for (std::size_t i = 0; i < n; ++i, src += 4, dst += dstChannels) {
+        dst[0] = bgr ? src[2] : src[0];
+        dst[1] = src[1];
+        dst[2] = bgr ? src[0] : src[2];
+
+        if (dstChannels == 4) {
+          dst[3] = 255;
+        }
+      }
+    }
+
+    // ParallelPNG decodes the image data as a three stage pipeline over bands of rows,
+    // each band passing through a small ring of buffers:
+    //
+    // 1. Inflate: the calling thread walks the IDAT chunks, checking each CRC as
+    //    libPNG would, & inflates the next band's rows (filter type bytes & all).
+    // 2. Unfilter: one thread undoes the row filters, band after band. Each row is
+    //    predicted from the one above so this stage can't be split any further.
+    // 3. Transform: the remaining threads convert unfiltered bands into the Image.
+    //    With only two threads the unfilter thread does this as well.
+    //
+    // A buffer goes back to the inflate stage once its band is in the Image, so the
+    // memory used is bounded by the ring rather than the image. The first error stops
+    // every stage.
+    //
+    class ParallelPNG {
+    public:
+      ParallelPNG(const PNGHeader& header, PixelFormat format, unsigned int nThreads, Image& img)
+        : img_(img), h_(header.h), w_(header.w),
+          srcChannels_(header.sourceColorType == PNG_COLOR_TYPE_GRAY ? 1 : header.sourceColorType == PNG_COLOR_TYPE_RGB ? 3 : 4),
+          format_(format), rowBytes_((std::size_t) header.w*srcChannels_),
+          bandRows_((unsigned int) std::min<std::size_t>(header.h, std::max<std::size_t>(1, ParallelBandBytes / (rowBytes_ + 1)))),
+          nBands_((header.h + bandRows_ - 1) / bandRows_),
+          nTransformThreads_(std::min(nThreads, nBands_ + 2) - 2),
+          failed_(false), error_(DecodeError::None), message_(nullptr),
+          unfiltered_(0), nextTransform_(0), transformed_(0)
+      {
+        if (format_ == PixelFormat::Auto) {
+          format_ = srcChannels_ == 4 ? PixelFormat::RGBA : PixelFormat::RGB;
+        }
+
+        ring_.resize(nTransformThreads_ + 3);
+
+        for (Band& band : ring_) {
+          band.rows.resize(bandRows_*(rowBytes_ + 1));
+          band.index = 0;
+          band.state = Band::State::Free;
+        }
+
+        prior_.assign(rowBytes_, 0);
+      }
+
+      ~ParallelPNG() {
+        Stop(DecodeError::Corrupt, nullptr);
+        Join();
+      }
+
+      ParallelPNG(const ParallelPNG&) = delete;
+      ParallelPNG& operator= (const ParallelPNG&) = delete;
+
+      std::size_t BufferBytes() const {
+        return ring_.size()*ring_[0].rows.size() + prior_.size();
+      }
+
+      // Starts the unfilter & transform threads. Returns false, having done nothing,
+      // if they can't be started.
+      //
+      bool Start() {
+        try {
+          threads_.emplace_back([this]() { UnfilterStage(); });
+
+          for (unsigned int i = 0; i < nTransformThreads_; ++i) {
+            threads_.emplace_back([this]() { TransformStage(); });
+          }
+        }
+        catch (...) {
+          Stop(DecodeError::OutOfMemory, nullptr);
+          Join();
+          return false;
+        }
+
+        return true;
+      }
+
+      // Runs the inflate stage on the calling thread, from the data of the IDAT chunk
+      // at idatPos onwards, then checks the rest of the PNG as png_read_end would (see
+      // ReadTrailer) & waits for the other stages to finish. On an error, returns it &
+      // sets message. bytesRead is set to the bytes consumed from idatPos.
+      //
+      DecodeError Inflate(const png_byte* data, std::size_t size, std::size_t idatPos,
+        const char*& message, std::size_t& bytesRead);
+
+    private:
+      struct Band {
+        enum class State { Free, Inflated, Unfiltered };
+
+        // Each row is its filter type followed by rowBytes_ of pixels
+        std::vector<unsigned char> rows;
+        unsigned int index;
+        State state;
+      };
+
+      unsigned int RowsIn(unsigned int band) const {
+        return std::min(bandRows_, h_ - band*bandRows_);
+      }
+
+      Band& BandFor(unsigned int band) {
+        return ring_[band % ring_.size()];
+      }
+
+      void Stop(DecodeError error, const char* message) {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        if (!failed_) {
+          failed_ = true;
+          error_ = error;
+          message_ = message;
+        }
+
+        changed_.notify_all();
+      }
+
+      void Join() {
+        for (std::thread& t : threads_) {
+          if (t.joinable()) {
+            t.join();
+          }
+        }
+      }
+
+      bool ReadTrailer(const png_byte* data, std::size_t size, std::size_t& pos);
+
+      void UnfilterStage();
+      void TransformStage();
+      void Transform(unsigned int band);
+
+      // Marks a band transformed, freeing its buffer for the inflate stage
+      void Done(unsigned int band);
+
+      Image& img_;
+      const unsigned int h_;
+      const unsigned int w_;
+      const unsigned int srcChannels_;
+      PixelFormat format_;
+      const std::size_t rowBytes_;
+      const unsigned int bandRows_;
+      const unsigned int nBands_;
+      const unsigned int nTransformThreads_;
+
+      std::vector<Band> ring_;
+
+      // The last row of the previous band, unfiltered. Only used by the unfilter stage.
+      std::vector<unsigned char> prior_;
+
+      std::vector<std::thread> threads_;
+
+      // Guards everything below & each band's state
+      std::mutex lock_;
+      std::condition_variable changed_;
+
+      bool failed_;
+      DecodeError error_;
+      const char* message_;
+
+      // Bands [0, unfiltered_) have been unfiltered; nextTransform_ is the next of
+      // them to be claimed by a transform thread.
+      unsigned int unfiltered_;
+      unsigned int nextTransform_;
+      unsigned int transformed_;
+    };
+
+    DecodeError ParallelPNG::Inflate(const png_byte* data, std::size_t size, std::size_t idatPos,
+      const char*& message, std::size_t& bytesRead)
+    {
+      z_stream zs = z_stream();
+      std::size_t chunkStart = idatPos - 8;
+      std::size_t chunkEnd = idatPos;
+      bool first = true;
+      bool streamEnded = false;
+      std::size_t end = idatPos;
+
+      // Moves zs on to the data of the next IDAT chunk (the first, on the first call)
+      auto nextChunk = [&]() -> bool {
+        if (!first) {
+          if (size - chunkEnd < 12) {
+            Stop(DecodeError::Truncated, "Unexpected end of file.");
+            return false;
+          }
+
+          if (std::memcmp(data + chunkEnd + 8, "IDAT", 4) != 0) {
+            Stop(DecodeError::Corrupt, "Not enough PNG image data.");
+            return false;
+          }
+
+          chunkStart = chunkEnd + 4;
+        }
+
+        first = false;
+
+        const std::size_t start = chunkStart + 8;
+        const std::uint32_t length = ReadBigEndian32(data + chunkStart);
+
+        if (length > PNG_UINT_31_MAX) {
+          Stop(DecodeError::Corrupt, "Bad PNG chunk length.");
+          return false;
+        }
+
+        if (size - start < (std::size_t) length + 4) {
+          Stop(DecodeError::Truncated, "Unexpected end of file.");
+          return false;
+        }
+
+        chunkEnd = start + length;
+
+        const uLong crc = crc32(crc32(0, data + chunkStart + 4, 4), data + start, length);
+        if (crc != ReadBigEndian32(data + chunkEnd)) {
+          Stop(DecodeError::Corrupt, "PNG image data CRC error.");
+          return false;
+        }
+
+        zs.next_in = const_cast<png_byte*>(data + start);
+        zs.avail_in = length;
+        return true;
+      };
+
+      if (inflateInit(&zs) != Z_OK) {
+        Stop(DecodeError::OutOfMemory, "Insufficient memory to decompress the PNG image data.");
+      }
+      else {
+        bool ok = true;
+
+        for (unsigned int b = 0; b < nBands_ && ok; ++b) {
+          Band& band = BandFor(b);
+
+          {
+            std::unique_lock<std::mutex> guard(lock_);
+            changed_.wait(guard, [&]() { return failed_ || band.state == Band::State::Free; });
+
+            if (failed_) {
+              break;
+            }
+          }
+
+          std::size_t remaining = RowsIn(b)*(rowBytes_ + 1);
+          zs.next_out = band.rows.data();
+
+          while (ok && remaining) {
+            if (zs.avail_in == 0 && !nextChunk()) {
+              ok = false;
+              break;
+            }
+
+            const uInt out = (uInt) std::min<std::size_t>(remaining, std::numeric_limits<uInt>::max());
+            zs.avail_out = out;
+
+            const int result = inflate(&zs, Z_NO_FLUSH);
+            remaining -= out - zs.avail_out;
+            streamEnded = result == Z_STREAM_END;
+
+            if (result == Z_STREAM_END && remaining) {
+              Stop(DecodeError::Corrupt, "Not enough PNG image data.");
+              ok = false;
+            }
+            else if (result == Z_MEM_ERROR) {
+              Stop(DecodeError::OutOfMemory, "Insufficient memory to decompress the PNG image data.");
+              ok = false;
+            }
+            else if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+              Stop(DecodeError::Corrupt, "Bad PNG image data.");
+              ok = false;
+            }
+          }
+
+          if (ok) {
+            std::lock_guard<std::mutex> guard(lock_);
+            band.index = b;
+            band.state = Band::State::Inflated;
+            changed_.notify_all();
+          }
+        }
+
+        // Like libPNG, the rest of the zlib stream is inflated so that its Adler-32 is
+        // checked, but any data beyond the last row (& after the end of the stream) is
+        // ignored
+        unsigned char discard[256];
+
+        while (ok && !streamEnded) {
+          if (zs.avail_in == 0 && !nextChunk()) {
+            ok = false;
+            break;
+          }
+
+          zs.next_out = discard;
+          zs.avail_out = sizeof(discard);
+
+          const int result = inflate(&zs, Z_NO_FLUSH);
+          streamEnded = result == Z_STREAM_END;
+
+          if (result == Z_MEM_ERROR) {
+            Stop(DecodeError::OutOfMemory, "Insufficient memory to decompress the PNG image data.");
+            ok = false;
+          }
+          else if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            Stop(DecodeError::Corrupt, "Bad PNG image data.");
+            ok = false;
+          }
+        }
+
+        inflateEnd(&zs);
+
+        end = chunkEnd + 4;
+        if (ok) {
+          ReadTrailer(data, size, end);
+        }
+      }
+
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        changed_.wait(guard, [&]() { return failed_ || transformed_ == nBands_; });
+      }
+
+      Join();
+
+      bytesRead = first ? 0 : end - idatPos;
+      message = message_;
+      return failed_ ? error_ : DecodeError::None;
+    }
+
+    // Reads the chunks from pos (just after the IDAT chunk in which the zlib stream
+    // ended) up to & including IEND, leaving pos after it. As in png_read_end, the
+    // chunks themselves are ignored but a missing IEND is an error, as is a bad CRC
+    // on a critical chunk (including further IDATs); bad CRCs on ancillary chunks are
+    // ignored. Returns false, having called Stop, on an error.
+    //
+    bool ParallelPNG::ReadTrailer(const png_byte* data, std::size_t size, std::size_t& pos) {
+      for (;;) {
+        if (size - pos < 8) {
+          Stop(DecodeError::Truncated, "Unexpected end of file.");
+          return false;
+        }
+
+        const std::uint32_t length = ReadBigEndian32(data + pos);
+        const png_byte* type = data + pos + 4;
+
+        if (length > PNG_UINT_31_MAX) {
+          Stop(DecodeError::Corrupt, "Bad PNG chunk length.");
+          return false;
+        }
+
+        if (size - pos - 8 < (std::size_t) length + 4) {
+          Stop(DecodeError::Truncated, "Unexpected end of file.");
+          return false;
+        }
+
+        // Bit 5 of the first letter of the type is clear for critical chunks
+        const bool critical = (type[0] & 0x20) == 0;
+        const uLong crc = crc32(0, type, 4 + length);
+
+        if (critical && crc != ReadBigEndian32(type + 4 + length)) {
+          Stop(DecodeError::Corrupt, "PNG chunk CRC error.");
+          return false;
+        }
+
+        pos += 12 + (std::size_t) length;
+
+        if (std::memcmp(type, "IEND", 4) == 0) {
+          return true;
+        }
+      }
+    }
+
+    void ParallelPNG::UnfilterStage() {
+      for (unsigned int b = 0; b < nBands_; ++b) {
+        Band& band = BandFor(b);
+
+        {
+          std::unique_lock<std::mutex> guard(lock_);
+          changed_.wait(guard, [&]() {
+            return failed_ || (band.state == Band::State::Inflated && band.index == b);
+          });
+
+          if (failed_) {
+            return;
+          }
+        }
+
+        const unsigned char* prior = prior_.data();
+
+        for (unsigned int y = 0, n = RowsIn(b); y < n; ++y) {
+          unsigned char* row = &band.rows[y*(rowBytes_ + 1)];
+
+          if (!UnfilterRow(srcChannels_, row, prior, rowBytes_)) {
+            Stop(DecodeError::Corrupt, "Bad PNG row filter.");
+            return;
+          }
+
+          prior = row + 1;
+        }
+
+        std::memcpy(prior_.data(), prior, rowBytes_);
+
+        if (nTransformThreads_ == 0) {
+          Transform(b);
+          Done(b);
+        }
+        else {
+          std::lock_guard<std::mutex> guard(lock_);
+          band.state = Band::State::Unfiltered;
+          unfiltered_ = b + 1;
+          changed_.notify_all();
+        }
+      }
+    }
+
+    void ParallelPNG::TransformStage() {
+      for (;;) {
+        unsigned int b;
+
+        {
+          std::unique_lock<std::mutex> guard(lock_);
+          changed_.wait(guard, [&]() {
+            return failed_ || nextTransform_ < unfiltered_ || nextTransform_ == nBands_;
+          });
+
+          if (failed_ || nextTransform_ == nBands_) {
+            return;
+          }
+
+          b = nextTransform_++;
+        }
+
+        Transform(b);
+        Done(b);
+      }
+    }
+
+    void ParallelPNG::Transform(unsigned int b) {
+      const Band& band = BandFor(b);
+
+      for (unsigned int y = 0, n = RowsIn(b); y < n; ++y) {
+        TransformRow(&band.rows[y*(rowBytes_ + 1) + 1], srcChannels_, img_.Row(b*bandRows_ + y), format_, w_);
+      }
+    }
+
+    void ParallelPNG::Done(unsigned int b) {
+      std::lock_guard<std::mutex> guard(lock_);
+      BandFor(b).state = Band::State::Free;
+      ++transformed_;
+      changed_.notify_all();
+    }
+
+    // Decodes the image into img (which must have the dimensions given by header) with
+    // ParallelPNG, given that CanReadParallel agreed. Returns false, having read
+    // nothing, if the threads couldn't be started; errors in the data are returned
+    // through error. Makes no libPNG calls, so it can't longjmp.
+    //
+    // postProcessSeconds doesn't include the transforms: they overlap the inflating.
+    //
+    bool ReadImageParallel(PNGLoaderState& state, const PNGHeader& header, const PNGLoadOptions& options,
+      Image& img, DecodeError& error)
+    {
+      ParallelPNG decoder(header, options.pixelFormat, options.threads, img);
+      state.stats.Allocated(decoder.BufferBytes());
+
+      if (!decoder.Start()) {
+        state.stats.Freed(decoder.BufferBytes());
+        return false;
+      }
+
+      std::size_t bytesRead = 0;
+      error = decoder.Inflate(state.data, state.dataSize, state.dataPos, state.message, bytesRead);
+
+      state.dataPos += bytesRead;
+      state.stats.BytesRead(bytesRead);
+      state.stats.Freed(decoder.BufferBytes());
+      return true;
+    }
+
+    // PNGReader implements the ImageReader interface on top of libPNG's row by row
+    // reading.
+    //
+    // Interlaced images are the awkward case: the rows aren't complete until the final
+    // pass so the only way to hand them out is to decode the whole image first. In that
+    // case the first call to ReadRows decodes into an internal Image & subsequent
+    // calls copy out of it.
+    //
+    class PNGReader : public ImageReader {
+    public:
+      explicit PNGReader(std::istream& src)
+        : state_(src), header_(), row_(0)
+      {
+        if (setjmp(png_jmpbuf(state_.libPNG.png))) {
+          ThrowCurrentError(state_);
+        }
+
+        InstallIOAdapter(state_);
+        header_ = ReadHeader(state_, PixelFormat::Auto, false);
+      }
+
+      unsigned int Width() const noexcept override { return header_.w; }
+      unsigned int Height() const noexcept override { return header_.h; }
+      unsigned int BitsPerPixel() const noexcept override { return header_.BitsPerPixel(); }
+      unsigned int RowsRead() const noexcept override { return row_; }
+
+      unsigned int ReadRows(unsigned char* dst, unsigned int nRows) override {
+        // volatile: set before the setjmp below & read after it
+        const volatile unsigned int n = std::min(nRows, header_.h - row_);
+
+        if (n == 0) {
+          return 0;
+        }
+
+        if (setjmp(png_jmpbuf(state_.libPNG.png))) {
+          ThrowCurrentError(state_);
+        }
+
+        if (header_.nPasses > 1) {
+          if (row_ == 0) {
+            state_.img = Image(header_.w, header_.h, header_.BitsPerPixel());
+            ReadImage(state_, header_, state_.img);
+          }
+
+          std::memcpy(dst, state_.img.Pixels() + row_*header_.RowBytes(), n*header_.RowBytes());
+        }
+        else {
+          for (unsigned int i = 0; i < n; ++i) {
+            png_read_row(state_.libPNG.png, dst + i*header_.RowBytes(), nullptr);
+          }
+        }
+
+        row_ += n;
+
+        if (row_ == header_.h) {
+          png_read_end(state_.libPNG.png, nullptr);
+          state_.img = Image();
+        }
+
+        return n;
+      }
+
+    private:
+      PNGLoaderState state_;
+      PNGHeader header_;
+      unsigned int row_;
+    };
+
+    // IncrementalPNGDecoder uses libPNG's progressive reader: png_process_data accepts
+    // data in pieces of any size, buffers any incomplete chunk itself & calls back as
+    // the header & each row are decoded.
+    //
+    // With interlace handling on, libPNG calls back for every row of every pass &
+    // png_progressive_combine_row fills in the pixels that later passes will provide
+    // by repeating the ones this pass has. After each pass the image is a complete,
+    // if blocky, version of the final one.
+    //
+    // As with ReadImage, premultiplication happens on the last pass, so the earlier
+    // passes of a PixelFormat::PremultipliedRGBA image are not yet premultiplied.
+    //
+    class IncrementalPNGDecoder : public IncrementalDecoder {
+    public:
+      explicit IncrementalPNGDecoder(const PNGLoadOptions& options)
+        : options_(options), header_()
+      {
+        if (setjmp(png_jmpbuf(state_.libPNG.png))) {
+          ThrowCurrentError(state_);
+        }
+
+        png_set_progressive_read_fn(state_.libPNG.png, this, &InfoCallback, &RowCallback, &EndCallback);
+      }
+
+      void Feed(const unsigned char* data, std::size_t size) override {
+        if (done || size == 0) {
+          return;
+        }
+
+        if (setjmp(png_jmpbuf(state_.libPNG.png))) {
+          ThrowCurrentError(state_);
+        }
+
+        // libPNG only reads from the buffer, despite the non-const parameter
+        png_process_data(state_.libPNG.png, state_.libPNG.info, (png_bytep) data, size);
+      }
+
+    private:
+      // The callbacks are called from C so exceptions are handed back to Feed in the
+      // same way as the IO adapters do.
+
+      static void InfoCallback(png_structp png, png_infop) {
+        IncrementalPNGDecoder* self = (IncrementalPNGDecoder*) png_get_progressive_ptr(png);
+
+        self->state_.headerRead = true;
+
+        try {
+          self->header_ = ConfigureHeader(self->state_, self->options_.pixelFormat, self->options_.keep16Bit);
+          self->image = Image(self->header_.w, self->header_.h, self->header_.BitsPerPixel(),
+            self->options_.rowAlignment, self->options_.allocator);
+          self->headerReady = true;
+        }
+        catch (...) {
+          self->state_.currentError = std::current_exception();
+          png_error(png, "Exception adapter");
+        }
+      }
+
+      static void RowCallback(png_structp png, png_bytep row, png_uint_32 y, int pass) {
+        IncrementalPNGDecoder* self = (IncrementalPNGDecoder*) png_get_progressive_ptr(png);
+
+        // row is null for rows that the pass doesn't touch
+        png_progressive_combine_row(png, self->image.Row(y), row);
+
+        // Every pass before this one is complete
+        self->refinements = pass;
+
+        if (pass == self->header_.nPasses - 1) {
+          self->FinishRows(y + 1);
+        }
+      }
+
+      static void EndCallback(png_structp png, png_infop) {
+        IncrementalPNGDecoder* self = (IncrementalPNGDecoder*) png_get_progressive_ptr(png);
+
+        // A small enough image has nothing in the last pass
+        self->FinishRows(self->header_.h);
+        self->refinements = self->header_.nPasses > 1 ? self->header_.nPasses : 0;
+        self->done = true;
+      }
+
+      // Marks rows up to end as complete
+      //
+      void FinishRows(png_uint_32 end) {
+        for (; rowsComplete < end; ++rowsComplete) {
+          if (header_.premultiply) {
+            Premultiply(header_, image.Row(rowsComplete), header_.w);
+          }
+        }
+      }
+
+      PNGLoaderState state_;
+      PNGLoadOptions options_;
+      PNGHeader header_;
+    };
+
+    // Starts collecting DecodeStats (if stats isn't null) into state.stats, including
+    // libPNG's allocations from now on.
+    //
+    void AttachStats(PNGLoaderState& state, DecodeStats* stats) {
+      if (stats) {
+        *stats = DecodeStats();
+        state.stats = StatsRecorder(stats);
+        state.memory.stats = &state.stats;
+      }
+    }
+
+    // Reads the chunks after the image data. They are only stored (in the main info
+    // struct, where ReadMetadata looks) if we want metadata from them.
+    //
+    void ReadEnd(PNGLoaderState& state, bool metadata) {
+      png_read_end(state.libPNG.png, metadata ? state.libPNG.info : nullptr);
+    }
+
+    // The body of LoadPNG & TryLoadPNG. Decodes into state.img, returning
+    // DecodeError::None, or returns why decoding failed: errors in the data are never
+    // thrown, so that rejecting a corrupt image doesn't cost an exception. (A region
+    // outside the image & a failure to allocate the Image are still thrown.)
+    //
+    DecodeError TryDecompress(PNGLoaderState& state, const PNGLoadOptions& options) {
+      // LoadPNG has a specific order of operation...
+      // (1) Allocate PNGLoaderState - we now have the PNG data structures needed
+      //     (done by the public LoadPNG overloads)
+      // (2) Call setjmp to setup error handling (pretty much any libPNG call can
+      //     fail with a longjmp but NOT create_read/info_struct - unlike libJPEG)
+      // (3) Install the IO adapter (std::istream or memory)
+      // (4) Read the header & configure the transforms we need
+      // (5) Allocate the Image (using the newly known image dimensions)
+      // (6) Decompress each row straight into the Image (for a region, only as far
+      //     as its bottom row; for a big image with threads to spare, see ParallelPNG)
+      //
+      // We deliberately avoid png_read_png: it allocates a complete copy of the image
+      // which we would then have to copy again. Reading row by row means the Image
+      // pixel buffer is the *only* full-size allocation made.
+
+      PNGHeader header;
+      StatsRecorder::Clock::time_point headerEnd;
+      const bool metadata = options.metadata || options.applyOrientation;
+
+      if (options.metadata) {
+        *options.metadata = ImageMetadata();
+      }
+
+      AttachStats(state, options.stats);
+      const StatsRecorder::Clock::time_point start = state.stats.Now();
+
+      if (setjmp(png_jmpbuf(state.libPNG.png))) {
+        state.img = Image();
+        return state.error;
+      }
+
+      InstallIOAdapter(state);
+
+      header = ReadHeader(state, options.pixelFormat, options.keep16Bit);
+
+      if (metadata) {
+        ReadMetadata(state, options);
+      }
+
+      headerEnd = state.stats.Lap(&DecodeStats::headerSeconds, start);
+
+      if (!options.region.Empty()) {
+        const Region region = options.region.ClippedTo(header.w, header.h);
+
+        if (region.Empty()) {
+          throw std::out_of_range("The requested region lies outside the PNG image.");
+        }
+
+        state.img = Image(region.width, region.height, header.BitsPerPixel(), options.rowAlignment, options.allocator);
+        state.stats.Allocated(ByteSize(state.img));
+
+        ReadRegion(state, header, region, state.img);
+
+        // Unless the region reaches the bottom of the image we stop reading part way
+        // through the image data, so there are no trailing chunks to read
+        if (region.y + region.height == header.h) {
+          ReadEnd(state, metadata);
+        }
+      }
+      else {
+        state.img = Image(header.w, header.h, header.BitsPerPixel(), options.rowAlignment, options.allocator);
+        state.stats.Allocated(ByteSize(state.img));
+
+        DecodeError error = DecodeError::None;
+
+        if (CanReadParallel(state, header, options) && ReadImageParallel(state, header, options, state.img, error)) {
+          // ParallelPNG has read on to IEND, as ReadEnd would
+          if (error != DecodeError::None) {
+            state.img = Image();
+            state.error = error;
+            return error;
+          }
+        }
+        else {
+          ReadImage(state, header, state.img);
+
+          // Reads any trailing chunks so that src is left just past the end of the PNG stream
+          ReadEnd(state, metadata);
+        }
+      }
+
+      if (metadata) {
+        ReadMetadata(state, options);
+      }
+
+      if (options.applyOrientation) {
+        const StatsRecorder::Clock::time_point orientStart = state.stats.Now();
+        ApplyOrientation(state.img, state.orientation);
+        state.stats.Lap(&DecodeStats::postProcessSeconds, orientStart);
+      }
+
+      state.stats.Lap(&DecodeStats::decodeSeconds, headerEnd);
+      state.stats.Output(state.img);
+
+      return DecodeError::None;
+    }
+
+    Image Decompress(PNGLoaderState& state, const PNGLoadOptions& options) {
+      if (TryDecompress(state, options) != DecodeError::None) {
+        ThrowCurrentError(state);
+      }
+
+      // state.img is a member so it must be moved explicitly; returning it by name would
+      // copy the whole pixel buffer.
+      return std::move(state.img);
+    }
+
+    // Runs TryDecompress on a state constructed from args, turning the exceptions that
+    // can still result from bad data (allocation failures & errors from the stream)
+    // into error codes.
+    //
+    template<class... Args>
+    LoadResult TryLoad(const PNGLoadOptions& options, Args&&... args) {
+      LoadResult result;
+
+      try {
+        PNGLoaderState state(std::forward<Args>(args)...);
+        result.error = TryDecompress(state, options);
+        result.image = std::move(state.img);
+      }
+      catch (std::bad_alloc&) {
+        result.error = DecodeError::OutOfMemory;
+      }
+      catch (std::ios::failure&) {
+        result.error = DecodeError::IO;
+      }
+
+      return result;
+    }
+
+    // Reads the header only (everything up to the first IDAT chunk).
+    //
+    ImageInfo Probe(PNGLoaderState& state) {
+      ImageInfo info;
+
+      if (setjmp(png_jmpbuf(state.libPNG.png))) {
+        ThrowCurrentError(state);
+      }
+
+      InstallIOAdapter(state);
+
+      png_read_info(state.libPNG.png, state.libPNG.info);
+      state.headerRead = true;
+
+      const png_structp png = state.libPNG.png;
+      const png_infop pngInfo = state.libPNG.info;
+
+      info.format = ImageFormat::PNG;
+      info.width = png_get_image_width(png, pngInfo);
+      info.height = png_get_image_height(png, pngInfo);
+      info.bitDepth = png_get_bit_depth(png, pngInfo);
+      info.interlaced = png_get_interlace_type(png, pngInfo) != PNG_INTERLACE_NONE;
+      info.hasICCProfile = png_get_valid(png, pngInfo, PNG_INFO_iCCP) != 0;
+#ifdef PNG_eXIf_SUPPORTED
+      info.hasEXIF = png_get_valid(png, pngInfo, PNG_INFO_eXIf) != 0;
+#endif
+
+      // Count the channels of the colour model rather than of the stored data, which
+      // for palette images is a single index
+      if (png_get_color_type(png, pngInfo) == PNG_COLOR_TYPE_PALETTE) {
+        info.channels = png_get_valid(png, pngInfo, PNG_INFO_tRNS) ? 4 : 3;
+      }
+      else {
+        info.channels = png_get_channels(png, pngInfo);
+      }
+
+      return info;
+    }
+  }
+
+  Image LoadPNG(std::istream& src) {
+    return LoadPNG(src, PNGLoadOptions());
+  }
+
+  Image LoadPNG(std::istream& src, const PNGLoadOptions& options) {
+    PNGLoaderState state(src);
+    return Decompress(state, options);
+  }
+
+  Image LoadPNG(const void* data, std::size_t size) {
+    return LoadPNG(data, size, PNGLoadOptions());
+  }
+
+  Image LoadPNG(const void* data, std::size_t size, const PNGLoadOptions& options) {
+    PNGLoaderState state(data, size);
+    return Decompress(state, options);
+  }
+
+  LoadResult TryLoadPNG(std::istream& src) {
+    return TryLoadPNG(src, PNGLoadOptions());
+  }
+
+  LoadResult TryLoadPNG(std::istream& src, const PNGLoadOptions& options) {
+    return TryLoad(options, src);
+  }
+
+  LoadResult TryLoadPNG(const void* data, std::size_t size) {
+    return TryLoadPNG(data, size, PNGLoadOptions());
+  }
+
+  LoadResult TryLoadPNG(const void* data, std::size_t size, const PNGLoadOptions& options) {
+    return TryLoad(options, data, size);
+  }
+
+  ImageInfo ProbePNG(std::istream& src) {
+    PNGLoaderState state(src);
+    return Probe(state);
+  }
+
+  ImageInfo ProbePNG(const void* data, std::size_t size) {
+    PNGLoaderState state(data, size);
+    return Probe(state);
+  }
+
+  std::unique_ptr<ImageReader> OpenPNGReader(std::istream& src) {
+    return std::unique_ptr<ImageReader>(new PNGReader(src));
+  }
+
+  std::unique_ptr<IncrementalDecoder> CreateIncrementalPNGDecoder(const PNGLoadOptions& options) {
+    return std::unique_ptr<IncrementalDecoder>(new IncrementalPNGDecoder(options));
+  }
+
+  // libPNG has no way to reset a read struct for another image, so each decode still
+  // creates its own. What a PNGDecoder saves is the allocations: libPNG & zlib's
+  // blocks are recycled through cache.
+  //
+  struct PNGDecoder::Impl {
+    explicit Impl(const PNGLoadOptions& options)
+      : options(options)
+    {
+    }
+
+    const PNGLoadOptions options;
+    PNGBlockCache cache;
+  };
+
+  PNGDecoder::PNGDecoder()
+    : PNGDecoder(PNGLoadOptions())
+  {
+  }
+
+  PNGDecoder::PNGDecoder(const PNGLoadOptions& options)
+    : impl_(new Impl(options))
+  {
+  }
+
+  PNGDecoder::~PNGDecoder() {
+  }
+
+  const PNGLoadOptions& PNGDecoder::Options() const noexcept {
+    return impl_->options;
+  }
+
+  Image PNGDecoder::Decode(std::istream& src) {
+    PNGLoaderState state(src, &impl_->cache);
+    return Decompress(state, impl_->options);
+  }
+
+  Image PNGDecoder::Decode(const void* data, std::size_t size) {
+    PNGLoaderState state(data, size, &impl_->cache);
+    return Decompress(state, impl_->options);
+  }
+
+  LoadResult PNGDecoder::TryDecode(std::istream& src) {
+    return TryLoad(impl_->options, src, &impl_->cache);
+  }
+
+  LoadResult PNGDecoder::TryDecode(const void* data, std::size_t size) {
+    return TryLoad(impl_->options, data, size, &impl_->cache);
+  }
+
+}
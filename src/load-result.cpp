@@ -0,0 +1,36 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+namespace james {
+
+  const char* DecodeErrorMessage(DecodeError error) noexcept {
+    switch (error) {
+    case DecodeError::None: return "No error.";
+    case DecodeError::Truncated: return "The image data is truncated.";
+    case DecodeError::BadHeader: return "The image header is invalid.";
+    case DecodeError::UnsupportedFormat: return "The image uses an unsupported format.";
+    case DecodeError::OutOfMemory: return "Out of memory.";
+    case DecodeError::IO: return "Error reading the image stream.";
+    case DecodeError::Corrupt: return "The image data is corrupt.";
+    }
+    return "Unknown error.";
+  }
+
+}
@@ -0,0 +1,141 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "mapped-file.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <Windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace james {
+
+#ifdef _WIN32
+
+  static std::system_error LastError(const char* what) {
+    return std::system_error(std::error_code((int) GetLastError(), std::system_category()), what);
+  }
+
+  MappedFile::MappedFile(const char* path)
+    : data_(nullptr), size_(0)
+  {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw LastError("Unable to open image file");
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+      std::system_error e(LastError("Unable to determine image file size"));
+      CloseHandle(file);
+      throw e;
+    }
+
+    if (fileSize.QuadPart == 0) {
+      CloseHandle(file);
+      return;
+    }
+
+    if ((unsigned long long) fileSize.QuadPart > (std::size_t) -1) {
+      CloseHandle(file);
+      throw std::runtime_error("Image file is too large to map into memory.");
+    }
+
+    // The mapping object & view keep the file open so the handle can go immediately
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+      throw LastError("Unable to map image file");
+    }
+
+    data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data_) {
+      throw LastError("Unable to map image file");
+    }
+
+    size_ = (std::size_t) fileSize.QuadPart;
+  }
+
+  MappedFile::~MappedFile() {
+    if (data_) {
+      UnmapViewOfFile(data_);
+    }
+  }
+
+#else
+
+  MappedFile::MappedFile(const char* path)
+    : data_(nullptr), size_(0)
+  {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "Unable to open image file");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      std::system_error e(errno, std::generic_category(), "Unable to determine image file size");
+      close(fd);
+      throw e;
+    }
+
+    if (info.st_size == 0) {
+      close(fd);
+      return;
+    }
+
+    if ((unsigned long long) info.st_size > (std::size_t) -1) {
+      close(fd);
+      throw std::runtime_error("Image file is too large to map into memory.");
+    }
+
+    // The mapping keeps its own reference to the file so fd can be closed immediately
+    void* data = mmap(nullptr, (std::size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int mapError = errno;
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw std::system_error(mapError, std::generic_category(), "Unable to map image file");
+    }
+
+    // Purely advisory so failure isn't an error
+    madvise(data, (std::size_t) info.st_size, MADV_SEQUENTIAL);
+
+    data_ = data;
+    size_ = (std::size_t) info.st_size;
+  }
+
+  MappedFile::~MappedFile() {
+    if (data_) {
+      munmap(const_cast<void*>(data_), size_);
+    }
+  }
+
+#endif
+
+}
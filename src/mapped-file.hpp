@@ -0,0 +1,48 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Internal to Image Loader: not part of the public interface.
+
+#include <cstddef>
+
+namespace james {
+
+  // MappedFile is a RAII type for a read-only memory mapping of an entire file.
+  //
+  // An empty file is represented by data == nullptr & size == 0 since neither
+  // platform will map a zero length file.
+  //
+  class MappedFile {
+  public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    const void* Data() const noexcept { return data_; }
+    std::size_t Size() const noexcept { return size_; }
+
+  private:
+    const void* data_;
+    std::size_t size_;
+  };
+
+}
@@ -0,0 +1,185 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+namespace james {
+
+  namespace {
+
+    void* AlignedAlloc(std::size_t size, std::size_t alignment) {
+#ifdef _WIN32
+      void* ptr = _aligned_malloc(size, alignment);
+#else
+      void* ptr = nullptr;
+      if (posix_memalign(&ptr, alignment, size) != 0) {
+        ptr = nullptr;
+      }
+#endif
+      if (!ptr) {
+        throw std::bad_alloc();
+      }
+      return ptr;
+    }
+
+    void AlignedFree(void* ptr) noexcept {
+#ifdef _WIN32
+      _aligned_free(ptr);
+#else
+      std::free(ptr);
+#endif
+    }
+
+  }
+
+  struct PixelBufferPool::Impl {
+    explicit Impl(std::size_t maxRetainedBytes)
+      : maxRetainedBytes(maxRetainedBytes), hits(0), misses(0), retainedBytes(0), retainedBuffers(0)
+    {
+    }
+
+    const std::size_t maxRetainedBytes;
+
+    mutable std::mutex lock;
+    std::unordered_map<std::size_t, std::vector<void*>> freeLists;
+    unsigned long long hits;
+    unsigned long long misses;
+    std::size_t retainedBytes;
+    std::size_t retainedBuffers;
+  };
+
+  PixelBufferPool::PixelBufferPool(std::size_t maxRetainedBytes)
+    : impl_(new Impl(maxRetainedBytes))
+  {
+  }
+
+  PixelBufferPool::~PixelBufferPool() {
+    Trim();
+  }
+
+  std::size_t PixelBufferPool::SizeClass(std::size_t size) noexcept {
+    if (size <= Alignment) {
+      return Alignment;
+    }
+
+    // Round up to a multiple of a quarter of the largest power of two <= size
+    std::size_t power = Alignment;
+    while (power <= size / 2) {
+      power *= 2;
+    }
+
+    // Sizes too close to SIZE_MAX to round up are left as they are (Allocate
+    // refuses them anyway)
+    const std::size_t step = power / 4;
+    if (size > SIZE_MAX - (step - 1)) {
+      return size;
+    }
+
+    return (size + step - 1) / step * step;
+  }
+
+  void* PixelBufferPool::Allocate(std::size_t size) {
+    // No object can be this big; don't ask the system (or a sanitizer) to try
+    if (size > PTRDIFF_MAX) {
+      throw std::bad_alloc();
+    }
+
+    const std::size_t classSize = SizeClass(size);
+
+    {
+      std::lock_guard<std::mutex> guard(impl_->lock);
+
+      auto i = impl_->freeLists.find(classSize);
+      if (i != impl_->freeLists.end() && !i->second.empty()) {
+        void* ptr = i->second.back();
+        i->second.pop_back();
+
+        ++impl_->hits;
+        impl_->retainedBytes -= classSize;
+        --impl_->retainedBuffers;
+        return ptr;
+      }
+
+      ++impl_->misses;
+    }
+
+    // Allocate outside the lock: it is the slow path & doesn't touch shared state
+    return AlignedAlloc(classSize, Alignment);
+  }
+
+  void PixelBufferPool::Deallocate(void* ptr, std::size_t size) noexcept {
+    if (!ptr) {
+      return;
+    }
+
+    const std::size_t classSize = SizeClass(size);
+
+    try {
+      std::lock_guard<std::mutex> guard(impl_->lock);
+
+      if (impl_->retainedBytes + classSize <= impl_->maxRetainedBytes) {
+        impl_->freeLists[classSize].push_back(ptr);
+        impl_->retainedBytes += classSize;
+        ++impl_->retainedBuffers;
+        return;
+      }
+    }
+    catch (...) {
+      // Failing to grow a free list (or to lock) just means we can't keep this
+      // buffer; fall through & free it.
+    }
+
+    AlignedFree(ptr);
+  }
+
+  void PixelBufferPool::Trim() noexcept {
+    std::unordered_map<std::size_t, std::vector<void*>> freeLists;
+
+    {
+      std::lock_guard<std::mutex> guard(impl_->lock);
+      freeLists.swap(impl_->freeLists);
+      impl_->retainedBytes = 0;
+      impl_->retainedBuffers = 0;
+    }
+
+    for (auto& list : freeLists) {
+      for (void* ptr : list.second) {
+        AlignedFree(ptr);
+      }
+    }
+  }
+
+  PixelBufferPool::Stats PixelBufferPool::GetStats() const {
+    std::lock_guard<std::mutex> guard(impl_->lock);
+
+    Stats stats;
+    stats.hits = impl_->hits;
+    stats.misses = impl_->misses;
+    stats.retainedBytes = impl_->retainedBytes;
+    stats.retainedBuffers = impl_->retainedBuffers;
+    return stats;
+  }
+
+}
@@ -0,0 +1,73 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "pixel-convert.hpp"
+
+namespace james {
+
+  namespace {
+
+    // libjpeg's luminance weights (ITU-R BT.601), in 16.16 fixed point
+    inline unsigned char Luminance(const unsigned char* rgb) {
+      return (unsigned char) ((19595u*rgb[0] + 38470u*rgb[1] + 7471u*rgb[2] + 32768u) >> 16);
+    }
+
+  }
+
+  void ConvertRow(const unsigned char* src, unsigned int srcChannels, unsigned char* dst,
+    PixelFormat format, std::size_t n) noexcept
+  {
+    const bool bgr = format == PixelFormat::BGR || format == PixelFormat::BGRA;
+    const unsigned int dstChannels = BytesPerPixel(format);
+
+    // The common cases have SIMD kernels
+    if (srcChannels == 3 && dstChannels == 4) {
+      RGBToRGBA(src, dst, n);
+      if (bgr) {
+        SwapRedBlue32(dst, n);
+      }
+      return;
+    }
+
+    if (srcChannels == 1 && dstChannels == 3) {
+      GrayToRGB(src, dst, n);
+      return;
+    }
+
+    for (std::size_t i = 0; i < n; ++i, src += srcChannels, dst += dstChannels) {
+      if (dstChannels == 1) {
+        dst[0] = srcChannels == 1 ? src[0] : Luminance(src);
+        continue;
+      }
+
+      const unsigned char r = src[0];
+      const unsigned char g = srcChannels == 1 ? src[0] : src[1];
+      const unsigned char b = srcChannels == 1 ? src[0] : src[2];
+
+      dst[0] = bgr ? b : r;
+      dst[1] = g;
+      dst[2] = bgr ? r : b;
+
+      if (dstChannels == 4) {
+        dst[3] = 255;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,40 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Internal to Image Loader: not part of the public interface.
+//
+// Row conversion for the cases where libjpeg can't produce the requested PixelFormat
+// itself. It runs on one batch of rows at a time, straight after they have been
+// decoded, so the data is still in cache.
+
+#include <cstddef>
+
+namespace james {
+
+  enum class PixelFormat;
+
+  /**
+   * Converts n pixels of 8 bit gray (srcChannels == 1) or RGB (srcChannels == 3) into
+   * format, which must not be PixelFormat::Auto. src & dst must not overlap.
+   */
+  void ConvertRow(const unsigned char* src, unsigned int srcChannels, unsigned char* dst,
+    PixelFormat format, std::size_t n) noexcept;
+
+}
@@ -0,0 +1,48 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Internal to Image Loader: not part of the public interface.
+//
+// The pixel kernels are split by instruction set so that each file only needs the
+// intrinsics headers for its own architecture. The SIMD implementations handle the
+// tail of each row (anything shorter than a full vector) with the scalar kernels.
+
+#include <cstddef>
+
+namespace james {
+
+  struct PixelKernels;
+
+  namespace scalar {
+    void RGBToRGBA(const unsigned char* src, unsigned char* dst, std::size_t n);
+    void GrayToRGB(const unsigned char* src, unsigned char* dst, std::size_t n);
+    void SwapRedBlue24(unsigned char* pixels, std::size_t n);
+    void SwapRedBlue32(unsigned char* pixels, std::size_t n);
+    void PremultiplyAlpha(unsigned char* pixels, std::size_t n);
+    void UnpremultiplyAlpha(unsigned char* pixels, std::size_t n);
+  }
+
+  // Each returns nullptr if the instruction set isn't available, either because the
+  // target architecture doesn't have it or because the CPU we're running on doesn't.
+  const PixelKernels* SSE2PixelKernels() noexcept;
+  const PixelKernels* AVX2PixelKernels() noexcept;
+  const PixelKernels* NEONPixelKernels() noexcept;
+
+}
@@ -0,0 +1,200 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "pixel-kernels-impl.hpp"
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)) && !defined(JAMES_IMAGE_LOADER_NO_NEON)
+
+#include <arm_neon.h>
+
+namespace james {
+
+  namespace {
+
+    // NEON's interleaving loads & stores (vld3/vst4 etc.) split pixels into one
+    // register per channel, so all of these work on 16 pixels at a time.
+
+    void RGBToRGBANEON(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        const uint8x16x3_t rgb = vld3q_u8(src + 3*i);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + 4*i, rgba);
+      }
+
+      scalar::RGBToRGBA(src + 3*i, dst + 4*i, n - i);
+    }
+
+    void GrayToRGBNEON(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        const uint8x16_t g = vld1q_u8(src + i);
+        uint8x16x3_t rgb;
+        rgb.val[0] = g;
+        rgb.val[1] = g;
+        rgb.val[2] = g;
+        vst3q_u8(dst + 3*i, rgb);
+      }
+
+      scalar::GrayToRGB(src + i, dst + 3*i, n - i);
+    }
+
+    void SwapRedBlue24NEON(unsigned char* pixels, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x3_t v = vld3q_u8(pixels + 3*i);
+        const uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst3q_u8(pixels + 3*i, v);
+      }
+
+      scalar::SwapRedBlue24(pixels + 3*i, n - i);
+    }
+
+    void SwapRedBlue32NEON(unsigned char* pixels, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(pixels + 4*i);
+        const uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst4q_u8(pixels + 4*i, v);
+      }
+
+      scalar::SwapRedBlue32(pixels + 4*i, n - i);
+    }
+
+    // round(c*a/255) as (t + ((t + 128) >> 8) + 128) >> 8 with t = c*a: the same value
+    // as scalar::PremultiplyAlpha, using rounding shifts for the + 128s.
+    //
+    inline uint8x8_t Premultiply8(uint8x8_t c, uint8x8_t a) {
+      const uint16x8_t t = vmull_u8(c, a);
+      return vrshrn_n_u16(vaddq_u16(t, vrshrq_n_u16(t, 8)), 8);
+    }
+
+    inline uint8x16_t Premultiply16(uint8x16_t c, uint8x16_t a) {
+      return vcombine_u8(
+        Premultiply8(vget_low_u8(c), vget_low_u8(a)),
+        Premultiply8(vget_high_u8(c), vget_high_u8(a)));
+    }
+
+    void PremultiplyAlphaNEON(unsigned char* pixels, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(pixels + 4*i);
+        v.val[0] = Premultiply16(v.val[0], v.val[3]);
+        v.val[1] = Premultiply16(v.val[1], v.val[3]);
+        v.val[2] = Premultiply16(v.val[2], v.val[3]);
+        vst4q_u8(pixels + 4*i, v);
+      }
+
+      scalar::PremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+    // (c*255 + a/2) / a in single precision, which is exact for these values (see the
+    // SSE2 version). 32 bit NEON has no vector divide so uses the scalar kernel.
+    //
+    inline uint16x4_t Unpremultiply4(uint16x4_t num, uint16x4_t a) {
+      const float32x4_t q = vdivq_f32(vcvtq_f32_u32(vmovl_u16(num)), vcvtq_f32_u32(vmovl_u16(a)));
+      return vqmovn_u32(vcvtq_u32_f32(q));
+    }
+
+    inline uint8x8_t Unpremultiply8(uint8x8_t c, uint8x8_t a) {
+      const uint16x8_t a16 = vmovl_u8(a);
+      const uint16x8_t num = vmlaq_n_u16(vshrq_n_u16(a16, 1), vmovl_u8(c), 255);
+
+      return vqmovn_u16(vcombine_u16(
+        Unpremultiply4(vget_low_u16(num), vget_low_u16(a16)),
+        Unpremultiply4(vget_high_u16(num), vget_high_u16(a16))));
+    }
+
+    // Division by zero saturates to 255 on the way down, so zero alpha is masked after
+    //
+    inline uint8x16_t Unpremultiply16(uint8x16_t c, uint8x16_t a) {
+      const uint8x16_t q = vcombine_u8(
+        Unpremultiply8(vget_low_u8(c), vget_low_u8(a)),
+        Unpremultiply8(vget_high_u8(c), vget_high_u8(a)));
+      return vandq_u8(q, vtstq_u8(a, a));
+    }
+
+    void UnpremultiplyAlphaNEON(unsigned char* pixels, std::size_t n) {
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(pixels + 4*i);
+        v.val[0] = Unpremultiply16(v.val[0], v.val[3]);
+        v.val[1] = Unpremultiply16(v.val[1], v.val[3]);
+        v.val[2] = Unpremultiply16(v.val[2], v.val[3]);
+        vst4q_u8(pixels + 4*i, v);
+      }
+
+      scalar::UnpremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+#else
+
+    void UnpremultiplyAlphaNEON(unsigned char* pixels, std::size_t n) {
+      scalar::UnpremultiplyAlpha(pixels, n);
+    }
+
+#endif
+
+    const PixelKernels NEONKernels = {
+      RGBToRGBANEON,
+      GrayToRGBNEON,
+      SwapRedBlue24NEON,
+      SwapRedBlue32NEON,
+      PremultiplyAlphaNEON,
+      UnpremultiplyAlphaNEON
+    };
+
+  }
+
+  // NEON is mandatory on AArch64 & if the compiler is targeting it on 32 bit ARM we
+  // take the build settings as a guarantee that the CPU has it.
+  //
+  const PixelKernels* NEONPixelKernels() noexcept {
+    return &NEONKernels;
+  }
+
+}
+
+#else
+
+namespace james {
+
+  const PixelKernels* NEONPixelKernels() noexcept {
+    return nullptr;
+  }
+
+}
+
+#endif
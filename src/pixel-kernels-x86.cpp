@@ -0,0 +1,413 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "pixel-kernels-impl.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  define JAMES_X86 1
+#endif
+
+#ifdef JAMES_X86
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#  define SSE2_FUNCTION
+#  define AVX2_FUNCTION
+#else
+#  include <cpuid.h>
+// GCC & Clang only allow intrinsics in functions compiled for their instruction set.
+// Marking just these functions (rather than building the file with -mavx2) keeps the
+// compiler from using AVX2 anywhere that runs before the CPU has been checked. (SSE2
+// is the baseline on x86-64 but not on 32 bit x86.)
+#  define SSE2_FUNCTION __attribute__((target("sse2")))
+#  define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+namespace james {
+
+  namespace {
+
+    // CPU feature detection
+    //
+
+    void CPUID(int leaf, int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+      int r[4];
+      __cpuidex(r, leaf, subleaf);
+      for (int i = 0; i < 4; ++i) {
+        regs[i] = (unsigned int) r[i];
+      }
+#else
+      __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // The build can leave an instruction set out of the dispatch altogether (see the
+    // IMAGE_LOADER_SSE2 & IMAGE_LOADER_AVX2 CMake options)
+#ifdef JAMES_IMAGE_LOADER_NO_SSE2
+    const bool SSE2Enabled = false;
+#else
+    const bool SSE2Enabled = true;
+#endif
+
+#ifdef JAMES_IMAGE_LOADER_NO_AVX2
+    const bool AVX2Enabled = false;
+#else
+    const bool AVX2Enabled = true;
+#endif
+
+    bool CPUHasSSE2() {
+#if defined(__x86_64__) || defined(_M_X64)
+      return true;
+#else
+      unsigned int regs[4];
+      CPUID(1, 0, regs);
+      return (regs[3] & (1u << 26)) != 0;
+#endif
+    }
+
+    bool CPUHasAVX2() {
+      unsigned int regs[4];
+
+      CPUID(0, 0, regs);
+      if (regs[0] < 7) {
+        return false;
+      }
+
+      // The CPU must support AVX & the OS must save the YMM registers (OSXSAVE, then
+      // XCR0 bits 1 & 2)
+      CPUID(1, 0, regs);
+      if ((regs[2] & (1u << 27)) == 0 || (regs[2] & (1u << 28)) == 0) {
+        return false;
+      }
+
+#ifdef _MSC_VER
+      const unsigned long long xcr0 = _xgetbv(0);
+#else
+      unsigned int eax, edx;
+      __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+      const unsigned long long xcr0 = ((unsigned long long) edx << 32) | eax;
+#endif
+
+      if ((xcr0 & 6) != 6) {
+        return false;
+      }
+
+      CPUID(7, 0, regs);
+      return (regs[1] & (1u << 5)) != 0;
+    }
+
+    inline int Load32(const unsigned char* p) {
+      std::int32_t v;
+      std::memcpy(&v, p, 4);
+      return v;
+    }
+
+    // SSE2
+    //
+    // SSE2 has no byte shuffle. rgbToRGBA works a pixel per 32 bit load instead of a
+    // byte at a time; grayToRGB & swapRedBlue24 gain nothing from tricks like that &
+    // use the scalar kernels.
+
+    SSE2_FUNCTION void RGBToRGBASSE2(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+      std::size_t i = 0;
+
+      // Each 32 bit load reads one byte past its pixel so the last pixel is always
+      // left to the scalar loop
+      for (; i + 4 < n; i += 4) {
+        const unsigned char* s = src + 3*i;
+        const __m128i v = _mm_setr_epi32(Load32(s), Load32(s + 3), Load32(s + 6), Load32(s + 9));
+        _mm_storeu_si128((__m128i*) (dst + 4*i), _mm_or_si128(v, alpha));
+      }
+
+      scalar::RGBToRGBA(src + 3*i, dst + 4*i, n - i);
+    }
+
+    SSE2_FUNCTION void SwapRedBlue32SSE2(unsigned char* pixels, std::size_t n) {
+      const __m128i agMask = _mm_set1_epi32((int) 0xFF00FF00);
+      const __m128i rbMask = _mm_set1_epi32(0x00FF00FF);
+      std::size_t i = 0;
+
+      for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*) (pixels + 4*i);
+        const __m128i v = _mm_loadu_si128(p);
+        const __m128i rb = _mm_and_si128(v, rbMask);
+        const __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(v, agMask), br));
+      }
+
+      scalar::SwapRedBlue32(pixels + 4*i, n - i);
+    }
+
+    // Multiplies 2 pixels of 16 bit channels by their alpha: the same formula as
+    // scalar::PremultiplyAlpha. The alpha lanes get garbage & must be restored.
+    //
+    SSE2_FUNCTION inline __m128i Premultiply16(__m128i x) {
+      const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+      const __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+      return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    SSE2_FUNCTION void PremultiplyAlphaSSE2(unsigned char* pixels, std::size_t n) {
+      const __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+      const __m128i zero = _mm_setzero_si128();
+      std::size_t i = 0;
+
+      for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*) (pixels + 4*i);
+        const __m128i v = _mm_loadu_si128(p);
+        const __m128i lo = Premultiply16(_mm_unpacklo_epi8(v, zero));
+        const __m128i hi = Premultiply16(_mm_unpackhi_epi8(v, zero));
+        const __m128i c = _mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi));
+        _mm_storeu_si128(p, _mm_or_si128(c, _mm_and_si128(v, alphaMask)));
+      }
+
+      scalar::PremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+    // Unpremultiplies 2 pixels of 16 bit channels. (c*255 + a/2) / a is computed in
+    // single precision, which is exact here: the numerator is at most 65152 & a
+    // non-integral quotient is at least 1/255 away from the next integer. Division by
+    // zero gives 0x80000000 which, like anything over 255, saturates correctly when
+    // packed: to 0 & 255 respectively.
+    //
+    SSE2_FUNCTION inline __m128i Unpremultiply16(__m128i x) {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+      const __m128i num = _mm_add_epi16(_mm_mullo_epi16(x, _mm_set1_epi16(255)), _mm_srli_epi16(a, 1));
+
+      const __m128i q0 = _mm_cvttps_epi32(_mm_div_ps(
+        _mm_cvtepi32_ps(_mm_unpacklo_epi16(num, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero))));
+      const __m128i q1 = _mm_cvttps_epi32(_mm_div_ps(
+        _mm_cvtepi32_ps(_mm_unpackhi_epi16(num, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero))));
+
+      return _mm_packs_epi32(q0, q1);
+    }
+
+    SSE2_FUNCTION void UnpremultiplyAlphaSSE2(unsigned char* pixels, std::size_t n) {
+      const __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+      const __m128i zero = _mm_setzero_si128();
+      std::size_t i = 0;
+
+      for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*) (pixels + 4*i);
+        const __m128i v = _mm_loadu_si128(p);
+        const __m128i lo = Unpremultiply16(_mm_unpacklo_epi8(v, zero));
+        const __m128i hi = Unpremultiply16(_mm_unpackhi_epi8(v, zero));
+        const __m128i c = _mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi));
+        _mm_storeu_si128(p, _mm_or_si128(c, _mm_and_si128(v, alphaMask)));
+      }
+
+      scalar::UnpremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+    const PixelKernels SSE2Kernels = {
+      RGBToRGBASSE2,
+      scalar::GrayToRGB,
+      scalar::SwapRedBlue24,
+      SwapRedBlue32SSE2,
+      PremultiplyAlphaSSE2,
+      UnpremultiplyAlphaSSE2
+    };
+
+    // AVX2
+    //
+    // The byte shuffles use 128 bit vpshufb where the data doesn't divide evenly into
+    // 256 bit lanes.
+
+    AVX2_FUNCTION void RGBToRGBAAVX2(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+      const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+      std::size_t i = 0;
+
+      // 8 pixels per iteration from two 16 byte loads at +0 & +12, which read 28
+      // bytes: i.e. up to 10 pixels
+      for (; i + 10 <= n; i += 8) {
+        const unsigned char* s = src + 3*i;
+        const __m256i v = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) s)),
+          _mm_loadu_si128((const __m128i*) (s + 12)), 1);
+        _mm256_storeu_si256((__m256i*) (dst + 4*i), _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha));
+      }
+
+      scalar::RGBToRGBA(src + 3*i, dst + 4*i, n - i);
+    }
+
+    AVX2_FUNCTION void GrayToRGBAVX2(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      const __m128i s0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+      const __m128i s1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+      const __m128i s2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i* d = (__m128i*) (dst + 3*i);
+        _mm_storeu_si128(d, _mm_shuffle_epi8(v, s0));
+        _mm_storeu_si128(d + 1, _mm_shuffle_epi8(v, s1));
+        _mm_storeu_si128(d + 2, _mm_shuffle_epi8(v, s2));
+      }
+
+      scalar::GrayToRGB(src + i, dst + 3*i, n - i);
+    }
+
+    AVX2_FUNCTION void SwapRedBlue24AVX2(unsigned char* pixels, std::size_t n) {
+      // 16 pixels (48 bytes, 3 vectors) per iteration. Three pixels straddle vector
+      // boundaries so each output vector is the OR of shuffles of its neighbours.
+      // (Stepping 5 pixels at a time with overlapping loads & stores is simpler, but
+      // stalls on store forwarding.)
+      const __m128i s00 = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, -1);
+      const __m128i s01 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1);
+      const __m128i s10 = _mm_setr_epi8(-1, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+      const __m128i s11 = _mm_setr_epi8(0, -1, 4, 3, 2, 7, 6, 5, 10, 9, 8, 13, 12, 11, -1, 15);
+      const __m128i s12 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1);
+      const __m128i s21 = _mm_setr_epi8(14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+      const __m128i s22 = _mm_setr_epi8(-1, 3, 2, 1, 6, 5, 4, 9, 8, 7, 12, 11, 10, 15, 14, 13);
+      std::size_t i = 0;
+
+      for (; i + 16 <= n; i += 16) {
+        __m128i* p = (__m128i*) (pixels + 3*i);
+        const __m128i a = _mm_loadu_si128(p);
+        const __m128i b = _mm_loadu_si128(p + 1);
+        const __m128i c = _mm_loadu_si128(p + 2);
+
+        _mm_storeu_si128(p, _mm_or_si128(_mm_shuffle_epi8(a, s00), _mm_shuffle_epi8(b, s01)));
+        _mm_storeu_si128(p + 1, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, s10), _mm_shuffle_epi8(b, s11)),
+          _mm_shuffle_epi8(c, s12)));
+        _mm_storeu_si128(p + 2, _mm_or_si128(_mm_shuffle_epi8(b, s21), _mm_shuffle_epi8(c, s22)));
+      }
+
+      scalar::SwapRedBlue24(pixels + 3*i, n - i);
+    }
+
+    AVX2_FUNCTION void SwapRedBlue32AVX2(unsigned char* pixels, std::size_t n) {
+      const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+      std::size_t i = 0;
+
+      for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*) (pixels + 4*i);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), shuffle));
+      }
+
+      scalar::SwapRedBlue32(pixels + 4*i, n - i);
+    }
+
+    AVX2_FUNCTION inline __m256i Premultiply16AVX2(__m256i x) {
+      const __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF);
+      const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+      return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    AVX2_FUNCTION void PremultiplyAlphaAVX2(unsigned char* pixels, std::size_t n) {
+      const __m256i alphaMask = _mm256_set1_epi32((int) 0xFF000000);
+      const __m256i zero = _mm256_setzero_si256();
+      std::size_t i = 0;
+
+      // Unpacking & packing both work within 128 bit lanes so the pixels end up back
+      // where they started
+      for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*) (pixels + 4*i);
+        const __m256i v = _mm256_loadu_si256(p);
+        const __m256i lo = Premultiply16AVX2(_mm256_unpacklo_epi8(v, zero));
+        const __m256i hi = Premultiply16AVX2(_mm256_unpackhi_epi8(v, zero));
+        const __m256i c = _mm256_andnot_si256(alphaMask, _mm256_packus_epi16(lo, hi));
+        _mm256_storeu_si256(p, _mm256_or_si256(c, _mm256_and_si256(v, alphaMask)));
+      }
+
+      scalar::PremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+    // As Unpremultiply16
+    //
+    AVX2_FUNCTION inline __m256i Unpremultiply16AVX2(__m256i x) {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF);
+      const __m256i num = _mm256_add_epi16(_mm256_mullo_epi16(x, _mm256_set1_epi16(255)), _mm256_srli_epi16(a, 1));
+
+      const __m256i q0 = _mm256_cvttps_epi32(_mm256_div_ps(
+        _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(num, zero)), _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(a, zero))));
+      const __m256i q1 = _mm256_cvttps_epi32(_mm256_div_ps(
+        _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(num, zero)), _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(a, zero))));
+
+      return _mm256_packs_epi32(q0, q1);
+    }
+
+    AVX2_FUNCTION void UnpremultiplyAlphaAVX2(unsigned char* pixels, std::size_t n) {
+      const __m256i alphaMask = _mm256_set1_epi32((int) 0xFF000000);
+      const __m256i zero = _mm256_setzero_si256();
+      std::size_t i = 0;
+
+      for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*) (pixels + 4*i);
+        const __m256i v = _mm256_loadu_si256(p);
+        const __m256i lo = Unpremultiply16AVX2(_mm256_unpacklo_epi8(v, zero));
+        const __m256i hi = Unpremultiply16AVX2(_mm256_unpackhi_epi8(v, zero));
+        const __m256i c = _mm256_andnot_si256(alphaMask, _mm256_packus_epi16(lo, hi));
+        _mm256_storeu_si256(p, _mm256_or_si256(c, _mm256_and_si256(v, alphaMask)));
+      }
+
+      scalar::UnpremultiplyAlpha(pixels + 4*i, n - i);
+    }
+
+    const PixelKernels AVX2Kernels = {
+      RGBToRGBAAVX2,
+      GrayToRGBAVX2,
+      SwapRedBlue24AVX2,
+      SwapRedBlue32AVX2,
+      PremultiplyAlphaAVX2,
+      UnpremultiplyAlphaAVX2
+    };
+
+  }
+
+  const PixelKernels* SSE2PixelKernels() noexcept {
+    static const bool supported = SSE2Enabled && CPUHasSSE2();
+    return supported ? &SSE2Kernels : nullptr;
+  }
+
+  const PixelKernels* AVX2PixelKernels() noexcept {
+    static const bool supported = AVX2Enabled && CPUHasAVX2();
+    return supported ? &AVX2Kernels : nullptr;
+  }
+
+}
+
+#else
+
+namespace james {
+
+  const PixelKernels* SSE2PixelKernels() noexcept {
+    return nullptr;
+  }
+
+  const PixelKernels* AVX2PixelKernels() noexcept {
+    return nullptr;
+  }
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "pixel-kernels-impl.hpp"
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+namespace james {
+
+  namespace scalar {
+
+    void RGBToRGBA(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      for (const unsigned char* end = src + 3*n; src != end; src += 3, dst += 4) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 255;
+      }
+    }
+
+    void GrayToRGB(const unsigned char* src, unsigned char* dst, std::size_t n) {
+      for (const unsigned char* end = src + n; src != end; ++src, dst += 3) {
+        dst[0] = dst[1] = dst[2] = *src;
+      }
+    }
+
+    void SwapRedBlue24(unsigned char* pixels, std::size_t n) {
+      for (unsigned char* end = pixels + 3*n; pixels != end; pixels += 3) {
+        const unsigned char t = pixels[0];
+        pixels[0] = pixels[2];
+        pixels[2] = t;
+      }
+    }
+
+    void SwapRedBlue32(unsigned char* pixels, std::size_t n) {
+      for (unsigned char* end = pixels + 4*n; pixels != end; pixels += 4) {
+        const unsigned char t = pixels[0];
+        pixels[0] = pixels[2];
+        pixels[2] = t;
+      }
+    }
+
+    // round(c*a/255) without a division: with t = c*a + 128, (t + (t >> 8)) >> 8 is
+    // exact for all 8 bit c & a. The SIMD versions use the same formula.
+    //
+    void PremultiplyAlpha(unsigned char* pixels, std::size_t n) {
+      for (unsigned char* end = pixels + 4*n; pixels != end; pixels += 4) {
+        const unsigned int a = pixels[3];
+
+        for (int c = 0; c < 3; ++c) {
+          const unsigned int t = pixels[c]*a + 128;
+          pixels[c] = (unsigned char) ((t + (t >> 8)) >> 8);
+        }
+      }
+    }
+
+    void UnpremultiplyAlpha(unsigned char* pixels, std::size_t n) {
+      for (unsigned char* end = pixels + 4*n; pixels != end; pixels += 4) {
+        const unsigned int a = pixels[3];
+
+        for (int c = 0; c < 3; ++c) {
+          const unsigned int v = a ? (pixels[c]*255u + a/2) / a : 0;
+          pixels[c] = (unsigned char) (v > 255 ? 255 : v);
+        }
+      }
+    }
+
+  }
+
+  namespace {
+
+    const PixelKernels ScalarKernels = {
+      scalar::RGBToRGBA,
+      scalar::GrayToRGB,
+      scalar::SwapRedBlue24,
+      scalar::SwapRedBlue32,
+      scalar::PremultiplyAlpha,
+      scalar::UnpremultiplyAlpha
+    };
+
+    SimdLevel DetectBestSimdLevel() noexcept {
+      if (AVX2PixelKernels()) {
+        return SimdLevel::AVX2;
+      }
+      if (SSE2PixelKernels()) {
+        return SimdLevel::SSE2;
+      }
+      if (NEONPixelKernels()) {
+        return SimdLevel::NEON;
+      }
+      return SimdLevel::Scalar;
+    }
+
+    const PixelKernels& Best() noexcept {
+      static const PixelKernels& best = *GetPixelKernels(BestSimdLevel());
+      return best;
+    }
+
+    // Logic errors are handled as described in image.hpp
+    //
+    void RequireBitsPerPixel(bool valid, const char* message) {
+#ifndef NDEBUG
+      assert(valid);
+#endif
+
+      if (!valid) {
+        throw std::invalid_argument(message);
+      }
+    }
+
+  }
+
+  const PixelKernels* GetPixelKernels(SimdLevel level) noexcept {
+    switch (level) {
+    case SimdLevel::Scalar:
+      return &ScalarKernels;
+    case SimdLevel::SSE2:
+      return SSE2PixelKernels();
+    case SimdLevel::AVX2:
+      return AVX2PixelKernels();
+    case SimdLevel::NEON:
+      return NEONPixelKernels();
+    default:
+      return nullptr;
+    }
+  }
+
+  SimdLevel BestSimdLevel() noexcept {
+    static const SimdLevel best = DetectBestSimdLevel();
+    return best;
+  }
+
+  void RGBToRGBA(const unsigned char* src, unsigned char* dst, std::size_t n) noexcept {
+    Best().rgbToRGBA(src, dst, n);
+  }
+
+  void GrayToRGB(const unsigned char* src, unsigned char* dst, std::size_t n) noexcept {
+    Best().grayToRGB(src, dst, n);
+  }
+
+  void SwapRedBlue24(unsigned char* pixels, std::size_t n) noexcept {
+    Best().swapRedBlue24(pixels, n);
+  }
+
+  void SwapRedBlue32(unsigned char* pixels, std::size_t n) noexcept {
+    Best().swapRedBlue32(pixels, n);
+  }
+
+  void PremultiplyAlpha(unsigned char* pixels, std::size_t n) noexcept {
+    Best().premultiplyAlpha(pixels, n);
+  }
+
+  void UnpremultiplyAlpha(unsigned char* pixels, std::size_t n) noexcept {
+    Best().unpremultiplyAlpha(pixels, n);
+  }
+
+  void SwapRedBlue(Image& img) {
+    const unsigned int bpp = img.BitsPerPixel();
+    RequireBitsPerPixel(bpp == 24 || bpp == 32, "SwapRedBlue requires a 24 or 32bpp image.");
+
+    const PixelKernels& k = Best();
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      (bpp == 24 ? k.swapRedBlue24 : k.swapRedBlue32)(img.Row(y), img.Width());
+    }
+  }
+
+  void PremultiplyAlpha(Image& img) {
+    RequireBitsPerPixel(img.BitsPerPixel() == 32, "PremultiplyAlpha requires a 32bpp image.");
+
+    const PixelKernels& k = Best();
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      k.premultiplyAlpha(img.Row(y), img.Width());
+    }
+  }
+
+  void UnpremultiplyAlpha(Image& img) {
+    RequireBitsPerPixel(img.BitsPerPixel() == 32, "UnpremultiplyAlpha requires a 32bpp image.");
+
+    const PixelKernels& k = Best();
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      k.unpremultiplyAlpha(img.Row(y), img.Width());
+    }
+  }
+
+  Image ExpandToRGBA(const Image& img) {
+    const unsigned int bpp = img.BitsPerPixel();
+    RequireBitsPerPixel(bpp == 8 || bpp == 24, "ExpandToRGBA requires an 8 or 24bpp image.");
+
+    Image out(img.Width(), img.Height(), 32, img.RowAlignment(), img.Allocator());
+    const PixelKernels& k = Best();
+
+    // There's no gray to RGBA kernel; going via one RGB row is still far cheaper than
+    // a byte at a time
+    std::vector<unsigned char> rgb(bpp == 8 ? (std::size_t) img.Width()*3 : 0);
+
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      if (bpp == 8) {
+        k.grayToRGB(img.Row(y), rgb.data(), img.Width());
+        k.rgbToRGBA(rgb.data(), out.Row(y), img.Width());
+      }
+      else {
+        k.rgbToRGBA(img.Row(y), out.Row(y), img.Width());
+      }
+    }
+
+    return out;
+  }
+
+  Image ExpandToRGB(const Image& img) {
+    RequireBitsPerPixel(img.BitsPerPixel() == 8, "ExpandToRGB requires an 8bpp image.");
+
+    Image out(img.Width(), img.Height(), 24, img.RowAlignment(), img.Allocator());
+    const PixelKernels& k = Best();
+
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      k.grayToRGB(img.Row(y), out.Row(y), img.Width());
+    }
+
+    return out;
+  }
+
+}
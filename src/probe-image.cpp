@@ -0,0 +1,93 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+
+#include <stdexcept>
+
+namespace james {
+
+  namespace {
+
+    // Returns a stream buffer to the position it had on construction, whether we
+    // leave by returning or by an exception
+    //
+    class StreamPositionGuard {
+    public:
+      StreamPositionGuard(std::streambuf& buf, std::streampos pos)
+        : buf_(buf), pos_(pos)
+      {
+      }
+
+      ~StreamPositionGuard() {
+        buf_.pubseekpos(pos_, std::ios::in);
+      }
+
+      StreamPositionGuard(const StreamPositionGuard&) = delete;
+      StreamPositionGuard& operator= (const StreamPositionGuard&) = delete;
+
+    private:
+      std::streambuf& buf_;
+      std::streampos pos_;
+    };
+
+    // Enough to hold the longest signature recognised by DetectImageFormat
+    const std::size_t SignatureSize = 8;
+  }
+
+  ImageInfo ProbeImage(std::istream& src) {
+    std::streambuf& buf = *src.rdbuf();
+    const std::streampos start = buf.pubseekoff(0, std::ios::cur, std::ios::in);
+
+    if (start == std::streampos(-1)) {
+      throw std::runtime_error("ProbeImage requires a seekable stream.");
+    }
+
+    StreamPositionGuard guard(buf, start);
+
+    char signature[SignatureSize];
+    const std::streamsize n = buf.sgetn(signature, sizeof(signature));
+
+    buf.pubseekpos(start, std::ios::in);
+
+    switch (DetectImageFormat(signature, n > 0 ? (std::size_t) n : 0)) {
+    case ImageFormat::PNG:
+      return ProbePNG(src);
+
+    case ImageFormat::JPEG:
+      return ProbeJPEG(src);
+
+    default:
+      return ImageInfo();
+    }
+  }
+
+  ImageInfo ProbeImage(const void* data, std::size_t size) {
+    switch (DetectImageFormat(data, size)) {
+    case ImageFormat::PNG:
+      return ProbePNG(data, size);
+
+    case ImageFormat::JPEG:
+      return ProbeJPEG(data, size);
+
+    default:
+      return ImageInfo();
+    }
+  }
+
+}
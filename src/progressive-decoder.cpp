@@ -0,0 +1,86 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "incremental-decoder.hpp"
+
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+namespace james {
+
+  ProgressiveDecoder::ProgressiveDecoder()
+    : decoder_(new FormatDetectingDecoder(LoadOptions(), true))
+  {
+  }
+
+  ProgressiveDecoder::ProgressiveDecoder(const LoadOptions& options)
+    : decoder_(new FormatDetectingDecoder(options, true))
+  {
+  }
+
+  ProgressiveDecoder::~ProgressiveDecoder() {
+  }
+
+  bool ProgressiveDecoder::Feed(const void* data, std::size_t size) {
+    const unsigned int rowsComplete = RowsComplete();
+    const unsigned int refinements = Refinements();
+
+    decoder_->Feed((const unsigned char*) data, size);
+
+    return RowsComplete() != rowsComplete || Refinements() != refinements;
+  }
+
+  ImageFormat ProgressiveDecoder::Format() const noexcept {
+    return decoder_->Format();
+  }
+
+  bool ProgressiveDecoder::HeaderReady() const noexcept {
+    return decoder_->Decoder() && decoder_->Decoder()->headerReady;
+  }
+
+  unsigned int ProgressiveDecoder::RowsComplete() const noexcept {
+    return decoder_->Decoder() ? decoder_->Decoder()->rowsComplete : 0;
+  }
+
+  unsigned int ProgressiveDecoder::Refinements() const noexcept {
+    return decoder_->Decoder() ? decoder_->Decoder()->refinements : 0;
+  }
+
+  bool ProgressiveDecoder::Done() const noexcept {
+    return decoder_->Decoder() && decoder_->Decoder()->done;
+  }
+
+  const Image& ProgressiveDecoder::Preview() const noexcept {
+    return decoder_->Decoder() ? decoder_->Decoder()->image : empty_;
+  }
+
+  Image ProgressiveDecoder::TakeImage() {
+#ifndef NDEBUG
+    assert(Done());
+#endif
+
+    if (!Done()) {
+      throw std::logic_error("ProgressiveDecoder::TakeImage called before decoding finished.");
+    }
+
+    return std::move(decoder_->Decoder()->image);
+  }
+
+}
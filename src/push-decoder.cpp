@@ -0,0 +1,112 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <james/image-loader.hpp>
+#include "incremental-decoder.hpp"
+
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+namespace james {
+
+  // Previews are turned off: a progressive JPEG is then decoded once, when all of
+  // its data is available, rather than once per scan.
+
+  PushDecoder::PushDecoder()
+    : decoder_(new FormatDetectingDecoder(LoadOptions(), false))
+  {
+  }
+
+  PushDecoder::PushDecoder(const LoadOptions& options)
+    : decoder_(new FormatDetectingDecoder(options, false))
+  {
+  }
+
+  PushDecoder::~PushDecoder() {
+  }
+
+  PushDecoder::Status PushDecoder::Feed(const void* data, std::size_t size) {
+    const bool headerReady = HeaderReady();
+    const unsigned int rowsComplete = RowsComplete();
+
+    if (!Done()) {
+      decoder_->Feed((const unsigned char*) data, size);
+    }
+
+    if (Done()) {
+      return Status::Done;
+    }
+
+    if (RowsComplete() != rowsComplete) {
+      return Status::RowsReady;
+    }
+
+    if (HeaderReady() != headerReady) {
+      return Status::HeaderReady;
+    }
+
+    return Status::NeedMoreData;
+  }
+
+  ImageFormat PushDecoder::Format() const noexcept {
+    return decoder_->Format();
+  }
+
+  bool PushDecoder::HeaderReady() const noexcept {
+    return decoder_->Decoder() && decoder_->Decoder()->headerReady;
+  }
+
+  unsigned int PushDecoder::Width() const noexcept {
+    return Decoded().Width();
+  }
+
+  unsigned int PushDecoder::Height() const noexcept {
+    return Decoded().Height();
+  }
+
+  unsigned int PushDecoder::BitsPerPixel() const noexcept {
+    // An empty Image still reports 32
+    return HeaderReady() ? Decoded().BitsPerPixel() : 0;
+  }
+
+  unsigned int PushDecoder::RowsComplete() const noexcept {
+    return decoder_->Decoder() ? decoder_->Decoder()->rowsComplete : 0;
+  }
+
+  bool PushDecoder::Done() const noexcept {
+    return decoder_->Decoder() && decoder_->Decoder()->done;
+  }
+
+  const Image& PushDecoder::Decoded() const noexcept {
+    return decoder_->Decoder() ? decoder_->Decoder()->image : empty_;
+  }
+
+  Image PushDecoder::TakeImage() {
+#ifndef NDEBUG
+    assert(Done());
+#endif
+
+    if (!Done()) {
+      throw std::logic_error("PushDecoder::TakeImage called before decoding finished.");
+    }
+
+    return std::move(decoder_->Decoder()->image);
+  }
+
+}
@@ -0,0 +1,171 @@
+// Checks that BatchDecoder delivers every item exactly once, decodes as LoadImage
+// does, isolates failures to their own item & respects its in-flight byte budget.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+int main() {
+  std::vector<std::string> encoded;
+  for (unsigned int i = 0; i < 24; ++i) {
+    const unsigned int w = 40 + 7 * i, h = 30 + 3 * i;
+    encoded.push_back(i % 2 ? test::EncodeJPEG(w, h, 1 + 2 * (i % 4 == 1)) :
+      test::EncodePNG(w, h, i % 4 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY_ALPHA));
+  }
+
+  const std::size_t corrupt = 5;
+  encoded[corrupt].resize(encoded[corrupt].size() / 3);
+
+  std::vector<james::BatchItem> items;
+  for (const std::string& e : encoded) {
+    items.push_back(james::BatchItem::Memory(e.data(), e.size()));
+  }
+
+  {
+    std::ofstream out("batch-decoder-test.jpg", std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(encoded[1].data(), encoded[1].size());
+  }
+  items.push_back(james::BatchItem::File("batch-decoder-test.jpg"));
+  items.push_back(james::BatchItem::File("batch-decoder-test.does-not-exist"));
+
+  const std::size_t fromFile = encoded.size(), missing = encoded.size() + 1;
+
+  // Callbacks: every item exactly once, failures confined to their own item
+  {
+    james::BatchDecoderOptions options;
+    options.threads = 4;
+    james::BatchDecoder decoder(options);
+    CHECK(decoder.Threads() == 4);
+
+    std::mutex lock;
+    std::vector<int> seen(items.size(), 0);
+    std::vector<james::BatchResult> results(items.size());
+
+    decoder.Decode(items, [&](james::BatchResult& r) {
+      std::lock_guard<std::mutex> l(lock);
+      ++seen[r.index];
+      results[r.index] = std::move(r);
+    });
+
+    for (std::size_t i = 0; i < items.size(); ++i) {
+      CHECK(seen[i] == 1);
+
+      if (i == corrupt || i == missing) {
+        CHECK(results[i].error);
+      }
+      else {
+        CHECK(!results[i].error);
+        const std::string& e = encoded[i == fromFile ? 1 : i];
+        CHECK(test::SameImage(results[i].image, james::LoadImage(e.data(), e.size())));
+      }
+    }
+
+    // A throwing callback doesn't stop the batch
+    std::atomic<unsigned int> calls(0);
+    decoder.Decode(items, [&](james::BatchResult&) {
+      ++calls;
+      throw std::runtime_error("callback failure");
+    });
+    CHECK(calls == items.size());
+
+    decoder.Decode(std::vector<james::BatchItem>(), [](james::BatchResult&) { CHECK(false); });
+  }
+
+  // Futures
+  {
+    james::BatchDecoder decoder;
+    CHECK(decoder.Threads() >= 1);
+
+    std::vector<std::future<james::Image>> futures(decoder.DecodeAsync(items));
+    CHECK(futures.size() == items.size());
+
+    for (std::size_t i = 0; i < futures.size(); ++i) {
+      bool threw = false;
+      try {
+        james::Image img(futures[i].get());
+        const std::string& e = encoded[i == fromFile ? 1 : i];
+        CHECK(test::SameImage(img, james::LoadImage(e.data(), e.size())));
+      }
+      catch (std::exception&) {
+        threw = true;
+      }
+      CHECK(threw == (i == corrupt || i == missing));
+    }
+  }
+
+  // With a budget of one image's worth, no two results may be held at once. The
+  // single item that exceeds the budget on its own must still be decoded.
+  {
+    const std::string large = test::EncodePNG(300, 200, PNG_COLOR_TYPE_RGB);
+    const std::string small = test::EncodeJPEG(64, 48, 3);
+
+    std::vector<james::BatchItem> batch(16, james::BatchItem::Memory(small.data(), small.size()));
+    batch.push_back(james::BatchItem::Memory(large.data(), large.size()));
+
+    james::BatchDecoderOptions options;
+    options.threads = 4;
+    options.maxInFlightBytes = 64 * 48 * 3;
+    james::BatchDecoder decoder(options);
+
+    std::atomic<int> active(0), maxActive(0), succeeded(0);
+
+    decoder.Decode(batch, [&](james::BatchResult& r) {
+      const int now = ++active;
+      int prev = maxActive;
+      while (now > prev && !maxActive.compare_exchange_weak(prev, now)) {
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      if (!r.error) {
+        ++succeeded;
+      }
+      --active;
+    });
+
+    CHECK(maxActive == 1);
+    CHECK(succeeded == (int) batch.size());
+  }
+
+  // Decode from a callback would wait on its own worker, so it throws; another
+  // decoder's Decode is fine. Small batches, submitted over & over, also exercise
+  // Submit racing with the workers.
+  {
+    james::BatchDecoderOptions options;
+    options.threads = 2;
+    james::BatchDecoder decoder(options), other(options);
+
+    const std::vector<james::BatchItem> one(items.begin(), items.begin() + 1);
+    std::atomic<int> rejected(0), nested(0);
+
+    for (unsigned int round = 0; round < 50; ++round) {
+      decoder.Decode(one, [&](james::BatchResult&) {
+        try {
+          decoder.Decode(one, [](james::BatchResult&) {});
+        }
+        catch (const std::logic_error&) {
+          ++rejected;
+        }
+
+        other.Decode(one, [&](james::BatchResult& r) {
+          if (!r.error) {
+            ++nested;
+          }
+        });
+      });
+    }
+
+    CHECK(rejected == 50);
+    CHECK(nested == 50);
+  }
+
+  std::remove("batch-decoder-test.jpg");
+
+  return 0;
+}
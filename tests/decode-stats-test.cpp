@@ -0,0 +1,127 @@
+// Checks that DecodeStats are filled in (& reset) by PNG & JPEG loads from memory &
+// streams, & that loads without them are unaffected.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+  const unsigned int W = 61;
+  const unsigned int H = 37;
+
+  void CheckCommon(const james::DecodeStats& stats, const james::Image& img) {
+    CHECK(stats.headerSeconds >= 0.0 && stats.decodeSeconds >= 0.0);
+    CHECK(stats.ioSeconds >= 0.0 && stats.postProcessSeconds >= 0.0);
+    CHECK(stats.outputBytes == james::ByteSize(img));
+    CHECK(stats.peakAllocatedBytes >= stats.outputBytes);
+  }
+
+  // Leaves stats obviously wrong, so that a missing reset shows up
+  void Scribble(james::DecodeStats& stats) {
+    stats.headerSeconds = stats.decodeSeconds = stats.ioSeconds = stats.postProcessSeconds = -1.0;
+    stats.bytesRead = 1ull << 40;
+    stats.ioCallbacks = 12345;
+    stats.peakAllocatedBytes = stats.outputBytes = 1;
+  }
+}
+
+int main() {
+  const std::string png = test::EncodePNG(W, H, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string jpeg = test::EncodeJPEG(W, H, 3);
+
+  // PNG from memory: libpng reads everything up to IEND
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::PNGLoadOptions options;
+    options.stats = &stats;
+    options.pixelFormat = james::PixelFormat::PremultipliedRGBA;
+    const james::Image img = james::LoadPNG(png.data(), png.size(), options);
+    CheckCommon(stats, img);
+    CHECK(stats.bytesRead == png.size());
+    CHECK(stats.ioCallbacks > 0);
+
+    // libpng's own buffers are counted too
+    CHECK(stats.peakAllocatedBytes > stats.outputBytes);
+  }
+
+  // PNG from a stream, with a region
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::PNGLoadOptions options;
+    options.stats = &stats;
+    options.region = james::Region(3, 4, 20, 10);
+    std::istringstream src(png);
+    const james::Image img = james::LoadPNG(src, options);
+    CHECK(img.Width() == 20 && img.Height() == 10);
+    CheckCommon(stats, img);
+    CHECK(stats.bytesRead > 0 && stats.bytesRead <= png.size());
+    CHECK(stats.ioCallbacks > 0);
+  }
+
+  // JPEG from memory is handed over in one go, so makes no callbacks
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::JPEGLoadOptions options;
+    options.stats = &stats;
+    const james::Image img = james::LoadJPEG(jpeg.data(), jpeg.size(), options);
+    CheckCommon(stats, img);
+    CHECK(stats.bytesRead > 0 && stats.bytesRead <= jpeg.size());
+    CHECK(stats.ioCallbacks == 0);
+  }
+
+  // JPEG from a stream, in small reads
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::JPEGLoadOptions options;
+    options.stats = &stats;
+    options.inputBufferSize = 64;
+    options.pixelFormat = james::PixelFormat::BGRA;
+    std::istringstream src(jpeg);
+    const james::Image img = james::LoadJPEG(src, options);
+    CheckCommon(stats, img);
+    CHECK(stats.bytesRead == jpeg.size());
+    CHECK(stats.ioCallbacks >= jpeg.size() / 64);
+  }
+
+  // Through LoadImage
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::LoadOptions options;
+    options.stats = &stats;
+    const james::Image img = james::LoadImage(png.data(), png.size(), options);
+    CheckCommon(stats, img);
+    CHECK(stats.bytesRead == png.size());
+  }
+
+  // A failed load still leaves them consistent
+  {
+    james::DecodeStats stats;
+    Scribble(stats);
+    james::PNGLoadOptions options;
+    options.stats = &stats;
+    const james::LoadResult result = james::TryLoadPNG(png.data(), png.size() / 2, options);
+    CHECK(result.error == james::DecodeError::Truncated);
+    CHECK(stats.outputBytes == 0);
+    CHECK(stats.bytesRead <= png.size() / 2);
+  }
+
+  // Without stats the results are the same
+  {
+    james::DecodeStats stats;
+    james::PNGLoadOptions withStats;
+    withStats.stats = &stats;
+    const james::Image a = james::LoadPNG(png.data(), png.size(), withStats);
+    const james::Image b = james::LoadPNG(png.data(), png.size(), james::PNGLoadOptions());
+    CHECK(james::ByteSize(a) == james::ByteSize(b));
+    CHECK(std::equal(a.Pixels(), a.Pixels() + james::ByteSize(a), b.Pixels()));
+  }
+
+  return 0;
+}
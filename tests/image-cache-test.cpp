@@ -0,0 +1,188 @@
+// Checks that ImageCache shares decoded images, evicts least recently used images to
+// stay within its budget, decodes concurrent misses only once, notices rewritten
+// files & doesn't cache failures.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+  void WriteFile(const char* path, const std::string& data) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+  }
+
+  template <typename F>
+  bool Throws(F f) {
+    try {
+      f();
+    }
+    catch (const std::exception&) {
+      return true;
+    }
+    return false;
+  }
+}
+
+int main() {
+  const std::string png = test::EncodePNG(50, 40, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string jpeg = test::EncodeJPEG(50, 40, 3);
+  const std::size_t pngBytes = 50 * 40 * 4, jpegBytes = 50 * 40 * 3;
+
+  // Hits share the handle; the result is the same as LoadImage's
+  {
+    james::ImageCache cache;
+    const james::ImageCache::Handle a = cache.Get(png.data(), png.size());
+    const std::string copy(png);
+    const james::ImageCache::Handle b = cache.Get(copy.data(), copy.size());
+    CHECK(a == b);
+    CHECK(test::SameImage(*a, james::LoadImage(png.data(), png.size())));
+
+    const james::ImageCache::Stats stats = cache.GetStats();
+    CHECK(stats.hits == 1 && stats.misses == 1 && stats.waits == 0);
+    CHECK(stats.images == 1 && stats.bytes == pngBytes);
+
+    cache.Clear();
+    CHECK(cache.GetStats().images == 0 && cache.GetStats().bytes == 0);
+    CHECK(cache.Get(png.data(), png.size()) != a);
+    CHECK(a->Width() == 50);
+  }
+
+  // LRU eviction within the budget
+  {
+    james::ImageCacheOptions options;
+    options.shards = 1;
+    options.maxBytes = pngBytes + jpegBytes;
+    james::ImageCache cache(options);
+
+    const std::string other = test::EncodePNG(50, 40, PNG_COLOR_TYPE_RGB);
+    const std::size_t otherBytes = 50 * 40 * 3;
+
+    const james::ImageCache::Handle p = cache.Get(png.data(), png.size());
+    cache.Get(jpeg.data(), jpeg.size());
+    cache.Get(png.data(), png.size());        // png is now the most recently used
+    cache.Get(other.data(), other.size());    // so the JPEG goes
+
+    james::ImageCache::Stats stats = cache.GetStats();
+    CHECK(stats.evictions == 1 && stats.images == 2 && stats.bytes == pngBytes + otherBytes);
+    CHECK(cache.Get(png.data(), png.size()) == p);
+    CHECK(cache.GetStats().hits == 2);
+
+    cache.Get(jpeg.data(), jpeg.size());
+    CHECK(cache.GetStats().misses == 4);
+
+    // Too big for the budget: returned but not cached
+    const std::string big = test::EncodePNG(100, 100, PNG_COLOR_TYPE_RGB);
+    CHECK(cache.Get(big.data(), big.size())->Width() == 100);
+    stats = cache.GetStats();
+    CHECK(stats.bytes <= options.maxBytes && stats.images == 2);
+  }
+
+  // Concurrent misses for one image decode it once
+  {
+    james::ImageCache cache;
+    const unsigned int nThreads = 8;
+    std::vector<james::ImageCache::Handle> handles(nThreads);
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> ready(0);
+
+    for (unsigned int i = 0; i < nThreads; ++i) {
+      threads.emplace_back([&, i]() {
+        ++ready;
+        while (ready < nThreads) {
+          std::this_thread::yield();
+        }
+        handles[i] = cache.Get(jpeg.data(), jpeg.size());
+      });
+    }
+
+    for (std::thread& t : threads) {
+      t.join();
+    }
+
+    const james::ImageCache::Stats stats = cache.GetStats();
+    CHECK(stats.misses == 1 && stats.hits + stats.waits == nThreads - 1);
+
+    for (const james::ImageCache::Handle& h : handles) {
+      CHECK(h == handles[0]);
+    }
+  }
+
+  // Files are keyed by path, modification time & size
+  {
+    const char* path = "image-cache-test.img";
+    WriteFile(path, png);
+
+    james::ImageCache cache;
+    const james::ImageCache::Handle a = cache.GetFile(path);
+    CHECK(cache.GetFile(path) == a);
+    CHECK(a->BitsPerPixel() == 32);
+
+    WriteFile(path, jpeg);
+    const james::ImageCache::Handle b = cache.GetFile(path);
+    CHECK(b != a && b->BitsPerPixel() == 24);
+
+    std::remove(path);
+    CHECK(Throws([&]() { cache.GetFile(path); }));
+  }
+
+  // A file replaced over & over while it is being loaded: every image handed out is
+  // one version or the other, never one cached under the other's key
+  {
+    const char* path = "image-cache-test-swap.img";
+    const char* temp = "image-cache-test-swap.tmp";
+    WriteFile(path, png);
+
+    const james::Image pngImage = james::LoadImage(png.data(), png.size());
+    const james::Image jpegImage = james::LoadImage(jpeg.data(), jpeg.size());
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+      for (unsigned int i = 0; !stop; ++i) {
+        WriteFile(temp, i % 2 ? png : jpeg);
+        std::rename(temp, path);
+      }
+    });
+
+    james::ImageCache cache;
+    for (unsigned int i = 0; i < 200; ++i) {
+      try {
+        const james::ImageCache::Handle h = cache.GetFile(path);
+        CHECK(test::SameImage(*h, pngImage) || test::SameImage(*h, jpegImage));
+      }
+      catch (const std::runtime_error&) {
+        // Changed every time it was tried
+      }
+    }
+
+    stop = true;
+    writer.join();
+
+    // Once it settles down the current version is what comes back
+    WriteFile(path, jpeg);
+    CHECK(test::SameImage(*cache.GetFile(path), jpegImage));
+    std::remove(path);
+    std::remove(temp);
+  }
+
+  // Failures aren't cached
+  {
+    james::ImageCache cache;
+    const std::string truncated = png.substr(0, png.size() / 2);
+    CHECK(Throws([&]() { cache.Get(truncated.data(), truncated.size()); }));
+    CHECK(Throws([&]() { cache.Get(truncated.data(), truncated.size()); }));
+
+    const james::ImageCache::Stats stats = cache.GetStats();
+    CHECK(stats.misses == 2 && stats.images == 0 && stats.bytes == 0);
+  }
+
+  CHECK(james::ImageCache::ContentHash(png.data(), png.size()) !=
+    james::ImageCache::ContentHash(png.data(), png.size() - 1));
+
+  return 0;
+}
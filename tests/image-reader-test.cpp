@@ -0,0 +1,53 @@
+// Checks that reading an image strip by strip through ImageReader produces exactly the
+// same pixels as loading it in one go.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+namespace {
+  typedef std::unique_ptr<james::ImageReader> (*OpenFn)(std::istream&);
+  typedef james::Image (*LoadFn)(std::istream&);
+
+  void CheckReader(const std::string& data, OpenFn open, LoadFn load, unsigned int stripRows) {
+    std::istringstream loadSrc(data);
+    james::Image expected(load(loadSrc));
+
+    std::istringstream readSrc(data);
+    std::unique_ptr<james::ImageReader> reader(open(readSrc));
+
+    CHECK(reader->Width() == expected.Width());
+    CHECK(reader->Height() == expected.Height());
+    CHECK(reader->BitsPerPixel() == expected.BitsPerPixel());
+
+    const std::size_t rowBytes = james::RowBytes(*reader);
+    std::vector<unsigned char> strip(stripRows*rowBytes);
+    unsigned int row = 0;
+
+    while (unsigned int n = reader->ReadRows(strip.data(), stripRows)) {
+      CHECK(n <= stripRows);
+      CHECK(std::memcmp(strip.data(), expected.Pixels() + row*rowBytes, n*rowBytes) == 0);
+      row += n;
+      CHECK(reader->RowsRead() == row);
+    }
+
+    CHECK(row == expected.Height());
+    CHECK(reader->ReadRows(strip.data(), stripRows) == 0);
+  }
+}
+
+int main() {
+  CheckReader(test::EncodePNG(301, 203, PNG_COLOR_TYPE_RGB), &james::OpenPNGReader, &james::LoadPNG, 16);
+  CheckReader(test::EncodePNG(301, 203, PNG_COLOR_TYPE_RGB_ALPHA), &james::OpenPNGReader, &james::LoadPNG, 7);
+  CheckReader(test::EncodePNG(301, 203, PNG_COLOR_TYPE_RGB, true), &james::OpenPNGReader, &james::LoadPNG, 16);
+  CheckReader(test::EncodePNG(64, 64, PNG_COLOR_TYPE_GRAY, true), &james::OpenPNGReader, &james::LoadPNG, 1);
+
+  CheckReader(test::EncodeJPEG(301, 203, 3), &james::OpenJPEGReader, &james::LoadJPEG, 16);
+  CheckReader(test::EncodeJPEG(301, 203, 1), &james::OpenJPEGReader, &james::LoadJPEG, 5);
+  CheckReader(test::EncodeJPEG(301, 203, 3, true), &james::OpenJPEGReader, &james::LoadJPEG, 1000);
+
+  return 0;
+}
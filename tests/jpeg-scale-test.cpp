@@ -0,0 +1,82 @@
+// Checks reduced size JPEG decoding through JPEGLoadOptions.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+  james::Image Load(const std::string& jpeg, const james::JPEGLoadOptions& options) {
+    return james::LoadJPEG(jpeg.data(), jpeg.size(), options);
+  }
+
+  void CheckSize(const std::string& jpeg, unsigned int d, unsigned int maxDimension,
+    unsigned int w, unsigned int h)
+  {
+    james::JPEGLoadOptions options;
+    options.scaleDenominator = d;
+    options.maxDimension = maxDimension;
+
+    james::Image img(Load(jpeg, options));
+    CHECK(img.Width() == w && img.Height() == h);
+
+    // The row by row reader must agree
+    std::istringstream src(jpeg);
+    std::unique_ptr<james::ImageReader> reader(james::OpenJPEGReader(src, options));
+    CHECK(reader->Width() == w && reader->Height() == h);
+  }
+}
+
+int main() {
+  const std::string jpeg = test::EncodeJPEG(1001, 600, 3);
+
+  CheckSize(jpeg, 1, 0, 1001, 600);
+  CheckSize(jpeg, 2, 0, 501, 300);
+  CheckSize(jpeg, 4, 0, 251, 150);
+  CheckSize(jpeg, 8, 0, 126, 75);
+
+  // maxDimension picks the cheapest scale that doesn't go below it
+  CheckSize(jpeg, 1, 120, 126, 75);
+  CheckSize(jpeg, 1, 127, 251, 150);
+  CheckSize(jpeg, 1, 500, 501, 300);
+  CheckSize(jpeg, 1, 502, 1001, 600);
+  CheckSize(jpeg, 1, 5000, 1001, 600);
+  CheckSize(jpeg, 8, 500, 126, 75);
+
+  // The fast options should still produce a recognisable image
+  james::JPEGLoadOptions fast;
+  fast.scaleDenominator = 2;
+  fast.fastDCT = true;
+  fast.fancyUpsampling = false;
+
+  james::JPEGLoadOptions accurate;
+  accurate.scaleDenominator = 2;
+
+  james::Image a(Load(jpeg, fast));
+  james::Image b(Load(jpeg, accurate));
+  CHECK(james::ByteSize(a) == james::ByteSize(b));
+
+  unsigned long totalError = 0;
+  for (std::size_t i = 0; i < james::ByteSize(a); ++i) {
+    totalError += std::abs(a.Pixels()[i] - b.Pixels()[i]);
+  }
+  CHECK(totalError / james::ByteSize(a) < 8);
+
+  // Invalid denominators are logic errors (only testable when assertions are off)
+#ifdef NDEBUG
+  james::JPEGLoadOptions invalid;
+  invalid.scaleDenominator = 3;
+
+  bool threw = false;
+  try {
+    Load(jpeg, invalid);
+  }
+  catch (std::invalid_argument&) {
+    threw = true;
+  }
+  CHECK(threw);
+#endif
+
+  return 0;
+}
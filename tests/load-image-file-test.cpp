@@ -0,0 +1,64 @@
+// Checks LoadImageFile's format detection & that it decodes exactly as the memory
+// loaders do. Files are written to the current directory.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+  void WriteFile(const char* path, const std::string& data) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    CHECK(out.good());
+  }
+
+  template<class E>
+  bool Throws(const char* path) {
+    try {
+      james::LoadImageFile(path);
+    }
+    catch (E&) {
+      return true;
+    }
+    return false;
+  }
+}
+
+int main() {
+  const std::string png = test::EncodePNG(123, 45, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string jpeg = test::EncodeJPEG(123, 45, 3);
+
+  CHECK(james::DetectImageFormat(png.data(), png.size()) == james::ImageFormat::PNG);
+  CHECK(james::DetectImageFormat(jpeg.data(), jpeg.size()) == james::ImageFormat::JPEG);
+  CHECK(james::DetectImageFormat(png.data(), 4) == james::ImageFormat::Unknown);
+  CHECK(james::DetectImageFormat("GIF89a", 6) == james::ImageFormat::Unknown);
+  CHECK(james::DetectImageFormat(nullptr, 0) == james::ImageFormat::Unknown);
+
+  WriteFile("load-image-file-test.png", png);
+  WriteFile("load-image-file-test.jpg", jpeg);
+  WriteFile("load-image-file-test.txt", "not an image");
+  WriteFile("load-image-file-test.empty", "");
+
+  // The extension is irrelevant; only the contents are used
+  WriteFile("load-image-file-test.jpg.png", jpeg);
+
+  CHECK(test::SameImage(james::LoadImageFile("load-image-file-test.png"), james::LoadPNG(png.data(), png.size())));
+  CHECK(test::SameImage(james::LoadImageFile("load-image-file-test.jpg"), james::LoadJPEG(jpeg.data(), jpeg.size())));
+  CHECK(test::SameImage(james::LoadImageFile("load-image-file-test.jpg.png"), james::LoadJPEG(jpeg.data(), jpeg.size())));
+
+  CHECK(Throws<std::runtime_error>("load-image-file-test.txt"));
+  CHECK(Throws<std::runtime_error>("load-image-file-test.empty"));
+  CHECK(Throws<std::system_error>("load-image-file-test.does-not-exist"));
+
+  std::remove("load-image-file-test.png");
+  std::remove("load-image-file-test.jpg");
+  std::remove("load-image-file-test.txt");
+  std::remove("load-image-file-test.empty");
+  std::remove("load-image-file-test.jpg.png");
+
+  return 0;
+}
@@ -0,0 +1,64 @@
+// Checks that decoding from memory gives the same result as decoding from a stream &
+// that truncated data is reported as an exception rather than read past.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+  template<class StreamLoad, class MemoryLoad>
+  void CheckFormat(const std::string& data, StreamLoad streamLoad, MemoryLoad memoryLoad) {
+    std::istringstream src(data);
+    james::Image expected(streamLoad(src));
+    james::Image actual(memoryLoad(data.data(), data.size()));
+
+    CHECK(test::SameImage(expected, actual));
+
+    // Truncated in the header & in the middle of the pixel data
+    const std::size_t cuts[] = { 20, data.size() / 2 };
+
+    for (std::size_t cut : cuts) {
+      bool memoryThrew = false;
+      bool streamThrew = false;
+
+      try {
+        memoryLoad(data.data(), cut);
+      }
+      catch (std::exception&) {
+        memoryThrew = true;
+      }
+
+      try {
+        std::istringstream truncated(data.substr(0, cut));
+        streamLoad(truncated);
+      }
+      catch (std::exception&) {
+        streamThrew = true;
+      }
+
+      CHECK(memoryThrew && streamThrew);
+    }
+  }
+}
+
+int main() {
+  CheckFormat(test::EncodePNG(301, 203, PNG_COLOR_TYPE_RGB_ALPHA),
+    [](std::istream& s) { return james::LoadPNG(s); },
+    [](const void* d, std::size_t n) { return james::LoadPNG(d, n); });
+
+  CheckFormat(test::EncodePNG(301, 203, PNG_COLOR_TYPE_RGB, true),
+    [](std::istream& s) { return james::LoadPNG(s); },
+    [](const void* d, std::size_t n) { return james::LoadPNG(d, n); });
+
+  CheckFormat(test::EncodeJPEG(301, 203, 3),
+    [](std::istream& s) { return james::LoadJPEG(s); },
+    [](const void* d, std::size_t n) { return james::LoadJPEG(d, n); });
+
+  CheckFormat(test::EncodeJPEG(301, 203, 1, true),
+    [](std::istream& s) { return james::LoadJPEG(s); },
+    [](const void* d, std::size_t n) { return james::LoadJPEG(d, n); });
+
+  return 0;
+}
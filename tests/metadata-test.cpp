@@ -0,0 +1,222 @@
+// Checks that ICC profiles & EXIF data are collected while decoding, that the size
+// limit is applied & that applyOrientation turns images upright.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <zlib.h>
+
+namespace {
+  const unsigned int W = 13;
+  const unsigned int H = 7;
+
+  std::vector<unsigned char> Bytes(const std::string& s) {
+    return std::vector<unsigned char>(s.begin(), s.end());
+  }
+
+  // Inserts an APPn marker straight after the SOI marker of a JPEG
+  std::string InsertMarker(const std::string& jpeg, int marker, const std::string& payload) {
+    const std::size_t length = payload.size() + 2;
+    std::string segment;
+    segment.push_back((char) 0xFF);
+    segment.push_back((char) marker);
+    segment.push_back((char) (length >> 8));
+    segment.push_back((char) length);
+    return jpeg.substr(0, 2) + segment + payload + jpeg.substr(2);
+  }
+
+  std::string ICCPart(unsigned int seq, unsigned int count, const std::string& data) {
+    std::string part("ICC_PROFILE\0", 12);
+    part.push_back((char) seq);
+    part.push_back((char) count);
+    return part + data;
+  }
+
+  template<class Options, class Load>
+  void CheckCollected(const std::string& encoded, const std::string& plain, const test::Metadata& expected, Load load) {
+    james::ImageMetadata metadata;
+    Options options;
+
+    // Nothing is collected unless asked for
+    load(encoded, options);
+
+    // Everything, within the default limit
+    options.metadata = &metadata;
+    metadata.orientation = 99;
+    const james::Image img = load(encoded, options);
+    CHECK(img.Width() == W && img.Height() == H);
+    CHECK(metadata.iccProfile == Bytes(expected.icc));
+    CHECK(metadata.exif == Bytes(expected.exif));
+    CHECK(metadata.orientation == 6);
+
+    // Applying the orientation doesn't change what is reported
+    options.applyOrientation = true;
+    const james::Image upright = load(encoded, options);
+    CHECK(upright.Width() == H && upright.Height() == W);
+    CHECK(metadata.orientation == 6);
+
+    // Too big to copy, but the orientation is still read
+    options.applyOrientation = false;
+    options.maxMetadataSize = 16;
+    load(encoded, options);
+    CHECK(metadata.iccProfile.empty());
+    CHECK(metadata.exif.empty());
+    CHECK(metadata.orientation == 6);
+
+    // A previous result is cleared
+    metadata.exif.assign(3, 0);
+    options.maxMetadataSize = 1 << 20;
+    load(plain, options);
+    CHECK(metadata.exif.empty() && metadata.iccProfile.empty() && metadata.orientation == 1);
+  }
+
+  // Where the stored pixel (x, y) of a w x h image ends up for each orientation
+  void Oriented(unsigned int orientation, unsigned int w, unsigned int h, unsigned int x, unsigned int y,
+    unsigned int& ox, unsigned int& oy)
+  {
+    switch (orientation) {
+    case 2: ox = w - 1 - x; oy = y; break;
+    case 3: ox = w - 1 - x; oy = h - 1 - y; break;
+    case 4: ox = x; oy = h - 1 - y; break;
+    case 5: ox = y; oy = x; break;
+    case 6: ox = h - 1 - y; oy = x; break;
+    case 7: ox = h - 1 - y; oy = w - 1 - x; break;
+    case 8: ox = y; oy = w - 1 - x; break;
+    default: ox = x; oy = y; break;
+    }
+  }
+
+  void CheckOrientation(unsigned int orientation, int colourType, unsigned int nChannels) {
+    test::Metadata embedded;
+    embedded.exif = test::MakeExif(orientation);
+    const std::string png = test::EncodePNG(W, H, colourType, false, &embedded);
+
+    james::PNGLoadOptions options;
+    options.pixelFormat = nChannels == 1 ? james::PixelFormat::Gray8 : james::PixelFormat::Auto;
+    options.applyOrientation = true;
+    options.rowAlignment = 8;
+
+    const james::Image img = james::LoadPNG(png.data(), png.size(), options);
+    const bool transposed = orientation >= 5;
+
+    CHECK(img.Width() == (transposed ? H : W) && img.Height() == (transposed ? W : H));
+    CHECK(img.RowAlignment() == 8);
+
+    for (unsigned int y = 0; y < H; ++y) {
+      for (unsigned int x = 0; x < W; ++x) {
+        unsigned int ox, oy;
+        Oriented(orientation, W, H, x, y, ox, oy);
+        for (unsigned int c = 0; c < nChannels; ++c) {
+          CHECK(img.Row(oy)[ox*nChannels + c] == test::PatternValue(x, y, c));
+        }
+      }
+    }
+  }
+}
+
+int main() {
+  test::Metadata embedded;
+  embedded.icc = test::MakeICCProfile();
+  embedded.exif = test::MakeExif(6);
+
+  const std::string png = test::EncodePNG(W, H, PNG_COLOR_TYPE_RGB, false, &embedded);
+  const std::string jpeg = test::EncodeJPEG(W, H, 3, false, 0, &embedded);
+  const std::string plainPNG = test::EncodePNG(W, H, PNG_COLOR_TYPE_RGB);
+  const std::string plainJPEG = test::EncodeJPEG(W, H, 3);
+
+  CheckCollected<james::PNGLoadOptions>(png, plainPNG, embedded, [](const std::string& data, const james::PNGLoadOptions& options) {
+    return james::LoadPNG(data.data(), data.size(), options);
+  });
+  CheckCollected<james::JPEGLoadOptions>(jpeg, plainJPEG, embedded, [](const std::string& data, const james::JPEGLoadOptions& options) {
+    return james::LoadJPEG(data.data(), data.size(), options);
+  });
+  CheckCollected<james::LoadOptions>(png, plainPNG, embedded, [](const std::string& data, const james::LoadOptions& options) {
+    return james::LoadImage(data.data(), data.size(), options);
+  });
+  CheckCollected<james::JPEGLoadOptions>(jpeg, plainJPEG, embedded, [](const std::string& data, const james::JPEGLoadOptions& options) {
+    std::istringstream src(data);
+    return james::TryLoadJPEG(src, options).image;
+  });
+
+  // An ICC profile split across markers, which needn't be in order
+  {
+    const std::string icc = test::MakeICCProfile();
+    const std::size_t half = icc.size() / 2;
+    std::string split = test::EncodeJPEG(W, H, 3);
+    split = InsertMarker(split, 0xE2, ICCPart(2, 2, icc.substr(half)));
+    split = InsertMarker(split, 0xE2, ICCPart(1, 2, icc.substr(0, half)));
+
+    james::ImageMetadata metadata;
+    james::JPEGLoadOptions options;
+    options.metadata = &metadata;
+    james::LoadJPEG(split.data(), split.size(), options);
+    CHECK(metadata.iccProfile == Bytes(icc));
+
+    // An incomplete profile is left out
+    std::string partial = InsertMarker(test::EncodeJPEG(W, H, 3), 0xE2, ICCPart(1, 2, icc.substr(0, half)));
+    james::LoadJPEG(partial.data(), partial.size(), options);
+    CHECK(metadata.iccProfile.empty());
+  }
+
+  // A PNG eXIf chunk after the image data is found when the whole image is decoded
+  {
+    const std::string exif = test::MakeExif(3);
+    std::string exifChunk;
+    const std::size_t length = exif.size();
+    exifChunk += std::string("\0\0", 2);
+    exifChunk.push_back((char) (length >> 8));
+    exifChunk.push_back((char) length);
+    exifChunk += "eXIf" + exif;
+    const unsigned long crc = crc32(crc32(0, nullptr, 0), (const Bytef*) exifChunk.data() + 4, (uInt) (exif.size() + 4));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      exifChunk.push_back((char) (crc >> shift));
+    }
+
+    std::string late = test::EncodePNG(W, H, PNG_COLOR_TYPE_RGB);
+    late.insert(late.size() - 12, exifChunk);
+
+    james::ImageMetadata metadata;
+    james::PNGLoadOptions options;
+    options.metadata = &metadata;
+    james::LoadPNG(late.data(), late.size(), options);
+    CHECK(metadata.orientation == 3);
+    CHECK(metadata.exif == Bytes(exif));
+  }
+
+  // Every orientation, for several pixel sizes
+  for (unsigned int orientation = 1; orientation <= 8; ++orientation) {
+    CheckOrientation(orientation, PNG_COLOR_TYPE_GRAY, 1);
+    CheckOrientation(orientation, PNG_COLOR_TYPE_RGB, 3);
+    CheckOrientation(orientation, PNG_COLOR_TYPE_RGB_ALPHA, 4);
+  }
+
+  // Malformed EXIF is treated as upright
+  CHECK(james::ParseExifOrientation(nullptr, 0) == 1);
+  {
+    const std::string exif = test::MakeExif(6);
+    CHECK(james::ParseExifOrientation((const unsigned char*) exif.data(), exif.size()) == 6);
+    CHECK(james::ParseExifOrientation((const unsigned char*) exif.data(), 12) == 1);
+
+    std::string bad = test::MakeExif(9);
+    CHECK(james::ParseExifOrientation((const unsigned char*) bad.data(), bad.size()) == 1);
+
+    bad = exif;
+    bad[4] = (char) 0xF0;           // IFD offset past the end
+    CHECK(james::ParseExifOrientation((const unsigned char*) bad.data(), bad.size()) == 1);
+  }
+
+  // Big endian EXIF
+  {
+    const unsigned char exif[] = {
+      'M', 'M', 0, 42, 0, 0, 0, 8,
+      0, 1,
+      0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, 8, 0, 0,
+      0, 0, 0, 0
+    };
+    CHECK(james::ParseExifOrientation(exif, sizeof(exif)) == 8);
+  }
+
+  return 0;
+}
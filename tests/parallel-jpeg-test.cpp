@@ -0,0 +1,222 @@
+// Checks that JPEGLoadOptions::threads gives exactly the same pixels as the single
+// threaded path for every chroma subsampling, pixel format, scale & upsampling mode,
+// with restart intervals that do & don't line up with MCU rows, & that JPEGs it
+// doesn't cover fall back to the usual path.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <sstream>
+
+namespace {
+
+  unsigned char NoiseValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int v = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    v ^= v >> 15;
+    v *= 0x2C1B3C6Du;
+    v ^= v >> 12;
+    return (unsigned char) (x + y*3 + c*70 + (v & 63));
+  }
+
+  // A baseline JPEG with a restart marker every restartMCUs MCUs (which needn't be
+  // a whole number of MCU rows) & the luma sampled h x v times as often as chroma
+  std::string RestartJPEG(unsigned int w, unsigned int h, int nComponents, unsigned int restartMCUs,
+    int hSamp = 2, int vSamp = 2)
+  {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr err;
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = nComponents;
+    cinfo.in_color_space = nComponents == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    cinfo.restart_interval = restartMCUs;
+
+    if (nComponents == 3) {
+      cinfo.comp_info[0].h_samp_factor = hSamp;
+      cinfo.comp_info[0].v_samp_factor = vSamp;
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    std::vector<unsigned char> row(w*nComponents);
+    while (cinfo.next_scanline < h) {
+      for (unsigned int x = 0; x < w; ++x) {
+        for (int c = 0; c < nComponents; ++c) {
+          row[x*nComponents + c] = NoiseValue(x, cinfo.next_scanline, c);
+        }
+      }
+
+      JSAMPROW rowPtr = row.data();
+      jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::string out((const char*) buffer, size);
+    std::free(buffer);
+    return out;
+  }
+
+  james::JPEGLoadOptions Parallel(unsigned int threads, james::PixelFormat format = james::PixelFormat::Auto) {
+    james::JPEGLoadOptions options;
+    options.threads = threads;
+    options.parallelThreshold = 0;
+    options.pixelFormat = format;
+    options.rowAlignment = 16;
+    return options;
+  }
+
+  bool SameAsSerial(const std::string& jpeg, const james::JPEGLoadOptions& options) {
+    james::JPEGLoadOptions serial = options;
+    serial.threads = 1;
+    const james::Image expected = james::LoadJPEG(jpeg.data(), jpeg.size(), serial);
+
+    for (unsigned int threads : { 2u, 3u, 8u }) {
+      james::JPEGLoadOptions parallel = options;
+      parallel.threads = threads;
+
+      if (!test::SameImage(james::LoadJPEG(jpeg.data(), jpeg.size(), parallel), expected)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Every format & scale, with & without fancy upsampling
+  bool SameAsSerial(const std::string& jpeg) {
+    const james::PixelFormat formats[] = {
+      james::PixelFormat::Auto, james::PixelFormat::RGB, james::PixelFormat::BGRA,
+      james::PixelFormat::RGBX, james::PixelFormat::PremultipliedRGBA, james::PixelFormat::Gray8
+    };
+
+    for (james::PixelFormat format : formats) {
+      for (unsigned int scale : { 1u, 2u, 4u, 8u }) {
+        for (bool fancy : { true, false }) {
+          james::JPEGLoadOptions options = Parallel(1, format);
+          options.scaleDenominator = scale;
+          options.fancyUpsampling = fancy;
+
+          if (!SameAsSerial(jpeg, options)) {
+            return false;
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+}
+
+int main() {
+  // Gray: markers every row (65 MCUs per row) & every 7 rows (7 MCUs, rows of 65)
+  CHECK(SameAsSerial(RestartJPEG(517, 300, 1, 65)));
+  CHECK(SameAsSerial(RestartJPEG(517, 300, 1, 7)));
+
+  // 4:2:0, whose upsampling needs the rows either side: markers every MCU, every row
+  // (39 MCUs per row) & at row starts only every 10 rows
+  CHECK(SameAsSerial(RestartJPEG(613, 410, 3, 1)));
+  CHECK(SameAsSerial(RestartJPEG(613, 410, 3, 39)));
+  CHECK(SameAsSerial(RestartJPEG(613, 410, 3, 10)));
+
+  // 4:2:2, 4:4:0 & 4:4:4
+  CHECK(SameAsSerial(RestartJPEG(450, 333, 3, 5, 2, 1)));
+  CHECK(SameAsSerial(RestartJPEG(450, 333, 3, 5, 1, 2)));
+  CHECK(SameAsSerial(RestartJPEG(450, 333, 3, 5, 1, 1)));
+
+  // libjpeg's own restart_in_rows & the fast DCT
+  {
+    james::JPEGLoadOptions fast = Parallel(4);
+    fast.fastDCT = true;
+    CHECK(SameAsSerial(test::EncodeJPEG(640, 480, 3, false, 2, nullptr, NoiseValue), fast));
+    CHECK(SameAsSerial(test::EncodeJPEG(640, 480, 1, false, 1, nullptr, NoiseValue), fast));
+  }
+
+  // Metadata, orientation & maxDimension still apply
+  {
+    test::Metadata metadata;
+    metadata.exif = test::MakeExif(6);
+    const std::string withExif = test::EncodeJPEG(400, 300, 3, false, 1, &metadata, NoiseValue);
+
+    james::ImageMetadata collected;
+    james::JPEGLoadOptions options = Parallel(3);
+    options.metadata = &collected;
+    options.applyOrientation = true;
+    CHECK(SameAsSerial(withExif, options));
+    CHECK(collected.orientation == 6 && !collected.exif.empty());
+
+    options.maxDimension = 100;
+    CHECK(SameAsSerial(withExif, options));
+    const james::Image thumbnail = james::LoadJPEG(withExif.data(), withExif.size(), options);
+    CHECK(thumbnail.Width() == 75 && thumbnail.Height() == 100);
+  }
+
+  // JPEGs the parallel path doesn't cover decode as usual: no restart markers,
+  // progressive & markers too far apart to split on
+  {
+    const std::string plain = test::EncodeJPEG(500, 300, 3, false, 0, nullptr, NoiseValue);
+    const std::string progressive = test::EncodeJPEG(500, 300, 3, true, 1, nullptr, NoiseValue);
+    const std::string sparse = RestartJPEG(500, 300, 3, 32*19);
+
+    CHECK(SameAsSerial(plain, Parallel(4)));
+    CHECK(SameAsSerial(progressive, Parallel(4)));
+    CHECK(SameAsSerial(sparse, Parallel(4)));
+
+    const std::string jpeg = RestartJPEG(500, 300, 3, 4);
+
+    james::JPEGLoadOptions region = Parallel(4);
+    region.region = james::Region(10, 20, 100, 50);
+    CHECK(SameAsSerial(jpeg, region));
+
+    // Streams always take the single threaded path
+    std::istringstream src(jpeg);
+    CHECK(test::SameImage(james::LoadJPEG(src, Parallel(4)), james::LoadJPEG(jpeg.data(), jpeg.size(), Parallel(1))));
+
+    // As do images below the threshold
+    james::JPEGLoadOptions threshold = Parallel(4);
+    threshold.parallelThreshold = 500 * 300 + 1;
+    CHECK(SameAsSerial(jpeg, threshold));
+  }
+
+  // Bad data is reported as on the single threaded path
+  {
+    const std::string jpeg = RestartJPEG(600, 400, 3, 3);
+
+    const std::string truncated = jpeg.substr(0, jpeg.size() / 2);
+    CHECK(james::TryLoadJPEG(truncated.data(), truncated.size(), Parallel(3)).error == james::DecodeError::Truncated);
+
+    // Out of sequence markers: libjpeg resynchronises, so this isn't an error, but
+    // the image can't be split on them
+    std::string resequenced = jpeg;
+    const std::size_t rst = resequenced.find("\xFF\xD3");
+    CHECK(rst != std::string::npos);
+    resequenced[rst + 1] = (char) 0xD5;
+    CHECK(SameAsSerial(resequenced, Parallel(3)));
+  }
+
+  // Stats still add up
+  {
+    const std::string jpeg = RestartJPEG(600, 400, 3, 6);
+    james::DecodeStats stats;
+    james::JPEGLoadOptions options = Parallel(3, james::PixelFormat::RGBA);
+    options.stats = &stats;
+
+    const james::Image img = james::LoadJPEG(jpeg.data(), jpeg.size(), options);
+    CHECK(stats.outputBytes == james::ByteSize(img));
+    CHECK(stats.bytesRead > 0 && stats.bytesRead <= jpeg.size());
+    CHECK(stats.peakAllocatedBytes >= james::ByteSize(img));
+  }
+
+  return 0;
+}
@@ -0,0 +1,291 @@
+// Checks that PNGLoadOptions::threads gives exactly the same pixels as the single
+// threaded path for every pixel format, filter type & thread count, that images it
+// doesn't cover fall back to the usual path & that bad data is reported in the same
+// way.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <sstream>
+#include <zlib.h>
+
+namespace {
+
+  unsigned char NoiseValue(unsigned int x, unsigned int y, unsigned int c) {
+    unsigned int v = x*0x9E3779B1u ^ y*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    v ^= v >> 15;
+    v *= 0x2C1B3C6Du;
+    v ^= v >> 12;
+    return (unsigned char) (x + y*2 + (v & 31));
+  }
+
+  void AppendU32(std::string& out, unsigned long v) {
+    out.push_back((char) (v >> 24));
+    out.push_back((char) (v >> 16));
+    out.push_back((char) (v >> 8));
+    out.push_back((char) v);
+  }
+
+  void AppendChunk(std::string& out, const char* type, const std::string& data) {
+    AppendU32(out, (unsigned long) data.size());
+    const std::size_t start = out.size();
+    out.append(type, 4);
+    out.append(data);
+    AppendU32(out, crc32(0, (const Bytef*) &out[start], (uInt) (out.size() - start)));
+  }
+
+  // A PNG whose scanlines are arbitrary bytes, each row using filter type
+  // filterFor(y), with the image data split into IDAT chunks of chunkSize bytes.
+  // libpng's encoder picks filters for itself, so this is how every filter gets
+  // tested (& how to make a bad one).
+  std::string RawPNG(unsigned int w, unsigned int h, int colourType, unsigned int channels,
+    unsigned char (*filterFor)(unsigned int y), std::size_t chunkSize)
+  {
+    std::string scanlines;
+
+    for (unsigned int y = 0; y < h; ++y) {
+      scanlines.push_back((char) filterFor(y));
+      for (unsigned int x = 0; x < w * channels; ++x) {
+        scanlines.push_back((char) NoiseValue(x, y, 0));
+      }
+    }
+
+    uLongf compressedSize = compressBound((uLong) scanlines.size());
+    std::string compressed(compressedSize, '\0');
+    compress((Bytef*) &compressed[0], &compressedSize, (const Bytef*) scanlines.data(), (uLong) scanlines.size());
+    compressed.resize(compressedSize);
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    std::string ihdr;
+    AppendU32(ihdr, w);
+    AppendU32(ihdr, h);
+    ihdr += (char) 8;
+    ihdr += (char) colourType;
+    ihdr.append(3, '\0');
+    AppendChunk(png, "IHDR", ihdr);
+
+    for (std::size_t i = 0; i < compressed.size(); i += chunkSize) {
+      AppendChunk(png, "IDAT", compressed.substr(i, chunkSize));
+    }
+
+    AppendChunk(png, "IEND", std::string());
+    return png;
+  }
+
+  // Recomputes the CRC of the chunk starting at pos after its data has been changed
+  void FixCRC(std::string& png, std::size_t pos) {
+    const std::size_t length = (std::size_t) (unsigned char) png[pos] << 24 | (unsigned char) png[pos + 1] << 16 |
+      (unsigned char) png[pos + 2] << 8 | (unsigned char) png[pos + 3];
+    std::string crc;
+    AppendU32(crc, crc32(0, (const Bytef*) &png[pos + 4], (uInt) (length + 4)));
+    png.replace(pos + 8 + length, 4, crc);
+  }
+
+  unsigned char EveryFilter(unsigned int y) { return (unsigned char) (y % 5); }
+  unsigned char BadFilter(unsigned int y) { return (unsigned char) (y == 150 ? 7 : y % 5); }
+
+  james::PNGLoadOptions Parallel(unsigned int threads, james::PixelFormat format = james::PixelFormat::Auto) {
+    james::PNGLoadOptions options;
+    options.threads = threads;
+    options.parallelThreshold = 0;
+    options.pixelFormat = format;
+    options.rowAlignment = 16;
+    return options;
+  }
+
+  // Compares the parallel & single threaded results for every format & a few thread
+  // counts
+  bool SameAsSerial(const std::string& png, bool gray) {
+    const james::PixelFormat formats[] = {
+      james::PixelFormat::Auto, james::PixelFormat::RGB, james::PixelFormat::BGR,
+      james::PixelFormat::RGBA, james::PixelFormat::BGRA, james::PixelFormat::RGBX,
+      james::PixelFormat::PremultipliedRGBA, james::PixelFormat::Gray8
+    };
+
+    for (james::PixelFormat format : formats) {
+      if (format == james::PixelFormat::Gray8 && !gray) {
+        continue;
+      }
+
+      james::PNGLoadOptions serial = Parallel(1, format);
+      const james::Image expected = james::LoadPNG(png.data(), png.size(), serial);
+
+      for (unsigned int threads : { 2u, 3u, 6u }) {
+        if (!test::SameImage(james::LoadPNG(png.data(), png.size(), Parallel(threads, format)), expected)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+}
+
+int main() {
+  // Many bands, many IDAT chunks, every colour type that the parallel path covers
+  CHECK(SameAsSerial(test::EncodePNG(1500, 120, PNG_COLOR_TYPE_GRAY, false, nullptr, NoiseValue), true));
+  CHECK(SameAsSerial(test::EncodePNG(900, 140, PNG_COLOR_TYPE_RGB, false, nullptr, NoiseValue), false));
+  CHECK(SameAsSerial(test::EncodePNG(700, 160, PNG_COLOR_TYPE_RGB_ALPHA, false, nullptr, NoiseValue), false));
+
+  // Every filter type, with chunks that split rows & the zlib stream arbitrarily
+  CHECK(SameAsSerial(RawPNG(301, 200, PNG_COLOR_TYPE_GRAY, 1, EveryFilter, 777), true));
+  CHECK(SameAsSerial(RawPNG(301, 200, PNG_COLOR_TYPE_RGB, 3, EveryFilter, 1), false));
+  CHECK(SameAsSerial(RawPNG(301, 200, PNG_COLOR_TYPE_RGB_ALPHA, 4, EveryFilter, 4096), false));
+
+  // Small images: a single band, a single row
+  CHECK(SameAsSerial(test::EncodePNG(5, 3, PNG_COLOR_TYPE_RGB_ALPHA), false));
+  CHECK(SameAsSerial(test::EncodePNG(64, 1, PNG_COLOR_TYPE_RGB), false));
+
+  // Images the parallel path doesn't cover decode as usual
+  {
+    const std::string interlaced = test::EncodePNG(300, 200, PNG_COLOR_TYPE_RGB_ALPHA, true);
+    const std::string grayAlpha = RawPNG(300, 200, PNG_COLOR_TYPE_GRAY_ALPHA, 2, EveryFilter, 4096);
+    const std::string sixteen = test::EncodePNG16(300, 200, PNG_COLOR_TYPE_RGB);
+
+    CHECK(test::SameImage(james::LoadPNG(interlaced.data(), interlaced.size(), Parallel(4)),
+      james::LoadPNG(interlaced.data(), interlaced.size(), Parallel(1))));
+    CHECK(test::SameImage(james::LoadPNG(grayAlpha.data(), grayAlpha.size(), Parallel(4)),
+      james::LoadPNG(grayAlpha.data(), grayAlpha.size(), Parallel(1))));
+    CHECK(test::SameImage(james::LoadPNG(sixteen.data(), sixteen.size(), Parallel(4)),
+      james::LoadPNG(sixteen.data(), sixteen.size(), Parallel(1))));
+
+    const std::string rgb = test::EncodePNG(300, 200, PNG_COLOR_TYPE_RGB, false, nullptr, NoiseValue);
+    james::PNGLoadOptions gray = Parallel(4, james::PixelFormat::Gray8);
+    CHECK(test::SameImage(james::LoadPNG(rgb.data(), rgb.size(), gray),
+      james::LoadPNG(rgb.data(), rgb.size(), Parallel(1, james::PixelFormat::Gray8))));
+
+    james::PNGLoadOptions region = Parallel(4);
+    region.region = james::Region(10, 20, 100, 50);
+    james::PNGLoadOptions serialRegion = Parallel(1);
+    serialRegion.region = region.region;
+    CHECK(test::SameImage(james::LoadPNG(rgb.data(), rgb.size(), region),
+      james::LoadPNG(rgb.data(), rgb.size(), serialRegion)));
+
+    // Streams always take the single threaded path
+    std::istringstream src(rgb);
+    CHECK(test::SameImage(james::LoadPNG(src, Parallel(4)), james::LoadPNG(rgb.data(), rgb.size(), Parallel(1))));
+
+    // As do images below the threshold
+    james::PNGLoadOptions threshold = Parallel(4);
+    threshold.parallelThreshold = 300 * 200 + 1;
+    CHECK(test::SameImage(james::LoadPNG(rgb.data(), rgb.size(), threshold),
+      james::LoadPNG(rgb.data(), rgb.size(), Parallel(1))));
+  }
+
+  // Bad data is reported as on the single threaded path
+  {
+    const std::string png = test::EncodePNG(800, 300, PNG_COLOR_TYPE_RGB_ALPHA, false, nullptr, NoiseValue);
+    const std::size_t idat = png.find("IDAT");
+
+    const std::string truncated = png.substr(0, png.size() / 2);
+    CHECK(james::TryLoadPNG(truncated.data(), truncated.size(), Parallel(3)).error == james::DecodeError::Truncated);
+
+    std::string badCRC = png;
+    badCRC[idat + 100] ^= 0x10;
+    CHECK(james::TryLoadPNG(badCRC.data(), badCRC.size(), Parallel(3)).error == james::DecodeError::Corrupt);
+    CHECK(james::TryLoadPNG(badCRC.data(), badCRC.size(), Parallel(1)).error == james::DecodeError::Corrupt);
+
+    const std::string badFilter = RawPNG(301, 200, PNG_COLOR_TYPE_RGB, 3, BadFilter, 4096);
+    for (unsigned int threads : { 1u, 2u, 4u }) {
+      const james::LoadResult result = james::TryLoadPNG(badFilter.data(), badFilter.size(), Parallel(threads));
+      CHECK(result.error == james::DecodeError::Corrupt && result.image.Width() == 0);
+    }
+
+    bool threw = false;
+    try {
+      james::LoadPNG(badFilter.data(), badFilter.size(), Parallel(4));
+    }
+    catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK(threw);
+
+    // Not enough image data: the header claims one more row than there is
+    std::string shortData = RawPNG(301, 200, PNG_COLOR_TYPE_RGB, 3, EveryFilter, 4096);
+    shortData[19] = (char) 201;
+    const unsigned long ihdrCRC = crc32(0, (const Bytef*) &shortData[12], 17);
+    std::string crc;
+    AppendU32(crc, ihdrCRC);
+    shortData.replace(29, 4, crc);
+    CHECK(james::TryLoadPNG(shortData.data(), shortData.size(), Parallel(3)).error == james::DecodeError::Corrupt);
+    CHECK(james::TryLoadPNG(shortData.data(), shortData.size(), Parallel(1)).error == james::DecodeError::Corrupt);
+  }
+
+  // As are problems after the image data, which the single threaded path finds in
+  // png_read_end: the end of the zlib stream & its Adler-32, further IDATs, the
+  // chunk CRCs & IEND
+  {
+    const std::string png = RawPNG(301, 200, PNG_COLOR_TYPE_RGB, 3, EveryFilter, 4096);
+    const std::size_t iend = png.size() - 12;
+    const std::size_t lastIDAT = png.rfind("IDAT") - 4;
+
+    std::string text;
+    AppendChunk(text, "tEXt", std::string("Comment\0trailer", 15));
+
+    std::string badText = text;
+    badText.back() ^= 1;
+
+    std::string extraIDAT;
+    AppendChunk(extraIDAT, "IDAT", "junk");
+
+    std::string badIDAT = extraIDAT;
+    badIDAT.back() ^= 1;
+
+    std::string badIEND = png;
+    badIEND.back() ^= 1;
+
+    std::string badAdler = png;
+    badAdler[iend - 5] ^= 1;
+    FixCRC(badAdler, lastIDAT);
+
+    // The last IDAT without its final 4 bytes, so the stream never ends
+    std::string noAdler = png.substr(0, iend - 8) + png.substr(iend);
+    noAdler[lastIDAT + 3] -= 4;
+    FixCRC(noAdler, lastIDAT);
+
+    const std::string trailers[] = {
+      png.substr(0, iend),
+      png.substr(0, iend + 6),
+      badIEND,
+      badAdler,
+      noAdler,
+      png.substr(0, iend) + badIDAT + png.substr(iend),
+      png.substr(0, iend) + extraIDAT + png.substr(iend),
+      png.substr(0, iend) + text + png.substr(iend),
+      png.substr(0, iend) + badText + png.substr(iend),
+      png.substr(0, iend) + text.substr(0, 10),
+      png + "garbage"
+    };
+
+    const james::DecodeError expected[] = {
+      james::DecodeError::Truncated, james::DecodeError::Truncated, james::DecodeError::Corrupt,
+      james::DecodeError::Corrupt, james::DecodeError::Corrupt, james::DecodeError::Corrupt,
+      james::DecodeError::None, james::DecodeError::None, james::DecodeError::None,
+      james::DecodeError::Truncated, james::DecodeError::None
+    };
+
+    for (std::size_t i = 0; i < sizeof(trailers) / sizeof(trailers[0]); ++i) {
+      for (unsigned int threads : { 1u, 3u }) {
+        const james::LoadResult result = james::TryLoadPNG(trailers[i].data(), trailers[i].size(), Parallel(threads));
+        CHECK(result.error == expected[i]);
+        CHECK((result.image.Width() == 0) == (expected[i] != james::DecodeError::None));
+      }
+    }
+  }
+
+  // Stats still add up
+  {
+    const std::string png = test::EncodePNG(600, 200, PNG_COLOR_TYPE_RGB, false, nullptr, NoiseValue);
+    james::DecodeStats stats;
+    james::PNGLoadOptions options = Parallel(3, james::PixelFormat::RGBA);
+    options.stats = &stats;
+
+    const james::Image img = james::LoadPNG(png.data(), png.size(), options);
+    CHECK(stats.outputBytes == james::ByteSize(img));
+    CHECK(stats.bytesRead == png.size());
+    CHECK(stats.peakAllocatedBytes > james::ByteSize(img));
+  }
+
+  return 0;
+}
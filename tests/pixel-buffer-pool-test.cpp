@@ -0,0 +1,115 @@
+// Checks PixelBufferPool & loading into pooled Images.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace {
+  bool Aligned(const void* p) {
+    return (reinterpret_cast<std::uintptr_t>(p) % james::PixelBufferPool::Alignment) == 0;
+  }
+}
+
+int main() {
+  // Size classes never round up by more than 25% (beyond the minimum size)
+  for (std::size_t size = 1; size < (1 << 20); size = size * 3 / 2 + 1) {
+    const std::size_t c = james::PixelBufferPool::SizeClass(size);
+    CHECK(c >= size);
+    CHECK(c <= james::PixelBufferPool::Alignment || c <= size + size / 4 + 1);
+    CHECK(james::PixelBufferPool::SizeClass(c) == c);
+  }
+
+  // Sizes that can't be rounded up aren't wrapped around to small ones; allocating
+  // them fails as usual
+  for (std::size_t size : { SIZE_MAX, SIZE_MAX - 1, SIZE_MAX / 2 + 2, SIZE_MAX - SIZE_MAX / 16 }) {
+    CHECK(james::PixelBufferPool::SizeClass(size) >= size);
+
+    bool threw = false;
+    try {
+      james::PixelBufferPool(1 << 20).Allocate(size);
+    }
+    catch (const std::bad_alloc&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  // Loading repeatedly through a pool recycles the same buffer
+  auto pool = std::make_shared<james::PixelBufferPool>(64 << 20);
+  const std::string png = test::EncodePNG(200, 100, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string jpeg = test::EncodeJPEG(200, 100, 3);
+
+  james::PNGLoadOptions pngOptions;
+  pngOptions.allocator = pool;
+
+  james::JPEGLoadOptions jpegOptions;
+  jpegOptions.allocator = pool;
+
+  for (int i = 0; i < 10; ++i) {
+    james::Image img(james::LoadPNG(png.data(), png.size(), pngOptions));
+    CHECK(img.Allocator() == pool);
+    CHECK(Aligned(img.Pixels()));
+
+    james::Image copy(img);
+    CHECK(copy.Allocator() == pool);
+    CHECK(std::memcmp(copy.Pixels(), img.Pixels(), james::ByteSize(img)) == 0);
+
+    james::Image j(james::LoadJPEG(jpeg.data(), jpeg.size(), jpegOptions));
+    CHECK(j.Allocator() == pool);
+  }
+
+  james::PixelBufferPool::Stats stats = pool->GetStats();
+  CHECK(stats.misses == 3);
+  CHECK(stats.hits == 27);
+  CHECK(stats.HitRate() == 0.9);
+  CHECK(stats.retainedBuffers == 3);
+
+  pool->Trim();
+  CHECK(pool->GetStats().retainedBytes == 0);
+
+  // Retained memory is capped
+  auto small = std::make_shared<james::PixelBufferPool>(100000);
+  {
+    james::Image a(200, 100, 32, small);   // 80000 bytes
+    james::Image b(200, 100, 32, small);
+    CHECK(Aligned(a.Pixels()) && Aligned(b.Pixels()));
+  }
+  CHECK(small->GetStats().retainedBuffers == 1);
+  CHECK(small->GetStats().retainedBytes <= 100000);
+
+  // Images keep their allocator alive
+  james::Image survivor;
+  {
+    auto temporary = std::make_shared<james::PixelBufferPool>(1 << 20);
+    survivor = james::Image(10, 10, 24, temporary);
+  }
+  std::memset(survivor.Pixels(), 0, james::ByteSize(survivor));
+
+  // Concurrent use
+  auto shared = std::make_shared<james::PixelBufferPool>(16 << 20);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([shared, t]() {
+      for (int i = 0; i < 1000; ++i) {
+        james::Image img(16 + (i % 7) * 16, 16 + t, 32, shared);
+        std::memset(img.Pixels(), t, james::ByteSize(img));
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  stats = shared->GetStats();
+  CHECK(stats.hits + stats.misses == 8000);
+  CHECK(stats.HitRate() > 0.5);
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Checks every PixelFormat against the Auto decode of the same image, converted in
+// the test, for each PNG colour type & for colour & grayscale JPEGs.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+  using james::PixelFormat;
+
+  const PixelFormat Formats[] = {
+    PixelFormat::RGB, PixelFormat::RGBA, PixelFormat::BGR, PixelFormat::BGRA,
+    PixelFormat::RGBX, PixelFormat::Gray8, PixelFormat::PremultipliedRGBA
+  };
+
+  // The expected value of channel c of a pixel in format, given the pixel as RGBA
+  int Expected(const unsigned char* rgba, PixelFormat format, unsigned int c, bool pngWeights) {
+    switch (format) {
+    case PixelFormat::BGR:
+    case PixelFormat::BGRA:
+      return c == 3 ? rgba[3] : rgba[2 - c];
+
+    case PixelFormat::RGBX:
+      return c == 3 ? 255 : rgba[c];
+
+    case PixelFormat::Gray8:
+      return pngWeights ?
+        (int) (0.2126*rgba[0] + 0.7152*rgba[1] + 0.0722*rgba[2] + 0.5) :
+        (int) (0.299*rgba[0] + 0.587*rgba[1] + 0.114*rgba[2] + 0.5);
+
+    case PixelFormat::PremultipliedRGBA:
+      return c == 3 ? rgba[3] : (int) (rgba[c]*rgba[3]/255.0 + 0.5);
+
+    default:
+      return rgba[c];
+    }
+  }
+
+  // reference is an Auto decode: RGB, RGBA or (JPEG only) gray
+  void CheckFormat(const james::Image& reference, const james::Image& img, PixelFormat format,
+    bool png, int tolerance)
+  {
+    const unsigned int refChannels = reference.BitsPerPixel() >> 3;
+    const unsigned int channels = james::BytesPerPixel(format);
+
+    CHECK(img.Width() == reference.Width() && img.Height() == reference.Height());
+    CHECK(img.BitsPerPixel() == channels << 3);
+
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      for (unsigned int x = 0; x < img.Width(); ++x) {
+        const unsigned char* ref = reference.Row(y) + x*refChannels;
+        const unsigned char rgba[4] = {
+          ref[0], ref[refChannels == 1 ? 0 : 1], ref[refChannels == 1 ? 0 : 2],
+          (unsigned char) (refChannels == 4 ? ref[3] : 255)
+        };
+
+        for (unsigned int c = 0; c < channels; ++c) {
+          const int actual = img.Row(y)[x*channels + c];
+          const int expected = refChannels == 1 && format == PixelFormat::Gray8 ?
+            ref[0] : Expected(rgba, format, c, png);
+          CHECK(std::abs(actual - expected) <= tolerance);
+        }
+      }
+    }
+  }
+
+  void CheckPNG(int colourType, bool interlaced) {
+    const std::string png = test::EncodePNG(29, 13, colourType, interlaced);
+    const james::Image reference(james::LoadPNG(png.data(), png.size()));
+
+    for (PixelFormat format : Formats) {
+      james::PNGLoadOptions options;
+      options.pixelFormat = format;
+
+      const bool gray = !(colourType & PNG_COLOR_MASK_COLOR);
+      const int tolerance = format == PixelFormat::Gray8 && !gray ? 1 : 0;
+
+      CheckFormat(reference, james::LoadPNG(png.data(), png.size(), options), format, true, tolerance);
+    }
+  }
+
+  void CheckJPEG(unsigned int nComponents) {
+    const std::string jpeg = test::EncodeJPEG(29, 13, nComponents);
+    const james::Image reference(james::LoadJPEG(jpeg.data(), jpeg.size()));
+
+    for (PixelFormat format : Formats) {
+      james::JPEGLoadOptions options;
+      options.pixelFormat = format;
+
+      // libjpeg's gray output is the decoded luma, not the luminance of the decoded
+      // (rounded & clamped) RGB
+      const int tolerance = format == PixelFormat::Gray8 && nComponents == 3 ? 3 : 0;
+
+      CheckFormat(reference, james::LoadJPEG(jpeg.data(), jpeg.size(), options), format, false, tolerance);
+    }
+  }
+
+}
+
+int main() {
+  CheckPNG(PNG_COLOR_TYPE_GRAY, false);
+  CheckPNG(PNG_COLOR_TYPE_GRAY_ALPHA, false);
+  CheckPNG(PNG_COLOR_TYPE_RGB, false);
+  CheckPNG(PNG_COLOR_TYPE_RGB_ALPHA, false);
+  CheckPNG(PNG_COLOR_TYPE_RGB_ALPHA, true);
+
+  CheckJPEG(1);
+  CheckJPEG(3);
+
+  // Auto is unchanged: gray JPEGs stay 8bpp
+  const std::string gray = test::EncodeJPEG(29, 13, 1);
+  CHECK(james::LoadJPEG(gray.data(), gray.size()).BitsPerPixel() == 8);
+
+  james::JPEGLoadOptions options;
+  options.pixelFormat = PixelFormat::BGRA;
+  std::istringstream src(gray);
+  std::unique_ptr<james::ImageReader> reader(james::OpenJPEGReader(src, options));
+  CHECK(reader->BitsPerPixel() == 32);
+
+  return 0;
+}
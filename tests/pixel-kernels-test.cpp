@@ -0,0 +1,233 @@
+// Checks the scalar pixel kernels against their definitions & every other kernel set
+// available on this machine against the scalar ones, for lengths that exercise both
+// the vector loops & the scalar tails, at unaligned addresses. Also checks the whole
+// image functions respect the stride.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+  using james::PixelKernels;
+  using james::SimdLevel;
+
+  std::vector<unsigned char> Random(std::size_t n, unsigned int seed) {
+    std::vector<unsigned char> v(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      seed = seed*1103515245u + 12345u;
+      v[i] = (unsigned char) (seed >> 16);
+    }
+    return v;
+  }
+
+  void CheckScalarDefinitions() {
+    const PixelKernels& k = *james::GetPixelKernels(SimdLevel::Scalar);
+
+    // Every colour & alpha combination
+    std::vector<unsigned char> px(256*256*4);
+    for (unsigned int c = 0; c < 256; ++c) {
+      for (unsigned int a = 0; a < 256; ++a) {
+        unsigned char* p = &px[(c*256 + a)*4];
+        p[0] = p[1] = p[2] = (unsigned char) c;
+        p[3] = (unsigned char) a;
+      }
+    }
+
+    std::vector<unsigned char> pre(px);
+    k.premultiplyAlpha(pre.data(), 256*256);
+
+    std::vector<unsigned char> un(px);
+    k.unpremultiplyAlpha(un.data(), 256*256);
+
+    for (unsigned int c = 0; c < 256; ++c) {
+      for (unsigned int a = 0; a < 256; ++a) {
+        const std::size_t i = (c*256 + a)*4;
+        CHECK(pre[i] == (unsigned int) (c*a/255.0 + 0.5));
+        CHECK(pre[i + 3] == a);
+
+        const unsigned int expected = a == 0 ? 0 : std::min(255u, (unsigned int) (c*255.0/a + 0.5));
+        CHECK(un[i] == expected);
+        CHECK(un[i + 3] == a);
+      }
+    }
+
+    // Opaque premultiplied pixels round trip exactly
+    std::vector<unsigned char> opaque(Random(400, 1));
+    for (std::size_t i = 3; i < opaque.size(); i += 4) {
+      opaque[i] = 255;
+    }
+    std::vector<unsigned char> roundTrip(opaque);
+    k.premultiplyAlpha(roundTrip.data(), 100);
+    CHECK(roundTrip == opaque);
+    k.unpremultiplyAlpha(roundTrip.data(), 100);
+    CHECK(roundTrip == opaque);
+
+    const unsigned char rgb[] = { 1, 2, 3, 4, 5, 6 };
+    unsigned char rgba[8];
+    k.rgbToRGBA(rgb, rgba, 2);
+    const unsigned char expectedRGBA[] = { 1, 2, 3, 255, 4, 5, 6, 255 };
+    CHECK(std::memcmp(rgba, expectedRGBA, 8) == 0);
+
+    unsigned char gray[] = { 7, 9 };
+    unsigned char grayRGB[6];
+    k.grayToRGB(gray, grayRGB, 2);
+    const unsigned char expectedGray[] = { 7, 7, 7, 9, 9, 9 };
+    CHECK(std::memcmp(grayRGB, expectedGray, 6) == 0);
+
+    unsigned char swap24[] = { 1, 2, 3, 4, 5, 6 };
+    k.swapRedBlue24(swap24, 2);
+    const unsigned char expected24[] = { 3, 2, 1, 6, 5, 4 };
+    CHECK(std::memcmp(swap24, expected24, 6) == 0);
+
+    k.swapRedBlue32(rgba, 2);
+    const unsigned char expected32[] = { 3, 2, 1, 255, 6, 5, 4, 255 };
+    CHECK(std::memcmp(rgba, expected32, 8) == 0);
+  }
+
+  // Runs a kernel with src & dst at the given byte offsets from an allocation & a
+  // guard band after dst that must not be written
+  template<class F>
+  std::vector<unsigned char> RunKernel(F f, const std::vector<unsigned char>& input,
+    std::size_t outBytes, std::size_t offset)
+  {
+    const std::size_t guard = 64;
+    std::vector<unsigned char> src(offset + input.size() + 1);
+    std::copy(input.begin(), input.end(), src.begin() + offset);
+
+    std::vector<unsigned char> dst(offset + outBytes + guard, 0xCD);
+    f(src.data() + offset, dst.data() + offset);
+
+    for (std::size_t i = 0; i < guard; ++i) {
+      CHECK(dst[offset + outBytes + i] == 0xCD);
+    }
+
+    return std::vector<unsigned char>(dst.begin() + offset, dst.begin() + offset + outBytes);
+  }
+
+  void CheckAgainstScalar(const PixelKernels& k) {
+    const PixelKernels& s = *james::GetPixelKernels(SimdLevel::Scalar);
+
+    for (std::size_t n = 0; n < 100; ++n) {
+      for (std::size_t offset = 0; offset < 4; ++offset) {
+        const std::vector<unsigned char> in(Random(4*n, (unsigned int) (n*7 + offset)));
+
+        // Source & destination kernels
+        auto expand = [&](const PixelKernels& kk, std::size_t inBpp, std::size_t outBpp,
+          void (*PixelKernels::*kernel)(const unsigned char*, unsigned char*, std::size_t))
+        {
+          const std::vector<unsigned char> input(in.begin(), in.begin() + inBpp*n);
+          return RunKernel([&](const unsigned char* src, unsigned char* dst) {
+            (kk.*kernel)(src, dst, n);
+          }, input, outBpp*n, offset);
+        };
+
+        CHECK(expand(k, 3, 4, &PixelKernels::rgbToRGBA) == expand(s, 3, 4, &PixelKernels::rgbToRGBA));
+        CHECK(expand(k, 1, 3, &PixelKernels::grayToRGB) == expand(s, 1, 3, &PixelKernels::grayToRGB));
+
+        // In place kernels
+        auto inPlace = [&](const PixelKernels& kk, std::size_t bpp,
+          void (*PixelKernels::*kernel)(unsigned char*, std::size_t))
+        {
+          const std::vector<unsigned char> input(in.begin(), in.begin() + bpp*n);
+          return RunKernel([&](const unsigned char* src, unsigned char* dst) {
+            std::copy(src, src + bpp*n, dst);
+            (kk.*kernel)(dst, n);
+          }, input, bpp*n, offset);
+        };
+
+        CHECK(inPlace(k, 3, &PixelKernels::swapRedBlue24) == inPlace(s, 3, &PixelKernels::swapRedBlue24));
+        CHECK(inPlace(k, 4, &PixelKernels::swapRedBlue32) == inPlace(s, 4, &PixelKernels::swapRedBlue32));
+        CHECK(inPlace(k, 4, &PixelKernels::premultiplyAlpha) == inPlace(s, 4, &PixelKernels::premultiplyAlpha));
+        CHECK(inPlace(k, 4, &PixelKernels::unpremultiplyAlpha) == inPlace(s, 4, &PixelKernels::unpremultiplyAlpha));
+      }
+    }
+
+    // Exhaustively for the alpha kernels
+    std::vector<unsigned char> px(256*256*4);
+    for (std::size_t i = 0; i < 256*256; ++i) {
+      px[4*i] = (unsigned char) (i >> 8);
+      px[4*i + 1] = (unsigned char) (i >> 8);
+      px[4*i + 2] = (unsigned char) ~(i >> 8);
+      px[4*i + 3] = (unsigned char) i;
+    }
+
+    std::vector<unsigned char> a(px), b(px);
+    k.premultiplyAlpha(a.data(), 256*256);
+    s.premultiplyAlpha(b.data(), 256*256);
+    CHECK(a == b);
+
+    a = px;
+    b = px;
+    k.unpremultiplyAlpha(a.data(), 256*256);
+    s.unpremultiplyAlpha(b.data(), 256*256);
+    CHECK(a == b);
+  }
+
+  void CheckImageFunctions() {
+    james::Image img(37, 5, 32, 64, nullptr);
+    const std::vector<unsigned char> bytes(Random(james::ByteSize(img), 99));
+    std::memcpy(img.Pixels(), bytes.data(), bytes.size());
+
+    james::SwapRedBlue(img);
+    for (unsigned int y = 0; y < img.Height(); ++y) {
+      const unsigned char* before = &bytes[y*img.Stride()];
+      const unsigned char* after = img.Row(y);
+
+      CHECK(after[0] == before[2] && after[2] == before[0] && after[3] == before[3]);
+
+      // Padding untouched
+      CHECK(std::memcmp(after + 37*4, before + 37*4, img.Stride() - 37*4) == 0);
+    }
+
+    james::Image gray(13, 3, 8, 16, nullptr);
+    for (unsigned int y = 0; y < gray.Height(); ++y) {
+      for (unsigned int x = 0; x < gray.Width(); ++x) {
+        gray.Row(y)[x] = (unsigned char) (x*11 + y);
+      }
+    }
+
+    const james::Image rgb(james::ExpandToRGB(gray));
+    const james::Image rgba(james::ExpandToRGBA(gray));
+    CHECK(rgb.BitsPerPixel() == 24 && rgb.RowAlignment() == 16);
+    CHECK(rgba.BitsPerPixel() == 32 && rgba.RowAlignment() == 16);
+
+    for (unsigned int y = 0; y < gray.Height(); ++y) {
+      for (unsigned int x = 0; x < gray.Width(); ++x) {
+        const unsigned char g = gray.Row(y)[x];
+        CHECK(rgb.Row(y)[3*x] == g && rgb.Row(y)[3*x + 1] == g && rgb.Row(y)[3*x + 2] == g);
+        CHECK(rgba.Row(y)[4*x] == g && rgba.Row(y)[4*x + 2] == g && rgba.Row(y)[4*x + 3] == 255);
+      }
+    }
+
+    james::Image rgba2(james::ExpandToRGBA(rgb));
+    CHECK(std::memcmp(rgba2.Row(2), rgba.Row(2), 13*4) == 0);
+
+    james::PremultiplyAlpha(rgba2);
+    CHECK(std::memcmp(rgba2.Row(2), rgba.Row(2), 13*4) == 0);
+    james::UnpremultiplyAlpha(rgba2);
+    CHECK(std::memcmp(rgba2.Row(2), rgba.Row(2), 13*4) == 0);
+  }
+
+}
+
+int main() {
+  CHECK(james::GetPixelKernels(SimdLevel::Scalar) != nullptr);
+  CHECK(james::GetPixelKernels(james::BestSimdLevel()) != nullptr);
+
+  CheckScalarDefinitions();
+
+  const SimdLevel levels[] = { SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON };
+  for (SimdLevel level : levels) {
+    if (const PixelKernels* k = james::GetPixelKernels(level)) {
+      CheckAgainstScalar(*k);
+    }
+  }
+
+  CheckImageFunctions();
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Checks that 16 bit PNGs decode to 16 bits per channel in the native byte order
+// with PNGLoadOptions::keep16Bit, & are scaled down to 8 bits without it.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+  const unsigned int W = 29;
+  const unsigned int H = 17;
+
+  // Samples are native endian so can be read directly
+  unsigned short Sample(const james::Image& img, unsigned int x, unsigned int y, unsigned int c) {
+    const unsigned int nChannels = img.BitsPerPixel() / 16;
+    std::uint16_t v;
+
+    std::memcpy(&v, img.Row(y) + (x*nChannels + c)*2, 2);
+    return v;
+  }
+
+  james::Image Load(const std::string& png, const james::PNGLoadOptions& options) {
+    return james::LoadPNG((const unsigned char*) png.data(), png.size(), options);
+  }
+
+  james::PNGLoadOptions Keep16Bit(james::PixelFormat format = james::PixelFormat::Auto) {
+    james::PNGLoadOptions options;
+    options.keep16Bit = true;
+    options.pixelFormat = format;
+    return options;
+  }
+
+  // channels[i] is the source channel that ends up in channel i
+  void CheckPattern(const james::Image& img, std::initializer_list<unsigned int> channels) {
+    CHECK(img.Width() == W && img.Height() == H);
+    CHECK(img.BitsPerPixel() == channels.size()*16);
+
+    for (unsigned int y = 0; y < H; ++y) {
+      for (unsigned int x = 0; x < W; ++x) {
+        unsigned int c = 0;
+        for (unsigned int src : channels) {
+          CHECK(Sample(img, x, y, c++) == test::PatternValue16(x, y, src));
+        }
+      }
+    }
+  }
+}
+
+int main() {
+  const std::string rgb = test::EncodePNG16(W, H, PNG_COLOR_TYPE_RGB);
+  const std::string rgba = test::EncodePNG16(W, H, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string rgbaInterlaced = test::EncodePNG16(W, H, PNG_COLOR_TYPE_RGB_ALPHA, true);
+  const std::string gray = test::EncodePNG16(W, H, PNG_COLOR_TYPE_GRAY);
+
+  // Full 16 bit precision, native endian
+  CheckPattern(Load(rgb, Keep16Bit()), { 0, 1, 2 });
+  CheckPattern(Load(rgba, Keep16Bit()), { 0, 1, 2, 3 });
+  CheckPattern(Load(rgbaInterlaced, Keep16Bit()), { 0, 1, 2, 3 });
+  CheckPattern(Load(gray, Keep16Bit(james::PixelFormat::Gray8)), { 0 });
+  CheckPattern(Load(gray, Keep16Bit()), { 0, 0, 0 });
+  CheckPattern(Load(rgba, Keep16Bit(james::PixelFormat::BGR)), { 2, 1, 0 });
+
+  // Added alpha is fully opaque at 16 bits too
+  {
+    const james::Image img = Load(rgb, Keep16Bit(james::PixelFormat::RGBA));
+    CHECK(img.BitsPerPixel() == 64);
+    CHECK(Sample(img, 3, 5, 3) == 0xFFFF);
+    CHECK(Sample(img, 3, 5, 1) == test::PatternValue16(3, 5, 1));
+  }
+
+  // Premultiplication
+  {
+    const james::Image img = Load(rgba, Keep16Bit(james::PixelFormat::PremultipliedRGBA));
+    for (unsigned int y = 0; y < H; ++y) {
+      for (unsigned int x = 0; x < W; ++x) {
+        const std::uint32_t a = test::PatternValue16(x, y, 3);
+        CHECK(Sample(img, x, y, 3) == a);
+        for (unsigned int c = 0; c < 3; ++c) {
+          CHECK(Sample(img, x, y, c) == (test::PatternValue16(x, y, c)*a + 32767) / 65535);
+        }
+      }
+    }
+  }
+
+  // Regions, interlaced or not, match the full image
+  for (const std::string* png : { &rgba, &rgbaInterlaced }) {
+    const james::Image full = Load(*png, Keep16Bit());
+    james::PNGLoadOptions options = Keep16Bit();
+    options.region = james::Region(5, 3, 11, 7);
+
+    const james::Image region = Load(*png, options);
+    CHECK(region.Width() == 11 && region.Height() == 7 && region.BitsPerPixel() == 64);
+    for (unsigned int y = 0; y < 7; ++y) {
+      CHECK(std::memcmp(region.Row(y), full.Row(y + 3) + 5*8, 11*8) == 0);
+    }
+  }
+
+  // TryLoadPNG honours the option as well
+  {
+    const james::LoadResult result = james::TryLoadPNG(
+      (const unsigned char*) rgb.data(), rgb.size(), Keep16Bit());
+    CHECK(result);
+    CheckPattern(result.image, { 0, 1, 2 });
+  }
+
+  // Without keep16Bit, 16 bit images are scaled to 8 bits as before
+  {
+    const james::Image img = Load(rgba, james::PNGLoadOptions());
+    CHECK(img.BitsPerPixel() == 32);
+    for (unsigned int y = 0; y < H; ++y) {
+      for (unsigned int x = 0; x < W; ++x) {
+        for (unsigned int c = 0; c < 4; ++c) {
+          const int expected = (test::PatternValue16(x, y, c)*255 + 32895) >> 16;
+          CHECK(img.Row(y)[x*4 + c] == expected);
+        }
+      }
+    }
+  }
+
+  // 8 bit images are unaffected by the option
+  {
+    const std::string png8 = test::EncodePNG(W, H, PNG_COLOR_TYPE_RGB);
+    const james::Image img = Load(png8, Keep16Bit());
+    CHECK(img.BitsPerPixel() == 24);
+    CHECK(img.Row(4)[7*3 + 2] == test::PatternValue(7, 4, 2));
+  }
+
+  // Image accepts the new depths
+  {
+    const james::Image img(3, 2, 48);
+    CHECK(img.Stride() == 18);
+    CHECK(james::Image(3, 2, 16).Stride() == 6);
+  }
+
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Checks that LoadPNG decodes straight into the Image: the pixel buffer should be the
+// only full-size allocation & peak memory should be little more than the image itself.
+//
+// libPNG's allocations are routed through operator new by LoadPNG so replacing the
+// global operator new/delete lets us see everything.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+// GCC can't see that the pointers handed to Free came from Allocate & warns about the
+// header arithmetic once everything is inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+
+namespace {
+  struct AllocationHeader {
+    std::size_t size;
+    std::size_t padding;
+  };
+
+  bool tracking = false;
+  std::size_t threshold = 0;
+  std::size_t largeAllocations = 0;
+  std::size_t currentBytes = 0;
+  std::size_t peakBytes = 0;
+
+  void* Allocate(std::size_t size) {
+    AllocationHeader* h = (AllocationHeader*)std::malloc(sizeof(AllocationHeader) + size);
+    if (!h) {
+      return nullptr;
+    }
+
+    h->size = size;
+    if (tracking) {
+      currentBytes += size;
+      peakBytes = std::max(peakBytes, currentBytes);
+      if (size >= threshold) {
+        ++largeAllocations;
+      }
+    }
+    return h + 1;
+  }
+
+  void Free(void* ptr) {
+    if (ptr) {
+      AllocationHeader* h = (AllocationHeader*)ptr - 1;
+      if (tracking) {
+        currentBytes -= std::min(currentBytes, h->size);
+      }
+      std::free(h);
+    }
+  }
+
+  void CheckDecode(unsigned int w, unsigned int h, int colourType, bool interlaced) {
+    std::istringstream src(test::EncodePNG(w, h, colourType, interlaced));
+
+    threshold = w*h*3;
+    largeAllocations = 0;
+    currentBytes = 0;
+    peakBytes = 0;
+
+    tracking = true;
+    james::Image img(james::LoadPNG(src));
+    tracking = false;
+
+    const unsigned int nChannels = img.BitsPerPixel() >> 3;
+
+    CHECK(img.Width() == w && img.Height() == h);
+    CHECK(largeAllocations == 1);
+    CHECK(peakBytes < james::ByteSize(img) + 512*1024);
+
+    for (unsigned int y = 0; y < h; ++y) {
+      for (unsigned int x = 0; x < w; ++x) {
+        const unsigned char* p = img.Pixels() + (y*w + x)*nChannels;
+        if (colourType == PNG_COLOR_TYPE_GRAY) {
+          CHECK(p[0] == test::PatternValue(x, y, 0) && p[1] == p[0] && p[2] == p[0]);
+        }
+        else {
+          for (unsigned int c = 0; c < nChannels; ++c) {
+            CHECK(p[c] == test::PatternValue(x, y, c));
+          }
+        }
+      }
+    }
+  }
+}
+
+void* operator new(std::size_t size) {
+  void* p = Allocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept { Free(ptr); }
+void operator delete[](void* ptr) noexcept { Free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { Free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { Free(ptr); }
+
+int main() {
+  CheckDecode(1024, 768, PNG_COLOR_TYPE_RGB, false);
+  CheckDecode(1024, 768, PNG_COLOR_TYPE_RGB_ALPHA, false);
+  CheckDecode(1024, 768, PNG_COLOR_TYPE_GRAY, false);
+  CheckDecode(1023, 767, PNG_COLOR_TYPE_RGB_ALPHA, true);
+  CheckDecode(333, 217, PNG_COLOR_TYPE_RGB, true);
+
+  return 0;
+}
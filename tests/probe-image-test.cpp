@@ -0,0 +1,59 @@
+// Checks that ProbeImage reports headers correctly & leaves streams where it found them.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <sstream>
+
+namespace {
+  void CheckInfo(const james::ImageInfo& info, james::ImageFormat format,
+    unsigned int w, unsigned int h, unsigned int channels, bool interlaced, bool icc, bool exif)
+  {
+    CHECK(info.format == format);
+    CHECK(info.width == w && info.height == h);
+    CHECK(info.channels == channels);
+    CHECK(info.bitDepth == 8);
+    CHECK(info.interlaced == interlaced);
+    CHECK(info.hasICCProfile == icc);
+    CHECK(info.hasEXIF == exif);
+  }
+
+  void CheckProbe(const std::string& data, james::ImageFormat format,
+    unsigned int w, unsigned int h, unsigned int channels, bool interlaced, bool icc, bool exif)
+  {
+    CheckInfo(james::ProbeImage(data.data(), data.size()), format, w, h, channels, interlaced, icc, exif);
+
+    // Probe part way through a stream, then check that a full decode can follow
+    std::istringstream src("xyz" + data);
+    src.ignore(3);
+
+    CheckInfo(james::ProbeImage(src), format, w, h, channels, interlaced, icc, exif);
+    CHECK(src.tellg() == std::streampos(3));
+
+    james::Image img(format == james::ImageFormat::PNG ? james::LoadPNG(src) : james::LoadJPEG(src));
+    CHECK(img.Width() == w && img.Height() == h);
+  }
+}
+
+int main() {
+  test::Metadata metadata;
+  metadata.icc = test::MakeICCProfile();
+  metadata.exif = test::MakeExif(6);
+
+  CheckProbe(test::EncodePNG(321, 123, PNG_COLOR_TYPE_RGB), james::ImageFormat::PNG, 321, 123, 3, false, false, false);
+  CheckProbe(test::EncodePNG(32, 12, PNG_COLOR_TYPE_GRAY, true), james::ImageFormat::PNG, 32, 12, 1, true, false, false);
+  CheckProbe(test::EncodePNG(32, 12, PNG_COLOR_TYPE_RGB_ALPHA, false, &metadata), james::ImageFormat::PNG, 32, 12, 4, false, true, true);
+
+  CheckProbe(test::EncodeJPEG(321, 123, 3), james::ImageFormat::JPEG, 321, 123, 3, false, false, false);
+  CheckProbe(test::EncodeJPEG(32, 12, 1, true), james::ImageFormat::JPEG, 32, 12, 1, true, false, false);
+  CheckProbe(test::EncodeJPEG(32, 12, 3, false, 0, &metadata), james::ImageFormat::JPEG, 32, 12, 3, false, true, true);
+
+  // Unrecognised data is reported rather than thrown
+  CHECK(james::ProbeImage("GIF89a", 6).format == james::ImageFormat::Unknown);
+
+  std::istringstream gif("GIF89a");
+  CHECK(james::ProbeImage(gif).format == james::ImageFormat::Unknown);
+  CHECK(gif.tellg() == std::streampos(0));
+
+  return 0;
+}
@@ -0,0 +1,209 @@
+// Checks that ProgressiveDecoder produces exactly what LoadPNG/LoadJPEG do however the
+// data is split up, that previews appear before the end of the data for progressive
+// JPEGs & interlaced PNGs, & that truncated & unrecognised data are handled.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+  // What we saw while feeding the data in pieces of chunkSize bytes
+  struct Progress {
+    Progress()
+      : previews(0), firstPreviewAt(0)
+    {
+    }
+
+    unsigned int previews;          // Feed calls returning true
+    std::size_t firstPreviewAt;     // bytes fed when Refinements() first became non-zero
+    james::Image image;
+  };
+
+  Progress Decode(const std::string& encoded, std::size_t chunkSize, const james::LoadOptions& options,
+    const james::Image& expected)
+  {
+    Progress progress;
+    james::ProgressiveDecoder decoder(options);
+    unsigned int rowsComplete = 0;
+
+    for (std::size_t pos = 0; pos < encoded.size(); pos += chunkSize) {
+      const std::size_t n = std::min(chunkSize, encoded.size() - pos);
+
+      if (decoder.Feed(encoded.data() + pos, n)) {
+        ++progress.previews;
+      }
+
+      CHECK(decoder.RowsComplete() >= rowsComplete);
+      rowsComplete = decoder.RowsComplete();
+
+      if (decoder.HeaderReady()) {
+        CHECK(decoder.Preview().Width() == expected.Width());
+        CHECK(decoder.Preview().Height() == expected.Height());
+        CHECK(decoder.Preview().RowAlignment() == options.rowAlignment);
+      }
+
+      // Complete rows are final whatever else is going on
+      for (unsigned int y = 0; y < rowsComplete; ++y) {
+        CHECK(std::memcmp(decoder.Preview().Row(y), expected.Row(y), expected.Width()*(expected.BitsPerPixel() >> 3)) == 0);
+      }
+
+      if (decoder.Refinements() > 0 && progress.firstPreviewAt == 0) {
+        progress.firstPreviewAt = pos + n;
+      }
+    }
+
+    CHECK(decoder.Format() != james::ImageFormat::Unknown);
+    CHECK(decoder.Done());
+    CHECK(decoder.RowsComplete() == expected.Height());
+
+    // More data after the end is ignored
+    CHECK(!decoder.Feed("xxxx", 4));
+
+    progress.image = decoder.TakeImage();
+    CHECK(test::SameImage(progress.image, expected));
+    return progress;
+  }
+
+  template<class Options, class Load>
+  void CheckFormat(const std::string& encoded, Options options, Load load, bool progressive) {
+    const james::Image expected(load(encoded, options));
+
+    for (std::size_t chunkSize : { (std::size_t) 1, (std::size_t) 7, (std::size_t) 100, encoded.size() }) {
+      const Progress progress = Decode(encoded, chunkSize, options, expected);
+
+      if (progressive && chunkSize < encoded.size() / 4) {
+        CHECK(progress.previews > 2);
+        CHECK(progress.firstPreviewAt > 0 && progress.firstPreviewAt < encoded.size() / 2);
+      }
+    }
+
+    options.rowAlignment = 16;
+    Decode(encoded, 64, options, load(encoded, options));
+  }
+
+  // After the first Adam7 pass every 8x8 block is filled with its top left pixel. The
+  // second pass only touches the right half of each block so the left half still
+  // shows that.
+  void CheckAdam7Replication(const std::string& encoded, const james::Image& expected) {
+    james::ProgressiveDecoder decoder;
+    const std::size_t bytesPerPixel = expected.BitsPerPixel() >> 3;
+
+    for (std::size_t pos = 0; decoder.Refinements() == 0; ++pos) {
+      CHECK(pos < encoded.size());
+      decoder.Feed(encoded.data() + pos, 1);
+    }
+
+    CHECK(decoder.Refinements() == 1);
+
+    for (unsigned int y = 0; y < expected.Height(); ++y) {
+      for (unsigned int x = 0; x < expected.Width(); ++x) {
+        if (x % 8 < 4) {
+          CHECK(std::memcmp(decoder.Preview().Row(y) + x*bytesPerPixel,
+            expected.Row(y & ~7u) + (x & ~7u)*bytesPerPixel, bytesPerPixel) == 0);
+        }
+      }
+    }
+  }
+
+}
+
+int main() {
+  auto loadPNG = [](const std::string& s, const james::PNGLoadOptions& o) {
+    return james::LoadPNG(s.data(), s.size(), o);
+  };
+  auto loadJPEG = [](const std::string& s, const james::JPEGLoadOptions& o) {
+    return james::LoadJPEG(s.data(), s.size(), o);
+  };
+
+  james::PNGLoadOptions png;
+  CheckFormat(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB), png, loadPNG, false);
+  CheckFormat(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB, true), png, loadPNG, true);
+  CheckFormat(test::EncodePNG(1, 1, PNG_COLOR_TYPE_RGB, true), png, loadPNG, false);
+
+  png.pixelFormat = james::PixelFormat::PremultipliedRGBA;
+  CheckFormat(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA), png, loadPNG, false);
+  CheckFormat(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA, true), png, loadPNG, true);
+  CheckFormat(test::EncodePNG(3, 1, PNG_COLOR_TYPE_RGB_ALPHA, true), png, loadPNG, false);
+
+  png.pixelFormat = james::PixelFormat::Gray8;
+  CheckFormat(test::EncodePNG(37, 20, PNG_COLOR_TYPE_RGB, true), png, loadPNG, false);
+
+  const std::string interlaced = test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB, true);
+  CheckAdam7Replication(interlaced, loadPNG(interlaced, james::PNGLoadOptions()));
+
+  james::JPEGLoadOptions jpeg;
+  CheckFormat(test::EncodeJPEG(100, 70, 3), jpeg, loadJPEG, false);
+  CheckFormat(test::EncodeJPEG(100, 70, 3, true), jpeg, loadJPEG, true);
+  CheckFormat(test::EncodeJPEG(100, 70, 1, true), jpeg, loadJPEG, false);
+  CheckFormat(test::EncodeJPEG(100, 70, 3, false, 2), jpeg, loadJPEG, false);
+
+  jpeg.pixelFormat = james::PixelFormat::BGRA;
+  CheckFormat(test::EncodeJPEG(100, 70, 3, true), jpeg, loadJPEG, true);
+  jpeg.pixelFormat = james::PixelFormat::RGB;
+  CheckFormat(test::EncodeJPEG(100, 70, 1), jpeg, loadJPEG, false);
+
+  // Fed in two pieces, split anywhere: in particular inside the EOI marker, after the
+  // last scan has already been output
+  for (const std::string& encoded : { test::EncodeJPEG(16, 31, 1, true), test::EncodeJPEG(40, 24, 3, true) }) {
+    const james::Image expected = james::LoadJPEG(encoded.data(), encoded.size());
+
+    for (std::size_t split = 1; split < encoded.size(); ++split) {
+      james::ProgressiveDecoder decoder;
+      decoder.Feed(encoded.data(), split);
+      decoder.Feed(encoded.data() + split, encoded.size() - split);
+
+      CHECK(decoder.Done());
+      CHECK(decoder.RowsComplete() == expected.Height());
+      CHECK(test::SameImage(decoder.TakeImage(), expected));
+    }
+  }
+
+  // Truncated data: no error, just not done. The first half of a progressive JPEG
+  // has a preview to show.
+  {
+    const std::string encoded = test::EncodeJPEG(100, 70, 3, true);
+    james::ProgressiveDecoder decoder;
+    decoder.Feed(encoded.data(), encoded.size() / 2);
+    CHECK(decoder.HeaderReady());
+    CHECK(decoder.Refinements() > 0);
+    CHECK(!decoder.Done());
+  }
+
+  // Unrecognised data is rejected once there is enough to be sure
+  {
+    james::ProgressiveDecoder decoder;
+    CHECK(!decoder.Feed("GIF8", 4));
+    CHECK(decoder.Format() == james::ImageFormat::Unknown);
+
+    bool threw = false;
+    try {
+      decoder.Feed("9a....", 6);
+    }
+    catch (std::runtime_error&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  // Corrupt data throws
+  {
+    std::string encoded = test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB);
+    encoded[40] ^= 0x55;
+
+    james::ProgressiveDecoder decoder;
+    bool threw = false;
+    try {
+      decoder.Feed(encoded.data(), encoded.size());
+    }
+    catch (std::exception&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  return 0;
+}
@@ -0,0 +1,237 @@
+// Checks that PushDecoder reports its progress correctly & produces exactly what
+// LoadPNG/LoadJPEG do, including when many decoders are interleaved as they would be
+// on an event loop. With a C++20 compiler the coroutine wrapper is checked too.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+namespace {
+
+  struct Sample {
+    std::string encoded;
+    james::Image expected;
+    bool rowsAtEnd;         // no rows are complete until all of the data has arrived
+  };
+
+  std::vector<Sample> MakeSamples() {
+    std::vector<Sample> samples;
+
+    auto addPNG = [&](const std::string& encoded) {
+      samples.push_back(Sample{ encoded, james::LoadPNG(encoded.data(), encoded.size()), false });
+    };
+    auto addJPEG = [&](const std::string& encoded, bool progressive) {
+      samples.push_back(Sample{ encoded, james::LoadJPEG(encoded.data(), encoded.size()), progressive });
+    };
+
+    addPNG(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB));
+    addPNG(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA, true));
+    addPNG(test::EncodePNG(33, 1, PNG_COLOR_TYPE_GRAY));
+    addJPEG(test::EncodeJPEG(100, 70, 3), false);
+    addJPEG(test::EncodeJPEG(100, 70, 3, true), true);
+    addJPEG(test::EncodeJPEG(57, 33, 1), false);
+
+    return samples;
+  }
+
+  void CheckStatuses(const Sample& sample, std::size_t chunkSize) {
+    typedef james::PushDecoder::Status Status;
+
+    james::PushDecoder decoder;
+    bool headerSeen = false;
+    unsigned int rowsComplete = 0;
+
+    for (std::size_t pos = 0; pos < sample.encoded.size(); pos += chunkSize) {
+      const std::size_t n = std::min(chunkSize, sample.encoded.size() - pos);
+      const Status status = decoder.Feed(sample.encoded.data() + pos, n);
+      const bool last = pos + n == sample.encoded.size();
+
+      CHECK((status == Status::Done) == last);
+      CHECK(decoder.Done() == last);
+
+      if (status != Status::NeedMoreData) {
+        CHECK(decoder.HeaderReady());
+        CHECK(status != Status::HeaderReady || !headerSeen);
+        headerSeen = true;
+      }
+
+      if (decoder.HeaderReady()) {
+        CHECK(decoder.Width() == sample.expected.Width());
+        CHECK(decoder.Height() == sample.expected.Height());
+        CHECK(decoder.BitsPerPixel() == sample.expected.BitsPerPixel());
+      }
+      else {
+        CHECK(status == Status::NeedMoreData);
+      }
+
+      CHECK((status == Status::RowsReady) == (!last && decoder.RowsComplete() > rowsComplete));
+      CHECK(decoder.RowsComplete() >= rowsComplete);
+      rowsComplete = decoder.RowsComplete();
+
+      if (sample.rowsAtEnd && !last) {
+        CHECK(rowsComplete == 0);
+      }
+
+      for (unsigned int y = 0; y < rowsComplete; ++y) {
+        CHECK(std::memcmp(decoder.Decoded().Row(y), sample.expected.Row(y),
+          sample.expected.Width()*(sample.expected.BitsPerPixel() >> 3)) == 0);
+      }
+    }
+
+    CHECK(decoder.Feed("more", 4) == Status::Done);
+    CHECK(test::SameImage(decoder.TakeImage(), sample.expected));
+  }
+
+  // Round robin over many decoders, a little data at a time
+  void CheckInterleaved(const std::vector<Sample>& samples) {
+    const unsigned int nDecoders = 60;
+
+    std::vector<std::unique_ptr<james::PushDecoder>> decoders;
+    std::vector<std::size_t> positions(nDecoders, 0);
+
+    for (unsigned int i = 0; i < nDecoders; ++i) {
+      decoders.emplace_back(new james::PushDecoder());
+    }
+
+    for (unsigned int remaining = nDecoders; remaining > 0; ) {
+      for (unsigned int i = 0; i < nDecoders; ++i) {
+        const std::string& encoded = samples[i % samples.size()].encoded;
+
+        if (positions[i] == encoded.size()) {
+          continue;
+        }
+
+        const std::size_t n = std::min<std::size_t>(97 + i, encoded.size() - positions[i]);
+        decoders[i]->Feed(encoded.data() + positions[i], n);
+        positions[i] += n;
+
+        if (positions[i] == encoded.size()) {
+          CHECK(decoders[i]->Done());
+          CHECK(test::SameImage(decoders[i]->TakeImage(), samples[i % samples.size()].expected));
+          --remaining;
+        }
+      }
+    }
+  }
+
+#ifdef JAMES_IMAGE_LOADER_COROUTINES
+
+  // A stand-in for an event loop: reads complete asynchronously, when Run gets
+  // round to them.
+  struct EventLoop {
+    std::deque<std::coroutine_handle<>> ready;
+
+    void Run() {
+      while (!ready.empty()) {
+        std::coroutine_handle<> h = ready.front();
+        ready.pop_front();
+        h.resume();
+      }
+    }
+  };
+
+  struct ChunkedRead {
+    struct Awaiter {
+      ChunkedRead* reader;
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { reader->loop->ready.push_back(h); }
+
+      std::string await_resume() {
+        const std::size_t n = std::min<std::size_t>(reader->chunkSize, reader->data.size() - reader->pos);
+        reader->pos += n;
+        return reader->data.substr(reader->pos - n, n);
+      }
+    };
+
+    Awaiter operator()() { return Awaiter{ this }; }
+
+    EventLoop* loop;
+    std::string data;
+    std::size_t chunkSize;
+    std::size_t pos;
+  };
+
+  james::ImageTask DecodeBoth(EventLoop& loop, const Sample& a, const Sample& b, std::size_t* decoded) {
+    ChunkedRead readA{ &loop, a.encoded, 50, 0 };
+    ChunkedRead readB{ &loop, b.encoded, 70, 0 };
+
+    CHECK(test::SameImage(co_await james::DecodeImageAsync([&] { return readA(); }), a.expected));
+    ++*decoded;
+
+    james::Image img = co_await james::DecodeImageAsync([&] { return readB(); });
+    ++*decoded;
+    co_return img;
+  }
+
+  void CheckCoroutines(const std::vector<Sample>& samples) {
+    EventLoop loop;
+
+    for (std::size_t i = 0; i + 1 < samples.size(); ++i) {
+      std::size_t decoded = 0;
+      james::ImageTask task = DecodeBoth(loop, samples[i], samples[i + 1], &decoded);
+
+      task.Start();
+      CHECK(!task.Done());
+      loop.Run();
+
+      CHECK(task.Done());
+      CHECK(decoded == 2);
+      CHECK(test::SameImage(task.Get(), samples[i + 1].expected));
+    }
+
+    // Truncated data is an error for the coroutine
+    ChunkedRead truncated{ &loop, samples[0].encoded.substr(0, 500), 64, 0 };
+    james::ImageTask task = james::DecodeImageAsync([&] { return truncated(); });
+    task.Start();
+    loop.Run();
+    CHECK(task.Done());
+
+    bool threw = false;
+    try {
+      task.Get();
+    }
+    catch (std::runtime_error&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+#endif
+
+}
+
+int main() {
+  const std::vector<Sample> samples = MakeSamples();
+
+  for (const Sample& sample : samples) {
+    for (std::size_t chunkSize : { (std::size_t) 1, (std::size_t) 13, (std::size_t) 512, sample.encoded.size() }) {
+      CheckStatuses(sample, chunkSize);
+    }
+  }
+
+  CheckInterleaved(samples);
+
+#ifdef JAMES_IMAGE_LOADER_COROUTINES
+  CheckCoroutines(samples);
+#endif
+
+  // A corrupt JPEG throws from Feed: here the image ends before it starts
+  {
+    james::PushDecoder decoder;
+    bool threw = false;
+    try {
+      decoder.Feed("\xFF\xD8\xFF\xD9", 4);
+    }
+    catch (std::exception&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Checks that decoding a region gives the same pixels as cropping a full decode, for
+// PNG (plain & interlaced) & JPEG (baseline, progressive & scaled), across regions
+// that are interior, full width, touching the edges & partly outside the image.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+  const james::Region Regions[] = {
+    james::Region(0, 0, 1, 1),
+    james::Region(13, 7, 40, 29),
+    james::Region(16, 16, 16, 16),
+    james::Region(0, 20, 100, 10),          // full width
+    james::Region(0, 0, 100, 70),           // everything
+    james::Region(90, 60, 50, 50),          // clipped at the bottom right
+    james::Region(99, 69, 1, 1),
+    james::Region(5, 33, 200, 1)
+  };
+
+  bool SameAsCrop(const james::Image& full, const james::Region& r, const james::Image& region) {
+    const james::Region clipped = r.ClippedTo(full.Width(), full.Height());
+    const std::size_t bytesPerPixel = full.BitsPerPixel() >> 3;
+
+    if (region.Width() != clipped.width || region.Height() != clipped.height ||
+      region.BitsPerPixel() != full.BitsPerPixel())
+    {
+      return false;
+    }
+
+    for (unsigned int y = 0; y < clipped.height; ++y) {
+      if (std::memcmp(region.Row(y), full.Row(clipped.y + y) + clipped.x*bytesPerPixel,
+        clipped.width*bytesPerPixel) != 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template<class Options, class Load>
+  void CheckRegions(const std::string& encoded, Options options, Load load) {
+    const james::Image full(load(encoded, options));
+
+    for (const james::Region& r : Regions) {
+      options.region = r;
+      CHECK(SameAsCrop(full, r, load(encoded, options)));
+
+      options.rowAlignment = 16;
+      CHECK(SameAsCrop(full, r, load(encoded, options)));
+      options.rowAlignment = 1;
+    }
+
+    bool threw = false;
+    options.region = james::Region(full.Width(), 0, 10, 10);
+    try {
+      load(encoded, options);
+    }
+    catch (std::out_of_range&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+}
+
+int main() {
+  auto loadPNG = [](const std::string& s, const james::PNGLoadOptions& o) {
+    return james::LoadPNG(s.data(), s.size(), o);
+  };
+  auto loadJPEG = [](const std::string& s, const james::JPEGLoadOptions& o) {
+    return james::LoadJPEG(s.data(), s.size(), o);
+  };
+
+  james::PNGLoadOptions png;
+  CheckRegions(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB), png, loadPNG);
+  CheckRegions(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB, true), png, loadPNG);
+
+  png.pixelFormat = james::PixelFormat::PremultipliedRGBA;
+  CheckRegions(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA), png, loadPNG);
+  CheckRegions(test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA, true), png, loadPNG);
+
+  james::JPEGLoadOptions jpeg;
+  CheckRegions(test::EncodeJPEG(100, 70, 3), jpeg, loadJPEG);
+  CheckRegions(test::EncodeJPEG(100, 70, 1), jpeg, loadJPEG);
+  CheckRegions(test::EncodeJPEG(100, 70, 3, true), jpeg, loadJPEG);
+
+  jpeg.pixelFormat = james::PixelFormat::BGRA;
+  CheckRegions(test::EncodeJPEG(100, 70, 3), jpeg, loadJPEG);
+
+  // Regions are in scaled coordinates
+  jpeg.pixelFormat = james::PixelFormat::Auto;
+  jpeg.scaleDenominator = 2;
+  CheckRegions(test::EncodeJPEG(200, 140, 3), jpeg, loadJPEG);
+
+  // From a stream too
+  const std::string encoded = test::EncodeJPEG(100, 70, 3);
+  std::istringstream src(encoded);
+  james::JPEGLoadOptions streamOptions;
+  streamOptions.region = james::Region(13, 7, 40, 29);
+  CHECK(SameAsCrop(james::LoadJPEG(encoded.data(), encoded.size()), streamOptions.region,
+    james::LoadJPEG(src, streamOptions)));
+
+  return 0;
+}
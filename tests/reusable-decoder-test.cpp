@@ -0,0 +1,148 @@
+// Checks that JPEGDecoder & PNGDecoder give the same results as LoadJPEG & LoadPNG
+// over a run of different images, that a failed decode leaves them ready for the
+// next one & that per-decode state (metadata, stream exception masks) doesn't leak
+// from one image into the next.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <sstream>
+
+namespace {
+
+  template<class F>
+  bool Throws(F f) {
+    try {
+      f();
+    }
+    catch (const std::exception&) {
+      return true;
+    }
+    return false;
+  }
+
+}
+
+int main() {
+  std::vector<std::string> jpegs, pngs;
+
+  for (unsigned int i = 0; i < 6; ++i) {
+    const unsigned int w = 9 + 13 * i, h = 5 + 11 * i;
+    jpegs.push_back(test::EncodeJPEG(w, h, i % 2 ? 1 : 3, i % 3 == 2));
+    pngs.push_back(test::EncodePNG(w, h, i % 3 == 0 ? PNG_COLOR_TYPE_GRAY :
+      i % 3 == 1 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA, i % 2 == 1));
+  }
+
+  // The same results as the one-shot loaders, from memory & from streams
+  {
+    james::JPEGDecoder jpeg;
+    james::PNGDecoder png;
+
+    for (unsigned int pass = 0; pass < 2; ++pass) {
+      for (const std::string& j : jpegs) {
+        const james::Image expected = james::LoadJPEG(j.data(), j.size());
+        CHECK(test::SameImage(jpeg.Decode(j.data(), j.size()), expected));
+
+        std::istringstream src(j);
+        CHECK(test::SameImage(jpeg.Decode(src), expected));
+        CHECK(src.exceptions() == std::ios::goodbit);
+      }
+
+      for (const std::string& p : pngs) {
+        const james::Image expected = james::LoadPNG(p.data(), p.size());
+        CHECK(test::SameImage(png.Decode(p.data(), p.size()), expected));
+
+        std::istringstream src(p);
+        CHECK(test::SameImage(png.Decode(src), expected));
+        CHECK(src.exceptions() == std::ios::goodbit);
+      }
+    }
+  }
+
+  // Options apply to every decode
+  {
+    james::JPEGLoadOptions jpegOptions;
+    jpegOptions.pixelFormat = james::PixelFormat::BGRA;
+    jpegOptions.scaleDenominator = 2;
+    jpegOptions.rowAlignment = 16;
+    jpegOptions.region = james::Region(1, 2, 8, 3);
+    james::JPEGDecoder jpeg(jpegOptions);
+    CHECK(jpeg.Options().scaleDenominator == 2);
+
+    james::PNGLoadOptions pngOptions;
+    pngOptions.pixelFormat = james::PixelFormat::PremultipliedRGBA;
+    pngOptions.region = james::Region(2, 1, 5, 4);
+    james::PNGDecoder png(pngOptions);
+
+    for (std::size_t i = 1; i < jpegs.size(); ++i) {
+      CHECK(test::SameImage(jpeg.Decode(jpegs[i].data(), jpegs[i].size()),
+        james::LoadJPEG(jpegs[i].data(), jpegs[i].size(), jpegOptions)));
+      CHECK(test::SameImage(png.Decode(pngs[i].data(), pngs[i].size()),
+        james::LoadPNG(pngs[i].data(), pngs[i].size(), pngOptions)));
+    }
+
+    // test::SameImage doesn't compare strides
+    CHECK(jpeg.Decode(jpegs[1].data(), jpegs[1].size()).Stride() % 16 == 0);
+
+    james::JPEGLoadOptions invalid;
+    invalid.inputBufferSize = 0;
+#ifdef NDEBUG
+    CHECK(Throws([&]() { james::JPEGDecoder bad(invalid); }));
+#endif
+  }
+
+  // Failures, thrown or returned, don't affect the next decode
+  {
+    james::JPEGDecoder jpeg;
+    james::PNGDecoder png;
+
+    const std::string& j = jpegs[3];
+    const std::string& p = pngs[3];
+    const std::string badJPEG = j.substr(0, j.size() / 2);
+    const std::string badPNG = p.substr(0, p.size() / 2);
+
+    CHECK(Throws([&]() { jpeg.Decode(badJPEG.data(), badJPEG.size()); }));
+    CHECK(Throws([&]() { png.Decode(badPNG.data(), badPNG.size()); }));
+    CHECK(test::SameImage(jpeg.Decode(j.data(), j.size()), james::LoadJPEG(j.data(), j.size())));
+    CHECK(test::SameImage(png.Decode(p.data(), p.size()), james::LoadPNG(p.data(), p.size())));
+
+    CHECK(jpeg.TryDecode(badJPEG.data(), badJPEG.size()).error == james::DecodeError::Truncated);
+    CHECK(png.TryDecode(badPNG.data(), badPNG.size()).error == james::DecodeError::Truncated);
+    CHECK(jpeg.TryDecode(pngs[0].data(), pngs[0].size()).error == james::DecodeError::BadHeader);
+
+    std::istringstream badSrc(badJPEG);
+    CHECK(jpeg.TryDecode(badSrc).error == james::DecodeError::Truncated);
+    CHECK(badSrc.exceptions() == std::ios::goodbit);
+
+    const james::LoadResult good = jpeg.TryDecode(j.data(), j.size());
+    CHECK(good && test::SameImage(good.image, james::LoadJPEG(j.data(), j.size())));
+    CHECK(png.TryDecode(p.data(), p.size()));
+  }
+
+  // Metadata & stats are reset for each image
+  {
+    test::Metadata metadata;
+    metadata.exif = test::MakeExif(6);
+    const std::string withExif = test::EncodeJPEG(20, 10, 3, false, 0, &metadata);
+
+    james::ImageMetadata collected;
+    james::DecodeStats stats;
+    james::JPEGLoadOptions options;
+    options.metadata = &collected;
+    options.stats = &stats;
+    options.applyOrientation = true;
+    james::JPEGDecoder jpeg(options);
+
+    james::Image img = jpeg.Decode(withExif.data(), withExif.size());
+    CHECK(collected.orientation == 6 && !collected.exif.empty());
+    CHECK(img.Width() == 10 && img.Height() == 20);
+    CHECK(stats.outputBytes == james::ByteSize(img));
+
+    img = jpeg.Decode(jpegs[2].data(), jpegs[2].size());
+    CHECK(collected.orientation == 1 && collected.exif.empty());
+    CHECK(test::SameImage(img, james::LoadJPEG(jpegs[2].data(), jpegs[2].size())));
+    CHECK(stats.outputBytes == james::ByteSize(img));
+  }
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+// Checks that Images with a row alignment have the expected stride & aligned rows,
+// that both decoders write correctly into padded rows & that copies keep the layout.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstdint>
+
+namespace {
+  bool Aligned(const void* p, unsigned int align) {
+    return reinterpret_cast<std::uintptr_t>(p) % align == 0;
+  }
+
+  void CheckLayout(const james::Image& img, unsigned int align, bool alignedBase) {
+    const std::size_t rowBytes = (std::size_t) img.Width()*(img.BitsPerPixel() >> 3);
+
+    CHECK(img.RowAlignment() == align);
+    CHECK(img.Stride() >= rowBytes && img.Stride() < rowBytes + align);
+    CHECK(img.Stride() % align == 0);
+    CHECK(james::ByteSize(img) == img.Stride()*img.Height());
+    CHECK(img.Row(1) == img.Pixels() + img.Stride());
+
+    if (alignedBase) {
+      for (unsigned int y = 0; y < img.Height(); ++y) {
+        CHECK(Aligned(img.Row(y), align));
+      }
+    }
+  }
+
+  template<class Options, class Load>
+  void CheckDecoder(const std::string& encoded, Load load) {
+    const james::Image packed(load(encoded, Options()));
+    CHECK(packed.Stride() == (std::size_t) packed.Width()*(packed.BitsPerPixel() >> 3));
+
+    const unsigned int alignments[] = { 1, 4, 16, 64, 256 };
+
+    for (unsigned int align : alignments) {
+      Options options;
+      options.rowAlignment = align;
+
+      james::Image img(load(encoded, options));
+      CheckLayout(img, align, true);
+      CHECK(test::SameImage(img, packed));
+
+      const james::Image copy(img);
+      CheckLayout(copy, align, true);
+      CHECK(test::SameImage(copy, packed));
+
+      options.allocator = std::make_shared<james::PixelBufferPool>(1 << 20);
+      img = load(encoded, options);
+      CheckLayout(img, align, align <= james::PixelBufferPool::Alignment);
+      CHECK(test::SameImage(img, packed));
+    }
+  }
+}
+
+int main() {
+  // Widths chosen so that packed rows are not a multiple of any alignment tested
+  const std::string png = test::EncodePNG(37, 21, PNG_COLOR_TYPE_RGB);
+  const std::string pngAlpha = test::EncodePNG(37, 21, PNG_COLOR_TYPE_RGB_ALPHA);
+  const std::string pngInterlaced = test::EncodePNG(37, 21, PNG_COLOR_TYPE_RGB, true);
+  const std::string jpeg = test::EncodeJPEG(37, 21, 3);
+  const std::string jpegGray = test::EncodeJPEG(37, 21, 1);
+
+  auto loadPNG = [](const std::string& s, const james::PNGLoadOptions& o) {
+    return james::LoadPNG(s.data(), s.size(), o);
+  };
+  auto loadJPEG = [](const std::string& s, const james::JPEGLoadOptions& o) {
+    return james::LoadJPEG(s.data(), s.size(), o);
+  };
+
+  CheckDecoder<james::PNGLoadOptions>(png, loadPNG);
+  CheckDecoder<james::PNGLoadOptions>(pngAlpha, loadPNG);
+  CheckDecoder<james::PNGLoadOptions>(pngInterlaced, loadPNG);
+  CheckDecoder<james::JPEGLoadOptions>(jpeg, loadJPEG);
+  CheckDecoder<james::JPEGLoadOptions>(jpegGray, loadJPEG);
+
+  // Directly constructed
+  james::Image img(3, 2, 24, 32, nullptr);
+  CheckLayout(img, 32, true);
+  CHECK(img.Stride() == 32);
+
+  james::Image moved(std::move(img));
+  CheckLayout(moved, 32, true);
+  CHECK(img.Pixels() == nullptr);
+
+  return 0;
+}
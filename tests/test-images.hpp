@@ -0,0 +1,287 @@
+/*
+  Image Loader
+  Copyright (C) 2017 James Heggie
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+// Helpers shared by the tests: generate images in memory so that the tests don't
+// depend on sample files being present in the working directory.
+
+#include <james/image-loader.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <png.h>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      std::fprintf(stderr, "%s(%d): CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      std::exit(1); \
+    } \
+  } while (0)
+
+namespace test {
+
+  // Compares the pixels of two images, row by row: row padding (& so the stride)
+  // isn't compared, since decoders leave it uninitialised.
+  inline bool SameImage(const james::Image& a, const james::Image& b) {
+    if (a.Width() != b.Width() || a.Height() != b.Height() || a.BitsPerPixel() != b.BitsPerPixel()) {
+      return false;
+    }
+
+    const std::size_t rowBytes = (std::size_t) a.Width()*(a.BitsPerPixel() >> 3);
+    for (unsigned int y = 0; y < a.Height(); ++y) {
+      if (std::memcmp(a.Row(y), b.Row(y), rowBytes) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // A deterministic pattern that is easy to verify after decoding.
+  inline unsigned char PatternValue(unsigned int x, unsigned int y, unsigned int c) {
+    return (unsigned char)(x*3 + y*7 + c*61);
+  }
+
+  // The encoders take the value of each channel of each pixel from one of these:
+  // PatternValue unless told otherwise.
+  typedef unsigned char (*PixelFunction)(unsigned int x, unsigned int y, unsigned int c);
+
+  // Optional metadata to embed when encoding. exif excludes the "Exif\0\0" prefix
+  // used in JPEG APP1 markers; the encoders add it where needed.
+  struct Metadata {
+    std::string icc;
+    std::string exif;
+  };
+
+  // A minimal ICC profile that libpng will accept: the 128 byte header followed by a
+  // tag table holding just a media white point, plus some incompressible padding
+  // (libpng rejects iCCP chunks whose compressed data is very short).
+  inline std::string MakeICCProfile() {
+    const unsigned char d50[] = { 0, 0, 0xF6, 0xD6, 0, 1, 0, 0, 0, 0, 0xD3, 0x2D };
+
+    std::string icc(128, '\0');
+    icc.replace(12, 4, "mntr");        // device class
+    icc.replace(16, 4, "RGB ");        // colour space
+    icc.replace(20, 4, "XYZ ");        // PCS
+    icc.replace(36, 4, "acsp");        // signature
+    icc[8] = 2;                        // version 2.0
+    icc.replace(68, 12, (const char*)d50, 12);  // illuminant
+
+    const unsigned char tags[] = { 0, 0, 0, 1, 'w', 't', 'p', 't', 0, 0, 0, 144, 0, 0, 0, 20 };
+    icc.append((const char*)tags, sizeof(tags));
+    icc.append("XYZ \0\0\0\0", 8);
+    icc.append((const char*)d50, 12);
+
+    for (unsigned int i = 0; i < 64; ++i) {
+      icc.push_back((char)((i*2654435761u) >> 13));
+    }
+
+    icc[3] = (char)icc.size();         // profile size (big endian)
+    return icc;
+  }
+
+  // A little endian TIFF structure holding just an orientation tag.
+  inline std::string MakeExif(unsigned int orientation) {
+    const unsigned char exif[] = {
+      'I', 'I', 42, 0, 8, 0, 0, 0,                            // header, IFD0 at offset 8
+      1, 0,                                                   // 1 entry
+      0x12, 0x01, 3, 0, 1, 0, 0, 0, (unsigned char)orientation, 0, 0, 0,  // orientation, SHORT, 1
+      0, 0, 0, 0                                              // no next IFD
+    };
+    return std::string((const char*)exif, sizeof(exif));
+  }
+
+  // Encodes a w x h 8 bit-per-channel PNG. colourType is one of PNG_COLOR_TYPE_GRAY,
+  // PNG_COLOR_TYPE_RGB or PNG_COLOR_TYPE_RGB_ALPHA.
+  inline std::string EncodePNG(
+    unsigned int w, unsigned int h, int colourType, bool interlaced = false,
+    const Metadata* metadata = nullptr, PixelFunction value = PatternValue)
+  {
+    std::string out;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+
+    if (setjmp(png_jmpbuf(png))) {
+      png_destroy_write_struct(&png, &info);
+      throw std::runtime_error("EncodePNG failed.");
+    }
+
+    png_set_write_fn(png, &out, [](png_structp png, png_bytep data, png_size_t length) {
+      ((std::string*)png_get_io_ptr(png))->append((const char*)data, length);
+    }, nullptr);
+
+    png_set_IHDR(png, info, w, h, 8, colourType,
+      interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    if (metadata && !metadata->icc.empty()) {
+      png_set_iCCP(png, info, "test", PNG_COMPRESSION_TYPE_BASE,
+        (png_const_bytep)metadata->icc.data(), (png_uint_32)metadata->icc.size());
+    }
+
+    if (metadata && !metadata->exif.empty()) {
+      png_set_eXIf_1(png, info, (png_uint_32)metadata->exif.size(), (png_bytep)metadata->exif.data());
+    }
+
+    png_write_info(png, info);
+
+    const unsigned int nChannels = png_get_channels(png, info);
+    std::vector<unsigned char> row((std::size_t) w*nChannels);
+    const int nPasses = png_set_interlace_handling(png);
+
+    // Row by row (every row of every pass, for interlacing) so that large images
+    // don't need a second full size buffer
+    for (int pass = 0; pass < nPasses; ++pass) {
+      for (unsigned int y = 0; y < h; ++y) {
+        for (unsigned int x = 0; x < w; ++x) {
+          for (unsigned int c = 0; c < nChannels; ++c) {
+            row[x*nChannels + c] = value(x, y, c);
+          }
+        }
+        png_write_row(png, row.data());
+      }
+    }
+
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+
+    return out;
+  }
+
+  // A 16 bit version of PatternValue that uses both bytes of each sample.
+  inline unsigned short PatternValue16(unsigned int x, unsigned int y, unsigned int c) {
+    return (unsigned short)(x*771 + y*1543 + c*12345);
+  }
+
+  // Encodes a w x h PNG with 16 bits per channel using PatternValue16.
+  inline std::string EncodePNG16(unsigned int w, unsigned int h, int colourType, bool interlaced = false) {
+    std::string out;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+
+    if (setjmp(png_jmpbuf(png))) {
+      png_destroy_write_struct(&png, &info);
+      throw std::runtime_error("EncodePNG16 failed.");
+    }
+
+    png_set_write_fn(png, &out, [](png_structp png, png_bytep data, png_size_t length) {
+      ((std::string*)png_get_io_ptr(png))->append((const char*)data, length);
+    }, nullptr);
+
+    png_set_IHDR(png, info, w, h, 16, colourType,
+      interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    png_write_info(png, info);
+
+    const unsigned int nChannels = png_get_channels(png, info);
+    std::vector<unsigned char> pixels(w*h*nChannels*2);
+    std::vector<png_bytep> rows(h);
+
+    // PNG samples are big endian
+    for (unsigned int y = 0; y < h; ++y) {
+      rows[y] = &pixels[y*w*nChannels*2];
+      for (unsigned int x = 0; x < w; ++x) {
+        for (unsigned int c = 0; c < nChannels; ++c) {
+          const unsigned short v = PatternValue16(x, y, c);
+          rows[y][(x*nChannels + c)*2] = (unsigned char)(v >> 8);
+          rows[y][(x*nChannels + c)*2 + 1] = (unsigned char)v;
+        }
+      }
+    }
+
+    png_write_image(png, rows.data());
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+
+    return out;
+  }
+
+  // Encodes a w x h JPEG with 1 (grayscale) or 3 (RGB) components. The pattern is
+  // smooth enough to compress sensibly but lossy so compare against LoadJPEG rather
+  // than PatternValue.
+  inline std::string EncodeJPEG(
+    unsigned int w, unsigned int h, int nComponents, bool progressive = false,
+    unsigned int restartRows = 0, const Metadata* metadata = nullptr, PixelFunction value = PatternValue)
+  {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr err;
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = nComponents;
+    cinfo.in_color_space = nComponents == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    cinfo.restart_in_rows = restartRows;
+
+    if (progressive) {
+      jpeg_simple_progression(&cinfo);
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (metadata && !metadata->exif.empty()) {
+      const std::string app1 = std::string("Exif\0\0", 6) + metadata->exif;
+      jpeg_write_marker(&cinfo, JPEG_APP0 + 1, (const JOCTET*)app1.data(), (unsigned int)app1.size());
+    }
+
+    if (metadata && !metadata->icc.empty()) {
+      // A single chunk: sequence number 1 of 1
+      const std::string app2 = std::string("ICC_PROFILE\0\x01\x01", 14) + metadata->icc;
+      jpeg_write_marker(&cinfo, JPEG_APP0 + 2, (const JOCTET*)app2.data(), (unsigned int)app2.size());
+    }
+
+    std::vector<unsigned char> row(w*nComponents);
+    while (cinfo.next_scanline < h) {
+      for (unsigned int x = 0; x < w; ++x) {
+        for (int c = 0; c < nComponents; ++c) {
+          row[x*nComponents + c] = value(x, cinfo.next_scanline, c);
+        }
+      }
+
+      JSAMPROW rowPtr = row.data();
+      jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::string out((const char*)buffer, size);
+    std::free(buffer);
+    return out;
+  }
+
+}
@@ -7,16 +7,6 @@
 james::Image png;
 james::Image jpeg;
 
-void FlipByteOrder(james::Image& i) {
-  unsigned char* pixel = i.Pixels();
-  unsigned char* end = &i.Pixels()[i.Width()*i.Height()*(i.BitsPerPixel() >> 3)];
-
-  while (pixel != end) {
-    std::swap(pixel[0], pixel[2]);
-    pixel += i.BitsPerPixel() >> 3;
-  }
-}
-
 void DrawImage(HDC dc, const james::Image& img, int x, int y) {
   BITMAPINFO bmi = {};
   bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
@@ -66,11 +56,16 @@ int main() {
 
   assert(src.good() && src2.good());
 
-  png = james::LoadPNG(src);
-  jpeg = james::LoadJPEG(src2);
+  // StretchDIBits requires DWORD aligned rows in BGR(A) order
+  james::PNGLoadOptions pngOptions;
+  james::JPEGLoadOptions jpegOptions;
+  pngOptions.rowAlignment = 4;
+  pngOptions.pixelFormat = james::PixelFormat::BGRA;
+  jpegOptions.rowAlignment = 4;
+  jpegOptions.pixelFormat = james::PixelFormat::BGR;
 
-  FlipByteOrder(png);
-  FlipByteOrder(jpeg);
+  png = james::LoadPNG(src, pngOptions);
+  jpeg = james::LoadJPEG(src2, jpegOptions);
 
   WNDCLASS wc = {};
   wc.lpfnWndProc = WndProc;
@@ -0,0 +1,209 @@
+// Checks that TryLoadPNG/TryLoadJPEG classify bad data correctly without throwing,
+// succeed with the same pixels as LoadPNG/LoadJPEG on good data, & that the throwing
+// loaders still report the same errors.
+
+#include <james/image-loader.hpp>
+#include "test-images.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+namespace {
+
+  james::DecodeError TryPNG(const std::string& s) {
+    const james::LoadResult result = james::TryLoadPNG(s.data(), s.size());
+    CHECK(!result == (result.error != james::DecodeError::None));
+    CHECK(result || result.image.Pixels() == nullptr);
+
+    // The stream overload agrees with the memory one
+    std::istringstream stream(s);
+    CHECK(james::TryLoadPNG(stream).error == result.error);
+    CHECK(stream.exceptions() == std::ios::goodbit);
+
+    return result.error;
+  }
+
+  james::DecodeError TryJPEG(const std::string& s) {
+    const james::LoadResult result = james::TryLoadJPEG(s.data(), s.size());
+    CHECK(!result == (result.error != james::DecodeError::None));
+    CHECK(result || result.image.Pixels() == nullptr);
+
+    std::istringstream stream(s);
+    CHECK(james::TryLoadJPEG(stream).error == result.error);
+    CHECK(stream.exceptions() == std::ios::goodbit);
+
+    return result.error;
+  }
+
+  template<class Load>
+  std::string ThrownMessage(Load load) {
+    try {
+      load();
+    }
+    catch (std::exception& e) {
+      return e.what();
+    }
+    return std::string();
+  }
+
+  // libjpeg can't convert CMYK to RGB
+  std::string EncodeCMYKJPEG(unsigned int w, unsigned int h) {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr err;
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_CMYK;
+    jpeg_set_defaults(&cinfo);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    std::vector<unsigned char> row(w*4, 0x80);
+    while (cinfo.next_scanline < h) {
+      JSAMPROW rowPtr = row.data();
+      jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::string out((const char*)buffer, size);
+    std::free(buffer);
+    return out;
+  }
+
+  // A stream that fails part way through
+  class FailingBuf : public std::streambuf {
+  public:
+    explicit FailingBuf(const std::string& data)
+      : data_(data)
+    {
+      setg(&data_[0], &data_[0], &data_[0] + data_.size() / 2);
+    }
+
+  protected:
+    int_type underflow() override {
+      throw std::runtime_error("Network unreachable.");
+    }
+
+  private:
+    std::string data_;
+  };
+
+}
+
+int main() {
+  typedef james::DecodeError Error;
+
+  const std::string png = test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB);
+  const std::string interlaced = test::EncodePNG(100, 70, PNG_COLOR_TYPE_RGB_ALPHA, true);
+  const std::string jpeg = test::EncodeJPEG(100, 70, 3);
+  const std::string progressive = test::EncodeJPEG(100, 70, 3, true);
+
+  // Good data
+  CHECK(TryPNG(png) == Error::None);
+  CHECK(test::SameImage(james::TryLoadPNG(png.data(), png.size()).image, james::LoadPNG(png.data(), png.size())));
+  CHECK(test::SameImage(james::TryLoadPNG(interlaced.data(), interlaced.size()).image,
+    james::LoadPNG(interlaced.data(), interlaced.size())));
+  CHECK(TryJPEG(jpeg) == Error::None);
+  CHECK(test::SameImage(james::TryLoadJPEG(jpeg.data(), jpeg.size()).image, james::LoadJPEG(jpeg.data(), jpeg.size())));
+
+  james::JPEGLoadOptions jpegOptions;
+  jpegOptions.pixelFormat = james::PixelFormat::BGRA;
+  jpegOptions.region = james::Region(10, 10, 20, 20);
+  CHECK(test::SameImage(james::TryLoadJPEG(progressive.data(), progressive.size(), jpegOptions).image,
+    james::LoadJPEG(progressive.data(), progressive.size(), jpegOptions)));
+
+  // Truncated anywhere, including inside the header
+  for (std::size_t size : { (std::size_t) 4, (std::size_t) 20, png.size() / 2, png.size() - 1 }) {
+    CHECK(TryPNG(png.substr(0, size)) == Error::Truncated);
+  }
+  for (std::size_t size : { (std::size_t) 4, (std::size_t) 100, jpeg.size() / 2, jpeg.size() - 1 }) {
+    CHECK(TryJPEG(jpeg.substr(0, size)) == Error::Truncated);
+  }
+  CHECK(TryPNG(interlaced.substr(0, interlaced.size() / 2)) == Error::Truncated);
+  CHECK(TryJPEG(progressive.substr(0, progressive.size() / 2)) == Error::Truncated);
+
+  // Not an image of that format at all
+  CHECK(TryPNG(jpeg) == Error::BadHeader);
+  CHECK(TryJPEG(png) == Error::BadHeader);
+  CHECK(TryJPEG(std::string()) == Error::Truncated);
+
+  // Damaged header: the IHDR chunk's CRC no longer matches
+  {
+    std::string bad = png;
+    bad[17] ^= 1;
+    CHECK(TryPNG(bad) == Error::BadHeader);
+  }
+
+  // Damaged image data: for PNG, a bad IDAT CRC; for JPEG, invalid parameters in
+  // the second scan of a progressive image
+  {
+    std::string bad = png;
+    const std::size_t idat = bad.find("IDAT");
+    CHECK(idat != std::string::npos);
+    bad[idat + 10] ^= 0x55;
+    CHECK(TryPNG(bad) == Error::Corrupt);
+
+    bad = progressive;
+    const std::size_t sos = bad.find("\xFF\xDA", bad.find("\xFF\xDA") + 2);
+    CHECK(sos != std::string::npos);
+    const std::size_t nComponents = (unsigned char) bad[sos + 4];
+    bad[sos + 5 + 2*nComponents] = 0x50;     // Ss > 63
+    CHECK(TryJPEG(bad) == Error::Corrupt);
+  }
+
+  // Valid but unsupported
+  CHECK(TryJPEG(EncodeCMYKJPEG(16, 16)) == Error::UnsupportedFormat);
+
+  // Errors from the stream itself
+  {
+    FailingBuf buf(png);
+    std::istream stream(&buf);
+    CHECK(james::TryLoadPNG(stream).error == Error::IO);
+  }
+  {
+    FailingBuf buf(jpeg);
+    std::istream stream(&buf);
+    CHECK(james::TryLoadJPEG(stream).error == Error::IO);
+  }
+
+  // Logic errors are still thrown
+  {
+    james::PNGLoadOptions options;
+    options.region = james::Region(500, 0, 10, 10);
+    bool threw = false;
+    try {
+      james::TryLoadPNG(png.data(), png.size(), options);
+    }
+    catch (std::out_of_range&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  // The throwing loaders report the same errors as before
+  CHECK(ThrownMessage([&] { james::LoadPNG(png.data(), png.size() / 2); }) == "Unexpected end of file.");
+  {
+    const std::string cmyk = EncodeCMYKJPEG(16, 16);
+    CHECK(ThrownMessage([&] { james::LoadJPEG(cmyk.data(), cmyk.size()); }) == "Unsupported JPEG image type.");
+  }
+  CHECK(ThrownMessage([&] { james::LoadJPEG(png.data(), png.size()); }) == "Error decompressing JPEG stream.");
+  {
+    FailingBuf buf(png);
+    std::istream stream(&buf);
+    CHECK(ThrownMessage([&] { james::LoadPNG(stream); }) == "Network unreachable.");
+  }
+
+  CHECK(std::strlen(james::DecodeErrorMessage(Error::Corrupt)) > 0);
+
+  return 0;
+}